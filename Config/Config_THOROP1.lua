@@ -31,6 +31,10 @@ Config.debug = {
 
 Config.arm_init_timeout = true
 Config.use_imu_yaw = false --use odometry for yaw
+-- Seqlock state blocks for the *cm segments (luajit-shmstate), with the
+-- version_ and wait_ change notification, which the MATLAB and Python shm
+-- readers cannot open
+Config.use_shmstate = false
 
 -----------------------------------
 
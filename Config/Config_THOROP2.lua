@@ -29,6 +29,10 @@ Config.debug = {
 
 Config.arm_init_timeout = true
 Config.use_imu_yaw = true
+-- Seqlock state blocks for the *cm segments (luajit-shmstate), with the
+-- version_ and wait_ change notification, which the MATLAB and Python shm
+-- readers cannot open
+Config.use_shmstate = false
 
 -- Tune for Webots
 if IS_WEBOTS then
@@ -7,6 +7,12 @@ Author: Stephen McGill <stephen.mgill@tri.global>, 05/2019
 #include <lua.h>
 #include <lualib.h>
 
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
 #include <apriltag/apriltag.h>
 #include <apriltag/apriltag_pose.h>
 #include <apriltag/common/zarray.h>
@@ -15,11 +21,29 @@ Author: Stephen McGill <stephen.mgill@tri.global>, 05/2019
 #define NBUFFERS 2
 /* metatable name for apriltags */
 #define MT_NAME "apriltags_mt"
+/* Maximum number of tags to follow in tracking mode */
+#define MAX_TRACKS 32
+
+/* Region of interest around a previously detected tag */
+typedef struct {
+  int x0, y0, x1, y1;
+} apriltag_roi;
 
 typedef struct {
   apriltag_detector_t *td;
   apriltag_family_t *tf;
   apriltag_detection_info_t *info;
+  /* Luminance scratch for YUYV input, reused across frames */
+  uint8_t *gray;
+  size_t gray_sz;
+  /* Tracking mode: search only around last frame's tags */
+  int track;
+  int full_period;
+  int roi_margin;
+  int force_full;
+  unsigned long frame;
+  int n_rois;
+  apriltag_roi rois[MAX_TRACKS];
 } apriltag_data;
 
 static apriltag_data *lua_checkapriltags(lua_State *L, int narg) {
@@ -54,6 +78,14 @@ static int lua_apriltag_delete(lua_State *L) {
     tag16h5_destroy(ud->tf);
     ud->tf = NULL;
   }
+  if (ud->info) {
+    free(ud->info);
+    ud->info = NULL;
+  }
+  if (ud->gray) {
+    free(ud->gray);
+    ud->gray = NULL;
+  }
 
 #ifdef DEBUG
   fprintf(stderr, "Cleaning done!\n");
@@ -61,26 +93,63 @@ static int lua_apriltag_delete(lua_State *L) {
   return 0;
 }
 
+/* Read an optional number from the options table at the top of the stack */
+static double opt_field(lua_State *L, const char *key, double def) {
+  double v = def;
+  lua_getfield(L, -1, key);
+  if (lua_isnumber(L, -1)) {
+    v = lua_tonumber(L, -1);
+  } else if (lua_isboolean(L, -1)) {
+    v = lua_toboolean(L, -1);
+  }
+  lua_pop(L, 1);
+  return v;
+}
+
+/* Apply a table of options to the detector, pose and tracking settings */
+static void lua_apriltag_configure(lua_State *L, int narg, apriltag_data *ud) {
+  if (!lua_istable(L, narg)) {
+    return;
+  }
+  lua_pushvalue(L, narg);
+  // Detector
+  ud->td->nthreads = opt_field(L, "nthreads", ud->td->nthreads);
+  ud->td->quad_decimate = opt_field(L, "quad_decimate", ud->td->quad_decimate);
+  ud->td->quad_sigma = opt_field(L, "quad_sigma", ud->td->quad_sigma);
+  ud->td->refine_edges = opt_field(L, "refine_edges", ud->td->refine_edges);
+  ud->td->decode_sharpening =
+      opt_field(L, "decode_sharpening", ud->td->decode_sharpening);
+  // Pose estimation (tagsize of zero disables)
+  ud->info->tagsize = opt_field(L, "tagsize", ud->info->tagsize);
+  ud->info->fx = opt_field(L, "fx", ud->info->fx);
+  ud->info->fy = opt_field(L, "fy", ud->info->fy);
+  ud->info->cx = opt_field(L, "cx", ud->info->cx);
+  ud->info->cy = opt_field(L, "cy", ud->info->cy);
+  // Tracking
+  ud->track = opt_field(L, "track", ud->track);
+  ud->full_period = opt_field(L, "full_period", ud->full_period);
+  ud->roi_margin = opt_field(L, "roi_margin", ud->roi_margin);
+  lua_pop(L, 1);
+  if (ud->td->nthreads < 1) {
+    ud->td->nthreads = 1;
+  }
+  if (ud->full_period < 1) {
+    ud->full_period = 1;
+  }
+  // Re-acquire everything on the next frame
+  ud->n_rois = 0;
+}
+
 static int lua_apriltag_init(lua_State *L) {
   apriltag_data *ud = lua_newuserdata(L, sizeof(apriltag_data));
   // Zero the data so that any initial access is NULL
   bzero(ud, sizeof(apriltag_data));
-  // Populate the userdata
-  // int n = lua_gettop(L);
-  // const char *video_device = lua_isstring(L, 1) ? lua_tostring(L, 1) : NULL;
-  // ud->width = luaL_optint(L, 2, 320);
-  // ud->height = luaL_optint(L, 3, 240);
-  // ud->pixelformat = luaL_optstring(L, 4, "yuyv");
-  // /* default 15 fps */
-  // ud->fps_num = luaL_optint(L, 5, 1);
-  // ud->fps_denum = luaL_optint(L, 6, 15);
-  // _Bool make_usb = lua_isboolean(L, 7) && lua_toboolean(L, 3);
 
   apriltag_detector_t *td = apriltag_detector_create();
   apriltag_family_t *tf = tag16h5_create();
   apriltag_detector_add_family(td, tf);
 
-  // TODO: Take table input
+  td->nthreads = 1;
   td->quad_decimate = 2.0;
   td->quad_sigma = 0.0;
   td->refine_edges = 1;
@@ -89,7 +158,6 @@ static int lua_apriltag_init(lua_State *L) {
   // Set the pose information
   apriltag_detection_info_t *info =
       calloc(1, sizeof(apriltag_detection_info_t));
-  // info.det = det;
   info->tagsize = 0.10; // tagsize;
   info->fx = 320;       // fx;
   info->fy = 240;       // fy;
@@ -100,36 +168,331 @@ static int lua_apriltag_init(lua_State *L) {
   ud->td = td;
   ud->tf = tf;
   ud->info = info;
+  // Full frame sweep every 10 frames when tracking
+  ud->track = 0;
+  ud->full_period = 10;
+  ud->roi_margin = 16;
+
+  // Optional table of settings
+  lua_apriltag_configure(L, 1, ud);
+
   luaL_getmetatable(L, MT_NAME);
   lua_setmetatable(L, -2);
   return 1;
 }
 
+static int lua_apriltag_set(lua_State *L) {
+  apriltag_data *ud = lua_checkapriltags(L, 1);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  lua_apriltag_configure(L, 2, ud);
+  return 0;
+}
+
+/*
+render(id [, scale])
+Gray image of a tag of the detector's family, with its white border,
+each cell scale pixels square
+Returns the pixels as a string and the width
+*/
+static int lua_apriltag_render(lua_State *L) {
+  apriltag_data *ud = lua_checkapriltags(L, 1);
+  int id = luaL_checkinteger(L, 2);
+  int scale = luaL_optinteger(L, 3, 1);
+  luaL_argcheck(L, id >= 0 && (uint32_t)id < ud->tf->ncodes, 2,
+                "No such tag id");
+  luaL_argcheck(L, scale >= 1, 3, "Scale must be positive");
+  image_u8_t *im = apriltag_to_image(ud->tf, id);
+  if (!im) {
+    return luaL_error(L, "Bad tag image");
+  }
+  int width = im->width * scale;
+  luaL_Buffer b;
+  luaL_buffinit(L, &b);
+  for (int y = 0; y < width; y++) {
+    const uint8_t *row = im->buf + (y / scale) * im->stride;
+    for (int x = 0; x < width; x++) {
+      luaL_addchar(&b, row[x / scale]);
+    }
+  }
+  image_u8_destroy(im);
+  luaL_pushresult(&b);
+  lua_pushinteger(L, width);
+  return 2;
+}
+
+/* Shift a detection found in a sub-image back into full image coordinates */
+static void offset_detection(apriltag_detection_t *det, int x0, int y0) {
+  det->c[0] += x0;
+  det->c[1] += y0;
+  for (int i = 0; i < 4; i++) {
+    det->p[i][0] += x0;
+    det->p[i][1] += y0;
+  }
+  // Left-multiply the homography by a pixel translation
+  for (int j = 0; j < 3; j++) {
+    MATD_EL(det->H, 0, j) += x0 * MATD_EL(det->H, 2, j);
+    MATD_EL(det->H, 1, j) += y0 * MATD_EL(det->H, 2, j);
+  }
+}
+
+/* Bounding box of the tag corners, grown so the tag can move between frames
+ */
+static apriltag_roi detection_roi(const apriltag_detection_t *det, int margin,
+                                  int width, int height) {
+  double xmin = det->p[0][0], xmax = det->p[0][0];
+  double ymin = det->p[0][1], ymax = det->p[0][1];
+  for (int i = 1; i < 4; i++) {
+    xmin = fmin(xmin, det->p[i][0]);
+    xmax = fmax(xmax, det->p[i][0]);
+    ymin = fmin(ymin, det->p[i][1]);
+    ymax = fmax(ymax, det->p[i][1]);
+  }
+  // Grow by the margin plus half of the tag extent
+  double grow = margin + 0.5 * fmax(xmax - xmin, ymax - ymin);
+  apriltag_roi roi;
+  roi.x0 = fmax(0, floor(xmin - grow));
+  roi.y0 = fmax(0, floor(ymin - grow));
+  roi.x1 = fmin(width, ceil(xmax + grow));
+  roi.y1 = fmin(height, ceil(ymax + grow));
+  return roi;
+}
+
+/* Push a detection table, with pose if a tag size is set */
+static void push_detection(lua_State *L, apriltag_data *ud,
+                           apriltag_detection_t *det) {
+  lua_createtable(L, 0, 8);
+
+  lua_pushinteger(L, det->id);
+  lua_setfield(L, -2, "id");
+  lua_pushinteger(L, det->hamming);
+  lua_setfield(L, -2, "hamming");
+  lua_pushnumber(L, det->decision_margin);
+  lua_setfield(L, -2, "margin");
+
+  lua_createtable(L, 2, 0);
+  lua_pushnumber(L, det->c[0]);
+  lua_rawseti(L, -2, 1);
+  lua_pushnumber(L, det->c[1]);
+  lua_rawseti(L, -2, 2);
+  lua_setfield(L, -2, "center");
+
+  lua_createtable(L, 4, 0);
+  for (int i = 0; i < 4; i++) {
+    lua_createtable(L, 2, 0);
+    lua_pushnumber(L, det->p[i][0]);
+    lua_rawseti(L, -2, 1);
+    lua_pushnumber(L, det->p[i][1]);
+    lua_rawseti(L, -2, 2);
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_setfield(L, -2, "corners");
+
+  if (ud->info->tagsize <= 0) {
+    return;
+  }
+  ud->info->det = det;
+  apriltag_pose_t pose;
+  double err = estimate_tag_pose(ud->info, &pose);
+  ud->info->det = NULL;
+  // Row major rotation
+  lua_createtable(L, 9, 0);
+  for (int i = 0; i < 9; i++) {
+    lua_pushnumber(L, pose.R->data[i]);
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_setfield(L, -2, "R");
+  lua_createtable(L, 3, 0);
+  for (int i = 0; i < 3; i++) {
+    lua_pushnumber(L, pose.t->data[i]);
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_setfield(L, -2, "t");
+  lua_pushnumber(L, err);
+  lua_setfield(L, -2, "err");
+  matd_destroy(pose.R);
+  matd_destroy(pose.t);
+}
+
+/*
+Run the detector on an image (or sub-image view), appending to the results
+table on top of the stack. For a tracked region, tags already seen this frame
+are skipped. A full frame reports every tag, and tracks up to MAX_TRACKS.
+Returns the number of new detections.
+*/
+static int detect_region(lua_State *L, apriltag_data *ud, image_u8_t *im,
+                         int x0, int y0, int width, int height, int is_roi,
+                         int *ids, int *n_ids, apriltag_roi *rois,
+                         int *n_rois) {
+  int n_found = 0;
+  zarray_t *detections = apriltag_detector_detect(ud->td, im);
+  for (int i = 0; i < zarray_size(detections); i++) {
+    apriltag_detection_t *det;
+    zarray_get(detections, i, &det);
+    // Overlapping regions may see the same tag twice
+    if (is_roi) {
+      int seen = 0;
+      for (int k = 0; k < *n_ids; k++) {
+        if (ids[k] == det->id) {
+          seen = 1;
+          break;
+        }
+      }
+      if (seen || *n_ids >= MAX_TRACKS) {
+        continue;
+      }
+    }
+    if (x0 || y0) {
+      offset_detection(det, x0, y0);
+    }
+    if (*n_ids < MAX_TRACKS) {
+      ids[(*n_ids)++] = det->id;
+      rois[(*n_rois)++] = detection_roi(det, ud->roi_margin, width, height);
+    }
+    push_detection(L, ud, det);
+#if LUA_VERSION_NUM == 501
+    lua_rawseti(L, -2, lua_objlen(L, -2) + 1);
+#else
+    lua_rawseti(L, -2, lua_rawlen(L, -2) + 1);
+#endif
+    n_found++;
+  }
+  apriltag_detections_destroy(detections);
+  return n_found;
+}
+
+/*
+detect(data, [len,] width, height [, fmt])
+data is a string, lightuserdata or pointer address (e.g. from ffi.cast)
+fmt is "gray" (default) or "yuyv"
+Returns an array of detections and whether a full frame sweep was made
+*/
 static int lua_apriltag_detect(lua_State *L) {
   apriltag_data *ud = lua_checkapriltags(L, 1);
-// lua_pushboolean(L, 0);
-// lua_pushliteral(L, "apriltags_start_streaming: unable to start stream");
-// return 2;
+  uint8_t *data;
+  size_t len = 0;
+  int width, height, fmt_idx;
+
+  switch (lua_type(L, 2)) {
+  case LUA_TLIGHTUSERDATA:
+    data = (uint8_t *)lua_touserdata(L, 2);
+    len = luaL_checkinteger(L, 3);
+    width = luaL_checkinteger(L, 4);
+    height = luaL_checkinteger(L, 5);
+    fmt_idx = 6;
+    break;
+  case LUA_TSTRING:
+    data = (uint8_t *)lua_tolstring(L, 2, &len);
+    width = luaL_checkinteger(L, 3);
+    height = luaL_checkinteger(L, 4);
+    fmt_idx = 5;
+    break;
+  case LUA_TNUMBER:
+    data = (uint8_t *)lua_tointeger(L, 2);
+    len = luaL_checkinteger(L, 3);
+    width = luaL_checkinteger(L, 4);
+    height = luaL_checkinteger(L, 5);
+    fmt_idx = 6;
+    break;
+  default:
+    lua_pushboolean(L, 0);
+    lua_pushliteral(L, "Input type is not supported");
+    return 2;
+  }
+  if (!data || width <= 0 || height <= 0) {
+    lua_pushboolean(L, 0);
+    lua_pushliteral(L, "Bad image dimensions");
+    return 2;
+  }
+
+  const char *fmt = luaL_optstring(L, fmt_idx, "gray");
+  uint8_t *gray;
+  if (strcmp(fmt, "yuyv") == 0) {
+    if (len < 2 * (size_t)width * height) {
+      lua_pushboolean(L, 0);
+      lua_pushliteral(L, "Buffer too small for yuyv");
+      return 2;
+    }
+    // Only the luminance is used; pull it into the reusable buffer
+    size_t gray_sz = (size_t)width * height;
+    if (gray_sz > ud->gray_sz) {
+      uint8_t *g = realloc(ud->gray, gray_sz);
+      if (!g) {
+        return luaL_error(L, "Bad realloc of luminance buffer");
+      }
+      ud->gray = g;
+      ud->gray_sz = gray_sz;
+    }
+    const uint8_t *src = data;
+    for (size_t i = 0; i < gray_sz; i++) {
+      ud->gray[i] = src[2 * i];
+    }
+    gray = ud->gray;
+  } else if (strcmp(fmt, "gray") == 0) {
+    if (len < (size_t)width * height) {
+      lua_pushboolean(L, 0);
+      lua_pushliteral(L, "Buffer too small for gray");
+      return 2;
+    }
+    // Detect directly on the caller's memory
+    gray = data;
+  } else {
+    lua_pushboolean(L, 0);
+    lua_pushliteral(L, "Format must be gray or yuyv");
+    return 2;
+  }
+
 #ifdef DEBUG
   fprintf(stderr, "Start detect...\n");
 #endif
-  image_u8_t *im = NULL;
-  zarray_t *detections = apriltag_detector_detect(ud->td, im);
 
-  for (int i = 0; i < zarray_size(detections); i++) {
-    apriltag_detection_t *det;
-    zarray_get(detections, i, &det);
-    ud->info->det = det;
+  // Full frame if not tracking, nothing tracked, periodic, or tags were lost
+  int full = !ud->track || ud->n_rois == 0 || ud->force_full ||
+             (ud->frame % ud->full_period) == 0;
+  ud->frame++;
+  ud->force_full = 0;
 
-    // Then call estimate_tag_pose.
-    apriltag_pose_t pose;
-    double err = estimate_tag_pose(ud->info, &pose);
+  int ids[MAX_TRACKS];
+  int n_ids = 0;
+  apriltag_roi rois[MAX_TRACKS];
+  int n_rois = 0;
+
+  lua_newtable(L);
+  if (!full) {
+    for (int r = 0; r < ud->n_rois; r++) {
+      apriltag_roi *roi = ud->rois + r;
+      // View into the full image; no copy
+      image_u8_t im_roi = {.width = roi->x1 - roi->x0,
+                           .height = roi->y1 - roi->y0,
+                           .stride = width,
+                           .buf = gray + roi->y0 * width + roi->x0};
+      if (im_roi.width < 8 || im_roi.height < 8) {
+        continue;
+      }
+      detect_region(L, ud, &im_roi, roi->x0, roi->y0, width, height, 1, ids,
+                    &n_ids, rois, &n_rois);
+    }
+    // Sweep next frame if any tracked tag went missing
+    if (n_ids < ud->n_rois) {
+      ud->force_full = 1;
+    }
+    // Everything was lost, so sweep right away
+    if (n_ids == 0) {
+      full = 1;
+    }
+  }
+  if (full) {
+    image_u8_t im = {
+        .width = width, .height = height, .stride = width, .buf = gray};
+    detect_region(L, ud, &im, 0, 0, width, height, 0, ids, &n_ids, rois,
+                  &n_rois);
   }
 
-  apriltag_detections_destroy(detections);
+  // Remember for the next frame
+  memcpy(ud->rois, rois, n_rois * sizeof(apriltag_roi));
+  ud->n_rois = n_rois;
 
-  lua_pushboolean(L, 1);
-  return 1;
+  lua_pushboolean(L, full);
+  return 2;
 }
 
 static const struct luaL_Reg apriltags_functions[] = {
@@ -137,6 +500,8 @@ static const struct luaL_Reg apriltags_functions[] = {
 
 static const struct luaL_Reg apriltags_methods[] = {
     {"detect", lua_apriltag_detect},
+    {"set", lua_apriltag_set},
+    {"render", lua_apriltag_render},
     {"__index", lua_apriltag_index},
     {"__gc", lua_apriltag_delete},
     {NULL, NULL}};
@@ -0,0 +1,87 @@
+#!/usr/bin/env luajit
+local apriltag = require'apriltag'
+local ffi = require'ffi'
+local unix = require'unix'
+
+-- Optional raw YUYV frame from lua-uvc, else a blank frame
+local fname = arg[1]
+local w = tonumber(arg[2]) or 320
+local h = tonumber(arg[3]) or 240
+
+local img
+if fname then
+  local f = assert(io.open(fname, 'rb'))
+  img = f:read'*all'
+  f:close()
+else
+  img = string.rep('\128', 2 * w * h)
+end
+local buf = ffi.new('uint8_t[?]', #img)
+ffi.copy(buf, img, #img)
+local ptr = tonumber(ffi.cast('intptr_t', ffi.cast('void *', buf)))
+
+local function bench(detector, name, n)
+  local t0 = unix.time()
+  local nfull = 0
+  local tags
+  for _=1,n do
+    local full
+    tags, full = assert(detector:detect(
+      ptr, #img, w, h, 'yuyv'))
+    if full then nfull = nfull + 1 end
+  end
+  local dt = unix.time() - t0
+  print(string.format("%s | %.2f ms per frame | %d full sweeps | %d tags",
+                      name, 1e3 * dt / n, nfull, #tags))
+  for _, tag in ipairs(tags) do
+    print(string.format("  id %d at (%.1f, %.1f)",
+                        tag.id, tag.center[1], tag.center[2]))
+    if tag.t then
+      print(string.format("  t = {%.3f, %.3f, %.3f} | err %g",
+                          tag.t[1], tag.t[2], tag.t[3], tag.err))
+    end
+  end
+end
+
+local opts = {
+  nthreads = 4, quad_decimate = 2, quad_sigma = 0, refine_edges = true,
+  tagsize = 0.10, fx = 320, fy = 240, cx = w / 2, cy = h / 2,
+}
+bench(assert(apriltag.init(opts)), "Full frame", 100)
+
+opts.track = true
+opts.full_period = 15
+bench(assert(apriltag.init(opts)), "Tracking", 100)
+
+-- String input avoids the FFI entirely
+local detector = assert(apriltag.init{nthreads = 2})
+detector:set{quad_decimate = 1}
+assert(detector:detect(img, w, h, 'yuyv'))
+
+-- A rendered tag in the middle of a white frame, square to the camera
+local tag, tag_w = detector:render(0, 10)
+local x0, y0 = math.floor((w - tag_w) / 2), math.floor((h - tag_w) / 2)
+local rows = {}
+for y=0, h - 1 do
+  if y >= y0 and y < y0 + tag_w then
+    rows[y + 1] = string.rep('\255', x0)..tag:sub((y - y0) * tag_w + 1, (y - y0 + 1) * tag_w)
+      ..string.rep('\255', w - x0 - tag_w)
+  else
+    rows[y + 1] = string.rep('\255', w)
+  end
+end
+local frame = table.concat(rows)
+detector = assert(apriltag.init{
+  quad_decimate = 1, tagsize = 0.10, fx = 320, fy = 320,
+  cx = x0 + tag_w / 2, cy = y0 + tag_w / 2,
+})
+local tags = assert(detector:detect(frame, w, h, 'gray'))
+assert(#tags == 1 and tags[1].id == 0, "Should find tag 0")
+assert(math.abs(tags[1].center[1] - x0 - tag_w / 2) < 1.5
+  and math.abs(tags[1].center[2] - y0 - tag_w / 2) < 1.5,
+  "Bad tag center")
+-- The black square spans 6 of the 8 cells, so 60 pixels at fx = 320
+local z = 320 * 0.10 / 60
+assert(math.abs(tags[1].t[3] - z) < 0.05 * z, "Bad tag distance")
+assert(math.abs(tags[1].t[1]) < 0.01 and math.abs(tags[1].t[2]) < 0.01, "Bad tag offset")
+print("OK")
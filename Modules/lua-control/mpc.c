@@ -0,0 +1,475 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <osqp/osqp.h>
+
+#include "mpc.h"
+
+struct mpc {
+  MPCParameters params;
+  /* Steps, variables and constraints */
+  int n, nv, m;
+  /* Plan of the last solve, and the input applied from it */
+  double *u, *x;
+  double u_prev[MPC_NU];
+  int has_plan;
+  /* Nominal inputs and trajectory, linearized about */
+  double *u_bar, *x_bar;
+  /* Jacobians of the steps, and the states in terms of the inputs,
+   * n * MPC_NX by nv and block lower triangular
+   */
+  double *jac_x, *jac_u;
+  double *s;
+  /* Residual of the nominal trajectory, less the nominal inputs */
+  double *e;
+  /* Upper triangle of the Hessian, column by column, and the linear cost
+   * and bounds, in the types of OSQP
+   */
+  c_float *p_x, *q, *l, *h;
+  c_int *p_i, *p_p;
+  c_float *a_x;
+  c_int *a_i, *a_p;
+  c_float *warm;
+  OSQPSettings settings;
+  OSQPWorkspace *work;
+  /* Solve times */
+  double times[MPC_N_TIMES];
+  int n_times;
+};
+
+void mpc_default_parameters(MPCParameters *params) {
+  params->horizon = 20;
+  params->dt = 0.1;
+  params->period = 0.02;
+  params->wheel_base = 0.325;
+  params->q[0] = 10;
+  params->q[1] = 10;
+  params->q[2] = 2;
+  params->q[3] = 1;
+  params->q_final[0] = 20;
+  params->q_final[1] = 20;
+  params->q_final[2] = 4;
+  params->q_final[3] = 1;
+  params->r[0] = 0.1;
+  params->r[1] = 0.1;
+  params->r_rate[0] = 2;
+  params->r_rate[1] = 0.1;
+  params->max_steering = 0.35;
+  params->max_steering_rate = 2.0;
+  params->min_accel = -3.0;
+  params->max_accel = 2.0;
+  params->min_speed = 0.0;
+  params->max_speed = 3.0;
+  params->max_iter = 200;
+  params->eps = 1e-3;
+}
+
+static double wrap_angle(double a) {
+  return a - 2 * M_PI * floor((a + M_PI) / (2 * M_PI));
+}
+
+/* Step the bicycle, with its Jacobians when asked */
+static void step(const MPCParameters *params, const double *x, const double *u,
+                 double *x1, double *jac_x, double *jac_u) {
+  double c = cos(x[2]), s = sin(x[2]);
+  double t = tan(u[0]);
+  double dt = params->dt, L = params->wheel_base;
+  x1[0] = x[0] + dt * x[3] * c;
+  x1[1] = x[1] + dt * x[3] * s;
+  x1[2] = x[2] + dt * x[3] * t / L;
+  x1[3] = x[3] + dt * u[1];
+  if (jac_x) {
+    memset(jac_x, 0, MPC_NX * MPC_NX * sizeof(double));
+    jac_x[0 * MPC_NX + 0] = 1;
+    jac_x[0 * MPC_NX + 2] = -dt * x[3] * s;
+    jac_x[0 * MPC_NX + 3] = dt * c;
+    jac_x[1 * MPC_NX + 1] = 1;
+    jac_x[1 * MPC_NX + 2] = dt * x[3] * c;
+    jac_x[1 * MPC_NX + 3] = dt * s;
+    jac_x[2 * MPC_NX + 2] = 1;
+    jac_x[2 * MPC_NX + 3] = dt * t / L;
+    jac_x[3 * MPC_NX + 3] = 1;
+  }
+  if (jac_u) {
+    memset(jac_u, 0, MPC_NX * MPC_NU * sizeof(double));
+    jac_u[2 * MPC_NU + 0] = dt * x[3] * (1 + t * t) / L;
+    jac_u[3 * MPC_NU + 1] = dt;
+  }
+}
+
+struct mpc *mpc_create(const MPCParameters *params) {
+  struct mpc *mpc;
+  int n, nv, m;
+  int j, k, nnz;
+  if (!params || params->horizon < 1 || params->dt <= 0 ||
+      params->wheel_base <= 0) {
+    return NULL;
+  }
+  mpc = calloc(1, sizeof(struct mpc));
+  if (!mpc) {
+    return NULL;
+  }
+  mpc->params = *params;
+  n = params->horizon;
+  nv = n * MPC_NU;
+  /* Input bounds, steering rate, then speed along the horizon */
+  m = nv + 2 * n;
+  mpc->n = n;
+  mpc->nv = nv;
+  mpc->m = m;
+
+  mpc->u = calloc(nv, sizeof(double));
+  mpc->x = calloc((n + 1) * MPC_NX, sizeof(double));
+  mpc->u_bar = calloc(nv, sizeof(double));
+  mpc->x_bar = calloc((n + 1) * MPC_NX, sizeof(double));
+  mpc->jac_x = calloc(n * MPC_NX * MPC_NX, sizeof(double));
+  mpc->jac_u = calloc(n * MPC_NX * MPC_NU, sizeof(double));
+  mpc->s = calloc(n * MPC_NX * nv, sizeof(double));
+  mpc->e = calloc(n * MPC_NX, sizeof(double));
+  mpc->p_x = calloc(nv * (nv + 1) / 2, sizeof(c_float));
+  mpc->p_i = calloc(nv * (nv + 1) / 2, sizeof(c_int));
+  mpc->p_p = calloc(nv + 1, sizeof(c_int));
+  mpc->q = calloc(nv, sizeof(c_float));
+  mpc->l = calloc(m, sizeof(c_float));
+  mpc->h = calloc(m, sizeof(c_float));
+  /* At most, an input bound, two rates and the speed along the horizon */
+  mpc->a_x = calloc(nv * (n + 3), sizeof(c_float));
+  mpc->a_i = calloc(nv * (n + 3), sizeof(c_int));
+  mpc->a_p = calloc(nv + 1, sizeof(c_int));
+  mpc->warm = calloc(nv, sizeof(c_float));
+  if (!mpc->u || !mpc->x || !mpc->u_bar || !mpc->x_bar || !mpc->jac_x ||
+      !mpc->jac_u || !mpc->s || !mpc->e || !mpc->p_x || !mpc->p_i ||
+      !mpc->p_p || !mpc->q || !mpc->l || !mpc->h || !mpc->a_x ||
+      !mpc->a_i || !mpc->a_p || !mpc->warm) {
+    mpc_free(mpc);
+    return NULL;
+  }
+
+  /* The Hessian is dense, so its upper triangle is the pattern */
+  nnz = 0;
+  for (j = 0; j < nv; j++) {
+    mpc->p_p[j] = nnz;
+    for (k = 0; k <= j; k++) {
+      mpc->p_i[nnz++] = k;
+    }
+  }
+  mpc->p_p[nv] = nnz;
+
+  /* Constraints only depend on dt */
+  nnz = 0;
+  for (k = 0; k < n; k++) {
+    /* Steering: its bounds, its rate now and its rate next */
+    j = k * MPC_NU;
+    mpc->a_p[j] = nnz;
+    mpc->a_i[nnz] = j;
+    mpc->a_x[nnz++] = 1;
+    mpc->a_i[nnz] = nv + k;
+    mpc->a_x[nnz++] = 1;
+    if (k + 1 < n) {
+      mpc->a_i[nnz] = nv + k + 1;
+      mpc->a_x[nnz++] = -1;
+    }
+    /* Acceleration: its bounds and the speed after it */
+    j = k * MPC_NU + 1;
+    mpc->a_p[j] = nnz;
+    mpc->a_i[nnz] = j;
+    mpc->a_x[nnz++] = 1;
+    for (j = k; j < n; j++) {
+      mpc->a_i[nnz] = nv + n + j;
+      mpc->a_x[nnz++] = params->dt;
+    }
+  }
+  mpc->a_p[nv] = nnz;
+
+  osqp_set_default_settings(&mpc->settings);
+  mpc->settings.verbose = 0;
+  mpc->settings.warm_start = 1;
+  mpc->settings.polish = 0;
+  mpc->settings.max_iter = params->max_iter;
+  mpc->settings.eps_abs = params->eps;
+  mpc->settings.eps_rel = params->eps;
+  return mpc;
+}
+
+void mpc_free(struct mpc *mpc) {
+  if (!mpc) {
+    return;
+  }
+  if (mpc->work) {
+    osqp_cleanup(mpc->work);
+  }
+  free(mpc->u);
+  free(mpc->x);
+  free(mpc->u_bar);
+  free(mpc->x_bar);
+  free(mpc->jac_x);
+  free(mpc->jac_u);
+  free(mpc->s);
+  free(mpc->e);
+  free(mpc->p_x);
+  free(mpc->p_i);
+  free(mpc->p_p);
+  free(mpc->q);
+  free(mpc->l);
+  free(mpc->h);
+  free(mpc->a_x);
+  free(mpc->a_i);
+  free(mpc->a_p);
+  free(mpc->warm);
+  free(mpc);
+}
+
+void mpc_reset(struct mpc *mpc) {
+  mpc->has_plan = 0;
+  memset(mpc->u_prev, 0, sizeof(mpc->u_prev));
+}
+
+/* Roll out the nominal inputs, the previous plan a period on, from state */
+static void linearize(struct mpc *mpc, const double *state) {
+  const MPCParameters *params = &mpc->params;
+  int n = mpc->n, nv = mpc->nv;
+  int i, j, k, r;
+  if (mpc->has_plan) {
+    double shift = params->period > 0 ? params->period / params->dt : 1;
+    for (k = 0; k < n; k++) {
+      double s = k + shift;
+      int k0 = (int)s;
+      double f = s - k0;
+      for (i = 0; i < MPC_NU; i++) {
+        mpc->u_bar[k * MPC_NU + i] =
+            k0 + 1 < n ? (1 - f) * mpc->u[k0 * MPC_NU + i] +
+                             f * mpc->u[(k0 + 1) * MPC_NU + i]
+                       : mpc->u[(n - 1) * MPC_NU + i];
+      }
+    }
+  } else {
+    memset(mpc->u_bar, 0, nv * sizeof(double));
+  }
+  memcpy(mpc->x_bar, state, MPC_NX * sizeof(double));
+  for (k = 0; k < n; k++) {
+    step(params, mpc->x_bar + k * MPC_NX, mpc->u_bar + k * MPC_NU,
+         mpc->x_bar + (k + 1) * MPC_NX, mpc->jac_x + k * MPC_NX * MPC_NX,
+         mpc->jac_u + k * MPC_NX * MPC_NU);
+  }
+  /* Block (k, j) of s is the state after step k by input j:
+   * jac_u[j] on the diagonal, then carried through jac_x[k]
+   */
+  memset(mpc->s, 0, n * MPC_NX * nv * sizeof(double));
+  for (j = 0; j < n; j++) {
+    for (r = 0; r < MPC_NX; r++) {
+      for (i = 0; i < MPC_NU; i++) {
+        mpc->s[(j * MPC_NX + r) * nv + j * MPC_NU + i] =
+            mpc->jac_u[(j * MPC_NX + r) * MPC_NU + i];
+      }
+    }
+    for (k = j + 1; k < n; k++) {
+      const double *a = mpc->jac_x + k * MPC_NX * MPC_NX;
+      for (r = 0; r < MPC_NX; r++) {
+        for (i = 0; i < MPC_NU; i++) {
+          double sum = 0;
+          int c;
+          for (c = 0; c < MPC_NX; c++) {
+            sum += a[r * MPC_NX + c] *
+                   mpc->s[((k - 1) * MPC_NX + c) * nv + j * MPC_NU + i];
+          }
+          mpc->s[(k * MPC_NX + r) * nv + j * MPC_NU + i] = sum;
+        }
+      }
+    }
+  }
+}
+
+/* Cost of the states, as s u + e from the reference, and of the inputs
+ * and their change per step
+ */
+static void build_cost(struct mpc *mpc, const double *reference) {
+  const MPCParameters *params = &mpc->params;
+  int n = mpc->n, nv = mpc->nv;
+  int a, b, i, k, r, idx;
+  for (k = 0; k < n; k++) {
+    const double *xb = mpc->x_bar + (k + 1) * MPC_NX;
+    const double *ref = reference + (k + 1) * MPC_NX;
+    for (r = 0; r < MPC_NX; r++) {
+      double e = xb[r] - ref[r];
+      /* Against the nominal heading, which may have wound around */
+      if (r == 2) {
+        e = wrap_angle(e);
+      }
+      for (i = 0; i < nv; i++) {
+        e -= mpc->s[(k * MPC_NX + r) * nv + i] * mpc->u_bar[i];
+      }
+      mpc->e[k * MPC_NX + r] = e;
+    }
+  }
+
+  /* Twice the Hessian, as OSQP halves it. Only rows of steps at or after
+   * both inputs are non-zero
+   */
+  idx = 0;
+  for (b = 0; b < nv; b++) {
+    for (a = 0; a <= b; a++) {
+      double sum = 0;
+      for (k = b / MPC_NU; k < n; k++) {
+        const double *w = k + 1 < n ? params->q : params->q_final;
+        for (r = 0; r < MPC_NX; r++) {
+          sum += w[r] * mpc->s[(k * MPC_NX + r) * nv + a] *
+                 mpc->s[(k * MPC_NX + r) * nv + b];
+        }
+      }
+      if (a == b) {
+        i = a % MPC_NU;
+        sum += params->r[i];
+        /* Change from the step before, and to the step after */
+        sum += params->r_rate[i] * (a + MPC_NU < nv ? 2 : 1);
+      } else if (b - a == MPC_NU) {
+        sum -= params->r_rate[a % MPC_NU];
+      }
+      mpc->p_x[idx++] = 2 * sum;
+    }
+  }
+
+  for (a = 0; a < nv; a++) {
+    double sum = 0;
+    for (k = a / MPC_NU; k < n; k++) {
+      const double *w = k + 1 < n ? params->q : params->q_final;
+      for (r = 0; r < MPC_NX; r++) {
+        sum += w[r] * mpc->s[(k * MPC_NX + r) * nv + a] *
+               mpc->e[k * MPC_NX + r];
+      }
+    }
+    /* Change from the input applied last */
+    if (a < MPC_NU) {
+      sum -= params->r_rate[a] * mpc->u_prev[a];
+    }
+    mpc->q[a] = 2 * sum;
+  }
+}
+
+static void build_bounds(struct mpc *mpc, double speed) {
+  const MPCParameters *params = &mpc->params;
+  int n = mpc->n, nv = mpc->nv;
+  double rate = params->max_steering_rate * params->dt;
+  int k;
+  for (k = 0; k < n; k++) {
+    double t = (k + 1) * params->dt;
+    mpc->l[k * MPC_NU] = -params->max_steering;
+    mpc->h[k * MPC_NU] = params->max_steering;
+    mpc->l[k * MPC_NU + 1] = params->min_accel;
+    mpc->h[k * MPC_NU + 1] = params->max_accel;
+    mpc->l[nv + k] = k == 0 ? mpc->u_prev[0] - rate : -rate;
+    mpc->h[nv + k] = k == 0 ? mpc->u_prev[0] + rate : rate;
+    /* Relaxed to what the accelerations can reach, when the speed is
+     * already out of its limits
+     */
+    mpc->l[nv + n + k] = fmin(params->min_speed - speed, t * params->max_accel);
+    mpc->h[nv + n + k] = fmax(params->max_speed - speed, t * params->min_accel);
+  }
+}
+
+static int setup(struct mpc *mpc) {
+  OSQPData data;
+  csc p, a;
+  memset(&p, 0, sizeof(p));
+  memset(&a, 0, sizeof(a));
+  p.m = mpc->nv;
+  p.n = mpc->nv;
+  p.nzmax = mpc->p_p[mpc->nv];
+  p.nz = -1;
+  p.p = mpc->p_p;
+  p.i = mpc->p_i;
+  p.x = mpc->p_x;
+  a.m = mpc->m;
+  a.n = mpc->nv;
+  a.nzmax = mpc->a_p[mpc->nv];
+  a.nz = -1;
+  a.p = mpc->a_p;
+  a.i = mpc->a_i;
+  a.x = mpc->a_x;
+  data.n = mpc->nv;
+  data.m = mpc->m;
+  data.P = &p;
+  data.A = &a;
+  data.q = mpc->q;
+  data.l = mpc->l;
+  data.u = mpc->h;
+  /* OSQP keeps its own copy */
+  return osqp_setup(&mpc->work, &data, &mpc->settings);
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+int mpc_solve(struct mpc *mpc, const double state[MPC_NX],
+              const double *reference, double input[MPC_NU]) {
+  int n = mpc->n, nv = mpc->nv;
+  double t0 = now();
+  int ret, status, i, k;
+
+  linearize(mpc, state);
+  build_cost(mpc, reference);
+  build_bounds(mpc, state[3]);
+
+  if (!mpc->work) {
+    if (setup(mpc) != 0) {
+      mpc->work = NULL;
+      return MPC_ERR_SETUP;
+    }
+  } else {
+    /* Same sparsity, so only the values change */
+    osqp_update_P(mpc->work, mpc->p_x, OSQP_NULL, mpc->p_p[nv]);
+    osqp_update_lin_cost(mpc->work, mpc->q);
+    osqp_update_bounds(mpc->work, mpc->l, mpc->h);
+  }
+  for (i = 0; i < nv; i++) {
+    mpc->warm[i] = mpc->u_bar[i];
+  }
+  osqp_warm_start_x(mpc->work, mpc->warm);
+  osqp_solve(mpc->work);
+
+  /* Out of iterations is still better than the previous plan */
+  status = mpc->work->info->status_val;
+  if (status == OSQP_SOLVED || status == OSQP_SOLVED_INACCURATE ||
+      status == OSQP_MAX_ITER_REACHED) {
+    for (i = 0; i < nv; i++) {
+      mpc->u[i] = mpc->work->solution->x[i];
+    }
+    ret = mpc->work->info->iter;
+  } else {
+    memcpy(mpc->u, mpc->u_bar, nv * sizeof(double));
+    ret = MPC_ERR_SOLVE;
+  }
+  mpc->has_plan = 1;
+
+  memcpy(mpc->x, state, MPC_NX * sizeof(double));
+  for (k = 0; k < n; k++) {
+    step(&mpc->params, mpc->x + k * MPC_NX, mpc->u + k * MPC_NU,
+         mpc->x + (k + 1) * MPC_NX, NULL, NULL);
+  }
+  memcpy(mpc->u_prev, mpc->u, sizeof(mpc->u_prev));
+  memcpy(input, mpc->u, sizeof(mpc->u_prev));
+
+  mpc->times[mpc->n_times % MPC_N_TIMES] = now() - t0;
+  mpc->n_times++;
+  return ret;
+}
+
+const double *mpc_inputs(const struct mpc *mpc) { return mpc->u; }
+
+const double *mpc_states(const struct mpc *mpc) { return mpc->x; }
+
+int mpc_solve_times(const struct mpc *mpc, double *times, int n) {
+  int n_kept = mpc->n_times < MPC_N_TIMES ? mpc->n_times : MPC_N_TIMES;
+  int i;
+  if (n > n_kept) {
+    n = n_kept;
+  }
+  for (i = 0; i < n; i++) {
+    times[i] = mpc->times[(mpc->n_times - n + i) % MPC_N_TIMES];
+  }
+  return n;
+}
@@ -0,0 +1,73 @@
+#pragma once
+/*
+Linear time-varying model predictive control of a kinematic bicycle
+Each solve rolls out the previous plan, carried forward a period, from the
+current state, linearizes about that trajectory, and condenses the states
+out, leaving a QP in only the inputs. Its sparsity never changes, so OSQP
+is set up once and only updated, then warm started from the shifted plan.
+*/
+
+/* State: x, y, heading and speed */
+#define MPC_NX 4
+/* Input: steering angle and acceleration */
+#define MPC_NU 2
+
+/* Errors of mpc_solve */
+#define MPC_ERR_SETUP (-1)
+#define MPC_ERR_SOLVE (-2)
+#define MPC_ERR_MEMORY (-3)
+
+/* Solve times kept for mpc_solve_times */
+#define MPC_N_TIMES 1024
+
+typedef struct {
+  /* Steps of dt seconds */
+  int horizon;
+  double dt;
+  /* Seconds between solves, to carry the previous plan forward */
+  double period;
+  double wheel_base;
+  /* State weights, along the horizon and at its end */
+  double q[MPC_NX];
+  double q_final[MPC_NX];
+  /* Input weights, and weights on the change in input per step */
+  double r[MPC_NU];
+  double r_rate[MPC_NU];
+  /* Limits in radians, radians per second, m/s^2 and m/s */
+  double max_steering;
+  double max_steering_rate;
+  double min_accel, max_accel;
+  double min_speed, max_speed;
+  /* OSQP iterations and tolerance */
+  int max_iter;
+  double eps;
+} MPCParameters;
+
+struct mpc;
+
+/* Defaults for the racecar: 2 s horizon in steps of 0.1 s, solved at 50 Hz */
+void mpc_default_parameters(MPCParameters *params);
+
+struct mpc *mpc_create(const MPCParameters *params);
+void mpc_free(struct mpc *mpc);
+
+/* Forget the previous plan, as when changing to another path */
+void mpc_reset(struct mpc *mpc);
+
+/* Plan from state to follow reference, (horizon + 1) states from now, and
+ * give the input to apply. On failure, the input follows the previous plan.
+ * Returns the OSQP iterations, or an error
+ */
+int mpc_solve(struct mpc *mpc, const double state[MPC_NX],
+              const double *reference, double input[MPC_NU]);
+
+/* Inputs, horizon by MPC_NU, and predicted states, (horizon + 1) by
+ * MPC_NX, of the last plan
+ */
+const double *mpc_inputs(const struct mpc *mpc);
+const double *mpc_states(const struct mpc *mpc);
+
+/* Copy up to n of the most recent solve times, in seconds, oldest first.
+ * Returns the number copied
+ */
+int mpc_solve_times(const struct mpc *mpc, double *times, int n);
@@ -0,0 +1,165 @@
+-- Model predictive control of the racecar, with OSQP
+local lib = {}
+
+local ffi = require'ffi'
+local floor = require'math'.floor
+local tsort = require'table'.sort
+
+ffi.cdef[[
+typedef struct {
+  int horizon;
+  double dt;
+  double period;
+  double wheel_base;
+  double q[4];
+  double q_final[4];
+  double r[2];
+  double r_rate[2];
+  double max_steering;
+  double max_steering_rate;
+  double min_accel, max_accel;
+  double min_speed, max_speed;
+  int max_iter;
+  double eps;
+} MPCParameters;
+struct mpc;
+void mpc_default_parameters(MPCParameters *params);
+struct mpc *mpc_create(const MPCParameters *params);
+void mpc_free(struct mpc *mpc);
+void mpc_reset(struct mpc *mpc);
+int mpc_solve(struct mpc *mpc, const double state[4],
+              const double *reference, double input[2]);
+const double *mpc_inputs(const struct mpc *mpc);
+const double *mpc_states(const struct mpc *mpc);
+int mpc_solve_times(const struct mpc *mpc, double *times, int n);
+]]
+local has_mpc, mpc = pcall(ffi.load, 'mpc')
+
+local NX, NU = 4, 2
+local N_TIMES = 1024
+
+local errors = {
+  [-1] = "OSQP setup failed",
+  [-2] = "OSQP did not solve",
+  [-3] = "Out of memory",
+}
+
+-- state is {x, y, heading, speed} and reference is a list of horizon + 1
+-- such states, from now in steps of dt. Returns the steering and the
+-- acceleration to apply, and the OSQP iterations
+local function solve(self, state, reference)
+  local n = self.params.horizon
+  local x0, ref, u = self.x0, self.reference, self.u
+  for i=1, NX do x0[i - 1] = state[i] end
+  for k=0, n do
+    local r = reference[k + 1] or reference[#reference]
+    for i=1, NX do ref[k * NX + i - 1] = r[i] end
+  end
+  local ret = mpc.mpc_solve(self.c, x0, ref, u)
+  if ret < 0 then return u[0], u[1], errors[ret] end
+  return u[0], u[1], ret
+end
+
+-- Predicted states of the last plan
+local function get_plan(self)
+  local states = mpc.mpc_states(self.c)
+  local plan = {}
+  for k=0, self.params.horizon do
+    local i = k * NX
+    plan[k + 1] = {states[i], states[i + 1], states[i + 2], states[i + 3]}
+  end
+  return plan
+end
+
+local function reset(self)
+  mpc.mpc_reset(self.c)
+end
+
+-- Distribution of the recent solve times, in seconds
+local function get_timing(self)
+  local n = mpc.mpc_solve_times(self.c, self.times, N_TIMES)
+  if n == 0 then return false, "No solves" end
+  local times, sum = {}, 0
+  for i=0, n - 1 do
+    times[i + 1] = self.times[i]
+    sum = sum + self.times[i]
+  end
+  tsort(times)
+  local function percentile(p)
+    return times[math.min(n, floor(p * n) + 1)]
+  end
+  return {
+    n = n,
+    mean = sum / n,
+    median = percentile(0.5),
+    p90 = percentile(0.9),
+    p99 = percentile(0.99),
+    max = times[n],
+  }
+end
+
+local function tostring_mpc(self)
+  local p = self.params
+  return string.format("MPC | %d steps of %.2f s, solved every %.3f s",
+    p.horizon, p.dt, p.period)
+end
+
+local mt = {
+  __tostring = tostring_mpc
+}
+
+-- Parameters default to mpc_default_parameters, and override the fields
+-- of MPCParameters that are given
+function lib.new(params)
+  if not has_mpc then return false, mpc end
+  if type(params) ~= 'table' then params = {} end
+  local c_params = ffi.new'MPCParameters'
+  mpc.mpc_default_parameters(c_params)
+  for k, v in pairs(params) do
+    if type(v) == 'table' then
+      for i, vi in ipairs(v) do c_params[k][i - 1] = vi end
+    else
+      c_params[k] = v
+    end
+  end
+  local c = mpc.mpc_create(c_params)
+  if c == nil then return false, "Bad parameters" end
+  local n = c_params.horizon
+  return setmetatable({
+    c = ffi.gc(c, mpc.mpc_free),
+    params = c_params,
+    x0 = ffi.new('double[?]', NX),
+    reference = ffi.new('double[?]', (n + 1) * NX),
+    u = ffi.new('double[?]', NU),
+    times = ffi.new('double[?]', N_TIMES),
+    solve = solve,
+    plan = get_plan,
+    reset = reset,
+    timing = get_timing,
+  }, mt)
+end
+
+-- Reference of n + 1 states along a path of points {x, y, heading} spaced
+-- by ds, from point id at speed
+function lib.reference(my_path, id, speed, dt, n)
+  local points = my_path.points
+  local n_points = #points
+  local reference = {}
+  for k=0, n do
+    local idx = id + floor(k * dt * speed / my_path.ds + 0.5)
+    local v = speed
+    if idx > n_points then
+      if my_path.closed then
+        idx = (idx - 1) % n_points + 1
+      else
+        -- Stop at the end
+        idx, v = n_points, 0
+      end
+    end
+    local p = points[idx]
+    reference[k + 1] = {p[1], p[2], p[3], v}
+  end
+  return reference
+end
+
+return lib
@@ -0,0 +1,59 @@
+#!/usr/bin/env luajit
+local mpc = require'mpc'
+
+local cos, sin, tan = math.cos, math.sin, math.tan
+
+-- A circle of radius 2, counterclockwise about (0, 2)
+local ds = 0.01
+local radius = 2
+local points = {}
+for i=1, math.floor(2 * math.pi * radius / ds) do
+  local th = (i - 1) * ds / radius
+  table.insert(points, {radius * sin(th), radius * (1 - cos(th)), th})
+end
+local my_path = {points = points, ds = ds, closed = true}
+
+-- 2 s ahead, solved at 50 Hz
+local controller = assert(mpc.new{horizon = 20, dt = 0.1, period = 0.02})
+print(controller)
+local params = controller.params
+
+-- Start off the path, and stopped
+local state = {0, -0.5, 0.3, 0}
+local speed = 1.5
+local err_max = 0
+for t=1, 1000 do
+  -- Nearest point, along the circle
+  local th = math.atan2(state[1], radius - state[2])
+  local id = math.floor((th % (2 * math.pi)) * radius / ds + 0.5) + 1
+  local reference = mpc.reference(my_path, id, speed, params.dt, params.horizon)
+  local steering, accel, iter = controller:solve(state, reference)
+  assert(type(iter) == 'number', iter)
+  assert(math.abs(steering) <= params.max_steering + 1e-3)
+  -- Drive for a period
+  local dt = params.period
+  state = {
+    state[1] + dt * state[4] * cos(state[3]),
+    state[2] + dt * state[4] * sin(state[3]),
+    state[3] + dt * state[4] * tan(steering) / params.wheel_base,
+    state[4] + dt * accel,
+  }
+  if t > 200 then
+    local dx, dy = state[1], state[2] - radius
+    err_max = math.max(err_max, math.abs(math.sqrt(dx * dx + dy * dy) - radius))
+  end
+end
+print(string.format("Tracking error: %.3f m", err_max))
+assert(err_max < 0.1, "Not on the path")
+assert(math.abs(state[4] - speed) < 0.1, "Not at speed")
+assert(#controller:plan() == params.horizon + 1)
+
+local timing = assert(controller:timing())
+print(string.format(
+  "Solve times of %d | mean %.1f us, median %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us",
+  timing.n, timing.mean * 1e6, timing.median * 1e6,
+  timing.p90 * 1e6, timing.p99 * 1e6, timing.max * 1e6))
+assert(timing.p99 < params.period, "Too slow for the loop")
+
+controller:reset()
+print("OK")
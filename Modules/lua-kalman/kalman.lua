@@ -368,6 +368,12 @@ function lib.ukf(parameters)
   }
 end
 
+-- Native square-root UKF with the same methods, when built
+local has_squkf, squkf = pcall(require, 'squkf')
+if has_squkf then
+  lib.squkf = squkf.new
+end
+
 -- Accessor Methods
 local function get_prior(self)
   return self.x_k_minus, self.P_k_minus
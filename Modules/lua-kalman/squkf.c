@@ -0,0 +1,450 @@
+/*
+Square-root unscented Kalman filter for an IMU
+(Van der Merwe and Wan): sigma points from the Cholesky factor, the
+factor rebuilt by QR after each transform, and rank one Cholesky updates
+for the center weight and the measurement correction
+*/
+
+#include <math.h>
+#include <string.h>
+
+#include "squkf.h"
+
+/* Weights of kalman.lua's get_weights */
+#define UKF_ALPHA 1.0
+#define UKF_BETA 2.0
+#define UKF_KAPPA 0.75
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define EPS 1e-12
+#define MEAN_ITERATIONS 16
+/* Rows of the compound matrix for QR: deviations, then the noise */
+#define QR_ROWS (2 * UKF_N + UKF_N)
+
+static const double UP[3] = {0, 0, 1};
+
+/* Quaternions are w, x, y, z */
+static void qmul(const double *a, const double *b, double *out) {
+  double w = a[0] * b[0] - a[1] * b[1] - a[2] * b[2] - a[3] * b[3];
+  double x = a[0] * b[1] + a[1] * b[0] + a[2] * b[3] - a[3] * b[2];
+  double y = a[0] * b[2] - a[1] * b[3] + a[2] * b[0] + a[3] * b[1];
+  double z = a[0] * b[3] + a[1] * b[2] - a[2] * b[1] + a[3] * b[0];
+  double norm = sqrt(w * w + x * x + y * y + z * z);
+  if (norm < EPS) {
+    out[0] = 1;
+    out[1] = out[2] = out[3] = 0;
+    return;
+  }
+  out[0] = w / norm;
+  out[1] = x / norm;
+  out[2] = y / norm;
+  out[3] = z / norm;
+}
+
+static void qconj(const double *q, double *out) {
+  out[0] = q[0];
+  out[1] = -q[1];
+  out[2] = -q[2];
+  out[3] = -q[3];
+}
+
+/* From a rotation vector */
+static void qexp(const double *t, double *out) {
+  double angle = sqrt(t[0] * t[0] + t[1] * t[1] + t[2] * t[2]);
+  double s = angle > EPS ? sin(angle / 2) / angle : 0.5;
+  out[0] = cos(angle / 2);
+  out[1] = s * t[0];
+  out[2] = s * t[1];
+  out[3] = s * t[2];
+}
+
+/* To a rotation vector, taking the short way around */
+static void qlog(const double *q, double *out) {
+  double w = q[0], sign = 1, mag, factor;
+  if (w < 0) {
+    w = -w;
+    sign = -1;
+  }
+  mag = sqrt(q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+  factor = mag > EPS ? 2 * atan2(mag, w) / mag : 2;
+  out[0] = sign * factor * q[1];
+  out[1] = sign * factor * q[2];
+  out[2] = sign * factor * q[3];
+}
+
+static void qrotate(const double *q, const double *v, double *out) {
+  /* v + 2 w (u x v) + 2 u x (u x v) */
+  double ux = q[1], uy = q[2], uz = q[3], w = q[0];
+  double cx = uy * v[2] - uz * v[1];
+  double cy = uz * v[0] - ux * v[2];
+  double cz = ux * v[1] - uy * v[0];
+  out[0] = v[0] + 2 * (w * cx + uy * cz - uz * cy);
+  out[1] = v[1] + 2 * (w * cy + uz * cx - ux * cz);
+  out[2] = v[2] + 2 * (w * cz + ux * cy - uy * cx);
+}
+
+/* Lower triangular S with S * S' equal to A' * A, for A of rows by cols,
+ * row major with a stride of cols. A is overwritten
+ */
+static void tria(double *A, int rows, int cols, double *S, int stride) {
+  int i, j, k;
+  for (k = 0; k < cols; k++) {
+    double norm = 0, alpha, vnorm, dot;
+    for (i = k; i < rows; i++) norm += A[i * cols + k] * A[i * cols + k];
+    norm = sqrt(norm);
+    if (norm < EPS) continue;
+    alpha = A[k * cols + k] > 0 ? -norm : norm;
+    /* Householder vector in column k, from row k down */
+    A[k * cols + k] -= alpha;
+    vnorm = 0;
+    for (i = k; i < rows; i++) vnorm += A[i * cols + k] * A[i * cols + k];
+    if (vnorm > EPS * EPS) {
+      for (j = k + 1; j < cols; j++) {
+        dot = 0;
+        for (i = k; i < rows; i++) dot += A[i * cols + k] * A[i * cols + j];
+        dot = 2 * dot / vnorm;
+        for (i = k; i < rows; i++) A[i * cols + j] -= dot * A[i * cols + k];
+      }
+    }
+    A[k * cols + k] = alpha;
+  }
+  /* R is the upper triangle; S = R', with a positive diagonal */
+  for (i = 0; i < cols; i++) {
+    double sign = A[i * cols + i] < 0 ? -1 : 1;
+    for (j = 0; j < cols; j++) {
+      S[j * stride + i] = j >= i ? sign * A[i * cols + j] : 0;
+    }
+  }
+}
+
+/* S * S' + sign * x * x', in place. x is overwritten.
+ * Returns -1, leaving S partly updated, if the result is not positive
+ */
+static int cholupdate(double *S, int n, int stride, double *x, double sign) {
+  int i, k;
+  for (k = 0; k < n; k++) {
+    double skk = S[k * stride + k];
+    double r2 = skk * skk + sign * x[k] * x[k];
+    double r, c, s;
+    if (r2 <= EPS * EPS || fabs(skk) < EPS) return -1;
+    r = sqrt(r2);
+    c = r / skk;
+    s = x[k] / skk;
+    S[k * stride + k] = r;
+    for (i = k + 1; i < n; i++) {
+      S[i * stride + k] = (S[i * stride + k] + sign * s * x[i]) / c;
+      x[i] = c * x[i] - s * S[i * stride + k];
+    }
+  }
+  return 0;
+}
+
+void squkf_init(SqUKF *f, const double *orientation_sd,
+                const double *position_sd, const double *velocity_sd) {
+  double lambda;
+  int i;
+  memset(f, 0, sizeof(SqUKF));
+  f->q[0] = 1;
+  for (i = 0; i < 3; i++) {
+    f->S[i][i] = orientation_sd[i];
+    f->S[3 + i][3 + i] = position_sd[i];
+    f->S[6 + i][6 + i] = velocity_sd[i];
+  }
+  /* Those of kalman.lua */
+  f->gyro_noise = 0.25 * M_PI / 180;
+  f->gravity_noise = 2 * M_PI / 180;
+  f->accel_noise = 0.01;
+  f->gravity = 9.80665;
+  f->gravity_gate = 0.06;
+
+  lambda = UKF_ALPHA * UKF_ALPHA * (UKF_N + UKF_KAPPA) - UKF_N;
+  f->gamma = sqrt(UKF_N + lambda);
+  f->w_mean0 = lambda / (UKF_N + lambda);
+  f->w_cov0 = f->w_mean0 + (1 + UKF_BETA - UKF_ALPHA * UKF_ALPHA);
+  f->w_i = 1 / (2 * (UKF_N + lambda));
+}
+
+/* Error of each sigma point: zero, then plus and minus each column */
+static void sigma_errors(const SqUKF *f, double chi[UKF_SIGMA][UKF_N]) {
+  int i, j;
+  memset(chi[0], 0, sizeof(chi[0]));
+  for (j = 0; j < UKF_N; j++) {
+    for (i = 0; i < UKF_N; i++) {
+      chi[1 + 2 * j][i] = f->gamma * f->S[i][j];
+      chi[2 + 2 * j][i] = -f->gamma * f->S[i][j];
+    }
+  }
+}
+
+static void sigma_state(const SqUKF *f, const double *err, double *q,
+                        double *p, double *v) {
+  double dq[4];
+  int i;
+  qexp(err, dq);
+  qmul(dq, f->q, q);
+  for (i = 0; i < 3; i++) {
+    p[i] = f->p[i] + err[3 + i];
+    v[i] = f->v[i] + err[6 + i];
+  }
+}
+
+/* Rebuild S from weighted deviations, the center one by a rank one update,
+ * and the diagonal noise standard deviations
+ */
+static int factor(double dev[UKF_SIGMA][UKF_N], const double *noise_sd,
+                  double w_i, double w_cov0, double S[UKF_N][UKF_N]) {
+  double A[QR_ROWS * UKF_N];
+  double x[UKF_N];
+  double sw = sqrt(w_i);
+  int i, j;
+  for (i = 1; i < UKF_SIGMA; i++) {
+    for (j = 0; j < UKF_N; j++) A[(i - 1) * UKF_N + j] = sw * dev[i][j];
+  }
+  memset(A + (UKF_SIGMA - 1) * UKF_N, 0, UKF_N * UKF_N * sizeof(double));
+  for (i = 0; i < UKF_N; i++) {
+    A[(UKF_SIGMA - 1 + i) * UKF_N + i] = noise_sd[i];
+  }
+  tria(A, QR_ROWS, UKF_N, &S[0][0], UKF_N);
+  for (j = 0; j < UKF_N; j++) x[j] = sqrt(fabs(w_cov0)) * dev[0][j];
+  return cholupdate(&S[0][0], UKF_N, UKF_N, x, w_cov0 < 0 ? -1 : 1);
+}
+
+int squkf_predict(SqUKF *f, const double *gyro, const double *accel,
+                  double dt) {
+  double chi[UKF_SIGMA][UKF_N];
+  double qs[UKF_SIGMA][4], ps[UKF_SIGMA][3], vs[UKF_SIGMA][3];
+  double dev[UKF_SIGMA][UKF_N];
+  double S[UKF_N][UKF_N];
+  double noise_sd[UKF_N];
+  double dq_body[4], rot[3], q_mean[4], q_inv[4], dq[4], err_mean[3];
+  double p_mean[3] = {0, 0, 0}, v_mean[3] = {0, 0, 0};
+  int i, j, iter;
+
+  for (j = 0; j < 3; j++) rot[j] = gyro[j] * dt;
+  qexp(rot, dq_body);
+
+  sigma_errors(f, chi);
+  for (i = 0; i < UKF_SIGMA; i++) {
+    double q[4];
+    sigma_state(f, chi[i], q, ps[i], vs[i]);
+    /* Rotation by the orientation, then by the gyro in the body frame */
+    qmul(q, dq_body, qs[i]);
+    if (accel) {
+      double a[3];
+      qrotate(qs[i], accel, a);
+      for (j = 0; j < 3; j++) {
+        a[j] = (a[j] - UP[j]) * f->gravity;
+        ps[i][j] += vs[i][j] * dt + 0.5 * a[j] * dt * dt;
+        vs[i][j] += a[j] * dt;
+      }
+    } else {
+      for (j = 0; j < 3; j++) ps[i][j] += vs[i][j] * dt;
+    }
+  }
+
+  /* Iterated mean of the quaternions, as quaternion.mean */
+  memcpy(q_mean, qs[0], sizeof(q_mean));
+  for (iter = 0; iter < MEAN_ITERATIONS; iter++) {
+    qconj(q_mean, q_inv);
+    memset(err_mean, 0, sizeof(err_mean));
+    for (i = 0; i < UKF_SIGMA; i++) {
+      double w = i == 0 ? f->w_mean0 : f->w_i;
+      qmul(qs[i], q_inv, dq);
+      qlog(dq, dev[i]);
+      for (j = 0; j < 3; j++) err_mean[j] += w * dev[i][j];
+    }
+    qexp(err_mean, dq);
+    qmul(dq, q_mean, q_mean);
+    if (err_mean[0] * err_mean[0] + err_mean[1] * err_mean[1] +
+            err_mean[2] * err_mean[2] < 1e-18) {
+      break;
+    }
+  }
+  for (i = 0; i < UKF_SIGMA; i++) {
+    double w = i == 0 ? f->w_mean0 : f->w_i;
+    for (j = 0; j < 3; j++) {
+      p_mean[j] += w * ps[i][j];
+      v_mean[j] += w * vs[i][j];
+    }
+  }
+  qconj(q_mean, q_inv);
+  for (i = 0; i < UKF_SIGMA; i++) {
+    qmul(qs[i], q_inv, dq);
+    qlog(dq, dev[i]);
+    for (j = 0; j < 3; j++) {
+      dev[i][3 + j] = ps[i][j] - p_mean[j];
+      dev[i][6 + j] = vs[i][j] - v_mean[j];
+    }
+  }
+
+  for (j = 0; j < 3; j++) {
+    double a_sd = f->accel_noise * f->gravity;
+    noise_sd[j] = f->gyro_noise * dt;
+    noise_sd[3 + j] = 0.5 * a_sd * dt * dt;
+    noise_sd[6 + j] = a_sd * dt;
+  }
+  if (factor(dev, noise_sd, f->w_i, f->w_cov0, S) != 0) {
+    f->n_failed++;
+    return -1;
+  }
+
+  memcpy(f->q, q_mean, sizeof(q_mean));
+  memcpy(f->p, p_mean, sizeof(p_mean));
+  memcpy(f->v, v_mean, sizeof(v_mean));
+  memcpy(f->S, S, sizeof(S));
+  f->n_predict++;
+  return 0;
+}
+
+/* Solve x * (L * L') = b for the row vector x, with L lower triangular */
+static void solve_llt(double L[UKF_M][UKF_M], const double *b,
+                      double *x) {
+  double y[UKF_M];
+  int i, k;
+  /* L * y = b, then L' * x = y */
+  for (i = 0; i < UKF_M; i++) {
+    double sum = b[i];
+    for (k = 0; k < i; k++) sum -= L[i][k] * y[k];
+    y[i] = sum / L[i][i];
+  }
+  for (i = UKF_M - 1; i >= 0; i--) {
+    double sum = y[i];
+    for (k = i + 1; k < UKF_M; k++) sum -= L[k][i] * x[k];
+    x[i] = sum / L[i][i];
+  }
+}
+
+int squkf_correct_gravity(SqUKF *f, const double *accel) {
+  double chi[UKF_SIGMA][UKF_N];
+  double zs[UKF_SIGMA][UKF_M];
+  double A[(2 * UKF_N + UKF_M) * UKF_M];
+  double Sz[UKF_M][UKF_M];
+  double Pxz[UKF_N][UKF_M];
+  double K[UKF_N][UKF_M];
+  double U[UKF_M][UKF_N];
+  double S[UKF_N][UKF_N];
+  double z_mean[UKF_M] = {0, 0, 0}, innovation[UKF_M], dx[UKF_N];
+  double x[UKF_M], a[3], dq[4], sw = sqrt(f->w_i);
+  double norm = sqrt(accel[0] * accel[0] + accel[1] * accel[1] +
+                     accel[2] * accel[2]);
+  int i, j, k;
+
+  if (norm < EPS) return -1;
+  for (j = 0; j < 3; j++) a[j] = accel[j] / norm;
+
+  /* Expected world frame up of each sigma point */
+  sigma_errors(f, chi);
+  for (i = 0; i < UKF_SIGMA; i++) {
+    double q[4], p[3], v[3];
+    sigma_state(f, chi[i], q, p, v);
+    qrotate(q, a, zs[i]);
+    for (j = 0; j < UKF_M; j++) {
+      z_mean[j] += (i == 0 ? f->w_mean0 : f->w_i) * zs[i][j];
+    }
+  }
+
+  for (i = 1; i < UKF_SIGMA; i++) {
+    for (j = 0; j < UKF_M; j++) {
+      A[(i - 1) * UKF_M + j] = sw * (zs[i][j] - z_mean[j]);
+    }
+  }
+  memset(A + (UKF_SIGMA - 1) * UKF_M, 0, UKF_M * UKF_M * sizeof(double));
+  for (j = 0; j < UKF_M; j++) {
+    A[(UKF_SIGMA - 1 + j) * UKF_M + j] = f->gravity_noise;
+  }
+  tria(A, 2 * UKF_N + UKF_M, UKF_M, &Sz[0][0], UKF_M);
+  for (j = 0; j < UKF_M; j++) {
+    x[j] = sqrt(fabs(f->w_cov0)) * (zs[0][j] - z_mean[j]);
+  }
+  if (cholupdate(&Sz[0][0], UKF_M, UKF_M, x, f->w_cov0 < 0 ? -1 : 1) != 0) {
+    f->n_failed++;
+    return -1;
+  }
+
+  /* The center error is zero, and the errors are symmetric about it */
+  memset(Pxz, 0, sizeof(Pxz));
+  for (i = 1; i < UKF_SIGMA; i++) {
+    for (j = 0; j < UKF_N; j++) {
+      for (k = 0; k < UKF_M; k++) {
+        Pxz[j][k] += f->w_i * chi[i][j] * (zs[i][k] - z_mean[k]);
+      }
+    }
+  }
+  for (j = 0; j < UKF_N; j++) solve_llt(Sz, Pxz[j], K[j]);
+
+  for (k = 0; k < UKF_M; k++) innovation[k] = UP[k] - z_mean[k];
+  for (j = 0; j < UKF_N; j++) {
+    dx[j] = 0;
+    for (k = 0; k < UKF_M; k++) dx[j] += K[j][k] * innovation[k];
+  }
+
+  /* Columns of K * Sz come off the covariance */
+  for (k = 0; k < UKF_M; k++) {
+    for (j = 0; j < UKF_N; j++) {
+      U[k][j] = 0;
+      for (i = k; i < UKF_M; i++) U[k][j] += K[j][i] * Sz[i][k];
+    }
+  }
+  memcpy(S, f->S, sizeof(S));
+  for (k = 0; k < UKF_M; k++) {
+    if (cholupdate(&S[0][0], UKF_N, UKF_N, U[k], -1) != 0) break;
+  }
+  /* Keep the prior covariance rather than one that lost rank */
+  if (k == UKF_M) {
+    memcpy(f->S, S, sizeof(S));
+  } else {
+    f->n_failed++;
+  }
+
+  /* The correction is in the world frame */
+  qexp(dx, dq);
+  qmul(dq, f->q, f->q);
+  for (j = 0; j < 3; j++) {
+    f->p[j] += dx[3 + j];
+    f->v[j] += dx[6 + j];
+  }
+  f->n_correct++;
+  return 0;
+}
+
+void squkf_just_gyro(SqUKF *f, const double *gyro, double dt) {
+  double rot[3], dq[4];
+  int j;
+  for (j = 0; j < 3; j++) rot[j] = gyro[j] * dt;
+  qexp(rot, dq);
+  qmul(f->q, dq, f->q);
+}
+
+int squkf_update_imu(SqUKF *f, const double *gyro, const double *accel,
+                     const double *dt, int n) {
+  int i, n_correct = 0;
+  for (i = 0; i < n; i++) {
+    const double *g = gyro + 3 * i;
+    const double *a = accel ? accel + 3 * i : NULL;
+    if (squkf_predict(f, g, a, dt[i]) != 0) return -(1 + i);
+    if (a) {
+      double norm = sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+      if (fabs(norm - 1) > f->gravity_gate) {
+        f->n_rejected++;
+      } else if (squkf_correct_gravity(f, a) == 0) {
+        n_correct++;
+      }
+    }
+  }
+  return n_correct;
+}
+
+void squkf_covariance(const SqUKF *f, double *P) {
+  int i, j, k;
+  for (i = 0; i < UKF_N; i++) {
+    for (j = 0; j <= i; j++) {
+      double sum = 0;
+      for (k = 0; k <= j; k++) sum += f->S[i][k] * f->S[j][k];
+      P[i * UKF_N + j] = sum;
+      P[j * UKF_N + i] = sum;
+    }
+  }
+}
@@ -0,0 +1,68 @@
+#pragma once
+/*
+Square-root unscented Kalman filter for an IMU
+Nominal state is the body to world quaternion, position and velocity.
+The filter runs on the error state of UKF_N: a world frame rotation
+vector, then position, then velocity. Every matrix has a compile time
+size, so no call allocates.
+*/
+
+#include <stdint.h>
+
+#define UKF_N 9
+#define UKF_M 3
+#define UKF_SIGMA (2 * UKF_N + 1)
+
+typedef struct {
+  /* Nominal state: quaternion as w, x, y, z */
+  double q[4];
+  double p[3];
+  double v[3];
+  /* Lower triangular, with the error covariance as S * S' */
+  double S[UKF_N][UKF_N];
+  /* Standard deviations of the noise */
+  double gyro_noise;    /* rad/s */
+  double accel_noise;   /* in accelerometer units */
+  double gravity_noise; /* of the unit gravity measurement */
+  /* m/s^2 per accelerometer unit, e.g. 9.80665 for readings in g */
+  double gravity;
+  /* Largest |norm(accel) - 1| taken as a gravity measurement by batches */
+  double gravity_gate;
+  /* Unscented transform */
+  double gamma;
+  double w_mean0, w_cov0, w_i;
+  /* Counters */
+  uint64_t n_predict;
+  uint64_t n_correct;
+  uint64_t n_rejected;
+  uint64_t n_failed;
+} SqUKF;
+
+/* Identity orientation at the origin at rest, with the given standard
+ * deviations of the initial error, each as three values
+ */
+void squkf_init(SqUKF *f, const double *orientation_sd,
+                const double *position_sd, const double *velocity_sd);
+
+/* Propagate by a body frame gyro reading over dt seconds. accel, in
+ * accelerometer units, also moves position and velocity; NULL keeps a
+ * constant velocity. Returns 0, or -1 if the covariance lost rank
+ */
+int squkf_predict(SqUKF *f, const double *gyro, const double *accel,
+                  double dt);
+/* Correct roll and pitch by taking accel as the direction of up.
+ * Returns 0, or -1 if the covariance could not be updated
+ */
+int squkf_correct_gravity(SqUKF *f, const double *accel);
+/* Only integrate the gyro, leaving the covariance */
+void squkf_just_gyro(SqUKF *f, const double *gyro, double dt);
+
+/* Predict and, within the gravity gate, correct on n samples of
+ * interleaved xyz gyro and accel with per sample dt.
+ * Returns the number of corrections, or -(1 + i) on a failure at sample i
+ */
+int squkf_update_imu(SqUKF *f, const double *gyro, const double *accel,
+                     const double *dt, int n);
+
+/* Error covariance, row major UKF_N by UKF_N */
+void squkf_covariance(const SqUKF *f, double *P);
@@ -0,0 +1,247 @@
+-- Native square-root UKF for an IMU, in place of kalman.ukf
+-- Same methods and fields, plus update_imu for a batch of samples
+local lib = {}
+local ffi = require'ffi'
+local unpack = unpack or require'table'.unpack
+ffi.cdef[[
+typedef struct {
+  double q[4];
+  double p[3];
+  double v[3];
+  double S[9][9];
+  double gyro_noise;
+  double accel_noise;
+  double gravity_noise;
+  double gravity;
+  double gravity_gate;
+  double gamma;
+  double w_mean0, w_cov0, w_i;
+  uint64_t n_predict;
+  uint64_t n_correct;
+  uint64_t n_rejected;
+  uint64_t n_failed;
+} SqUKF;
+void squkf_init(SqUKF *f, const double *orientation_sd,
+                const double *position_sd, const double *velocity_sd);
+int squkf_predict(SqUKF *f, const double *gyro, const double *accel,
+                  double dt);
+int squkf_correct_gravity(SqUKF *f, const double *accel);
+void squkf_just_gyro(SqUKF *f, const double *gyro, double dt);
+int squkf_update_imu(SqUKF *f, const double *gyro, const double *accel,
+                     const double *dt, int n);
+void squkf_covariance(const SqUKF *f, double *P);
+]]
+local C = ffi.load'squkf'
+lib.C = C
+
+local matrix = require'matrix'
+local has_view, matrix_view = pcall(require, 'matrix_view')
+local quaternion = require'quaternion'
+local vector = require'vector'
+local vnew = vector.new
+local vrad = vector.rad
+local sqrt = require'math'.sqrt
+
+-- Size of the error state: orientation, position, velocity
+local N = 9
+
+-- Standard deviations from a list, or from the diagonal of a covariance
+local function to_sd(cov, n, default)
+  if type(cov)~='table' then return default end
+  local sd = {}
+  for i=1,n do
+    local v = cov[i]
+    if type(v)=='table' then
+      sd[i] = sqrt(v[i])
+    else
+      sd[i] = tonumber(v) or default[i]
+    end
+  end
+  return sd
+end
+
+local function covariance(self)
+  C.squkf_covariance(self.filter, self.P)
+  local P = matrix:new(N, N)
+  for i=1,N do
+    for j=1,N do P[i][j] = self.P[(i-1) * N + j - 1] end
+  end
+  return P
+end
+
+-- Fields of kalman.ukf, read from the native state when asked for
+local getters = {
+  orientation = function(self)
+    local q = self.filter.q
+    return quaternion.unit{q[0], q[1], q[2], q[3]}
+  end,
+  orientation_cov = function(self)
+    return matrix.subm(covariance(self), 1, 1, 3, 3)
+  end,
+  -- Position then velocity, as the position0 parameter
+  position = function(self)
+    local f = self.filter
+    return vnew{f.p[0], f.p[1], f.p[2], f.v[0], f.v[1], f.v[2]}
+  end,
+  position_cov = function(self)
+    return matrix.subm(covariance(self), 4, 4, N, N)
+  end,
+  covariance = covariance,
+  -- The same, as a view for lapack to work on in place, refreshed on each
+  -- read. Symmetric, so row major is also column major
+  covariance_view = function(self)
+    C.squkf_covariance(self.filter, self.P)
+    return self.P_view
+  end,
+}
+
+local mt = {
+  __index = function(self, k)
+    local get = getters[k]
+    if get then return get(self) end
+  end,
+}
+
+local function set3(buf, v)
+  buf[0], buf[1], buf[2] = v[1], v[2], v[3]
+  return buf
+end
+
+local function just_gyro(self, measured_gyro, dt)
+  C.squkf_just_gyro(self.filter, set3(self.gyro, measured_gyro), dt)
+  return self
+end
+
+-- accel is optional, and moves position and velocity
+local function motion_gyro(self, measured_gyro, dt, measured_accel)
+  local accel = measured_accel and set3(self.accel, measured_accel)
+  if C.squkf_predict(self.filter, set3(self.gyro, measured_gyro),
+                     accel, dt) ~= 0 then
+    return false, "Covariance lost rank"
+  end
+  return self
+end
+
+local function correct_gravity(self, measured_accel)
+  if type(measured_accel)~='table' then
+    return false, "Bad input"
+  end
+  if C.squkf_correct_gravity(self.filter,
+                             set3(self.accel, measured_accel)) ~= 0 then
+    return false, "Bad correction"
+  end
+  return self
+end
+
+-- Room for n samples in the batch buffers
+local function reserve(self, n)
+  if n <= self.batch_size then return end
+  self.batch_size = n
+  self.batch_gyro = ffi.new('double[?]', 3 * n)
+  self.batch_accel = ffi.new('double[?]', 3 * n)
+  self.batch_dt = ffi.new('double[?]', n)
+end
+
+-- Predict, and correct when accel is near 1g, on each of a batch of samples
+-- gyros, accels: lists of xyz tables, or cdata of n interleaved xyz doubles
+-- dts: list or cdata of n times, or a single dt for all
+-- Returns the number of corrections
+local function update_imu(self, gyros, accels, dts, n)
+  local gyro, accel, dt = gyros, accels, dts
+  if type(gyros)=='table' then
+    n = #gyros
+    reserve(self, n)
+    gyro = self.batch_gyro
+    for i=1,n do
+      local g = gyros[i]
+      gyro[3*i-3], gyro[3*i-2], gyro[3*i-1] = g[1], g[2], g[3]
+    end
+  end
+  n = tonumber(n)
+  if not n then return false, "No sample count" end
+  reserve(self, n)
+  if type(accels)=='table' then
+    accel = self.batch_accel
+    for i=1,n do
+      local a = accels[i]
+      accel[3*i-3], accel[3*i-2], accel[3*i-1] = a[1], a[2], a[3]
+    end
+  end
+  if type(dts)=='number' then
+    dt = self.batch_dt
+    for i=0,n-1 do dt[i] = dts end
+  elseif type(dts)=='table' then
+    dt = self.batch_dt
+    for i=1,n do dt[i-1] = dts[i] end
+  end
+  local ret = C.squkf_update_imu(self.filter, gyro, accel, dt, n)
+  if ret < 0 then
+    return false, string.format("Covariance lost rank at sample %d", -ret)
+  end
+  return ret
+end
+
+local function stats(self)
+  local f = self.filter
+  return {
+    n_predict = tonumber(f.n_predict),
+    n_correct = tonumber(f.n_correct),
+    n_rejected = tonumber(f.n_rejected),
+    n_failed = tonumber(f.n_failed),
+  }
+end
+
+-- Parameters as kalman.ukf: orientation_cov and position_cov as standard
+-- deviations (position then velocity) or covariance matrices, orientation0
+-- and position0. Optional gyro_noise, accel_noise, gravity_noise, gravity
+-- and gravity_gate set those of the filter
+function lib.new(parameters)
+  if type(parameters)~='table' then
+    parameters = {}
+  end
+  local orientation_sd = to_sd(parameters.orientation_cov, 3, vrad{2, 2, 2})
+  local position_sd = to_sd(parameters.position_cov, 6, {
+    0.05, 0.05, 0.05,
+    0.01, 0.01, 0.01
+  })
+  local filter = ffi.new'SqUKF'
+  C.squkf_init(filter,
+    ffi.new('double[3]', orientation_sd),
+    ffi.new('double[3]', {unpack(position_sd, 1, 3)}),
+    ffi.new('double[3]', {unpack(position_sd, 4, 6)}))
+  for _, k in ipairs{'gyro_noise', 'accel_noise', 'gravity_noise',
+                     'gravity', 'gravity_gate'} do
+    if tonumber(parameters[k]) then filter[k] = parameters[k] end
+  end
+  if type(parameters.orientation0)=='table' then
+    local q = quaternion.unit(parameters.orientation0)
+    for i=1,4 do filter.q[i-1] = q[i] end
+  end
+  if type(parameters.position0)=='table' then
+    for i=1,3 do
+      filter.p[i-1] = parameters.position0[i] or 0
+      filter.v[i-1] = parameters.position0[i+3] or 0
+    end
+  end
+
+  local P = ffi.new('double[?]', N * N)
+  return setmetatable({
+    just_gyro = just_gyro,
+    motion_gyro = motion_gyro,
+    correct_gravity = correct_gravity,
+    update_imu = update_imu,
+    stats = stats,
+    filter = filter,
+    -- Scratch, so that the methods do not allocate
+    gyro = ffi.new'double[3]',
+    accel = ffi.new'double[3]',
+    P = P,
+    P_view = has_view and matrix_view.wrap(P, N, N),
+    batch_size = 0,
+    -- Weights
+    gamma = filter.gamma,
+    n = N,
+  }, mt)
+end
+
+return lib
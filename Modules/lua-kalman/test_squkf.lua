@@ -0,0 +1,51 @@
+#!/usr/bin/env luajit
+-- Native square-root UKF: converge on a fixed tilt from a level start
+local squkf = require'squkf'
+local quaternion = require'quaternion'
+local vector = require'vector'
+local unpack = unpack or require'table'.unpack
+math.randomseed(1234)
+
+local RAD_TO_DEG = 180 / math.pi
+local roll, pitch = math.rad(20), math.rad(-10)
+local q_true = quaternion.from_rpy(roll, pitch, 0)
+-- Accelerometer reads up in the body frame
+local up_body = quaternion.inv_rotate(q_true, {0, 0, 1})
+
+local filter = assert(squkf.new{orientation_cov = vector.rad{20, 20, 20}})
+local n, dt = 100, 0.01
+for batch=1,10 do
+  local gyros, accels = {}, {}
+  for i=1,n do
+    gyros[i] = (vector.random(3) - 0.5) * 0.004
+    accels[i] = vector.new(up_body) + (vector.random(3) - 0.5) * 0.01
+  end
+  local n_correct = assert(filter:update_imu(gyros, accels, dt))
+  assert(n_correct == n, "Every sample is within the gravity gate")
+end
+
+local rpy = quaternion.to_rpy(filter.orientation)
+print(string.format("RPY: %+.3f, %+.3f, %+.3f",
+  unpack(RAD_TO_DEG * vector.new(rpy))))
+assert(math.abs(rpy[1] - roll) < math.rad(0.5), "Roll")
+assert(math.abs(rpy[2] - pitch) < math.rad(0.5), "Pitch")
+
+-- Yaw is not observed by gravity, so only its uncertainty grows
+local cov = filter.orientation_cov
+print("Covariance")
+print(RAD_TO_DEG * cov)
+assert(cov[1][1] < cov[3][3])
+
+-- Drop-in methods of kalman.ukf
+assert(filter:motion_gyro({0, 0, 0}, dt))
+assert(filter:correct_gravity(up_body))
+print("Stats", filter:stats().n_correct, filter:stats().n_failed)
+assert(filter:stats().n_failed == 0)
+
+-- The covariance as a view, factored in place by lapack
+local has_lapack, lapack = pcall(require, 'lapack')
+if has_lapack and (lapack.has_lapack or lapack.has_batch) then
+  local P = filter.covariance
+  local L = assert(lapack.chol(filter.covariance_view))
+  assert(math.abs(L:get(1, 1) ^ 2 - P[1][1]) < 1e-12)
+end
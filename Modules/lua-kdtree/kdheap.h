@@ -0,0 +1,92 @@
+/*
+Bounded max-heap of (id, squared distance) pairs for k-nearest searches.
+The heap lives in caller-provided arrays, so no allocation is performed.
+*/
+
+#ifndef _KDHEAP_H_
+#define _KDHEAP_H_
+
+#include <stdint.h>
+
+struct kdheap {
+  int64_t *id;
+  double *dist_sq;
+  int size, cap;
+  /* Only keep items within this squared distance */
+  double range_sq;
+};
+
+static inline void kdheap_init(struct kdheap *h, int64_t *id, double *dist_sq,
+                               int cap, double range_sq) {
+  h->id = id;
+  h->dist_sq = dist_sq;
+  h->size = 0;
+  h->cap = cap;
+  h->range_sq = range_sq;
+}
+
+/* Squared distance an item must beat to enter the heap */
+static inline double kdheap_bound(const struct kdheap *h) {
+  return h->size < h->cap ? h->range_sq : h->dist_sq[0];
+}
+
+static inline void kdheap_sift_down(struct kdheap *h, int i, int n) {
+  int64_t id = h->id[i];
+  double d = h->dist_sq[i];
+  int c;
+  while ((c = 2 * i + 1) < n) {
+    if (c + 1 < n && h->dist_sq[c + 1] > h->dist_sq[c]) {
+      c++;
+    }
+    if (h->dist_sq[c] <= d) {
+      break;
+    }
+    h->id[i] = h->id[c];
+    h->dist_sq[i] = h->dist_sq[c];
+    i = c;
+  }
+  h->id[i] = id;
+  h->dist_sq[i] = d;
+}
+
+static inline void kdheap_push(struct kdheap *h, int64_t id, double d) {
+  int i, p;
+  if (h->size < h->cap) {
+    if (d > h->range_sq) {
+      return;
+    }
+    /* Sift up from the end */
+    i = h->size++;
+    while (i > 0 && h->dist_sq[p = (i - 1) / 2] < d) {
+      h->id[i] = h->id[p];
+      h->dist_sq[i] = h->dist_sq[p];
+      i = p;
+    }
+    h->id[i] = id;
+    h->dist_sq[i] = d;
+  } else if (h->cap > 0 && d < h->dist_sq[0]) {
+    /* Replace the furthest */
+    h->id[0] = id;
+    h->dist_sq[0] = d;
+    kdheap_sift_down(h, 0, h->size);
+  }
+}
+
+/* Heapsort in place, leaving the items in order of increasing distance */
+static inline int kdheap_sort(struct kdheap *h) {
+  int n;
+  int64_t id;
+  double d;
+  for (n = h->size - 1; n > 0; n--) {
+    id = h->id[0];
+    d = h->dist_sq[0];
+    h->id[0] = h->id[n];
+    h->dist_sq[0] = h->dist_sq[n];
+    h->id[n] = id;
+    h->dist_sq[n] = d;
+    kdheap_sift_down(h, 0, n);
+  }
+  return h->size;
+}
+
+#endif /* _KDHEAP_H_ */
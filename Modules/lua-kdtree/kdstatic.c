@@ -0,0 +1,239 @@
+/*
+Static, balanced k-d tree with median splits, stored as an implicit array.
+*/
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kdheap.h"
+#include "kdstatic.h"
+
+#define SQ(x) ((x) * (x))
+
+struct kdstatic {
+  int dim;
+  size_t n, depth;
+  /* Reordered positions, n * dim */
+  double *pos;
+  /* Splitting axis of the node at each position */
+  unsigned char *split;
+  int64_t *user;
+};
+
+/* Partition perm so that the element at rank kth is in place along axis */
+static void select_kth(const double *pts, int dim, size_t *perm, size_t n,
+                       size_t kth, int axis) {
+  size_t lo = 0, hi = n - 1;
+  while (lo < hi) {
+    /* Median of three pivot */
+    size_t mid = lo + (hi - lo) / 2;
+    double a = pts[perm[lo] * dim + axis];
+    double b = pts[perm[mid] * dim + axis];
+    double c = pts[perm[hi] * dim + axis];
+    double pivot = (a < b) ? ((b < c) ? b : ((a < c) ? c : a))
+                           : ((a < c) ? a : ((b < c) ? c : b));
+    size_t i = lo, j = hi, tmp;
+    while (i <= j) {
+      while (pts[perm[i] * dim + axis] < pivot) {
+        i++;
+      }
+      while (pts[perm[j] * dim + axis] > pivot) {
+        j--;
+      }
+      if (i <= j) {
+        tmp = perm[i];
+        perm[i] = perm[j];
+        perm[j] = tmp;
+        i++;
+        if (j == 0) {
+          break;
+        }
+        j--;
+      }
+    }
+    if (kth <= j) {
+      hi = j;
+    } else if (kth >= i) {
+      lo = i;
+    } else {
+      break;
+    }
+  }
+}
+
+/* Split along the axis of largest spread, which suits long, thin paths */
+static int widest_axis(const double *pts, int dim, const size_t *perm,
+                       size_t n) {
+  int axis, best = 0;
+  size_t i;
+  double best_spread = -1;
+  for (axis = 0; axis < dim; axis++) {
+    double lo = INFINITY, hi = -INFINITY;
+    for (i = 0; i < n; i++) {
+      double v = pts[perm[i] * dim + axis];
+      lo = v < lo ? v : lo;
+      hi = v > hi ? v : hi;
+    }
+    if (hi - lo > best_spread) {
+      best_spread = hi - lo;
+      best = axis;
+    }
+  }
+  return best;
+}
+
+static size_t build_rec(struct kdstatic *tree, const double *pts, size_t *perm,
+                        size_t lo, size_t hi) {
+  size_t mid, d_left, d_right;
+  int axis;
+  if (hi <= lo) {
+    return 0;
+  }
+  if (hi - lo == 1) {
+    tree->split[lo] = 0;
+    return 1;
+  }
+  axis = widest_axis(pts, tree->dim, perm + lo, hi - lo);
+  mid = lo + (hi - lo) / 2;
+  select_kth(pts, tree->dim, perm + lo, hi - lo, mid - lo, axis);
+  tree->split[mid] = axis;
+  d_left = build_rec(tree, pts, perm, lo, mid);
+  d_right = build_rec(tree, pts, perm, mid + 1, hi);
+  return 1 + (d_left > d_right ? d_left : d_right);
+}
+
+struct kdstatic *kds_build(int k, const double *pts, size_t n,
+                           const int64_t *user) {
+  struct kdstatic *tree;
+  size_t *perm, i;
+
+  if (k <= 0 || !pts) {
+    return 0;
+  }
+  if (!(tree = calloc(1, sizeof *tree))) {
+    return 0;
+  }
+  tree->dim = k;
+  tree->n = n;
+  perm = malloc(n * sizeof *perm);
+  tree->pos = malloc(n * k * sizeof *tree->pos);
+  tree->split = malloc(n * sizeof *tree->split);
+  tree->user = malloc(n * sizeof *tree->user);
+  if (n > 0 && (!perm || !tree->pos || !tree->split || !tree->user)) {
+    free(perm);
+    kds_free(tree);
+    return 0;
+  }
+
+  for (i = 0; i < n; i++) {
+    perm[i] = i;
+  }
+  tree->depth = build_rec(tree, pts, perm, 0, n);
+
+  /* Gather into tree order so that queries walk contiguous memory */
+  for (i = 0; i < n; i++) {
+    memcpy(tree->pos + i * k, pts + perm[i] * k, k * sizeof *tree->pos);
+    tree->user[i] = user ? user[perm[i]] : (int64_t)perm[i] + 1;
+  }
+  free(perm);
+  return tree;
+}
+
+void kds_free(struct kdstatic *tree) {
+  if (tree) {
+    free(tree->pos);
+    free(tree->split);
+    free(tree->user);
+    free(tree);
+  }
+}
+
+int kds_get_dimension(const struct kdstatic *tree) {
+  return tree ? tree->dim : 0;
+}
+
+size_t kds_get_size(const struct kdstatic *tree) { return tree ? tree->n : 0; }
+
+size_t kds_get_depth(const struct kdstatic *tree) {
+  return tree ? tree->depth : 0;
+}
+
+static void search_rec(const struct kdstatic *tree, size_t lo, size_t hi,
+                       const double *pos, struct kdheap *heap) {
+  const int dim = tree->dim;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    const double *node = tree->pos + mid * dim;
+    int i, axis = tree->split[mid];
+    double dist_sq = 0, dx;
+    for (i = 0; i < dim; i++) {
+      dist_sq += SQ(node[i] - pos[i]);
+    }
+    kdheap_push(heap, (int64_t)mid, dist_sq);
+
+    /* Descend the near side, then only the far side if it may hold closer */
+    dx = pos[axis] - node[axis];
+    if (dx <= 0) {
+      search_rec(tree, lo, mid, pos, heap);
+      if (SQ(dx) > kdheap_bound(heap)) {
+        return;
+      }
+      lo = mid + 1;
+    } else {
+      search_rec(tree, mid + 1, hi, pos, heap);
+      if (SQ(dx) > kdheap_bound(heap)) {
+        return;
+      }
+      hi = mid;
+    }
+  }
+}
+
+int kds_nearest_n_pos(const struct kdstatic *tree, const double *pos, int num,
+                      double range, int64_t *out_id, double *out_dist_sq,
+                      double *out_pos) {
+  struct kdheap heap;
+  int i, n_found;
+  size_t node;
+  if (!tree || num <= 0) {
+    return 0;
+  }
+  /* Search by position in the tree, then give the ids of those positions */
+  kdheap_init(&heap, out_id, out_dist_sq, num, SQ(range));
+  search_rec(tree, 0, tree->n, pos, &heap);
+  n_found = kdheap_sort(&heap);
+  for (i = 0; i < n_found; i++) {
+    node = (size_t)out_id[i];
+    if (out_pos) {
+      memcpy(out_pos + i * tree->dim, tree->pos + node * tree->dim,
+             tree->dim * sizeof *out_pos);
+    }
+    out_id[i] = tree->user[node];
+  }
+  return n_found;
+}
+
+int kds_nearest_n(const struct kdstatic *tree, const double *pos, int num,
+                  double range, int64_t *out_id, double *out_dist_sq) {
+  return kds_nearest_n_pos(tree, pos, num, range, out_id, out_dist_sq, NULL);
+}
+
+size_t kds_nearest_n_batch(const struct kdstatic *tree, const double *pos,
+                           size_t nq, int num, double range, int64_t *out_id,
+                           double *out_dist_sq, int32_t *out_count) {
+  size_t iq, total = 0;
+  int n_found;
+  if (!tree || num <= 0) {
+    return 0;
+  }
+  for (iq = 0; iq < nq; iq++) {
+    n_found = kds_nearest_n(tree, pos + iq * tree->dim, num, range,
+                            out_id + iq * num, out_dist_sq + iq * num);
+    if (out_count) {
+      out_count[iq] = n_found;
+    }
+    total += n_found;
+  }
+  return total;
+}
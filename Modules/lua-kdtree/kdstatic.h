@@ -0,0 +1,59 @@
+/*
+Static, balanced k-d tree built in bulk from an array of points.
+The tree is implicit: the points are reordered so that each subtree is a
+contiguous range whose median element is the splitting node.
+*/
+
+#ifndef _KDSTATIC_H_
+#define _KDSTATIC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct kdstatic;
+
+/* Build from n points of dimension k, stored contiguously (n * k doubles).
+ * Each point carries an id from "user", or its 1-based index if NULL,
+ * matching the convention of kd_insert(pt, i) from Lua.
+ */
+struct kdstatic *kds_build(int k, const double *pts, size_t n,
+                           const int64_t *user);
+
+void kds_free(struct kdstatic *tree);
+
+int kds_get_dimension(const struct kdstatic *tree);
+size_t kds_get_size(const struct kdstatic *tree);
+size_t kds_get_depth(const struct kdstatic *tree);
+
+/* Find up to "num" nearest points within "range" (use INFINITY for no limit).
+ * Results are written to the caller's arrays in order of increasing distance.
+ * Returns the number of results.
+ */
+int kds_nearest_n(const struct kdstatic *tree, const double *pos, int num,
+                  double range, int64_t *out_id, double *out_dist_sq);
+
+/* As kds_nearest_n, also writing the position of each result to out_pos,
+ * of num * k doubles, if not NULL.
+ */
+int kds_nearest_n_pos(const struct kdstatic *tree, const double *pos, int num,
+                      double range, int64_t *out_id, double *out_dist_sq,
+                      double *out_pos);
+
+/* Batched form of kds_nearest_n over nq query points (nq * k doubles).
+ * Query i writes to out_id/out_dist_sq at offset i * num, and its result
+ * count to out_count[i] if not NULL.
+ * Returns the total number of results.
+ */
+size_t kds_nearest_n_batch(const struct kdstatic *tree, const double *pos,
+                           size_t nq, int num, double range, int64_t *out_id,
+                           double *out_dist_sq, int32_t *out_count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _KDSTATIC_H_ */
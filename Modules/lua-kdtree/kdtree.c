@@ -32,6 +32,7 @@ OF SUCH DAMAGE.
 #include <config.h>
 #endif
 
+#include "kdheap.h"
 #include "kdtree.h"
 #include <math.h>
 #include <stdio.h>
@@ -470,6 +471,49 @@ static int find_nearest(struct kdnode *node, const double *pos, double range,
   return added_res;
 }
 
+/* Bounded search into a caller-provided heap; no result nodes allocated */
+static void find_nearest_heap(struct kdnode *node, const double *pos, int dim,
+                              struct kdheap *heap) {
+  double dist_sq, dx;
+  int i;
+  struct kdnode *dup;
+
+  while (node) {
+    dist_sq = 0;
+    for (i = 0; i < dim; i++) {
+      dist_sq += SQ(node->pos[i] - pos[i]);
+    }
+    /* Points at the same position hang off of the next list */
+    for (dup = node; dup; dup = dup->next) {
+      kdheap_push(heap, (int64_t)(intptr_t)dup->data, dist_sq);
+    }
+
+    dx = pos[node->dir] - node->pos[node->dir];
+    find_nearest_heap(dx <= 0.0 ? node->left : node->right, pos, dim, heap);
+    if (SQ(dx) > kdheap_bound(heap)) {
+      return;
+    }
+    node = dx <= 0.0 ? node->right : node->left;
+  }
+}
+
+int kd_nearest_n_buf(struct kdtree *kd, const double *pos, int num,
+                     double range, int64_t *out_id, double *out_dist_sq) {
+  struct kdheap heap;
+
+  if (!kd || !pos || num < 0 || (num > 0 && (!out_id || !out_dist_sq))) {
+    return -1;
+  }
+  kdheap_init(&heap, out_id, out_dist_sq, num, SQ(range));
+  find_nearest_heap(kd->root, pos, kd->dim, &heap);
+  return kdheap_sort(&heap);
+}
+
+int kd_nearest_range_buf(struct kdtree *kd, const double *pos, double range,
+                         int cap, int64_t *out_id, double *out_dist_sq) {
+  return kd_nearest_n_buf(kd, pos, cap, range, out_id, out_dist_sq);
+}
+
 #if 0
 static int find_nearest_n(struct kdnode *node, const double *pos, double range, int num, struct rheap *heap, int dim)
 {
@@ -625,7 +669,7 @@ struct kdres *kd_nearest(struct kdtree *kd, const double *pos) {
 
   /* Store the result */
   if (result) {
-    if (rlist_insert(rset->rlist, result, -1.0) == -1) {
+    if (rlist_insert(rset->rlist, result, dist_sq) == -1) {
       kd_res_free(rset);
       return NULL;
     }
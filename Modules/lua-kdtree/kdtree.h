@@ -26,6 +26,7 @@ OF SUCH DAMAGE.
 */
 
 #include <stddef.h>
+#include <stdint.h>
 
 #ifndef _KDTREE_H_
 #define _KDTREE_H_
@@ -106,6 +107,23 @@ struct kdres *kd_nearest_range3(struct kdtree *tree, double x, double y,
 struct kdres *kd_nearest_range3f(struct kdtree *tree, float x, float y, float z,
                                  float range);
 
+/* Find the N nearest nodes within a range, without allocating.
+ *
+ * Results are written into the caller's fixed-capacity arrays in order of
+ * increasing distance: the data pointer of each node (as an integer id, see
+ * kd_insert) and its squared distance. Pass INFINITY for no range limit.
+ * The same buffers may be reused for every query.
+ * Returns the number of results, at most num, or -1 on bad arguments.
+ */
+int kd_nearest_n_buf(struct kdtree *tree, const double *pos, int num,
+                     double range, int64_t *out_id, double *out_dist_sq);
+
+/* Find up to cap nodes within a range, closest first, without allocating.
+ * Returns the number of results, at most cap, or -1 on bad arguments.
+ */
+int kd_nearest_range_buf(struct kdtree *tree, const double *pos, double range,
+                         int cap, int64_t *out_id, double *out_dist_sq);
+
 /* Find nodes within a given range.
  * This function returns a pointer to a result set.
  * The returned pointer can be null as an indication of an error. Otherwise
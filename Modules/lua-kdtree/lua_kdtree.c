@@ -5,8 +5,15 @@ Author: Stephen McGill <stephen.mcgill@tri.global> 2018
 #include <lua.h>
 #include <lualib.h>
 
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kdstatic.h"
 #include "kdtree.h"
 #define MT_NAME "kdtree_mt"
+#define MT_STATIC_NAME "kdstatic_mt"
 
 #define MAX_DIMENSION 4
 
@@ -16,6 +23,32 @@ struct kdtree **lua_checkkdtree(lua_State *L, int narg) {
   return ud;
 }
 
+/* Static tree, plus result scratch so Lua queries do not allocate */
+struct kdstatic_ud {
+  struct kdstatic *tree;
+  int64_t *id;
+  double *dist_sq;
+  double *pos;
+};
+
+struct kdstatic_ud *lua_checkkdstatic(lua_State *L, int narg) {
+  void *ud = luaL_checkudata(L, narg, MT_STATIC_NAME);
+  luaL_argcheck(L, ud != NULL, narg, "Invalid kdstatic userdata");
+  return ud;
+}
+
+// Raw memory from a lightuserdata or an address number (e.g. ffi.cast)
+static void *lua_kdtree_topointer(lua_State *L, int narg) {
+  switch (lua_type(L, narg)) {
+  case LUA_TLIGHTUSERDATA:
+    return lua_touserdata(L, narg);
+  case LUA_TNUMBER:
+    return (void *)lua_tointeger(L, narg);
+  default:
+    return NULL;
+  }
+}
+
 static int lua_kdtree_index(lua_State *L) {
   if (!lua_getmetatable(L, 1)) {
     /* push metatable */
@@ -165,6 +198,15 @@ static int lua_kdtree_nearest(lua_State *L) {
   } else {
     set = kd_nearest(kd, vals0);
   }
+  if (!set) {
+    lua_pushboolean(L, 0);
+    if (kd_get_size(kd) == 0) {
+      lua_pushliteral(L, "Nobody nearby");
+    } else {
+      lua_pushliteral(L, "Bad allocation of results");
+    }
+    return 2;
+  }
 
   int n_res = kd_res_size(set);
   if (n_res == 0) {
@@ -206,6 +248,282 @@ static int lua_kdtree_nearest(lua_State *L) {
   return 1;
 }
 
+/*
+Bulk load a balanced tree
+kdtree.build(k, points): points is a table of tables
+kdtree.build(k, ptr, n [, user]): ptr is n*k doubles, user is n int64_t ids
+*/
+static int lua_kdtree_build(lua_State *L) {
+  int k = luaL_checkinteger(L, 1);
+  if (k > MAX_DIMENSION) {
+    lua_pushboolean(L, 0);
+    lua_pushliteral(L, "Too many dimensions!");
+    return 2;
+  }
+
+  double *pts = NULL;
+  size_t n;
+  const int64_t *user = NULL;
+  struct kdstatic *tree;
+  // Everything allocated is held here first, so __gc frees it on any error
+  struct kdstatic_ud *ud = lua_newuserdata(L, sizeof(struct kdstatic_ud));
+  memset(ud, 0, sizeof(struct kdstatic_ud));
+  luaL_getmetatable(L, MT_STATIC_NAME);
+  lua_setmetatable(L, -2);
+  if (lua_istable(L, 2)) {
+#if LUA_VERSION_NUM == 501
+    n = lua_objlen(L, 2);
+#else
+    n = lua_rawlen(L, 2);
+#endif
+    pts = malloc(n * k * sizeof(double));
+    if (n > 0 && !pts) {
+      lua_pushboolean(L, 0);
+      lua_pushliteral(L, "Bad allocation of points");
+      return 2;
+    }
+    for (size_t i = 0; i < n; i++) {
+      lua_rawgeti(L, 2, i + 1);
+      for (int ik = 0; ik < k; ik++) {
+        if (lua_istable(L, -1)) {
+          lua_rawgeti(L, -1, ik + 1);
+        } else {
+          lua_pushnil(L);
+        }
+        if (!lua_isnumber(L, -1)) {
+          free(pts);
+          return luaL_error(L, "Point %d needs %d numbers", (int)i + 1, k);
+        }
+        pts[i * k + ik] = lua_tonumber(L, -1);
+        lua_pop(L, 1);
+      }
+      lua_pop(L, 1);
+    }
+    tree = kds_build(k, pts, n, NULL);
+    free(pts);
+  } else {
+    pts = lua_kdtree_topointer(L, 2);
+    if (!pts) {
+      lua_pushboolean(L, 0);
+      lua_pushliteral(L, "Need a table or pointer of points");
+      return 2;
+    }
+    n = luaL_checkinteger(L, 3);
+    user = lua_kdtree_topointer(L, 4);
+    tree = kds_build(k, pts, n, user);
+  }
+  if (!tree) {
+    lua_pushboolean(L, 0);
+    lua_pushliteral(L, "Could not build kd-tree!");
+    return 2;
+  }
+  ud->tree = tree;
+
+  ud->id = malloc((n > 0 ? n : 1) * sizeof(int64_t));
+  ud->dist_sq = malloc((n > 0 ? n : 1) * sizeof(double));
+  ud->pos = malloc((n > 0 ? n : 1) * k * sizeof(double));
+  if (!ud->id || !ud->dist_sq || !ud->pos) {
+    return luaL_error(L, "Bad allocation of kd-tree results");
+  }
+  return 1;
+}
+
+static int lua_kdstatic_free(lua_State *L) {
+  struct kdstatic_ud *ud = lua_checkkdstatic(L, 1);
+  if (ud->tree) {
+    kds_free(ud->tree);
+    ud->tree = NULL;
+  }
+  if (ud->id) {
+    free(ud->id);
+    ud->id = NULL;
+  }
+  if (ud->dist_sq) {
+    free(ud->dist_sq);
+    ud->dist_sq = NULL;
+  }
+  if (ud->pos) {
+    free(ud->pos);
+    ud->pos = NULL;
+  }
+  return 0;
+}
+
+// Same table output as the dynamic tree's nearest
+static int lua_kdstatic_push_results(lua_State *L, struct kdstatic_ud *ud,
+                                     int n_res) {
+  if (n_res == 0) {
+    lua_pushboolean(L, 0);
+    lua_pushliteral(L, "Nobody nearby");
+    return 2;
+  }
+  int k = kds_get_dimension(ud->tree);
+  lua_createtable(L, n_res, 0);
+  for (int i = 0; i < n_res; i++) {
+    lua_createtable(L, k, 2);
+    for (int ik = 0; ik < k; ik++) {
+      lua_pushnumber(L, ud->pos[i * k + ik]);
+      lua_rawseti(L, -2, ik + 1);
+    }
+    lua_pushliteral(L, "user");
+    lua_pushinteger(L, ud->id[i]);
+    lua_settable(L, -3);
+    lua_pushliteral(L, "dist_sq");
+    lua_pushnumber(L, ud->dist_sq[i]);
+    lua_settable(L, -3);
+    lua_rawseti(L, -2, i + 1);
+  }
+  return 1;
+}
+
+static int lua_kdstatic_checkpoint(lua_State *L, int narg, int k,
+                                   double *pos) {
+  if (!lua_istable(L, narg)) {
+    return 0;
+  }
+#if LUA_VERSION_NUM == 501
+  int nd = lua_objlen(L, narg);
+#else
+  int nd = lua_rawlen(L, narg);
+#endif
+  if (nd < k) {
+    return luaL_error(L, "Point needs %d coordinates, not %d", k, nd);
+  }
+  for (int i = 0; i < k; i++) {
+    lua_rawgeti(L, narg, i + 1);
+    pos[i] = luaL_checknumber(L, -1);
+    lua_pop(L, 1);
+  }
+  return 1;
+}
+
+// nearest(pt [, range]): closest point, or all within range
+static int lua_kdstatic_nearest(lua_State *L) {
+  struct kdstatic_ud *ud = lua_checkkdstatic(L, 1);
+  double pos[MAX_DIMENSION];
+  if (!lua_kdstatic_checkpoint(L, 2, kds_get_dimension(ud->tree), pos)) {
+    lua_pushboolean(L, 0);
+    lua_pushliteral(L, "Need a table for the point");
+    return 2;
+  }
+  int n_res;
+  if (lua_isnumber(L, 3)) {
+    n_res = kds_nearest_n_pos(ud->tree, pos, kds_get_size(ud->tree),
+                              lua_tonumber(L, 3), ud->id, ud->dist_sq, ud->pos);
+  } else {
+    n_res = kds_nearest_n_pos(ud->tree, pos, 1, INFINITY, ud->id, ud->dist_sq,
+                              ud->pos);
+  }
+  return lua_kdstatic_push_results(L, ud, n_res);
+}
+
+// nearest_n(pt, num [, range])
+static int lua_kdstatic_nearest_n(lua_State *L) {
+  struct kdstatic_ud *ud = lua_checkkdstatic(L, 1);
+  double pos[MAX_DIMENSION];
+  if (!lua_kdstatic_checkpoint(L, 2, kds_get_dimension(ud->tree), pos)) {
+    lua_pushboolean(L, 0);
+    lua_pushliteral(L, "Need a table for the point");
+    return 2;
+  }
+  int num = luaL_checkinteger(L, 3);
+  if (num > (int)kds_get_size(ud->tree)) {
+    num = kds_get_size(ud->tree);
+  }
+  double range = luaL_optnumber(L, 4, INFINITY);
+  int n_res = kds_nearest_n_pos(ud->tree, pos, num, range, ud->id,
+                                ud->dist_sq, ud->pos);
+  return lua_kdstatic_push_results(L, ud, n_res);
+}
+
+/*
+batch(queries, nq, num, range, out_id, out_dist_sq [, out_count])
+queries is nq*k doubles; outputs have nq*num entries (out_count has nq)
+num=1 gives nearest; num as a capacity with a range gives radius queries.
+range may be nil for no limit. Returns the total number of results.
+*/
+static int lua_kdstatic_batch(lua_State *L) {
+  struct kdstatic_ud *ud = lua_checkkdstatic(L, 1);
+  const double *queries = lua_kdtree_topointer(L, 2);
+  size_t nq = luaL_checkinteger(L, 3);
+  int num = luaL_checkinteger(L, 4);
+  double range = luaL_optnumber(L, 5, INFINITY);
+  int64_t *out_id = lua_kdtree_topointer(L, 6);
+  double *out_dist_sq = lua_kdtree_topointer(L, 7);
+  int32_t *out_count = lua_kdtree_topointer(L, 8);
+  if (!queries || !out_id || !out_dist_sq) {
+    lua_pushboolean(L, 0);
+    lua_pushliteral(L, "Need pointers for queries and results");
+    return 2;
+  }
+  size_t total = kds_nearest_n_batch(ud->tree, queries, nq, num, range, out_id,
+                                     out_dist_sq, out_count);
+  lua_pushinteger(L, total);
+  return 1;
+}
+
+static int lua_kdstatic_tostring(lua_State *L) {
+  struct kdstatic_ud *ud = lua_checkkdstatic(L, 1);
+  lua_pushfstring(L,
+                  "KD-Tree (static) | %d dimensional | %d elements | %d depth",
+                  kds_get_dimension(ud->tree), (int)kds_get_size(ud->tree),
+                  (int)kds_get_depth(ud->tree));
+  return 1;
+}
+
+static int lua_kdstatic_size(lua_State *L) {
+  struct kdstatic_ud *ud = lua_checkkdstatic(L, 1);
+  lua_pushinteger(L, kds_get_size(ud->tree));
+  return 1;
+}
+
+static int lua_kdstatic_dim(lua_State *L) {
+  struct kdstatic_ud *ud = lua_checkkdstatic(L, 1);
+  lua_pushinteger(L, kds_get_dimension(ud->tree));
+  return 1;
+}
+
+/*
+nearest_into(pt, num, range, out_id, out_dist_sq)
+Write up to num nearest within range (nil for no limit) into reusable
+buffers of int64_t ids and double squared distances. pt is a table or a
+pointer to k doubles. Returns the number of results.
+*/
+static int lua_kdtree_nearest_into(lua_State *L) {
+  struct kdtree *kd = *lua_checkkdtree(L, 1);
+  int k = kd_get_dimension(kd);
+  double vals0[MAX_DIMENSION];
+  const double *pos = vals0;
+  if (lua_istable(L, 2)) {
+    if (!lua_kdstatic_checkpoint(L, 2, k, vals0)) {
+      lua_pushboolean(L, 0);
+      lua_pushliteral(L, "Not enough dimensions");
+      return 2;
+    }
+  } else if (!(pos = lua_kdtree_topointer(L, 2))) {
+    lua_pushboolean(L, 0);
+    lua_pushliteral(L, "Need a table or pointer for the point");
+    return 2;
+  }
+  int num = luaL_checkinteger(L, 3);
+  double range = luaL_optnumber(L, 4, INFINITY);
+  int64_t *out_id = lua_kdtree_topointer(L, 5);
+  double *out_dist_sq = lua_kdtree_topointer(L, 6);
+  if (!out_id || !out_dist_sq) {
+    lua_pushboolean(L, 0);
+    lua_pushliteral(L, "Need pointers for results");
+    return 2;
+  }
+  int n_res = kd_nearest_n_buf(kd, pos, num, range, out_id, out_dist_sq);
+  if (n_res < 0) {
+    lua_pushboolean(L, 0);
+    lua_pushliteral(L, "Bad query");
+    return 2;
+  }
+  lua_pushinteger(L, n_res);
+  return 1;
+}
+
 static int lua_kdtree_tostring(lua_State *L) {
   struct kdtree *kd = *lua_checkkdtree(L, 1);
   lua_pushfstring(L, "KD-Tree | %d dimensional | %d elements | %d depth",
@@ -226,6 +544,7 @@ static int lua_kdtree_dim(lua_State *L) {
 }
 
 static const struct luaL_Reg kdtree_lib[] = {{"create", lua_kdtree_create},
+                                             {"build", lua_kdtree_build},
                                              {NULL, NULL}};
 
 static const struct luaL_Reg kdtree_methods[] = {
@@ -240,6 +559,21 @@ static const struct luaL_Reg kdtree_methods[] = {
 #endif
     {"clear", lua_kdtree_clear},
     {"nearest", lua_kdtree_nearest},
+    {"nearest_into", lua_kdtree_nearest_into},
+    {NULL, NULL}};
+
+static const struct luaL_Reg kdstatic_methods[] = {
+    {"__index", lua_kdtree_index},
+    {"__gc", lua_kdstatic_free},
+    {"__tostring", lua_kdstatic_tostring},
+    {"dim", lua_kdstatic_dim},
+    {"size", lua_kdstatic_size},
+#if LUA_VERSION_NUM > 501
+    {"__len", lua_kdstatic_size},
+#endif
+    {"nearest", lua_kdstatic_nearest},
+    {"nearest_n", lua_kdstatic_nearest_n},
+    {"batch", lua_kdstatic_batch},
     {NULL, NULL}};
 
 #ifdef __cplusplus
@@ -247,6 +581,14 @@ extern "C"
 #endif
     int
     luaopen_kdtree(lua_State *L) {
+  luaL_newmetatable(L, MT_STATIC_NAME);
+#if LUA_VERSION_NUM == 501
+  luaL_register(L, NULL, kdstatic_methods);
+#else
+  luaL_setfuncs(L, kdstatic_methods, 0);
+#endif
+  lua_pop(L, 1);
+
   luaL_newmetatable(L, MT_NAME);
 #if LUA_VERSION_NUM == 501
   luaL_register(L, NULL, kdtree_methods);
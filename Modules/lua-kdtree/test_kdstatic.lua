@@ -0,0 +1,118 @@
+#!/usr/bin/env luajit
+-- Compare the bulk-loaded static tree with the incremental tree
+local ffi = require'ffi'
+local unix = require'unix'
+local kdtree = require'kdtree'
+require'math'.randomseed(1)
+
+local function ptr(cdata)
+  return tonumber(ffi.cast('intptr_t', ffi.cast('void *', cdata)))
+end
+
+local k = 2
+local n = tonumber(arg[1]) or 100000
+local nq = tonumber(arg[2]) or 10000
+local num = 8
+local radius = 0.01
+
+-- Path-like data: a long, thin sampling, which skews incremental inserts
+local pts = ffi.new('double[?]', n * k)
+local pts_tbl = {}
+for i=0,n-1 do
+  local x, y = i / n * 100, math.sin(i / n * 20) + 1e-3 * math.random()
+  pts[i * k], pts[i * k + 1] = x, y
+  pts_tbl[i + 1] = {x, y}
+end
+local queries = ffi.new('double[?]', nq * k)
+local queries_tbl = {}
+for i=0,nq-1 do
+  local x, y = math.random() * 100, 2 * math.random() - 1
+  queries[i * k], queries[i * k + 1] = x, y
+  queries_tbl[i + 1] = {x, y}
+end
+
+-- Build
+local t0 = unix.time()
+local kd = assert(kdtree.create(k))
+for i, pt in ipairs(pts_tbl) do kd:insert(pt, i) end
+local t1 = unix.time()
+local kds = assert(kdtree.build(k, ptr(pts), n))
+local t2 = unix.time()
+print(kd)
+print(kds)
+print(string.format("Build | incremental %.2f ms | static %.2f ms",
+                    1e3 * (t1 - t0), 1e3 * (t2 - t1)))
+
+-- Table input gives the same tree
+local kds_tbl = assert(kdtree.build(k, pts_tbl))
+assert(kds_tbl:size() == kds:size())
+
+-- Single nearest queries, checked against each other
+t0 = unix.time()
+local res_kd = {}
+for i, q in ipairs(queries_tbl) do res_kd[i] = kd:nearest(q)[1] end
+t1 = unix.time()
+local res_kds = {}
+for i, q in ipairs(queries_tbl) do res_kds[i] = kds:nearest(q)[1] end
+t2 = unix.time()
+for i=1,nq do
+  assert(math.abs(res_kd[i].dist_sq - res_kds[i].dist_sq) < 1e-12,
+         "Mismatched nearest")
+end
+print(string.format("Nearest | incremental %.2f us | static %.2f us",
+                    1e6 * (t1 - t0) / nq, 1e6 * (t2 - t1) / nq))
+
+-- Batched queries into reusable buffers
+local out_id = ffi.new('int64_t[?]', nq * num)
+local out_dist_sq = ffi.new('double[?]', nq * num)
+local out_count = ffi.new('int32_t[?]', nq)
+t0 = unix.time()
+local total = kds:batch(ptr(queries), nq, 1, nil,
+  ptr(out_id), ptr(out_dist_sq))
+t1 = unix.time()
+assert(total == nq)
+for i=1,nq do
+  assert(tonumber(out_id[i - 1]) == res_kds[i].user, "Mismatched batch")
+end
+print(string.format("Nearest (batch) | static %.2f us", 1e6 * (t1 - t0) / nq))
+
+t0 = unix.time()
+total = kds:batch(ptr(queries), nq, num, nil,
+  ptr(out_id), ptr(out_dist_sq),
+  ptr(out_count))
+t1 = unix.time()
+print(string.format("Nearest %d (batch) | static %.2f us | %d results",
+                    num, 1e6 * (t1 - t0) / nq, total))
+
+-- Radius queries
+t0 = unix.time()
+local n_kd = 0
+for _, q in ipairs(queries_tbl) do
+  local near = kd:nearest(q, radius)
+  n_kd = n_kd + (near and #near or 0)
+end
+t1 = unix.time()
+local n_kds = 0
+for _, q in ipairs(queries_tbl) do
+  local near = kds:nearest(q, radius)
+  n_kds = n_kds + (near and #near or 0)
+end
+t2 = unix.time()
+assert(n_kd == n_kds, "Mismatched radius results")
+print(string.format("Radius | incremental %.2f us | static %.2f us",
+                    1e6 * (t1 - t0) / nq, 1e6 * (t2 - t1) / nq))
+
+-- Results carry their coordinates, as the incremental tree's do
+local near = assert(kds:nearest(queries_tbl[1]))[1]
+local pt = pts_tbl[near.user]
+assert(near[1] == pt[1] and near[2] == pt[2], "Mismatched coordinates")
+near = assert(kds:nearest_n(queries_tbl[1], num))
+for _, v in ipairs(near) do
+  assert(v[1] == pts_tbl[v.user][1] and v[2] == pts_tbl[v.user][2],
+         "Mismatched coordinates")
+end
+
+-- Points with too few coordinates are errors, not zeros
+assert(not pcall(kds.nearest, kds, {1}), "Short query")
+assert(not pcall(kdtree.build, k, {{1, 2}, {3}}), "Short point")
+print("OK")
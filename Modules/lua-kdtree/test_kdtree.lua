@@ -53,6 +53,27 @@ for i, v in ipairs(set) do
   print(i, unpack(v))
 end
 
+-- Allocation-free queries into reusable buffers
+local has_ffi, ffi = pcall(require, 'ffi')
+if has_ffi then
+  local num = 25
+  local ids = ffi.new('int64_t[?]', num)
+  local dists = ffi.new('double[?]', num)
+  local ptr_ids = tonumber(ffi.cast('intptr_t', ffi.cast('void *', ids)))
+  local ptr_dists = tonumber(ffi.cast('intptr_t', ffi.cast('void *', dists)))
+  local n_found = kd:nearest_into(pt0, num, threshold, ptr_ids, ptr_dists)
+  print("Nearest into buffers", n_found)
+  assert(n_found == math.min(num, #set), "Bad number of results")
+  for i=0,n_found-1 do
+    -- points are sorted by distance
+    assert(math.abs(math.sqrt(dists[i]) - points[i + 1].d) < 1e-9,
+           "Bad distance")
+    if i > 0 then assert(dists[i] >= dists[i - 1], "Not sorted") end
+  end
+  n_found = kd:nearest_into(pt0, 1, nil, ptr_ids, ptr_dists)
+  assert(n_found == 1 and tonumber(ids[0]) == res.user, "Bad nearest")
+end
+
 print("Clearing tree...")
 assert(kd:clear())
 print("KD tree size:", kd:size())
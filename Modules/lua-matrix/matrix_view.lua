@@ -0,0 +1,145 @@
+-- Strided views of column major matrices, as LAPACK takes them
+-- lapack, kalman and matrix code pass these around, rather than copying
+-- between tables of tables and Fortran ordered cdata at every call
+local lib = {}
+
+local ffi = require'ffi'
+local has_matrix, matrix = pcall(require, 'matrix')
+
+ffi.cdef[[
+typedef struct {
+  double *data;
+  /* Element (i, j), from 0, is data[i + j * ld] */
+  int32_t rows, cols, ld;
+  /* Matrices in a batch, each stride doubles after the last */
+  int32_t count, stride;
+} MatrixView;
+]]
+
+-- Keep the memory under each view alive for as long as the view
+local owners = setmetatable({}, {__mode = 'k'})
+
+local function wrap(data, rows, cols, options)
+  if type(options) ~= 'table' then options = {} end
+  local ld = options.ld or rows
+  local count = options.count or 1
+  local view = ffi.new('MatrixView', {
+    ffi.cast('double*', data), rows, cols,
+    ld, count, options.stride or ld * cols
+  })
+  owners[view] = options.owner or data
+  return view
+end
+lib.wrap = wrap
+
+-- Zeros, contiguous
+local function new(rows, cols, count)
+  cols = cols or rows
+  count = count or 1
+  local data = ffi.new('double[?]', rows * cols * count)
+  return wrap(data, rows, cols, {count = count})
+end
+lib.new = new
+
+local function is_view(v)
+  return ffi.istype('MatrixView', v)
+end
+lib.is_view = is_view
+
+-- Copy in a table of tables, or a list of them as a batch
+local function from_matrix(m)
+  local batch = type(m[1][1]) == 'table' and m or {m}
+  local rows, cols = #batch[1], #batch[1][1]
+  local view = new(rows, cols, #batch)
+  local data, stride = view.data, view.stride
+  for k, mk in ipairs(batch) do
+    local off = (k - 1) * stride
+    for i, row in ipairs(mk) do
+      for j, v in ipairs(row) do
+        data[off + (i - 1) + (j - 1) * rows] = v
+      end
+    end
+  end
+  return view
+end
+lib.from_matrix = from_matrix
+
+local methods = {}
+
+-- Indices from 1, as lua-matrix, and k picks the matrix in a batch
+function methods.get(self, i, j, k)
+  return self.data[((k or 1) - 1) * self.stride + (i - 1) + (j - 1) * self.ld]
+end
+
+function methods.set(self, i, j, v, k)
+  self.data[((k or 1) - 1) * self.stride + (i - 1) + (j - 1) * self.ld] = v
+end
+
+function methods.size(self)
+  return self.rows, self.cols, self.count
+end
+
+-- Rows i1 to i2 and columns j1 to j2 of each matrix, sharing the memory
+function methods.sub(self, i1, j1, i2, j2)
+  local off = (i1 - 1) + (j1 - 1) * self.ld
+  return wrap(self.data + off, i2 - i1 + 1, j2 - j1 + 1, {
+    ld = self.ld, count = self.count, stride = self.stride, owner = self
+  })
+end
+
+-- Matrix k of a batch, sharing the memory
+function methods.batch(self, k)
+  return wrap(self.data + (k - 1) * self.stride, self.rows, self.cols, {
+    ld = self.ld, owner = self
+  })
+end
+
+-- Contiguous copy, with one memcpy per column, or one for the whole batch
+-- when the view is contiguous already
+function methods.copy(self)
+  local rows, cols, count = self.rows, self.cols, self.count
+  local view = new(rows, cols, count)
+  local n_col = rows * ffi.sizeof'double'
+  if self.ld == rows and (count == 1 or self.stride == rows * cols) then
+    ffi.copy(view.data, self.data, n_col * cols * count)
+    return view
+  end
+  for k=0, count - 1 do
+    local src, dst = self.data + k * self.stride, view.data + k * view.stride
+    for j=0, cols - 1 do
+      ffi.copy(dst + j * rows, src + j * self.ld, n_col)
+    end
+  end
+  return view
+end
+
+-- Copy out matrix k as a table of tables, a lua-matrix when available
+function methods.to_matrix(self, k)
+  local m = {}
+  for i=1, self.rows do
+    local row = {}
+    for j=1, self.cols do row[j] = self:get(i, j, k) end
+    m[i] = row
+  end
+  return has_matrix and matrix:new(m) or m
+end
+
+local function tostring_view(self)
+  local lines = {string.format("MatrixView | %d x %d, %d in batch",
+    self.rows, self.cols, self.count)}
+  for i=1, math.min(self.rows, 10) do
+    local row = {}
+    for j=1, math.min(self.cols, 10) do
+      row[j] = string.format("%.4g", self:get(i, j))
+    end
+    table.insert(lines, table.concat(row, ", "))
+  end
+  return table.concat(lines, "\n")
+end
+
+ffi.metatype('MatrixView', {
+  __index = methods,
+  __tostring = tostring_view,
+})
+
+return lib
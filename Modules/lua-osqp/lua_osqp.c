@@ -711,8 +711,13 @@ static int lua_osqp_setproblem(lua_State *L) {
 static int lua_osqp_solve(lua_State *L) {
   struct osqp_ud *ud = lua_checkosqp(L, 1);
 
-  // Run the solver
+  // Run the solver, on a new workspace for the new problem
+  // NOTE: For the same sparsity, libosqp_ffi updates rather than sets up
   c_int res;
+  if (ud->work) {
+    osqp_cleanup(ud->work);
+    ud->work = NULL;
+  }
   res = osqp_setup(&ud->work, ud->data, ud->settings);
   if (res != 0) {
     lua_pushboolean(L, 0);
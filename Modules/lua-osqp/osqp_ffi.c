@@ -0,0 +1,187 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "osqp_ffi.h"
+
+struct osqp_ffi {
+  OSQPWorkspace *work;
+  OSQPSettings settings;
+};
+
+int osqp_ffi_sizeof_int(void) { return sizeof(c_int); }
+
+int osqp_ffi_sizeof_float(void) { return sizeof(c_float); }
+
+void osqp_ffi_default_settings(OSQPFFISettings *settings) {
+  OSQPSettings defaults;
+  osqp_set_default_settings(&defaults);
+  settings->max_iter = defaults.max_iter;
+  settings->eps_abs = defaults.eps_abs;
+  settings->eps_rel = defaults.eps_rel;
+  settings->rho = defaults.rho;
+  settings->sigma = defaults.sigma;
+  settings->alpha = defaults.alpha;
+  settings->adaptive_rho = defaults.adaptive_rho;
+  settings->polish = defaults.polish;
+  settings->warm_start = defaults.warm_start;
+  settings->verbose = 0;
+}
+
+struct osqp_ffi *osqp_ffi_setup(c_int n, c_int m, const c_float *P_x,
+                                const c_int *P_i, const c_int *P_p,
+                                const c_float *q, const c_float *A_x,
+                                const c_int *A_i, const c_int *A_p,
+                                const c_float *l, const c_float *u,
+                                const OSQPFFISettings *settings) {
+  struct osqp_ffi *solver;
+  OSQPData data;
+  csc P, A;
+  if (n < 1 || m < 0 || !P_p || !A_p || !q || !l || !u) {
+    return NULL;
+  }
+  solver = calloc(1, sizeof(struct osqp_ffi));
+  if (!solver) {
+    return NULL;
+  }
+  osqp_set_default_settings(&solver->settings);
+  solver->settings.verbose = 0;
+  if (settings) {
+    solver->settings.max_iter = settings->max_iter;
+    solver->settings.eps_abs = settings->eps_abs;
+    solver->settings.eps_rel = settings->eps_rel;
+    solver->settings.rho = settings->rho;
+    solver->settings.sigma = settings->sigma;
+    solver->settings.alpha = settings->alpha;
+    solver->settings.adaptive_rho = settings->adaptive_rho;
+    solver->settings.polish = settings->polish;
+    solver->settings.warm_start = settings->warm_start;
+    solver->settings.verbose = settings->verbose;
+  }
+
+  /* OSQP copies the data, so the arrays are only borrowed */
+  memset(&P, 0, sizeof(P));
+  P.m = n;
+  P.n = n;
+  P.nzmax = P_p[n];
+  P.nz = -1;
+  P.p = (c_int *)P_p;
+  P.i = (c_int *)P_i;
+  P.x = (c_float *)P_x;
+  memset(&A, 0, sizeof(A));
+  A.m = m;
+  A.n = n;
+  A.nzmax = A_p[n];
+  A.nz = -1;
+  A.p = (c_int *)A_p;
+  A.i = (c_int *)A_i;
+  A.x = (c_float *)A_x;
+  data.n = n;
+  data.m = m;
+  data.P = &P;
+  data.A = &A;
+  data.q = (c_float *)q;
+  data.l = (c_float *)l;
+  data.u = (c_float *)u;
+  if (osqp_setup(&solver->work, &data, &solver->settings) != 0) {
+    if (solver->work) {
+      osqp_cleanup(solver->work);
+    }
+    free(solver);
+    return NULL;
+  }
+  return solver;
+}
+
+void osqp_ffi_cleanup(struct osqp_ffi *solver) {
+  if (!solver) {
+    return;
+  }
+  osqp_cleanup(solver->work);
+  free(solver);
+}
+
+c_int osqp_ffi_update_P(struct osqp_ffi *solver, const c_float *P_x,
+                        const c_int *P_idx, c_int P_n) {
+  return osqp_update_P(solver->work, P_x, P_idx, P_n);
+}
+
+c_int osqp_ffi_update_A(struct osqp_ffi *solver, const c_float *A_x,
+                        const c_int *A_idx, c_int A_n) {
+  return osqp_update_A(solver->work, A_x, A_idx, A_n);
+}
+
+c_int osqp_ffi_update_P_A(struct osqp_ffi *solver, const c_float *P_x,
+                          const c_int *P_idx, c_int P_n, const c_float *A_x,
+                          const c_int *A_idx, c_int A_n) {
+  /* One factorization, rather than one for each */
+  return osqp_update_P_A(solver->work, P_x, P_idx, P_n, A_x, A_idx, A_n);
+}
+
+c_int osqp_ffi_update_lin_cost(struct osqp_ffi *solver, const c_float *q) {
+  return osqp_update_lin_cost(solver->work, q);
+}
+
+c_int osqp_ffi_update_bounds(struct osqp_ffi *solver, const c_float *l,
+                             const c_float *u) {
+  if (l && u) {
+    return osqp_update_bounds(solver->work, l, u);
+  } else if (l) {
+    return osqp_update_lower_bound(solver->work, l);
+  } else if (u) {
+    return osqp_update_upper_bound(solver->work, u);
+  }
+  return 0;
+}
+
+c_int osqp_ffi_warm_start(struct osqp_ffi *solver, const c_float *x,
+                          const c_float *y) {
+  if (x && y) {
+    return osqp_warm_start(solver->work, x, y);
+  } else if (x) {
+    return osqp_warm_start_x(solver->work, x);
+  } else if (y) {
+    return osqp_warm_start_y(solver->work, y);
+  }
+  return 0;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+c_int osqp_ffi_solve(struct osqp_ffi *solver, OSQPFFIInfo *info) {
+  OSQPInfo *osqp_info = solver->work->info;
+  double t0 = now();
+  osqp_solve(solver->work);
+  if (info) {
+    info->solve_time = now() - t0;
+    info->iter = osqp_info->iter;
+    info->status = osqp_info->status_val;
+    info->status_polish = osqp_info->status_polish;
+    info->obj_val = osqp_info->obj_val;
+    info->pri_res = osqp_info->pri_res;
+    info->dua_res = osqp_info->dua_res;
+    info->rho_updates = osqp_info->rho_updates;
+#ifdef PROFILING
+    info->setup_time = osqp_info->setup_time;
+    info->update_time = osqp_info->update_time;
+    info->polish_time = osqp_info->polish_time;
+#else
+    info->setup_time = 0;
+    info->update_time = 0;
+    info->polish_time = 0;
+#endif
+  }
+  return osqp_info->status_val;
+}
+
+const c_float *osqp_ffi_x(const struct osqp_ffi *solver) {
+  return solver->work->solution->x;
+}
+
+const c_float *osqp_ffi_y(const struct osqp_ffi *solver) {
+  return solver->work->solution->y;
+}
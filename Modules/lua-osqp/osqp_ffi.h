@@ -0,0 +1,80 @@
+#pragma once
+/*
+OSQP for the LuaJIT FFI
+Problems are given as CSC arrays, which OSQP copies at setup. After that,
+only values change: the same arrays, filled with new values, go straight
+to the osqp_update functions, with no tables in between.
+*/
+
+#include <osqp/osqp.h>
+
+typedef struct {
+  c_int max_iter;
+  c_float eps_abs, eps_rel;
+  c_float rho, sigma, alpha;
+  c_int adaptive_rho;
+  c_int polish;
+  c_int warm_start;
+  c_int verbose;
+} OSQPFFISettings;
+
+typedef struct {
+  c_int iter;
+  /* OSQP_SOLVED, and the like */
+  c_int status;
+  /* 1 when polished, -1 when polishing failed, 0 when not tried */
+  c_int status_polish;
+  c_float obj_val;
+  c_float pri_res, dua_res;
+  c_int rho_updates;
+  /* Seconds. The solve time is measured here, and the rest are from OSQP
+   * when built with profiling, else zero
+   */
+  c_float setup_time, update_time, polish_time;
+  c_float solve_time;
+} OSQPFFIInfo;
+
+struct osqp_ffi;
+
+/* Sizes of c_int and c_float, to check the FFI declarations against */
+int osqp_ffi_sizeof_int(void);
+int osqp_ffi_sizeof_float(void);
+
+void osqp_ffi_default_settings(OSQPFFISettings *settings);
+
+/* min 0.5 x' P x + q' x such that l <= A x <= u, where P is n by n and
+ * upper triangular, and A is m by n. Returns NULL when OSQP fails to set up
+ */
+struct osqp_ffi *osqp_ffi_setup(c_int n, c_int m, const c_float *P_x,
+                                const c_int *P_i, const c_int *P_p,
+                                const c_float *q, const c_float *A_x,
+                                const c_int *A_i, const c_int *A_p,
+                                const c_float *l, const c_float *u,
+                                const OSQPFFISettings *settings);
+void osqp_ffi_cleanup(struct osqp_ffi *solver);
+
+/* Values of the non-zeros at idx, or all of them in order when idx is
+ * NULL. The sparsity stays as set up. Return 0, or OSQP's error
+ */
+c_int osqp_ffi_update_P(struct osqp_ffi *solver, const c_float *P_x,
+                        const c_int *P_idx, c_int P_n);
+c_int osqp_ffi_update_A(struct osqp_ffi *solver, const c_float *A_x,
+                        const c_int *A_idx, c_int A_n);
+c_int osqp_ffi_update_P_A(struct osqp_ffi *solver, const c_float *P_x,
+                          const c_int *P_idx, c_int P_n, const c_float *A_x,
+                          const c_int *A_idx, c_int A_n);
+c_int osqp_ffi_update_lin_cost(struct osqp_ffi *solver, const c_float *q);
+/* Either bound may be NULL, to keep it */
+c_int osqp_ffi_update_bounds(struct osqp_ffi *solver, const c_float *l,
+                             const c_float *u);
+
+/* Start from x, y or both, either of which may be NULL */
+c_int osqp_ffi_warm_start(struct osqp_ffi *solver, const c_float *x,
+                          const c_float *y);
+
+/* Solve, and describe it in info, which may be NULL. Returns the status */
+c_int osqp_ffi_solve(struct osqp_ffi *solver, OSQPFFIInfo *info);
+
+/* Primal and dual solutions of the last solve, owned by OSQP */
+const c_float *osqp_ffi_x(const struct osqp_ffi *solver);
+const c_float *osqp_ffi_y(const struct osqp_ffi *solver);
@@ -0,0 +1,231 @@
+-- OSQP through the FFI, for problems solved again and again with new
+-- values. Matrices are CSC arrays of cdata, passed to OSQP without copies
+local lib = {}
+
+local ffi = require'ffi'
+
+ffi.cdef[[
+typedef long long c_int;
+typedef double c_float;
+typedef struct {
+  c_int max_iter;
+  c_float eps_abs, eps_rel;
+  c_float rho, sigma, alpha;
+  c_int adaptive_rho;
+  c_int polish;
+  c_int warm_start;
+  c_int verbose;
+} OSQPFFISettings;
+typedef struct {
+  c_int iter;
+  c_int status;
+  c_int status_polish;
+  c_float obj_val;
+  c_float pri_res, dua_res;
+  c_int rho_updates;
+  c_float setup_time, update_time, polish_time;
+  c_float solve_time;
+} OSQPFFIInfo;
+struct osqp_ffi;
+int osqp_ffi_sizeof_int(void);
+int osqp_ffi_sizeof_float(void);
+void osqp_ffi_default_settings(OSQPFFISettings *settings);
+struct osqp_ffi *osqp_ffi_setup(c_int n, c_int m, const c_float *P_x,
+                                const c_int *P_i, const c_int *P_p,
+                                const c_float *q, const c_float *A_x,
+                                const c_int *A_i, const c_int *A_p,
+                                const c_float *l, const c_float *u,
+                                const OSQPFFISettings *settings);
+void osqp_ffi_cleanup(struct osqp_ffi *solver);
+c_int osqp_ffi_update_P(struct osqp_ffi *solver, const c_float *P_x,
+                        const c_int *P_idx, c_int P_n);
+c_int osqp_ffi_update_A(struct osqp_ffi *solver, const c_float *A_x,
+                        const c_int *A_idx, c_int A_n);
+c_int osqp_ffi_update_P_A(struct osqp_ffi *solver, const c_float *P_x,
+                          const c_int *P_idx, c_int P_n, const c_float *A_x,
+                          const c_int *A_idx, c_int A_n);
+c_int osqp_ffi_update_lin_cost(struct osqp_ffi *solver, const c_float *q);
+c_int osqp_ffi_update_bounds(struct osqp_ffi *solver, const c_float *l,
+                             const c_float *u);
+c_int osqp_ffi_warm_start(struct osqp_ffi *solver, const c_float *x,
+                          const c_float *y);
+c_int osqp_ffi_solve(struct osqp_ffi *solver, OSQPFFIInfo *info);
+const c_float *osqp_ffi_x(const struct osqp_ffi *solver);
+const c_float *osqp_ffi_y(const struct osqp_ffi *solver);
+]]
+local has_osqp, osqp = pcall(ffi.load, 'osqp_ffi')
+if has_osqp and (osqp.osqp_ffi_sizeof_int() ~= ffi.sizeof'c_int'
+    or osqp.osqp_ffi_sizeof_float() ~= ffi.sizeof'c_float') then
+  has_osqp, osqp = false, "OSQP was built with other types"
+end
+
+-- Bounds at or beyond this are infinite to OSQP
+lib.INFINITY = 1e30
+
+lib.status = {
+  [1] = "solved",
+  [2] = "solved inaccurate",
+  [3] = "primal infeasible inaccurate",
+  [4] = "dual infeasible inaccurate",
+  [-2] = "maximum iterations reached",
+  [-3] = "primal infeasible",
+  [-4] = "dual infeasible",
+  [-5] = "interrupted",
+  [-6] = "run time limit reached",
+  [-7] = "problem non convex",
+  [-10] = "unsolved",
+}
+
+-- Array of c_float from a table, or the cdata itself
+local function to_floats(v, n)
+  if type(v) == 'cdata' then return v end
+  if type(v) ~= 'table' then return false end
+  local arr = ffi.new('c_float[?]', n)
+  for i=1, n do arr[i - 1] = v[i] end
+  return arr
+end
+lib.floats = to_floats
+
+-- CSC arrays of an m by n matrix, from a row major table. With upper, only
+-- the upper triangle, as OSQP takes P
+local function to_csc(dense, m, n, upper)
+  local nnz = 0
+  for c=0, n - 1 do
+    for r=0, upper and c or m - 1 do
+      if dense[r * n + c + 1] ~= 0 then nnz = nnz + 1 end
+    end
+  end
+  local x = ffi.new('c_float[?]', nnz)
+  local i = ffi.new('c_int[?]', nnz)
+  local p = ffi.new('c_int[?]', n + 1)
+  local k = 0
+  for c=0, n - 1 do
+    p[c] = k
+    for r=0, upper and c or m - 1 do
+      local v = dense[r * n + c + 1]
+      if v ~= 0 then
+        x[k], i[k] = v, r
+        k = k + 1
+      end
+    end
+  end
+  p[n] = k
+  return {x = x, i = i, p = p, nnz = nnz, m = m, n = n}
+end
+lib.csc = to_csc
+
+-- Values of the non-zeros listed in idx, else all of them in order
+local function update_P(self, x, idx, n_idx)
+  local ret = osqp.osqp_ffi_update_P(self.c, x, idx, idx and n_idx or self.P_nnz)
+  if ret ~= 0 then return false, "Cannot update P" end
+  return self
+end
+
+local function update_A(self, x, idx, n_idx)
+  local ret = osqp.osqp_ffi_update_A(self.c, x, idx, idx and n_idx or self.A_nnz)
+  if ret ~= 0 then return false, "Cannot update A" end
+  return self
+end
+
+-- Both at once, with all of their values
+local function update_P_A(self, P_x, A_x)
+  local ret = osqp.osqp_ffi_update_P_A(self.c,
+    P_x, nil, self.P_nnz, A_x, nil, self.A_nnz)
+  if ret ~= 0 then return false, "Cannot update P and A" end
+  return self
+end
+
+local function update_q(self, q)
+  local ret = osqp.osqp_ffi_update_lin_cost(self.c, to_floats(q, self.n))
+  if ret ~= 0 then return false, "Cannot update q" end
+  return self
+end
+
+-- Either bound may be nil, to keep it
+local function update_bounds(self, l, u)
+  local ret = osqp.osqp_ffi_update_bounds(self.c,
+    to_floats(l, self.m) or nil, to_floats(u, self.m) or nil)
+  if ret ~= 0 then return false, "Inconsistent bounds" end
+  return self
+end
+
+-- Start from the primal x, the dual y, or both
+local function warm_start(self, x, y)
+  local ret = osqp.osqp_ffi_warm_start(self.c,
+    to_floats(x, self.n) or nil, to_floats(y, self.m) or nil)
+  if ret ~= 0 then return false, "Cannot warm start" end
+  return self
+end
+
+-- Returns the primal solution, owned by OSQP until the next solve, and the
+-- statistics of the solve, refilled on each solve
+local function solve(self)
+  local status = tonumber(osqp.osqp_ffi_solve(self.c, self.info))
+  if status ~= 1 and status ~= 2 then
+    return false, lib.status[status] or "unknown status", self.info
+  end
+  return osqp.osqp_ffi_x(self.c), self.info
+end
+
+-- Copies of the last solution, as tables
+local function get_solution(self)
+  local x, y = osqp.osqp_ffi_x(self.c), osqp.osqp_ffi_y(self.c)
+  local tx, ty = {}, {}
+  for i=0, self.n - 1 do tx[i + 1] = x[i] end
+  for i=0, self.m - 1 do ty[i + 1] = y[i] end
+  return tx, ty
+end
+
+local function tostring_solver(self)
+  return string.format("OSQP FFI | %d variables, %d constraints",
+    self.n, self.m)
+end
+
+local mt = {
+  __tostring = tostring_solver
+}
+
+-- min 0.5 x' P x + q' x such that l <= A x <= u
+-- P and A are CSC arrays, {x=, i=, p=}, as from lib.csc, with P upper
+-- triangular. q, l and u are tables or cdata. settings override the fields
+-- of OSQPFFISettings
+function lib.setup(problem)
+  if not has_osqp then return false, osqp end
+  if type(problem) ~= 'table' then return false, "No problem" end
+  local n, m = tonumber(problem.n), tonumber(problem.m)
+  local P, A = problem.P, problem.A
+  if not (n and m and type(P) == 'table' and type(A) == 'table') then
+    return false, "Need n, m, P and A"
+  end
+  local q = problem.q and to_floats(problem.q, n) or ffi.new('c_float[?]', n)
+  local l, u = to_floats(problem.l, m), to_floats(problem.u, m)
+  if not (l and u) then return false, "Need l and u" end
+  local settings = ffi.new'OSQPFFISettings'
+  osqp.osqp_ffi_default_settings(settings)
+  if type(problem.settings) == 'table' then
+    for k, v in pairs(problem.settings) do
+      settings[k] = type(v) == 'boolean' and (v and 1 or 0) or v
+    end
+  end
+  local c = osqp.osqp_ffi_setup(n, m, P.x, P.i, P.p, q, A.x, A.i, A.p, l, u,
+    settings)
+  if c == nil then return false, "Cannot setup" end
+  return setmetatable({
+    c = ffi.gc(c, osqp.osqp_ffi_cleanup),
+    n = n,
+    m = m,
+    P_nnz = tonumber(P.p[n]),
+    A_nnz = tonumber(A.p[n]),
+    info = ffi.new'OSQPFFIInfo',
+    update_P = update_P,
+    update_A = update_A,
+    update_P_A = update_P_A,
+    update_q = update_q,
+    update_bounds = update_bounds,
+    warm_start = warm_start,
+    solve = solve,
+    solution = get_solution,
+  }, mt)
+end
+
+return lib
@@ -0,0 +1,127 @@
+#!/usr/bin/env luajit
+local osqp_ffi = require'osqp_ffi'
+local ffi = require'ffi'
+
+-- The demo of test_osqp.lua
+local P = osqp_ffi.csc({
+  4, 1,
+  1, 2,
+}, 2, 2, true)
+local A = osqp_ffi.csc({
+  1, 1,
+  1, 0,
+  0, 1,
+}, 3, 2)
+local demo = assert(osqp_ffi.setup{
+  n = 2, m = 3,
+  P = P, A = A,
+  q = {1, 1},
+  l = {1, 0, 0},
+  u = {1, 0.7, 0.7},
+  settings = {eps_abs = 1e-6, eps_rel = 1e-6, polish = true},
+})
+print(demo)
+local x, info = assert(demo:solve())
+print(string.format("x = [%.4f, %.4f] | %d iterations, polish %d, %.1f us",
+  x[0], x[1], tonumber(info.iter), tonumber(info.status_polish),
+  info.solve_time * 1e6))
+assert(math.abs(x[0] - 0.3) < 1e-3 and math.abs(x[1] - 0.7) < 1e-3)
+
+-- Same sparsity, new values: P is now 2 I, so x = [0.5, 0.5]
+P.x[0], P.x[1], P.x[2] = 2, 0, 2
+assert(demo:update_P(P.x))
+assert(demo:update_q{0, 0})
+x = assert(demo:solve())
+assert(math.abs(x[0] - 0.5) < 1e-3 and math.abs(x[1] - 0.5) < 1e-3)
+-- Only the upper bound on the first variable
+assert(demo:update_bounds(nil, {1, 0.2, 0.9}))
+x = assert(demo:solve())
+assert(math.abs(x[0] - 0.2) < 1e-3 and math.abs(x[1] - 0.8) < 1e-3)
+local tx, ty = demo:solution()
+assert(#tx == 2 and #ty == 3)
+
+-- Benchmark: a sparse QP of 500 variables, re-solved with new costs and
+-- bounds, and every so often a new P, as a controller would
+local n_solves = tonumber(arg[1]) or 10000
+local n, n_rows = 500, 100
+math.randomseed(123)
+local dense_P = {}
+for i=1, n * n do dense_P[i] = 0 end
+for r=0, n - 1 do
+  dense_P[r * n + r + 1] = 4 + math.random()
+  -- Couple each variable to a few after it, keeping P diagonally dominant
+  for k=1, 3 do
+    local c = r + math.random(1, 10)
+    if c < n then
+      local v = 0.5 * (math.random() - 0.5)
+      dense_P[r * n + c + 1], dense_P[c * n + r + 1] = v, v
+    end
+  end
+end
+-- Bounds on each variable, and on sums of a few
+local m = n + n_rows
+local dense_A = {}
+for i=1, m * n do dense_A[i] = 0 end
+for r=0, n - 1 do dense_A[r * n + r + 1] = 1 end
+for r=n, m - 1 do
+  for _=1, 5 do dense_A[r * n + math.random(0, n - 1) + 1] = 1 end
+end
+local bench_P, bench_A = osqp_ffi.csc(dense_P, n, n, true), osqp_ffi.csc(dense_A, m, n)
+local q = ffi.new('c_float[?]', n)
+local l, u = ffi.new('c_float[?]', m), ffi.new('c_float[?]', m)
+for i=0, m - 1 do l[i], u[i] = -1, 1 end
+for i=0, n - 1 do q[i] = math.random() - 0.5 end
+local P_x0 = ffi.new('c_float[?]', bench_P.nnz)
+ffi.copy(P_x0, bench_P.x, ffi.sizeof(P_x0))
+
+local t0 = os.clock()
+local bench = assert(osqp_ffi.setup{
+  n = n, m = m, P = bench_P, A = bench_A, q = q, l = l, u = u,
+  settings = {polish = false, warm_start = true},
+})
+print(bench, string.format("P %d, A %d non-zeros | setup %.2f ms",
+  bench.P_nnz, bench.A_nnz, (os.clock() - t0) * 1e3))
+
+local times, n_iter, n_failed = {}, 0, 0
+local t_start = os.clock()
+for k=1, n_solves do
+  for i=0, n - 1 do q[i] = q[i] + 0.05 * (math.random() - 0.5) end
+  assert(bench:update_q(q))
+  local width = 1 + 0.1 * math.sin(k / 50)
+  for i=0, m - 1 do l[i], u[i] = -width, width end
+  assert(bench:update_bounds(l, u))
+  if k % 100 == 0 then
+    local scale = 1 + 0.1 * math.sin(k / 1000)
+    for i=0, bench_P.nnz - 1 do bench_P.x[i] = scale * P_x0[i] end
+    assert(bench:update_P(bench_P.x))
+  end
+  local sol = bench:solve()
+  if not sol then n_failed = n_failed + 1 end
+  n_iter = n_iter + tonumber(bench.info.iter)
+  times[k] = bench.info.solve_time
+end
+local t_total = os.clock() - t_start
+table.sort(times)
+local function percentile(p) return times[math.min(n_solves, math.floor(p * n_solves) + 1)] end
+print(string.format(
+  "%d solves in %.2f s | %.1f iterations on average, %d not solved",
+  n_solves, t_total, n_iter / n_solves, n_failed))
+print(string.format(
+  "Solve times | median %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us",
+  percentile(0.5) * 1e6, percentile(0.9) * 1e6,
+  percentile(0.99) * 1e6, times[n_solves] * 1e6))
+assert(n_failed == 0)
+
+-- Against setting up each time, as the table binding does
+local n_setups = math.min(n_solves, 100)
+t0 = os.clock()
+for _=1, n_setups do
+  local solver = assert(osqp_ffi.setup{
+    n = n, m = m, P = bench_P, A = bench_A, q = q, l = l, u = u,
+    settings = {polish = false},
+  })
+  assert(solver:solve())
+end
+print(string.format("Setup and solve | %.1f us each",
+  (os.clock() - t0) / n_setups * 1e6))
+print("OK")
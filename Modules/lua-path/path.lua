@@ -14,6 +14,38 @@ local unpack = unpack or require'table'.unpack
 -- local has_dubins, dubins = pcall(require, 'dubins')
 local has_grid, grid = pcall(require, 'grid')
 local has_kdtree, kdtree = pcall(require, 'kdtree')
+local has_ffi, ffi = pcall(require, 'ffi')
+local has_index, route_index = false, "No FFI"
+if has_ffi then
+  ffi.cdef[[
+typedef struct {
+  double cell_size;
+  int n_headings;
+  double max_distance;
+  double max_angle;
+} RouteIndexParameters;
+typedef struct {
+  int32_t route;
+  int32_t point;
+  double station;
+  double lateral;
+  double da;
+  double distance;
+} RouteMatch;
+struct route_index;
+void route_index_default_parameters(RouteIndexParameters *params);
+struct route_index *route_index_create(const RouteIndexParameters *params);
+void route_index_free(struct route_index *index);
+int route_index_add(struct route_index *index, const double *xy, int n_points,
+                    int closed);
+int route_index_build(struct route_index *index);
+double route_index_length(const struct route_index *index, int route);
+int route_index_query(const struct route_index *index, const double *poses,
+                      int n, const int32_t *routes, double distance_threshold,
+                      double angle_threshold, RouteMatch *matches);
+]]
+  has_index, route_index = pcall(ffi.load, 'route_index')
+end
 --
 local mod_angle = require'transform'.mod_angle
 local tf2D_inv = require'transform'.tf2D_inv
@@ -35,8 +67,14 @@ local function generate_kdtree(self)
   end
   -- 2D points
   local k_dim = 2
-  local tree = assert(kdtree.create(k_dim))
-  for i, pt in ipairs(self.points) do tree:insert(pt, i) end
+  local tree
+  if kdtree.build then
+    -- Balanced, bulk-loaded tree, with the user data as the point index
+    tree = assert(kdtree.build(k_dim, self.points))
+  else
+    tree = assert(kdtree.create(k_dim))
+    for i, pt in ipairs(self.points) do tree:insert(pt, i) end
+  end
   if tree:size() ~= #self.points then
     return false, "Not enough points added to the kd-tree"
   end
@@ -147,10 +185,11 @@ local function sort_candidates(a, b)
 end
 -- Given a pose and a table of paths
 local function find_in_paths(p_vehicle, paths, options)
+  if type(options) ~= 'table' then options = {} end
   -- Generate the best candidate per path
   local candidates = {}
   for name_path, my_path in pairs(paths) do
-    local candidate, err = find_in_path(p_vehicle, my_path, options)
+    local candidate, err = find_in_path(my_path, p_vehicle, options)
     if candidate then
       candidate.path_name = name_path
       table.insert(candidates, candidate)
@@ -408,6 +447,217 @@ local function path_from_waypoints(waypoints, params)
 end
 lib.path_from_waypoints = path_from_waypoints
 
+-- Route index: localize a whole fleet against many paths at once
+local function tostring_index(self)
+  return string.format("Route index | %d paths", #self.names)
+end
+
+local mt_index = {
+  __tostring = tostring_index
+}
+
+-- Find each pose in the paths of the index. options.path restricts every
+-- pose to one path, and options.paths[i] restricts pose i.
+-- Returns a list with the find information, or false, for each pose
+local function find_all_in_index(self, poses, options)
+  if type(options) ~= 'table' then options = {} end
+  local name_all = options.path
+  local names_each = type(options.paths) == 'table' and options.paths
+  if name_all and not self.ids[name_all] then
+    return false, "Path not in the index"
+  end
+  local results = {}
+  local n_poses = #poses
+  if not self.index then
+    -- Search the kd-tree of each path
+    for i, p_vehicle in ipairs(poses) do
+      local name = name_all or (names_each and names_each[i])
+      local info
+      if name then
+        local my_path = self.paths[name]
+        info = my_path and find_in_path(my_path, p_vehicle, options)
+        if info then info.path_name = name end
+      else
+        info = find_in_paths(p_vehicle, self.paths, options)
+      end
+      results[i] = info or false
+    end
+    return results
+  end
+  if n_poses == 0 then return results end
+  -- Grow the query buffers with the fleet
+  if n_poses > self.n_allocated then
+    self.poses_c = ffi.new('double[?]', 3 * n_poses)
+    self.routes_c = ffi.new('int32_t[?]', n_poses)
+    self.matches_c = ffi.new('RouteMatch[?]', n_poses)
+    self.n_allocated = n_poses
+  end
+  local poses_c, routes_c, matches_c = self.poses_c, self.routes_c, self.matches_c
+  local skip_angle = options.skip_angle or not options.orientation_threshold
+  for i, p_vehicle in ipairs(poses) do
+    local k = 3 * (i - 1)
+    poses_c[k], poses_c[k + 1] = p_vehicle[1], p_vehicle[2]
+    poses_c[k + 2] = skip_angle and 0/0 or (p_vehicle[3] or 0/0)
+    local name = name_all or (names_each and names_each[i])
+    local id = name and self.ids[name]
+    -- An unknown path matches nothing
+    if name and not id then poses_c[k] = 0/0 end
+    routes_c[i - 1] = id and (id - 1) or -1
+  end
+  route_index.route_index_query(self.index, poses_c, n_poses, routes_c,
+    tonumber(options.distance_threshold) or 0,
+    tonumber(options.orientation_threshold) or 0,
+    matches_c)
+  for i=1,n_poses do
+    local match = matches_c[i - 1]
+    if match.route < 0 then
+      results[i] = false
+    else
+      local name = self.names[match.route + 1]
+      local idx_path = match.point + 1
+      local da = match.da
+      if skip_angle then
+        -- Only if the path _has_ an angle at that point
+        local p_a = poses[i][3]
+        local path_a = self.paths[name].points[idx_path][3]
+        da = (p_a and path_a) and mod_angle(p_a - path_a) or 0
+      end
+      results[i] = {
+        path_name = name,
+        idx_path = idx_path,
+        idx_lane = 0,
+        --
+        dist = match.distance,
+        dist_normal = fabs(match.lateral),
+        dist_tangent = 0/0,
+        da = da,
+        -- Frenet frame
+        station = match.station,
+        lateral = match.lateral,
+      }
+    end
+  end
+  return results
+end
+
+local function find_in_index(self, p_vehicle, options)
+  local results, err = find_all_in_index(self, {p_vehicle}, options)
+  if not results then return false, err end
+  return results[1] or false, "No well-oriented candidates"
+end
+
+local function sort_names(a, b)
+  return tostring(a) < tostring(b)
+end
+-- Index a table of paths, by name, for finding poses in O(1) per pose.
+-- Without the native library, falls back to the kd-tree of each path.
+-- params: cell_size and max_distance in meters, n_headings and max_angle,
+-- in radians, of the largest queries
+local function index_paths(paths, params)
+  if type(paths) ~= 'table' then return false, "No paths" end
+  if type(params) ~= 'table' then params = {} end
+  local names = {}
+  for name in pairs(paths) do tinsert(names, name) end
+  table.sort(names, sort_names)
+  local ids = {}
+  for i, name in ipairs(names) do ids[name] = i end
+  local obj = {
+    paths = paths,
+    names = names,
+    ids = ids,
+    find = find_in_index,
+    find_all = find_all_in_index,
+  }
+  if not has_index then
+    for _, name in ipairs(names) do
+      local ok, err = generate_kdtree(paths[name])
+      if not ok then return false, err end
+    end
+    return setmetatable(obj, mt_index)
+  end
+  local c_params = ffi.new'RouteIndexParameters'
+  route_index.route_index_default_parameters(c_params)
+  c_params.cell_size = tonumber(params.cell_size) or c_params.cell_size
+  c_params.n_headings = tonumber(params.n_headings) or c_params.n_headings
+  c_params.max_distance = tonumber(params.max_distance) or c_params.max_distance
+  c_params.max_angle = tonumber(params.max_angle) or c_params.max_angle
+  local index = route_index.route_index_create(c_params)
+  if index == nil then return false, "Out of memory" end
+  ffi.gc(index, route_index.route_index_free)
+  for _, name in ipairs(names) do
+    local my_path = paths[name]
+    local points = my_path.points
+    local xy = ffi.new('double[?]', 2 * #points)
+    for i, p in ipairs(points) do
+      xy[2 * i - 2], xy[2 * i - 1] = p[1], p[2]
+    end
+    local closed = my_path.closed and 1 or 0
+    if route_index.route_index_add(index, xy, #points, closed) < 0 then
+      return false, "Out of memory"
+    end
+  end
+  if route_index.route_index_build(index) ~= 0 then
+    return false, "Out of memory"
+  end
+  obj.index = index
+  obj.n_allocated = 0
+  return setmetatable(obj, mt_index)
+end
+lib.index = index_paths
+
+-- Sample a polyline of {x, y} knots every ds
+local function path_along(knots, ds)
+  local waypoints = {}
+  for i, p in ipairs(knots) do
+    local p_next = knots[i + 1]
+    local heading = p_next and atan2(p_next[2] - p[2], p_next[1] - p[1])
+      or waypoints[i - 1][3]
+    waypoints[i] = {p[1], p[2], heading, da=0}
+  end
+  return path_from_waypoints(waypoints, {ds = ds})
+end
+
+-- Paths along the road segments from lua-roads, with points in meters east
+-- and north of the southwest corner of the bounds, or their xy points from
+-- road_graph. Two-way roads have a path each way, the other named with a
+-- "_reverse" suffix.
+-- params: ds in meters, and those of the index
+local function index_roads(segments, bounds, params)
+  if type(segments) ~= 'table' then return false, "No road segments" end
+  if type(bounds) ~= 'table' then return false, "No bounds" end
+  if type(params) ~= 'table' then params = {} end
+  local ds = tonumber(params.ds) or 0.5
+  -- Equirectangular, about the middle of the bounds
+  local lat0, lon0 = bounds.minlat, bounds.minlon
+  local m_per_lat = math.rad(6378137)
+  local m_per_lon = m_per_lat * cos(math.rad((bounds.minlat + bounds.maxlat) / 2))
+  local paths = {}
+  for id, segment in pairs(segments) do
+    local knots = {}
+    for i, latlon in ipairs(segment.points or segment.latlon or {}) do
+      local x = (latlon[2] - lon0) * m_per_lon
+      local y = (latlon[1] - lat0) * m_per_lat
+      -- Already projected by road_graph
+      if segment.xy then x, y = unpack(segment.xy[i], 1, 2) end
+      local p_last = knots[#knots]
+      -- Skip repeated nodes
+      if not p_last or x ~= p_last[1] or y ~= p_last[2] then
+        tinsert(knots, {x, y})
+      end
+    end
+    if #knots > 1 then
+      paths[id] = path_along(knots, ds)
+      if not segment.oneway then
+        local knots_reverse = {}
+        for i=#knots,1,-1 do tinsert(knots_reverse, knots[i]) end
+        paths[id.."_reverse"] = path_along(knots_reverse, ds)
+      end
+    end
+  end
+  return index_paths(paths, params)
+end
+lib.index_roads = index_roads
+
 local function draw_svg(path)
   return false, "Not implemented"
 end
@@ -0,0 +1,460 @@
+/*
+Spatial index of a network of routes, for localizing many vehicles at once
+*/
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "route_index.h"
+
+#define TWO_PI (2 * M_PI)
+#define EMPTY_KEY UINT64_MAX
+
+typedef struct {
+  /* Start, unit tangent and length */
+  double x0, y0, ux, uy, len;
+  double heading;
+  /* Station of the start */
+  double s0;
+  int32_t route;
+  /* Points at either end */
+  int32_t point0, point1;
+} Segment;
+
+typedef struct {
+  uint64_t key;
+  int32_t segment;
+} KeyedSegment;
+
+typedef struct {
+  uint64_t key;
+  int32_t start, count;
+} Bucket;
+
+struct route_index {
+  RouteIndexParameters params;
+  Segment *segments;
+  int n_segments, cap_segments;
+  double *lengths;
+  int n_routes, cap_routes;
+  /* Bounds of the cells */
+  double xmin, ymin;
+  int64_t nx, ny;
+  double bin_width;
+  /* Open addressed buckets into the candidate list */
+  Bucket *buckets;
+  uint64_t bucket_mask;
+  int32_t *candidates;
+  int is_built;
+};
+
+static inline double mod_angle(double a) {
+  a = fmod(a, TWO_PI);
+  if (a >= M_PI) {
+    a -= TWO_PI;
+  } else if (a < -M_PI) {
+    a += TWO_PI;
+  }
+  return a;
+}
+
+static inline uint64_t hash_key(uint64_t key) {
+  return key * 0x9E3779B97F4A7C15ULL;
+}
+
+static inline uint64_t cell_key(const struct route_index *index, int64_t ci,
+                                int64_t cj, int bin) {
+  return ((uint64_t)(cj * index->nx + ci)) * index->params.n_headings + bin;
+}
+
+static inline int heading_bin(const struct route_index *index, double a) {
+  int bin = (int)floor((mod_angle(a) + M_PI) / index->bin_width);
+  /* Rounding at +pi */
+  return bin < index->params.n_headings ? bin : 0;
+}
+
+static const Bucket *find_bucket(const struct route_index *index,
+                                 uint64_t key) {
+  uint64_t slot = hash_key(key) & index->bucket_mask;
+  while (index->buckets[slot].key != EMPTY_KEY) {
+    if (index->buckets[slot].key == key) {
+      return &index->buckets[slot];
+    }
+    slot = (slot + 1) & index->bucket_mask;
+  }
+  return NULL;
+}
+
+static void clear_hash(struct route_index *index) {
+  free(index->buckets);
+  free(index->candidates);
+  index->buckets = NULL;
+  index->candidates = NULL;
+  index->is_built = 0;
+}
+
+void route_index_default_parameters(RouteIndexParameters *params) {
+  params->cell_size = 0.5;
+  params->n_headings = 8;
+  params->max_distance = 1.0;
+  params->max_angle = M_PI / 3;
+}
+
+struct route_index *route_index_create(const RouteIndexParameters *params) {
+  struct route_index *index = calloc(1, sizeof(struct route_index));
+  if (!index) {
+    return NULL;
+  }
+  if (params) {
+    index->params = *params;
+  } else {
+    route_index_default_parameters(&index->params);
+  }
+  if (!(index->params.cell_size > 0)) {
+    index->params.cell_size = 0.5;
+  }
+  if (index->params.n_headings < 1) {
+    index->params.n_headings = 1;
+  }
+  if (!(index->params.max_distance > 0)) {
+    index->params.max_distance = 1.0;
+  }
+  if (!(index->params.max_angle > 0) || index->params.max_angle > M_PI) {
+    index->params.max_angle = M_PI;
+  }
+  index->bin_width = TWO_PI / index->params.n_headings;
+  return index;
+}
+
+void route_index_free(struct route_index *index) {
+  if (!index) {
+    return;
+  }
+  clear_hash(index);
+  free(index->segments);
+  free(index->lengths);
+  free(index);
+}
+
+int route_index_add(struct route_index *index, const double *xy, int n_points,
+                    int closed) {
+  int n_new = closed ? n_points : n_points - 1;
+  int route = index->n_routes;
+  double station = 0;
+  int i;
+  if (n_points < 1) {
+    n_new = 0;
+  }
+  if (index->n_segments + n_new > index->cap_segments) {
+    int cap = index->cap_segments ? index->cap_segments : 1024;
+    Segment *segments;
+    while (cap < index->n_segments + n_new) {
+      cap *= 2;
+    }
+    segments = realloc(index->segments, cap * sizeof(Segment));
+    if (!segments) {
+      return -1;
+    }
+    index->segments = segments;
+    index->cap_segments = cap;
+  }
+  if (route == index->cap_routes) {
+    int cap = index->cap_routes ? 2 * index->cap_routes : 16;
+    double *lengths = realloc(index->lengths, cap * sizeof(double));
+    if (!lengths) {
+      return -1;
+    }
+    index->lengths = lengths;
+    index->cap_routes = cap;
+  }
+  for (i = 0; i < n_new; i++) {
+    int i1 = (i + 1) % n_points;
+    double dx = xy[2 * i1] - xy[2 * i];
+    double dy = xy[2 * i1 + 1] - xy[2 * i + 1];
+    double len = sqrt(dx * dx + dy * dy);
+    Segment *seg;
+    /* Skip repeated points */
+    if (len < 1e-9) {
+      continue;
+    }
+    seg = &index->segments[index->n_segments++];
+    seg->x0 = xy[2 * i];
+    seg->y0 = xy[2 * i + 1];
+    seg->ux = dx / len;
+    seg->uy = dy / len;
+    seg->len = len;
+    seg->heading = atan2(dy, dx);
+    seg->s0 = station;
+    seg->route = route;
+    seg->point0 = i;
+    seg->point1 = i1;
+    station += len;
+  }
+  index->lengths[route] = station;
+  index->n_routes++;
+  clear_hash(index);
+  return route;
+}
+
+double route_index_length(const struct route_index *index, int route) {
+  if (route < 0 || route >= index->n_routes) {
+    return -1;
+  }
+  return index->lengths[route];
+}
+
+static int compare_keyed(const void *a, const void *b) {
+  const KeyedSegment *ka = a, *kb = b;
+  if (ka->key != kb->key) {
+    return ka->key < kb->key ? -1 : 1;
+  }
+  return ka->segment - kb->segment;
+}
+
+/* Distance from a point to a segment */
+static double segment_distance(const Segment *seg, double x, double y) {
+  double dx = x - seg->x0, dy = y - seg->y0;
+  double t = dx * seg->ux + dy * seg->uy;
+  if (t < 0) {
+    t = 0;
+  } else if (t > seg->len) {
+    t = seg->len;
+  }
+  dx -= t * seg->ux;
+  dy -= t * seg->uy;
+  return sqrt(dx * dx + dy * dy);
+}
+
+int route_index_build(struct route_index *index) {
+  const RouteIndexParameters *params = &index->params;
+  const double cs = params->cell_size;
+  /* Any point of a cell is this close to its center */
+  const double reach = params->max_distance + cs * M_SQRT1_2;
+  double xmin = INFINITY, ymin = INFINITY;
+  double xmax = -INFINITY, ymax = -INFINITY;
+  KeyedSegment *keyed = NULL;
+  size_t n_keyed = 0, cap_keyed = 0;
+  size_t n_keys, i;
+  uint64_t n_slots;
+  int s;
+
+  clear_hash(index);
+  for (s = 0; s < index->n_segments; s++) {
+    const Segment *seg = &index->segments[s];
+    double x1 = seg->x0 + seg->len * seg->ux;
+    double y1 = seg->y0 + seg->len * seg->uy;
+    xmin = fmin(xmin, fmin(seg->x0, x1));
+    ymin = fmin(ymin, fmin(seg->y0, y1));
+    xmax = fmax(xmax, fmax(seg->x0, x1));
+    ymax = fmax(ymax, fmax(seg->y0, y1));
+  }
+  if (index->n_segments == 0) {
+    xmin = ymin = xmax = ymax = 0;
+  }
+  index->xmin = xmin - params->max_distance - cs;
+  index->ymin = ymin - params->max_distance - cs;
+  index->nx = (int64_t)ceil((xmax - index->xmin + params->max_distance) / cs) + 1;
+  index->ny = (int64_t)ceil((ymax - index->ymin + params->max_distance) / cs) + 1;
+
+  /* File each segment under the keys from which it may match */
+  for (s = 0; s < index->n_segments; s++) {
+    const Segment *seg = &index->segments[s];
+    double x1 = seg->x0 + seg->len * seg->ux;
+    double y1 = seg->y0 + seg->len * seg->uy;
+    int64_t ci0 = (int64_t)floor((fmin(seg->x0, x1) - params->max_distance - index->xmin) / cs);
+    int64_t ci1 = (int64_t)floor((fmax(seg->x0, x1) + params->max_distance - index->xmin) / cs);
+    int64_t cj0 = (int64_t)floor((fmin(seg->y0, y1) - params->max_distance - index->ymin) / cs);
+    int64_t cj1 = (int64_t)floor((fmax(seg->y0, y1) + params->max_distance - index->ymin) / cs);
+    int bin0 = 0, n_bins = params->n_headings;
+    int64_t ci, cj;
+    if (params->n_headings > 1 && params->max_angle < M_PI) {
+      /* Bins overlapping the heading, plus or minus the largest error */
+      double lo = seg->heading - params->max_angle;
+      double hi = seg->heading + params->max_angle;
+      int b_lo = (int)floor((lo + M_PI) / index->bin_width);
+      int b_hi = (int)floor((hi + M_PI) / index->bin_width);
+      bin0 = b_lo;
+      n_bins = b_hi - b_lo + 1;
+      if (n_bins > params->n_headings) {
+        n_bins = params->n_headings;
+      }
+    }
+    for (cj = cj0; cj <= cj1; cj++) {
+      for (ci = ci0; ci <= ci1; ci++) {
+        double xc = index->xmin + (ci + 0.5) * cs;
+        double yc = index->ymin + (cj + 0.5) * cs;
+        int b;
+        if (segment_distance(seg, xc, yc) > reach) {
+          continue;
+        }
+        if (n_keyed + n_bins > cap_keyed) {
+          size_t cap = cap_keyed ? 2 * cap_keyed : 4096;
+          KeyedSegment *grown;
+          while (cap < n_keyed + n_bins) {
+            cap *= 2;
+          }
+          grown = realloc(keyed, cap * sizeof(KeyedSegment));
+          if (!grown) {
+            free(keyed);
+            return -1;
+          }
+          keyed = grown;
+          cap_keyed = cap;
+        }
+        for (b = 0; b < n_bins; b++) {
+          int bin = (bin0 + b) % params->n_headings;
+          if (bin < 0) {
+            bin += params->n_headings;
+          }
+          keyed[n_keyed].key = cell_key(index, ci, cj, bin);
+          keyed[n_keyed].segment = s;
+          n_keyed++;
+        }
+      }
+    }
+  }
+
+  /* Group by key, into a table at most half full */
+  qsort(keyed, n_keyed, sizeof(KeyedSegment), compare_keyed);
+  n_keys = 0;
+  for (i = 0; i < n_keyed; i++) {
+    if (i == 0 || keyed[i].key != keyed[i - 1].key) {
+      n_keys++;
+    }
+  }
+  n_slots = 16;
+  while (n_slots < 2 * n_keys) {
+    n_slots *= 2;
+  }
+  index->buckets = malloc(n_slots * sizeof(Bucket));
+  index->candidates = malloc((n_keyed ? n_keyed : 1) * sizeof(int32_t));
+  if (!index->buckets || !index->candidates) {
+    free(keyed);
+    clear_hash(index);
+    return -1;
+  }
+  index->bucket_mask = n_slots - 1;
+  for (i = 0; i < n_slots; i++) {
+    index->buckets[i].key = EMPTY_KEY;
+  }
+  for (i = 0; i < n_keyed; i++) {
+    Bucket *bucket;
+    uint64_t slot;
+    index->candidates[i] = keyed[i].segment;
+    if (i > 0 && keyed[i].key == keyed[i - 1].key) {
+      continue;
+    }
+    slot = hash_key(keyed[i].key) & index->bucket_mask;
+    while (index->buckets[slot].key != EMPTY_KEY) {
+      slot = (slot + 1) & index->bucket_mask;
+    }
+    bucket = &index->buckets[slot];
+    bucket->key = keyed[i].key;
+    bucket->start = i;
+    bucket->count = 0;
+    while (i + bucket->count < n_keyed &&
+           keyed[i + bucket->count].key == bucket->key) {
+      bucket->count++;
+    }
+  }
+  free(keyed);
+  index->is_built = 1;
+  return 0;
+}
+
+/* Project onto the candidates of one bucket, keeping the nearest */
+static void match_bucket(const struct route_index *index, const Bucket *bucket,
+                         double x, double y, double a, int32_t route,
+                         double distance_threshold, double angle_threshold,
+                         RouteMatch *match) {
+  int k;
+  for (k = 0; k < bucket->count; k++) {
+    const Segment *seg =
+        &index->segments[index->candidates[bucket->start + k]];
+    double dx, dy, t, ex, ey, dist, da = 0;
+    if (route >= 0 && seg->route != route) {
+      continue;
+    }
+    dx = x - seg->x0;
+    dy = y - seg->y0;
+    t = dx * seg->ux + dy * seg->uy;
+    if (t < 0) {
+      t = 0;
+    } else if (t > seg->len) {
+      t = seg->len;
+    }
+    ex = dx - t * seg->ux;
+    ey = dy - t * seg->uy;
+    dist = sqrt(ex * ex + ey * ey);
+    if (dist > distance_threshold ||
+        (match->route >= 0 && dist >= match->distance)) {
+      continue;
+    }
+    if (!isnan(a)) {
+      da = mod_angle(a - seg->heading);
+      if (fabs(da) > angle_threshold) {
+        continue;
+      }
+    }
+    match->route = seg->route;
+    match->point = (2 * t < seg->len) ? seg->point0 : seg->point1;
+    match->station = seg->s0 + t;
+    match->lateral = seg->ux * dy - seg->uy * dx;
+    match->da = da;
+    match->distance = dist;
+  }
+}
+
+int route_index_query(const struct route_index *index, const double *poses,
+                      int n, const int32_t *routes, double distance_threshold,
+                      double angle_threshold, RouteMatch *matches) {
+  const RouteIndexParameters *params = &index->params;
+  int i, n_matched = 0;
+  if (!(distance_threshold > 0) || distance_threshold > params->max_distance) {
+    distance_threshold = params->max_distance;
+  }
+  if (!(angle_threshold > 0) || angle_threshold > params->max_angle) {
+    angle_threshold = params->max_angle;
+  }
+  for (i = 0; i < n; i++) {
+    double x = poses[3 * i], y = poses[3 * i + 1], a = poses[3 * i + 2];
+    int32_t route = routes ? routes[i] : -1;
+    RouteMatch *match = &matches[i];
+    double fi = floor((x - index->xmin) / params->cell_size);
+    double fj = floor((y - index->ymin) / params->cell_size);
+    match->route = -1;
+    match->point = -1;
+    match->station = NAN;
+    match->lateral = NAN;
+    match->da = NAN;
+    match->distance = INFINITY;
+    if (!index->is_built || !(fi >= 0 && fi < index->nx) ||
+        !(fj >= 0 && fj < index->ny)) {
+      continue;
+    }
+    if (isnan(a) || params->n_headings == 1) {
+      /* Every bin of the cell */
+      int b;
+      for (b = 0; b < params->n_headings; b++) {
+        const Bucket *bucket =
+            find_bucket(index, cell_key(index, (int64_t)fi, (int64_t)fj, b));
+        if (bucket) {
+          match_bucket(index, bucket, x, y, a, route, distance_threshold,
+                       angle_threshold, match);
+        }
+      }
+    } else {
+      const Bucket *bucket = find_bucket(
+          index, cell_key(index, (int64_t)fi, (int64_t)fj, heading_bin(index, a)));
+      if (bucket) {
+        match_bucket(index, bucket, x, y, a, route, distance_threshold,
+                     angle_threshold, match);
+      }
+    }
+    if (match->route >= 0) {
+      n_matched++;
+    }
+  }
+  return n_matched;
+}
@@ -0,0 +1,69 @@
+#pragma once
+/*
+Spatial index of a network of routes, for localizing many vehicles at once
+Routes are densely sampled polylines, as from path_from_waypoints. Each
+segment is filed under every (cell, heading bin) key from which a pose
+could match it, so that a query hashes its key and projects onto a short
+candidate list, with the station of each segment start precomputed.
+*/
+
+#include <stdint.h>
+
+typedef struct {
+  /* Meters per side of a hash cell */
+  double cell_size;
+  /* Heading bins over the circle, with 1 ignoring the heading */
+  int n_headings;
+  /* Farthest match, in meters, and most heading error, in radians, that
+   * queries may ask for
+   */
+  double max_distance;
+  double max_angle;
+} RouteIndexParameters;
+
+typedef struct {
+  /* Route of the match, or -1 for none */
+  int32_t route;
+  /* Nearest point of the route, from 0 */
+  int32_t point;
+  /* Frenet frame: distance along the route, and signed offset, positive to
+   * the left, in meters
+   */
+  double station;
+  double lateral;
+  /* Heading of the pose relative to the route */
+  double da;
+  /* Euclidean distance to the route */
+  double distance;
+} RouteMatch;
+
+struct route_index;
+
+/* Defaults for the racecar, with routes sampled every few centimeters */
+void route_index_default_parameters(RouteIndexParameters *params);
+
+struct route_index *route_index_create(const RouteIndexParameters *params);
+void route_index_free(struct route_index *index);
+
+/* Add a route of n_points {x, y} pairs, closing it back to the first point
+ * if closed. Returns the route id, from 0, or -1 if out of memory
+ */
+int route_index_add(struct route_index *index, const double *xy, int n_points,
+                    int closed);
+
+/* Build the hash of the routes added so far.
+ * Returns 0, or -1 if out of memory
+ */
+int route_index_build(struct route_index *index);
+
+/* Length in meters of a route, or -1 */
+double route_index_length(const struct route_index *index, int route);
+
+/* Match n {x, y, heading} poses. Each may be restricted to one route from
+ * routes, where a negative id or NULL allows any. A NaN heading ignores
+ * the heading. Distance and angle thresholds beyond the built maximums are
+ * clamped to them. Returns the number of poses matched
+ */
+int route_index_query(const struct route_index *index, const double *poses,
+                      int n, const int32_t *routes, double distance_threshold,
+                      double angle_threshold, RouteMatch *matches);
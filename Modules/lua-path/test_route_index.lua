@@ -0,0 +1,145 @@
+#!/usr/bin/env luajit
+local unpack = unpack or require'table'.unpack
+local path = require'path'
+local time = require'unix'.time
+
+local ds = 0.01
+
+-- Two loops in the Holodeck, one each way, and a roundabout
+local routes = {
+  outer = {
+    {0.75, -0.75},
+    {4, -0.75},
+    {4, 5.75},
+    {0.75, 5.75},
+    turning_radius = 0.3,
+    closed = true
+  },
+  inner = {
+    {1.25, -0.25},
+    {1.25, 5.25},
+    {3.5, 5.25},
+    {3.5, -0.25},
+    turning_radius = 0.3,
+    closed = true
+  },
+  roundabout = {
+    {9, 1},
+    {9, 4},
+    {6, 4},
+    {6, 1},
+    turning_radius = 1.5,
+    closed = true
+  },
+}
+
+local paths = {}
+for name, route in pairs(routes) do
+  local waypoints = assert(path.generate_waypoints(route))
+  local my_path = assert(path.path_from_waypoints(waypoints, {
+    ds = ds,
+    closed = route.closed
+  }))
+  my_path.closed = route.closed
+  paths[name] = my_path
+end
+
+local index = assert(path.index(paths, {max_distance = 0.5}))
+print(index)
+
+-- Poses near the routes, in both directions
+math.randomseed(123)
+local poses = {}
+for i=1,1000 do
+  local name = index.names[math.random(#index.names)]
+  local points = paths[name].points
+  local x, y, a = unpack(points[math.random(#points)])
+  local dir = (i % 2 == 0) and 0 or math.pi
+  table.insert(poses, {
+    x + 0.2 * (math.random() - 0.5),
+    y + 0.2 * (math.random() - 0.5),
+    a + dir + 0.2 * (math.random() - 0.5)
+  })
+end
+
+local t0 = time()
+local found = assert(index:find_all(poses, {
+  distance_threshold = 0.3,
+  orientation_threshold = math.rad(45)
+}))
+local t1 = time()
+print(string.format("Found %d poses in %.3f ms", #poses, 1e3 * (t1 - t0)))
+
+-- Compare with the nearest well-oriented point of every path
+local n_found = 0
+for i, p in ipairs(poses) do
+  local best_dist, best_name = math.huge, false
+  for name, my_path in pairs(paths) do
+    for _, pt in ipairs(my_path.points) do
+      local dx, dy = p[1] - pt[1], p[2] - pt[2]
+      local d = math.sqrt(dx * dx + dy * dy)
+      local da = math.abs(require'transform'.mod_angle(p[3] - pt[3]))
+      if d < best_dist and d < 0.3 and da < math.rad(40) then
+        best_dist, best_name = d, name
+      end
+    end
+  end
+  local info = found[i]
+  if best_name then
+    assert(info, "Missed a pose")
+    -- Segments are at least as near as their points
+    assert(info.dist <= best_dist + 1e-9, "Farther than the nearest point")
+    assert(math.abs(math.abs(info.lateral) - info.dist) < ds, "Bad lateral offset")
+    assert(info.station >= 0 and info.station <= paths[info.path_name].length + ds, "Bad station")
+    n_found = n_found + 1
+  end
+  -- Restricting each pose to its own match gives the same
+  if info then
+    local info1 = assert(index:find(p, {
+      path = info.path_name,
+      distance_threshold = 0.3,
+      orientation_threshold = math.rad(45)
+    }))
+    assert(info1.idx_path == info.idx_path)
+  end
+end
+print(string.format("Checked %d poses", n_found))
+
+-- Unknown paths find nothing
+assert(not index:find_all(poses, {path = 'none'}))
+local none = assert(index:find_all({poses[1]}, {paths = {'none'}}))
+assert(none[1] == false)
+
+-- Road segments from lua-roads, with a two-way road crossing a one-way road
+local segments = {
+  A000001 = {
+    name = "Main", lanes = 2,
+    points = {{42.5190, -71.6090}, {42.5200, -71.6050}},
+  },
+  B000002 = {
+    name = "Side", oneway = true,
+    points = {{42.5210, -71.6070}, {42.5190, -71.6070}},
+  },
+}
+local bounds = {
+  minlat = 42.5187, minlon = -71.6094,
+  maxlat = 42.5247, maxlon = -71.6010,
+}
+local roads = assert(path.index_roads(segments, bounds, {ds = 0.5}))
+print(roads)
+assert(#roads.names == 3, "Two-way roads go both ways")
+assert(roads.paths.A000001_reverse, "No reverse path")
+-- About 350 meters long, on the ground
+local length = roads.paths.A000001.length
+assert(length > 300 and length < 400, "Bad road length")
+-- Heading down the one-way road, at its start
+local p_start = roads.paths.B000002.points[1]
+local on_road = assert(roads:find({p_start[1] + 0.1, p_start[2] - 1, -math.pi/2}, {
+  orientation_threshold = math.rad(30)
+}))
+assert(on_road.path_name == 'B000002')
+assert(math.abs(on_road.station - 1) < 1e-6, "Bad station")
+-- Driving the wrong way
+assert(not roads:find({p_start[1], p_start[2] - 1, math.pi/2}, {
+  orientation_threshold = math.rad(30)
+}))
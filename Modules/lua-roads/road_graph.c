@@ -0,0 +1,926 @@
+/*
+Road graph of an OSM extract, streamed from XML, and its cache file
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "road_graph.h"
+
+#define CHUNK_SIZE (1 << 20)
+#define CACHE_MAGIC "ROADGRPH"
+#define CACHE_VERSION 2
+
+/* Header of the cache file, followed by the arrays, each 8 byte aligned,
+ * in the native byte order
+ */
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t n_nodes, n_edges, n_ways, n_way_nodes, n_strings, n_chars;
+  uint32_t reserved;
+  double minlat, minlon, maxlat, maxlon;
+  double lat0, lon0;
+  uint64_t source_size;
+  int64_t source_mtime;
+} CacheHeader;
+
+/* Growable array */
+typedef struct {
+  char *data;
+  size_t n, cap, elem_sz;
+} Vec;
+
+static void vec_init(Vec *v, size_t elem_sz) {
+  v->data = NULL;
+  v->n = 0;
+  v->cap = 0;
+  v->elem_sz = elem_sz;
+}
+
+static void *vec_push(Vec *v, size_t count) {
+  void *ptr;
+  if (v->n + count > v->cap) {
+    size_t cap = v->cap ? v->cap : 1024;
+    char *data;
+    while (cap < v->n + count) {
+      cap *= 2;
+    }
+    data = realloc(v->data, cap * v->elem_sz);
+    if (!data) {
+      return NULL;
+    }
+    v->data = data;
+    v->cap = cap;
+  }
+  ptr = v->data + v->n * v->elem_sz;
+  v->n += count;
+  return ptr;
+}
+
+#define VEC_AT(v, type, i) (((type *)(v).data)[i])
+
+enum { IN_NONE, IN_NODE, IN_WAY, IN_OTHER };
+
+typedef struct {
+  int pass;
+  int context;
+  int failed;
+  /* Tag being read, between < and > */
+  Vec tag;
+  int in_tag;
+  char quote;
+  /* Way being read */
+  int64_t way_id;
+  Vec refs;
+  int has_highway, has_lanes, is_building, is_area, is_roundabout;
+  int has_oneway, oneway, lanes;
+  int32_t name, highway;
+  double width;
+  /* Kept ways */
+  Vec way_id_v, way_count, way_refs, way_name, way_highway, way_lanes,
+      way_oneway, way_width;
+  /* Interned strings, hashed by index + 1 */
+  Vec str_ptr, str_chars;
+  uint32_t *str_hash;
+  size_t str_hash_cap;
+  Vec scratch;
+  /* Referenced nodes, sorted, and their coordinates */
+  int64_t *node_id;
+  size_t n_nodes, n_found;
+  double *lat, *lon;
+  uint8_t *found;
+  int has_bounds;
+  double minlat, minlon, maxlat, maxlon;
+} Parser;
+
+/* Next attribute of a tag as name="value", or 0 at the end */
+static int next_attr(const char **cursor, const char *end, const char **name,
+                     size_t *name_len, const char **value, size_t *value_len) {
+  const char *p = *cursor;
+  char quote;
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+    p++;
+  }
+  *name = p;
+  while (p < end && *p != '=' && *p != ' ' && *p != '\t' && *p != '\n' &&
+         *p != '\r') {
+    p++;
+  }
+  *name_len = p - *name;
+  while (p < end && *p != '=') {
+    p++;
+  }
+  while (p < end && *p != '"' && *p != '\'') {
+    p++;
+  }
+  if (p >= end) {
+    return 0;
+  }
+  quote = *p++;
+  *value = p;
+  while (p < end && *p != quote) {
+    p++;
+  }
+  if (p >= end) {
+    return 0;
+  }
+  *value_len = p - *value;
+  *cursor = p + 1;
+  return 1;
+}
+
+static int attr_is(const char *name, size_t len, const char *key) {
+  return strlen(key) == len && memcmp(name, key, len) == 0;
+}
+
+/* Copy a value into the scratch buffer, replacing XML entities */
+static char *unescape(Parser *ps, const char *value, size_t len) {
+  size_t i = 0;
+  char *out;
+  ps->scratch.n = 0;
+  if (!vec_push(&ps->scratch, len + 1)) {
+    return NULL;
+  }
+  out = ps->scratch.data;
+  ps->scratch.n = 0;
+  while (i < len) {
+    char c = value[i];
+    if (c == '&') {
+      static const struct {
+        const char *entity;
+        char c;
+      } entities[] = {{"&amp;", '&'}, {"&quot;", '"'}, {"&apos;", '\''},
+                      {"&lt;", '<'},  {"&gt;", '>'}};
+      size_t k;
+      for (k = 0; k < sizeof(entities) / sizeof(entities[0]); k++) {
+        size_t elen = strlen(entities[k].entity);
+        if (i + elen <= len && memcmp(value + i, entities[k].entity, elen) == 0) {
+          break;
+        }
+      }
+      if (k < sizeof(entities) / sizeof(entities[0])) {
+        out[ps->scratch.n++] = entities[k].c;
+        i += strlen(entities[k].entity);
+        continue;
+      }
+    }
+    out[ps->scratch.n++] = c;
+    i++;
+  }
+  out[ps->scratch.n] = '\0';
+  return out;
+}
+
+static uint32_t hash_string(const char *s) {
+  uint32_t h = 2166136261u;
+  while (*s) {
+    h = (h ^ (uint8_t)*s++) * 16777619u;
+  }
+  return h;
+}
+
+/* Index of a string, added if new, or -2 if out of memory */
+static int32_t intern(Parser *ps, const char *s) {
+  size_t n_strings = ps->str_ptr.n ? ps->str_ptr.n - 1 : 0;
+  size_t len = strlen(s), slot;
+  char *chars;
+  if (2 * (n_strings + 1) > ps->str_hash_cap) {
+    size_t cap = ps->str_hash_cap ? 2 * ps->str_hash_cap : 1024;
+    uint32_t *table = calloc(cap, sizeof(uint32_t));
+    size_t i;
+    if (!table) {
+      return -2;
+    }
+    for (i = 0; i < n_strings; i++) {
+      const char *si = ps->str_chars.data + VEC_AT(ps->str_ptr, uint32_t, i);
+      slot = hash_string(si) & (cap - 1);
+      while (table[slot]) {
+        slot = (slot + 1) & (cap - 1);
+      }
+      table[slot] = i + 1;
+    }
+    free(ps->str_hash);
+    ps->str_hash = table;
+    ps->str_hash_cap = cap;
+  }
+  slot = hash_string(s) & (ps->str_hash_cap - 1);
+  while (ps->str_hash[slot]) {
+    uint32_t i = ps->str_hash[slot] - 1;
+    if (strcmp(ps->str_chars.data + VEC_AT(ps->str_ptr, uint32_t, i), s) == 0) {
+      return i;
+    }
+    slot = (slot + 1) & (ps->str_hash_cap - 1);
+  }
+  if (ps->str_ptr.n == 0) {
+    uint32_t *first = vec_push(&ps->str_ptr, 1);
+    if (!first) {
+      return -2;
+    }
+    *first = 0;
+  }
+  chars = vec_push(&ps->str_chars, len + 1);
+  if (!chars || !vec_push(&ps->str_ptr, 1)) {
+    return -2;
+  }
+  memcpy(chars, s, len + 1);
+  VEC_AT(ps->str_ptr, uint32_t, n_strings + 1) = ps->str_chars.n;
+  ps->str_hash[slot] = n_strings + 1;
+  return n_strings;
+}
+
+static int find_node(const Parser *ps, int64_t id, size_t *idx) {
+  size_t lo = 0, hi = ps->n_nodes;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (ps->node_id[mid] < id) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  *idx = lo;
+  return lo < ps->n_nodes && ps->node_id[lo] == id;
+}
+
+static void begin_way(Parser *ps, const char *attrs, const char *end) {
+  const char *name, *value;
+  size_t name_len, value_len;
+  ps->context = IN_WAY;
+  ps->way_id = 0;
+  ps->refs.n = 0;
+  ps->has_highway = ps->has_lanes = ps->is_building = ps->is_area = 0;
+  ps->is_roundabout = ps->has_oneway = ps->oneway = ps->lanes = 0;
+  ps->name = ps->highway = -1;
+  ps->width = NAN;
+  while (next_attr(&attrs, end, &name, &name_len, &value, &value_len)) {
+    if (attr_is(name, name_len, "id")) {
+      ps->way_id = strtoll(value, NULL, 10);
+    }
+  }
+}
+
+static void way_tag(Parser *ps, const char *attrs, const char *end) {
+  const char *name, *value, *k = NULL, *v = NULL;
+  size_t name_len, value_len, k_len = 0, v_len = 0;
+  char *s;
+  while (next_attr(&attrs, end, &name, &name_len, &value, &value_len)) {
+    if (attr_is(name, name_len, "k")) {
+      k = value;
+      k_len = value_len;
+    } else if (attr_is(name, name_len, "v")) {
+      v = value;
+      v_len = value_len;
+    }
+  }
+  if (!k || !v) {
+    return;
+  }
+  s = unescape(ps, v, v_len);
+  if (!s) {
+    ps->failed = ROAD_GRAPH_ERR_MEMORY;
+    return;
+  }
+  if (attr_is(k, k_len, "highway")) {
+    ps->has_highway = 1;
+    ps->highway = intern(ps, s);
+  } else if (attr_is(k, k_len, "name")) {
+    ps->name = intern(ps, s);
+  } else if (attr_is(k, k_len, "lanes")) {
+    ps->has_lanes = 1;
+    ps->lanes = atoi(s);
+  } else if (attr_is(k, k_len, "width")) {
+    ps->width = strtod(s, NULL);
+  } else if (attr_is(k, k_len, "oneway")) {
+    ps->has_oneway = 1;
+    if (!strcmp(s, "yes") || !strcmp(s, "true") || !strcmp(s, "1")) {
+      ps->oneway = 1;
+    } else if (!strcmp(s, "-1") || !strcmp(s, "reverse")) {
+      ps->oneway = -1;
+    }
+  } else if (attr_is(k, k_len, "junction")) {
+    ps->is_roundabout = !strcmp(s, "roundabout");
+  } else if (attr_is(k, k_len, "building")) {
+    ps->is_building = 1;
+  } else if (attr_is(k, k_len, "area")) {
+    ps->is_area = !strcmp(s, "yes");
+  }
+  if (ps->name < -1 || ps->highway < -1) {
+    ps->failed = ROAD_GRAPH_ERR_MEMORY;
+  }
+}
+
+/* Keep roads: ways with a highway or lanes tag */
+static void end_way(Parser *ps) {
+  size_t n_refs = ps->refs.n;
+  int ok = 1;
+  ps->context = IN_NONE;
+  if (!(ps->has_highway || ps->has_lanes) || ps->is_building || ps->is_area ||
+      n_refs < 2) {
+    return;
+  }
+  if (!ps->has_oneway && ps->is_roundabout) {
+    ps->oneway = 1;
+  }
+  ok = ok && vec_push(&ps->way_id_v, 1);
+  ok = ok && vec_push(&ps->way_count, 1);
+  ok = ok && vec_push(&ps->way_refs, n_refs);
+  ok = ok && vec_push(&ps->way_name, 1) && vec_push(&ps->way_highway, 1);
+  ok = ok && vec_push(&ps->way_lanes, 1) && vec_push(&ps->way_oneway, 1);
+  ok = ok && vec_push(&ps->way_width, 1);
+  if (!ok) {
+    ps->failed = ROAD_GRAPH_ERR_MEMORY;
+    return;
+  }
+  memcpy(ps->way_refs.data + (ps->way_refs.n - n_refs) * sizeof(int64_t),
+         ps->refs.data, n_refs * sizeof(int64_t));
+  {
+    size_t w = ps->way_id_v.n - 1;
+    VEC_AT(ps->way_id_v, int64_t, w) = ps->way_id;
+    VEC_AT(ps->way_count, uint32_t, w) = n_refs;
+    VEC_AT(ps->way_name, int32_t, w) = ps->name;
+    VEC_AT(ps->way_highway, int32_t, w) = ps->highway;
+    VEC_AT(ps->way_lanes, int32_t, w) = ps->lanes;
+    VEC_AT(ps->way_oneway, int32_t, w) = ps->oneway;
+    VEC_AT(ps->way_width, double, w) = ps->width;
+  }
+}
+
+static void read_node(Parser *ps, const char *attrs, const char *end) {
+  const char *name, *value;
+  size_t name_len, value_len, idx;
+  int64_t id = 0;
+  double lat = NAN, lon = NAN;
+  while (next_attr(&attrs, end, &name, &name_len, &value, &value_len)) {
+    if (attr_is(name, name_len, "id")) {
+      id = strtoll(value, NULL, 10);
+    } else if (attr_is(name, name_len, "lat")) {
+      lat = strtod(value, NULL);
+    } else if (attr_is(name, name_len, "lon")) {
+      lon = strtod(value, NULL);
+    }
+  }
+  if (find_node(ps, id, &idx)) {
+    ps->lat[idx] = lat;
+    ps->lon[idx] = lon;
+    ps->n_found += !ps->found[idx];
+    ps->found[idx] = 1;
+  }
+}
+
+static void read_bounds(Parser *ps, const char *attrs, const char *end) {
+  const char *name, *value;
+  size_t name_len, value_len;
+  while (next_attr(&attrs, end, &name, &name_len, &value, &value_len)) {
+    if (attr_is(name, name_len, "minlat")) {
+      ps->minlat = strtod(value, NULL);
+    } else if (attr_is(name, name_len, "minlon")) {
+      ps->minlon = strtod(value, NULL);
+    } else if (attr_is(name, name_len, "maxlat")) {
+      ps->maxlat = strtod(value, NULL);
+    } else if (attr_is(name, name_len, "maxlon")) {
+      ps->maxlon = strtod(value, NULL);
+    }
+  }
+  ps->has_bounds = 1;
+}
+
+/* Handle one tag, without its angle brackets, and null terminated */
+static void process_tag(Parser *ps, const char *tag, size_t len) {
+  const char *end = tag + len, *attrs = tag;
+  int is_closed = len > 0 && tag[len - 1] == '/';
+  size_t name_len;
+  if (len == 0 || tag[0] == '?' || tag[0] == '!') {
+    return;
+  }
+  if (tag[0] == '/') {
+    if (ps->context == IN_WAY && len >= 4 && !memcmp(tag, "/way", 4)) {
+      if (ps->pass == 1) {
+        end_way(ps);
+      }
+      ps->context = IN_NONE;
+    } else if (ps->context != IN_WAY) {
+      ps->context = IN_NONE;
+    }
+    return;
+  }
+  while (attrs < end && *attrs != ' ' && *attrs != '/' && *attrs != '\t' &&
+         *attrs != '\n' && *attrs != '\r') {
+    attrs++;
+  }
+  name_len = attrs - tag;
+  if (is_closed) {
+    end--;
+  }
+  if (attr_is(tag, name_len, "nd")) {
+    if (ps->pass == 1 && ps->context == IN_WAY) {
+      const char *name, *value;
+      size_t n_len, v_len;
+      while (next_attr(&attrs, end, &name, &n_len, &value, &v_len)) {
+        if (attr_is(name, n_len, "ref")) {
+          int64_t *ref = vec_push(&ps->refs, 1);
+          if (!ref) {
+            ps->failed = ROAD_GRAPH_ERR_MEMORY;
+            return;
+          }
+          *ref = strtoll(value, NULL, 10);
+        }
+      }
+    }
+  } else if (attr_is(tag, name_len, "tag")) {
+    if (ps->pass == 1 && ps->context == IN_WAY) {
+      way_tag(ps, attrs, end);
+    }
+  } else if (attr_is(tag, name_len, "node")) {
+    if (ps->pass == 2) {
+      read_node(ps, attrs, end);
+    }
+    ps->context = is_closed ? IN_NONE : IN_NODE;
+  } else if (attr_is(tag, name_len, "way")) {
+    if (ps->pass == 1) {
+      begin_way(ps, attrs, end);
+      if (is_closed) {
+        end_way(ps);
+      }
+    }
+    ps->context = is_closed ? IN_NONE : IN_WAY;
+  } else if (attr_is(tag, name_len, "bounds")) {
+    if (ps->pass == 1) {
+      read_bounds(ps, attrs, end);
+    }
+  } else if (!is_closed && ps->context == IN_NONE) {
+    /* relation, or the osm root, holds nothing for us */
+    ps->context = attr_is(tag, name_len, "osm") ? IN_NONE : IN_OTHER;
+  }
+}
+
+/* Split a chunk of the file into tags, which may continue across chunks */
+static void feed(Parser *ps, const char *buf, size_t len) {
+  const char *p = buf, *end = buf + len;
+  while (p < end && !ps->failed) {
+    if (!ps->in_tag) {
+      p = memchr(p, '<', end - p);
+      if (!p) {
+        return;
+      }
+      p++;
+      ps->in_tag = 1;
+      ps->quote = 0;
+      ps->tag.n = 0;
+      continue;
+    }
+    {
+      /* Copy until the closing bracket, outside of quotes */
+      const char *start = p;
+      char *dst;
+      while (p < end) {
+        char c = *p;
+        if (ps->quote) {
+          if (c == ps->quote) {
+            ps->quote = 0;
+          }
+        } else if (c == '"' || c == '\'') {
+          ps->quote = c;
+        } else if (c == '>') {
+          break;
+        }
+        p++;
+      }
+      dst = vec_push(&ps->tag, p - start + 1);
+      if (!dst) {
+        ps->failed = ROAD_GRAPH_ERR_MEMORY;
+        return;
+      }
+      memcpy(dst, start, p - start);
+      /* Room for the terminator, without counting it */
+      ps->tag.n--;
+      if (p < end) {
+        ps->tag.data[ps->tag.n] = '\0';
+        process_tag(ps, ps->tag.data, ps->tag.n);
+        ps->in_tag = 0;
+        p++;
+      }
+    }
+  }
+}
+
+static int stream_file(Parser *ps, const char *filename, int pass) {
+  FILE *f = fopen(filename, "rb");
+  char *buf;
+  size_t n;
+  if (!f) {
+    return ROAD_GRAPH_ERR_OPEN;
+  }
+  buf = malloc(CHUNK_SIZE);
+  if (!buf) {
+    fclose(f);
+    return ROAD_GRAPH_ERR_MEMORY;
+  }
+  ps->pass = pass;
+  ps->context = IN_NONE;
+  ps->in_tag = 0;
+  while (!ps->failed && (n = fread(buf, 1, CHUNK_SIZE, f)) > 0) {
+    feed(ps, buf, n);
+    /* Nodes come before ways, so stop once all are found */
+    if (pass == 2 && ps->n_found == ps->n_nodes) {
+      break;
+    }
+  }
+  free(buf);
+  fclose(f);
+  return ps->failed;
+}
+
+static int compare_id(const void *a, const void *b) {
+  int64_t ia = *(const int64_t *)a, ib = *(const int64_t *)b;
+  return ia < ib ? -1 : (ia > ib ? 1 : 0);
+}
+
+static void free_parser(Parser *ps) {
+  free(ps->tag.data);
+  free(ps->refs.data);
+  free(ps->way_id_v.data);
+  free(ps->way_count.data);
+  free(ps->way_refs.data);
+  free(ps->way_name.data);
+  free(ps->way_highway.data);
+  free(ps->way_lanes.data);
+  free(ps->way_oneway.data);
+  free(ps->way_width.data);
+  free(ps->str_ptr.data);
+  free(ps->str_chars.data);
+  free(ps->str_hash);
+  free(ps->scratch.data);
+  free(ps->node_id);
+  free(ps->lat);
+  free(ps->lon);
+  free(ps->found);
+}
+
+/* Keep the nodes that were found, dropping them from their ways, then
+ * form the edges
+ */
+static int finish_graph(Parser *ps, RoadGraph *g) {
+  size_t n_ways_in = ps->way_id_v.n;
+  uint32_t *remap = malloc((ps->n_nodes ? ps->n_nodes : 1) * sizeof(uint32_t));
+  uint32_t *degree = NULL;
+  size_t i, w, r, n_nodes = 0, n_ways = 0, n_way_nodes = 0, n_edges = 0;
+  size_t n_strings = ps->str_ptr.n ? ps->str_ptr.n - 1 : 0;
+  if (!remap) {
+    return ROAD_GRAPH_ERR_MEMORY;
+  }
+  for (i = 0; i < ps->n_nodes; i++) {
+    remap[i] = ps->found[i] ? n_nodes++ : UINT32_MAX;
+  }
+  g->is_owner = 1;
+  g->node_id = malloc((n_nodes + 1) * sizeof(int64_t));
+  g->lat = malloc((n_nodes + 1) * sizeof(double));
+  g->lon = malloc((n_nodes + 1) * sizeof(double));
+  g->x = calloc(n_nodes + 1, sizeof(double));
+  g->y = calloc(n_nodes + 1, sizeof(double));
+  g->row_ptr = calloc(n_nodes + 1, sizeof(uint32_t));
+  g->way_id = malloc((n_ways_in + 1) * sizeof(int64_t));
+  g->way_ptr = malloc((n_ways_in + 1) * sizeof(uint32_t));
+  g->way_node = malloc((ps->way_refs.n + 1) * sizeof(uint32_t));
+  g->way_name = malloc((n_ways_in + 1) * sizeof(int32_t));
+  g->way_highway = malloc((n_ways_in + 1) * sizeof(int32_t));
+  g->way_lanes = malloc((n_ways_in + 1) * sizeof(int32_t));
+  g->way_oneway = malloc((n_ways_in + 1) * sizeof(int32_t));
+  g->way_width = malloc((n_ways_in + 1) * sizeof(double));
+  g->str_ptr = malloc((n_strings + 1) * sizeof(uint32_t));
+  g->str_chars = malloc(ps->str_chars.n + 1);
+  degree = calloc(n_nodes + 1, sizeof(uint32_t));
+  if (!g->node_id || !g->lat || !g->lon || !g->x || !g->y || !g->row_ptr ||
+      !g->way_id || !g->way_ptr || !g->way_node || !g->way_name ||
+      !g->way_highway || !g->way_lanes || !g->way_oneway || !g->way_width ||
+      !g->str_ptr || !g->str_chars || !degree) {
+    free(remap);
+    free(degree);
+    return ROAD_GRAPH_ERR_MEMORY;
+  }
+  for (i = 0; i < ps->n_nodes; i++) {
+    if (remap[i] != UINT32_MAX) {
+      g->node_id[remap[i]] = ps->node_id[i];
+      g->lat[remap[i]] = ps->lat[i];
+      g->lon[remap[i]] = ps->lon[i];
+    }
+  }
+  /* Ways with at least two distinct nodes left */
+  g->way_ptr[0] = 0;
+  for (w = 0, r = 0; w < n_ways_in; w++) {
+    uint32_t count = VEC_AT(ps->way_count, uint32_t, w);
+    size_t start = n_way_nodes;
+    for (i = 0; i < count; i++, r++) {
+      size_t idx;
+      uint32_t node;
+      if (!find_node(ps, VEC_AT(ps->way_refs, int64_t, r), &idx) ||
+          remap[idx] == UINT32_MAX) {
+        continue;
+      }
+      node = remap[idx];
+      if (n_way_nodes > start && g->way_node[n_way_nodes - 1] == node) {
+        continue;
+      }
+      g->way_node[n_way_nodes++] = node;
+    }
+    if (n_way_nodes - start < 2) {
+      n_way_nodes = start;
+      continue;
+    }
+    g->way_id[n_ways] = VEC_AT(ps->way_id_v, int64_t, w);
+    g->way_name[n_ways] = VEC_AT(ps->way_name, int32_t, w);
+    g->way_highway[n_ways] = VEC_AT(ps->way_highway, int32_t, w);
+    g->way_lanes[n_ways] = VEC_AT(ps->way_lanes, int32_t, w);
+    g->way_oneway[n_ways] = VEC_AT(ps->way_oneway, int32_t, w);
+    g->way_width[n_ways] = VEC_AT(ps->way_width, double, w);
+    n_ways++;
+    g->way_ptr[n_ways] = n_way_nodes;
+  }
+  free(remap);
+  /* Count, then place, the directed edges of each node */
+  for (w = 0; w < n_ways; w++) {
+    for (i = g->way_ptr[w]; i + 1 < g->way_ptr[w + 1]; i++) {
+      uint32_t a = g->way_node[i], b = g->way_node[i + 1];
+      if (g->way_oneway[w] >= 0) {
+        degree[a]++;
+      }
+      if (g->way_oneway[w] <= 0) {
+        degree[b]++;
+      }
+    }
+  }
+  for (i = 0; i < n_nodes; i++) {
+    g->row_ptr[i + 1] = g->row_ptr[i] + degree[i];
+    degree[i] = g->row_ptr[i];
+  }
+  n_edges = g->row_ptr[n_nodes];
+  g->col = malloc((n_edges + 1) * sizeof(uint32_t));
+  g->edge_way = malloc((n_edges + 1) * sizeof(uint32_t));
+  if (!g->col || !g->edge_way) {
+    free(degree);
+    return ROAD_GRAPH_ERR_MEMORY;
+  }
+  for (w = 0; w < n_ways; w++) {
+    for (i = g->way_ptr[w]; i + 1 < g->way_ptr[w + 1]; i++) {
+      uint32_t a = g->way_node[i], b = g->way_node[i + 1];
+      if (g->way_oneway[w] >= 0) {
+        g->col[degree[a]] = b;
+        g->edge_way[degree[a]++] = w;
+      }
+      if (g->way_oneway[w] <= 0) {
+        g->col[degree[b]] = a;
+        g->edge_way[degree[b]++] = w;
+      }
+    }
+  }
+  free(degree);
+  if (n_strings > 0) {
+    memcpy(g->str_ptr, ps->str_ptr.data, (n_strings + 1) * sizeof(uint32_t));
+  } else {
+    g->str_ptr[0] = 0;
+  }
+  memcpy(g->str_chars, ps->str_chars.data, ps->str_chars.n);
+  g->n_nodes = n_nodes;
+  g->n_edges = n_edges;
+  g->n_ways = n_ways;
+  g->n_way_nodes = n_way_nodes;
+  g->n_strings = n_strings;
+  g->n_chars = ps->str_chars.n;
+  /* Without bounds, take those of the nodes */
+  if (ps->has_bounds) {
+    g->minlat = ps->minlat;
+    g->minlon = ps->minlon;
+    g->maxlat = ps->maxlat;
+    g->maxlon = ps->maxlon;
+  } else {
+    g->minlat = g->minlon = INFINITY;
+    g->maxlat = g->maxlon = -INFINITY;
+    for (i = 0; i < n_nodes; i++) {
+      g->minlat = fmin(g->minlat, g->lat[i]);
+      g->minlon = fmin(g->minlon, g->lon[i]);
+      g->maxlat = fmax(g->maxlat, g->lat[i]);
+      g->maxlon = fmax(g->maxlon, g->lon[i]);
+    }
+  }
+  g->lat0 = (g->minlat + g->maxlat) / 2;
+  g->lon0 = (g->minlon + g->maxlon) / 2;
+  return 0;
+}
+
+int road_graph_parse(const char *filename, RoadGraph *graph) {
+  struct stat st;
+  Parser ps;
+  int ret;
+  size_t i, n;
+  memset(&ps, 0, sizeof(ps));
+  memset(graph, 0, sizeof(RoadGraph));
+  if (stat(filename, &st) != 0) {
+    return ROAD_GRAPH_ERR_OPEN;
+  }
+  graph->source_size = (uint64_t)st.st_size;
+  graph->source_mtime = (int64_t)st.st_mtime;
+  vec_init(&ps.tag, 1);
+  vec_init(&ps.refs, sizeof(int64_t));
+  vec_init(&ps.way_id_v, sizeof(int64_t));
+  vec_init(&ps.way_count, sizeof(uint32_t));
+  vec_init(&ps.way_refs, sizeof(int64_t));
+  vec_init(&ps.way_name, sizeof(int32_t));
+  vec_init(&ps.way_highway, sizeof(int32_t));
+  vec_init(&ps.way_lanes, sizeof(int32_t));
+  vec_init(&ps.way_oneway, sizeof(int32_t));
+  vec_init(&ps.way_width, sizeof(double));
+  vec_init(&ps.str_ptr, sizeof(uint32_t));
+  vec_init(&ps.str_chars, 1);
+  vec_init(&ps.scratch, 1);
+  /* Ways, then the nodes that they reference */
+  ret = stream_file(&ps, filename, 1);
+  if (ret == 0) {
+    n = ps.way_refs.n;
+    ps.node_id = malloc((n ? n : 1) * sizeof(int64_t));
+    if (!ps.node_id) {
+      ret = ROAD_GRAPH_ERR_MEMORY;
+    }
+  }
+  if (ret == 0) {
+    memcpy(ps.node_id, ps.way_refs.data, n * sizeof(int64_t));
+    qsort(ps.node_id, n, sizeof(int64_t), compare_id);
+    for (i = 0; i < n; i++) {
+      if (ps.n_nodes == 0 || ps.node_id[ps.n_nodes - 1] != ps.node_id[i]) {
+        ps.node_id[ps.n_nodes++] = ps.node_id[i];
+      }
+    }
+    ps.lat = malloc((ps.n_nodes + 1) * sizeof(double));
+    ps.lon = malloc((ps.n_nodes + 1) * sizeof(double));
+    ps.found = calloc(ps.n_nodes + 1, 1);
+    if (!ps.lat || !ps.lon || !ps.found) {
+      ret = ROAD_GRAPH_ERR_MEMORY;
+    }
+  }
+  if (ret == 0) {
+    ret = stream_file(&ps, filename, 2);
+  }
+  if (ret == 0) {
+    ret = finish_graph(&ps, graph);
+  }
+  free_parser(&ps);
+  if (ret != 0) {
+    road_graph_free(graph);
+  }
+  return ret;
+}
+
+void road_graph_free(RoadGraph *graph) {
+  if (graph->is_owner) {
+    free(graph->node_id);
+    free(graph->lat);
+    free(graph->lon);
+    free(graph->x);
+    free(graph->y);
+    free(graph->row_ptr);
+    free(graph->col);
+    free(graph->edge_way);
+    free(graph->way_id);
+    free(graph->way_ptr);
+    free(graph->way_node);
+    free(graph->way_name);
+    free(graph->way_highway);
+    free(graph->way_lanes);
+    free(graph->way_oneway);
+    free(graph->way_width);
+    free(graph->str_ptr);
+    free(graph->str_chars);
+  }
+  memset(graph, 0, sizeof(RoadGraph));
+}
+
+/* Arrays in the order of the cache file */
+typedef struct {
+  void **ptr;
+  size_t size;
+} Section;
+
+#define N_SECTIONS 18
+
+static void get_sections(RoadGraph *g, Section *s) {
+  size_t nn = g->n_nodes, ne = g->n_edges, nw = g->n_ways;
+  Section sections[N_SECTIONS] = {
+      {(void **)&g->node_id, nn * sizeof(int64_t)},
+      {(void **)&g->lat, nn * sizeof(double)},
+      {(void **)&g->lon, nn * sizeof(double)},
+      {(void **)&g->x, nn * sizeof(double)},
+      {(void **)&g->y, nn * sizeof(double)},
+      {(void **)&g->row_ptr, (nn + 1) * sizeof(uint32_t)},
+      {(void **)&g->col, ne * sizeof(uint32_t)},
+      {(void **)&g->edge_way, ne * sizeof(uint32_t)},
+      {(void **)&g->way_id, nw * sizeof(int64_t)},
+      {(void **)&g->way_ptr, (nw + 1) * sizeof(uint32_t)},
+      {(void **)&g->way_node, g->n_way_nodes * sizeof(uint32_t)},
+      {(void **)&g->way_name, nw * sizeof(int32_t)},
+      {(void **)&g->way_highway, nw * sizeof(int32_t)},
+      {(void **)&g->way_lanes, nw * sizeof(int32_t)},
+      {(void **)&g->way_oneway, nw * sizeof(int32_t)},
+      {(void **)&g->way_width, nw * sizeof(double)},
+      {(void **)&g->str_ptr, (g->n_strings + 1) * sizeof(uint32_t)},
+      {(void **)&g->str_chars, g->n_chars},
+  };
+  memcpy(s, sections, sizeof(sections));
+}
+
+static size_t align8(size_t n) { return (n + 7) & ~(size_t)7; }
+
+int road_graph_save(const RoadGraph *graph, const char *filename) {
+  static const char zeros[8] = {0};
+  RoadGraph g = *graph;
+  Section sections[N_SECTIONS];
+  CacheHeader header;
+  FILE *f;
+  int i, ok;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+  header.version = CACHE_VERSION;
+  header.n_nodes = g.n_nodes;
+  header.n_edges = g.n_edges;
+  header.n_ways = g.n_ways;
+  header.n_way_nodes = g.n_way_nodes;
+  header.n_strings = g.n_strings;
+  header.n_chars = g.n_chars;
+  header.minlat = g.minlat;
+  header.minlon = g.minlon;
+  header.maxlat = g.maxlat;
+  header.maxlon = g.maxlon;
+  header.lat0 = g.lat0;
+  header.lon0 = g.lon0;
+  header.source_size = g.source_size;
+  header.source_mtime = g.source_mtime;
+  get_sections(&g, sections);
+  f = fopen(filename, "wb");
+  if (!f) {
+    return ROAD_GRAPH_ERR_OPEN;
+  }
+  ok = fwrite(&header, sizeof(header), 1, f) == 1;
+  for (i = 0; ok && i < N_SECTIONS; i++) {
+    size_t size = sections[i].size, pad = align8(size) - size;
+    ok = fwrite(*sections[i].ptr, 1, size, f) == size &&
+         fwrite(zeros, 1, pad, f) == pad;
+  }
+  if (fclose(f) != 0) {
+    ok = 0;
+  }
+  return ok ? 0 : ROAD_GRAPH_ERR_WRITE;
+}
+
+int road_graph_view(RoadGraph *graph, const void *data, size_t size) {
+  const CacheHeader *header = data;
+  Section sections[N_SECTIONS];
+  size_t offset = sizeof(CacheHeader);
+  int i;
+  memset(graph, 0, sizeof(RoadGraph));
+  if (size < sizeof(CacheHeader) ||
+      memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != CACHE_VERSION) {
+    return ROAD_GRAPH_ERR_FORMAT;
+  }
+  graph->n_nodes = header->n_nodes;
+  graph->n_edges = header->n_edges;
+  graph->n_ways = header->n_ways;
+  graph->n_way_nodes = header->n_way_nodes;
+  graph->n_strings = header->n_strings;
+  graph->n_chars = header->n_chars;
+  graph->minlat = header->minlat;
+  graph->minlon = header->minlon;
+  graph->maxlat = header->maxlat;
+  graph->maxlon = header->maxlon;
+  graph->lat0 = header->lat0;
+  graph->lon0 = header->lon0;
+  graph->source_size = header->source_size;
+  graph->source_mtime = header->source_mtime;
+  get_sections(graph, sections);
+  for (i = 0; i < N_SECTIONS; i++) {
+    if (offset + sections[i].size > size) {
+      memset(graph, 0, sizeof(RoadGraph));
+      return ROAD_GRAPH_ERR_FORMAT;
+    }
+    *sections[i].ptr = (char *)data + offset;
+    offset += align8(sections[i].size);
+  }
+  /* The ends of the offset arrays must agree with the counts */
+  if (graph->row_ptr[graph->n_nodes] != graph->n_edges ||
+      graph->way_ptr[graph->n_ways] != graph->n_way_nodes ||
+      graph->str_ptr[graph->n_strings] != graph->n_chars) {
+    memset(graph, 0, sizeof(RoadGraph));
+    return ROAD_GRAPH_ERR_FORMAT;
+  }
+  return 0;
+}
+
+int road_graph_is_current(const RoadGraph *graph, const char *filename) {
+  struct stat st;
+  if (stat(filename, &st) != 0) {
+    return 0;
+  }
+  return graph->source_size == (uint64_t)st.st_size &&
+         graph->source_mtime == (int64_t)st.st_mtime;
+}
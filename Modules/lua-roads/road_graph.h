@@ -0,0 +1,70 @@
+#pragma once
+/*
+Road graph of an OSM extract
+The XML is streamed twice, first for the ways with a highway or lanes tag,
+then for the coordinates of only their nodes. Arrays are laid out as in the
+cache file, so that a memory mapped cache is used in place.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Errors */
+#define ROAD_GRAPH_ERR_OPEN (-1)
+#define ROAD_GRAPH_ERR_MEMORY (-2)
+#define ROAD_GRAPH_ERR_FORMAT (-3)
+#define ROAD_GRAPH_ERR_WRITE (-4)
+
+typedef struct {
+  uint32_t n_nodes, n_edges, n_ways, n_way_nodes, n_strings, n_chars;
+  /* Bounds of the extract, in degrees */
+  double minlat, minlon, maxlat, maxlon;
+  /* Origin of x and y, where x is east and y is north in meters */
+  double lat0, lon0;
+  /* Size and modification time of the OSM file, to tell a stale cache */
+  uint64_t source_size;
+  int64_t source_mtime;
+  /* Nodes */
+  int64_t *node_id;
+  double *lat, *lon;
+  double *x, *y;
+  /* Directed edges from node i are [row_ptr[i], row_ptr[i + 1]), to node
+   * col[e] along way edge_way[e]
+   */
+  uint32_t *row_ptr, *col, *edge_way;
+  /* Nodes of way i are way_node[way_ptr[i]] to way_node[way_ptr[i + 1] - 1] */
+  int64_t *way_id;
+  uint32_t *way_ptr, *way_node;
+  /* Strings, or -1 when untagged */
+  int32_t *way_name, *way_highway;
+  /* Lanes, or 0 when untagged. Oneway is 1 along the nodes, -1 against */
+  int32_t *way_lanes, *way_oneway;
+  /* Meters, or NaN */
+  double *way_width;
+  /* String i is str_chars[str_ptr[i]], and null terminated */
+  uint32_t *str_ptr;
+  char *str_chars;
+  /* Whether the arrays were allocated, rather than viewed */
+  int is_owner;
+} RoadGraph;
+
+/* Parse an OSM XML file. x and y are zero until projected.
+ * Returns 0 or an error
+ */
+int road_graph_parse(const char *filename, RoadGraph *graph);
+
+/* Free a parsed graph. A view only forgets its pointers */
+void road_graph_free(RoadGraph *graph);
+
+/* Write the cache file. Returns 0 or an error */
+int road_graph_save(const RoadGraph *graph, const char *filename);
+
+/* Point the graph into the memory of a cache file, which must stay mapped.
+ * Returns 0 or an error
+ */
+int road_graph_view(RoadGraph *graph, const void *data, size_t size);
+
+/* Whether the graph was parsed from the OSM file as it is now.
+ * Returns 1, or 0 if the file changed or cannot be read
+ */
+int road_graph_is_current(const RoadGraph *graph, const char *filename);
@@ -0,0 +1,255 @@
+-- Road graph of an OSM extract, parsed natively and cached to a file
+-- that is memory mapped on later runs
+local lib = {}
+
+local ffi = require'ffi'
+local cos = require'math'.cos
+local rad = require'math'.rad
+local tinsert = require'table'.insert
+
+local has_proj, proj = pcall(require, 'proj')
+local has_mmap, mmap = pcall(require, 'mmap')
+
+ffi.cdef[[
+typedef struct {
+  uint32_t n_nodes, n_edges, n_ways, n_way_nodes, n_strings, n_chars;
+  double minlat, minlon, maxlat, maxlon;
+  double lat0, lon0;
+  uint64_t source_size;
+  int64_t source_mtime;
+  int64_t *node_id;
+  double *lat, *lon;
+  double *x, *y;
+  uint32_t *row_ptr, *col, *edge_way;
+  int64_t *way_id;
+  uint32_t *way_ptr, *way_node;
+  int32_t *way_name, *way_highway;
+  int32_t *way_lanes, *way_oneway;
+  double *way_width;
+  uint32_t *str_ptr;
+  char *str_chars;
+  int is_owner;
+} RoadGraph;
+int road_graph_parse(const char *filename, RoadGraph *graph);
+void road_graph_free(RoadGraph *graph);
+int road_graph_save(const RoadGraph *graph, const char *filename);
+int road_graph_view(RoadGraph *graph, const void *data, size_t size);
+int road_graph_is_current(const RoadGraph *graph, const char *filename);
+]]
+local road_graph = ffi.load'road_graph'
+
+local errors = {
+  [-1] = "Could not open the file",
+  [-2] = "Out of memory",
+  [-3] = "Not a road graph cache",
+  [-4] = "Could not write the file",
+}
+
+-- Interned string, or nil when untagged
+local function get_string(self, idx)
+  if idx < 0 then return end
+  return ffi.string(self.c.str_chars + self.c.str_ptr[idx])
+end
+
+-- Attributes and nodes, indexed from 0, of way w, also from 0
+local function get_way(self, w)
+  local c = self.c
+  local nodes = {}
+  for k=c.way_ptr[w], c.way_ptr[w + 1] - 1 do
+    tinsert(nodes, c.way_node[k])
+  end
+  local width = c.way_width[w]
+  return {
+    id = tonumber(c.way_id[w]),
+    name = get_string(self, c.way_name[w]),
+    highway = get_string(self, c.way_highway[w]),
+    lanes = c.way_lanes[w] > 0 and c.way_lanes[w] or nil,
+    width = width == width and width or nil,
+    oneway = c.way_oneway[w],
+    nodes = nodes,
+  }
+end
+
+local function reverse(t)
+  local n = #t
+  for k=1, math.floor(n / 2) do
+    t[k], t[n + 1 - k] = t[n + 1 - k], t[k]
+  end
+  return t
+end
+
+-- Iterate the nodes reachable from node i, with the way of each edge
+local function neighbors(self, i)
+  local c = self.c
+  local e, e_end = c.row_ptr[i] - 1, c.row_ptr[i + 1]
+  return function()
+    e = e + 1
+    if e < e_end then return c.col[e], c.edge_way[e] end
+  end
+end
+
+-- Ways split at intersections, and the intersections, as written by
+-- roads.lua. With xy, segments include their points in meters.
+-- Unlike roads.lua, which kept the node order and any oneway tag as true,
+-- a oneway segment always runs along its points: ways tagged oneway=-1
+-- have their points, xy and links reversed
+local function get_segments(self, options)
+  if type(options) ~= 'table' then options = {} end
+  local c = self.c
+  -- Nodes referenced more than once are intersections
+  local n_refs = ffi.new('uint8_t[?]', c.n_nodes)
+  for k=0, c.n_way_nodes - 1 do
+    local i = c.way_node[k]
+    if n_refs[i] < 2 then n_refs[i] = n_refs[i] + 1 end
+  end
+  local segments, intersections = {}, {}
+  local function add_link(i, id)
+    local ref = string.format("%d", tonumber(c.node_id[i]))
+    local intersection = intersections[ref]
+    if not intersection then
+      intersection = {point = {c.lat[i], c.lon[i]}, segments = {}}
+      intersections[ref] = intersection
+    end
+    tinsert(intersection.segments, id)
+    return ref
+  end
+  for w=0, c.n_ways - 1 do
+    local way = get_way(self, w)
+    local k_start = 1
+    for k=2, #way.nodes do
+      local i = way.nodes[k]
+      if k == #way.nodes or n_refs[i] > 1 then
+        local id = string.format("W%d_%d", way.id, k_start)
+        local points, xy = {}, options.xy and {}
+        for kk=k_start, k do
+          local ii = way.nodes[kk]
+          tinsert(points, {c.lat[ii], c.lon[ii]})
+          if xy then tinsert(xy, {c.x[ii], c.y[ii]}) end
+        end
+        local i_start = way.nodes[k_start]
+        local links = {
+          n_refs[i_start] > 1 and add_link(i_start, id),
+          n_refs[i] > 1 and add_link(i, id),
+        }
+        -- Traffic goes against the node order
+        if way.oneway < 0 then
+          reverse(points)
+          if xy then reverse(xy) end
+          links[1], links[2] = links[2], links[1]
+        end
+        segments[id] = {
+          name = way.name,
+          highway = way.highway,
+          lanes = way.lanes,
+          width = way.width,
+          oneway = way.oneway ~= 0 or nil,
+          points = points,
+          xy = xy,
+          links = links,
+        }
+        k_start = k
+      end
+    end
+  end
+  return segments, intersections
+end
+
+local function get_bounds(self)
+  local c = self.c
+  return {
+    minlat = c.minlat, minlon = c.minlon,
+    maxlat = c.maxlat, maxlon = c.maxlon,
+  }
+end
+
+local function save(self, filename)
+  local ret = road_graph.road_graph_save(self.c, filename)
+  if ret ~= 0 then return false, errors[ret] end
+  return self
+end
+
+local function tostring_graph(self)
+  local c = self.c
+  return string.format("Road graph | %d nodes, %d edges, %d ways",
+    c.n_nodes, c.n_edges, c.n_ways)
+end
+
+local mt = {
+  __tostring = tostring_graph
+}
+
+local function wrap(c, mapping)
+  return setmetatable({
+    c = c,
+    -- Keep the memory map of a cache alive with the graph
+    mapping = mapping,
+    string = get_string,
+    way = get_way,
+    neighbors = neighbors,
+    segments = get_segments,
+    bounds = get_bounds,
+    save = save,
+  }, mt)
+end
+
+-- Parse an OSM file, projecting to meters east and north of origin, a
+-- {lat, lon} pair defaulting to the middle of the bounds
+function lib.parse(filename, origin)
+  local c = ffi.gc(ffi.new'RoadGraph', road_graph.road_graph_free)
+  local ret = road_graph.road_graph_parse(filename, c)
+  if ret ~= 0 then return false, errors[ret] end
+  if type(origin) == 'table' then
+    c.lat0, c.lon0 = origin[1], origin[2]
+  end
+  local lat, lon, x, y = c.lat, c.lon, c.x, c.y
+  if has_proj then
+    local P = proj.new{c.lat0, c.lon0}
+    for i=0, c.n_nodes - 1 do
+      x[i], y[i] = P:enu(lat[i], lon[i])
+    end
+  else
+    -- Equirectangular, without luajit-proj
+    local m_per_lat = rad(6378137)
+    local m_per_lon = m_per_lat * cos(rad(c.lat0))
+    for i=0, c.n_nodes - 1 do
+      x[i] = (lon[i] - c.lon0) * m_per_lon
+      y[i] = (lat[i] - c.lat0) * m_per_lat
+    end
+  end
+  return wrap(c)
+end
+
+-- Map a cache file written by save
+function lib.load(filename)
+  if not has_mmap then return false, mmap end
+  local mapping, err = mmap.open(filename)
+  if not mapping then return false, err end
+  local ptr, sz = mapping[1], mapping[2]
+  local c = ffi.new'RoadGraph'
+  local ret = road_graph.road_graph_view(c, ptr, sz)
+  if ret ~= 0 then return false, errors[ret] end
+  return wrap(c, mapping)
+end
+
+-- Load the cache of an OSM file, or parse and write it
+function lib.open(filename, cache)
+  if type(cache) ~= 'string' then
+    cache = filename:gsub('%.osm$', '')..'.graph'
+  end
+  local f_cache = io.open(cache)
+  if f_cache then
+    f_cache:close()
+    local graph = lib.load(cache)
+    -- Parse again if the OSM file changed since the cache was written
+    if graph and road_graph.road_graph_is_current(graph.c, filename) == 1 then
+      return graph
+    end
+  end
+  local graph, err = lib.parse(filename)
+  if not graph then return false, err end
+  -- The cache is only for speed, so keep the graph regardless
+  graph:save(cache)
+  return graph
+end
+
+return lib
@@ -197,127 +197,148 @@ local function get_split(segment, intersection_ref)
   return ip
 end
 
--- Node references to keep
-local nodes = {}
--- Ways to keep
-local ways = {}
-local bounds = get_bound(fname)
-assert(type(bounds)=='table', 'Did not find the bounds')
-process_in_way(fname, nodes, ways)
--- Done with attribute saving
-attr2way = nil
---
-save_nodes(fname, nodes)
-associate_ways(nodes, ways)
-ways = as_hashtable(ways)
-local intersections= to_intersections(nodes, ways)
--- SPLIT ZONE --
-local segments2 = {}
-local segments = ways
+-- Parse in Lua, holding the file in tables
+local function parse_lua(filename)
+  -- Node references to keep
+  local nodes = {}
+  -- Ways to keep
+  local ways = {}
+  local bounds = get_bound(filename)
+  assert(type(bounds)=='table', 'Did not find the bounds')
+  process_in_way(filename, nodes, ways)
+  -- Done with attribute saving
+  attr2way = nil
+  --
+  save_nodes(filename, nodes)
+  associate_ways(nodes, ways)
+  ways = as_hashtable(ways)
+  local intersections= to_intersections(nodes, ways)
+  -- SPLIT ZONE --
+  local segments2 = {}
+  local segments = ways
 
--- Set the intersection points in the segments
-for _, segment in pairs(segments) do
-  segment.intersections = {}
-  for i=1, #segment.points do segment.intersections[i] = false end
-  -- Must include the end points
-  segment.intersections[1] = true
-  segment.intersections[#segment.points] = true
-end
-for intersection_ref, intersection in pairs(intersections) do
-  -- local p = intersection.point
-  for _, s in ipairs(intersection.segments) do
-    local segment = segments[s]
-    --local ip = assert(get_split1(segment, intersection))
-    local ip = assert(get_split(segment, intersection_ref))
-    segment.intersections[ip] = intersection_ref
+  -- Set the intersection points in the segments
+  for _, segment in pairs(segments) do
+    segment.intersections = {}
+    for i=1, #segment.points do segment.intersections[i] = false end
+    -- Must include the end points
+    segment.intersections[1] = true
+    segment.intersections[#segment.points] = true
   end
-end
-
--- Find the split points
-local segment_ip_pairs = {}
-for ref, segment in pairs(segments) do
-  -- This is sorted, too
-  local split_ips = {}
-  for ip, intersected in ipairs(segment.intersections) do
-    if intersected then table.insert(split_ips, ip) end
+  for intersection_ref, intersection in pairs(intersections) do
+    -- local p = intersection.point
+    for _, s in ipairs(intersection.segments) do
+      local segment = segments[s]
+      --local ip = assert(get_split1(segment, intersection))
+      local ip = assert(get_split(segment, intersection_ref))
+      segment.intersections[ip] = intersection_ref
+    end
   end
-  local ip_pairs = {}
-  for i=1,#split_ips-1 do
-    local ip1 = split_ips[i]
-    local ip2 = split_ips[i+1]
-    table.insert(ip_pairs, {ip1, ip2})
+
+  -- Find the split points
+  local segment_ip_pairs = {}
+  for ref, segment in pairs(segments) do
+    -- This is sorted, too
+    local split_ips = {}
+    for ip, intersected in ipairs(segment.intersections) do
+      if intersected then table.insert(split_ips, ip) end
+    end
+    local ip_pairs = {}
+    for i=1,#split_ips-1 do
+      local ip1 = split_ips[i]
+      local ip2 = split_ips[i+1]
+      table.insert(ip_pairs, {ip1, ip2})
+    end
+    -- print("Pairs", 1, #segment.intersections)
+    -- for i, p in ipairs(ip_pairs) do
+    --   print(unpack(p))
+    -- end
+    segment_ip_pairs[ref] = ip_pairs
   end
-  -- print("Pairs", 1, #segment.intersections)
-  -- for i, p in ipairs(ip_pairs) do
-  --   print(unpack(p))
-  -- end
-  segment_ip_pairs[ref] = ip_pairs
-end
 
--- Correct everything now
-local new_ids = {}
-for ref, segment in pairs(segments) do
-  for _, ip_pair in ipairs(segment_ip_pairs[ref]) do
-    -- Find the next split point
-    local ip1, ip2 = unpack(ip_pair)
-    -- Split the segment
-    local seg_id = gen_id(segments2)
-    -- Copy all information
-    local seg = {}
-    for k,v in pairs(segment) do seg[k] = v end
-    seg.points = {unpack(segment.points, ip1, ip2)}
-    seg.links = {false, false}
-    segments2[seg_id] = seg
-    table.insert(new_ids, seg_id)
-    if segment.intersections[ip1]~=true then
-      -- Update the first intersection
-      seg.links[1] = segment.intersections[ip1]
-      local intersection1 = intersections[segment.intersections[ip1]]
-      table.insert(intersection1.segments, seg_id)
+  -- Correct everything now
+  local new_ids = {}
+  for ref, segment in pairs(segments) do
+    for _, ip_pair in ipairs(segment_ip_pairs[ref]) do
+      -- Find the next split point
+      local ip1, ip2 = unpack(ip_pair)
+      -- Split the segment
+      local seg_id = gen_id(segments2)
+      -- Copy all information
+      local seg = {}
+      for k,v in pairs(segment) do seg[k] = v end
+      seg.points = {unpack(segment.points, ip1, ip2)}
+      seg.links = {false, false}
+      segments2[seg_id] = seg
+      table.insert(new_ids, seg_id)
+      if segment.intersections[ip1]~=true then
+        -- Update the first intersection
+        seg.links[1] = segment.intersections[ip1]
+        local intersection1 = intersections[segment.intersections[ip1]]
+        table.insert(intersection1.segments, seg_id)
+      end
+      if segment.intersections[ip2]~=true then
+        seg.links[2] = segment.intersections[ip2]
+        -- Update the second intersection
+        local intersection2 = intersections[segment.intersections[ip2]]
+        table.insert(intersection2.segments, seg_id)
+      end
     end
-    if segment.intersections[ip2]~=true then
-      seg.links[2] = segment.intersections[ip2]
-      -- Update the second intersection
-      local intersection2 = intersections[segment.intersections[ip2]]
-      table.insert(intersection2.segments, seg_id)
+  end
+
+  -- Show the final points
+  local nLinks = 0
+  for _, intersection in pairs(intersections) do
+    --for k,v in pairs(intersection) do print(k) end
+    -- local p = intersection.point
+    -- print("Point", unpack(p))
+    -- print("Segments", unpack(intersection.segments))
+    local filtered = {}
+    for _, s in ipairs(intersection.segments) do
+      if s:match'%a%d+' then table.insert(filtered, s) end
     end
+    intersection.segments = filtered
+    --print("Segments", unpack(intersection.segments))
+    -- local inter = {}
+    -- for i, ref in ipairs(intersection.segments) do
+    --   inter[i] = segments2[ref].name
+    -- end
+    --print(table.concat(inter,'\t'))
+    intersection.ref = nil
+    nLinks = nLinks + 1
   end
-end
 
--- Show the final points
-local nLinks = 0
-for _, intersection in pairs(intersections) do
-  --for k,v in pairs(intersection) do print(k) end
-  -- local p = intersection.point
-  -- print("Point", unpack(p))
-  -- print("Segments", unpack(intersection.segments))
-  local filtered = {}
-  for _, s in ipairs(intersection.segments) do
-    if s:match'%a%d+' then table.insert(filtered, s) end
+  local nSegments = 0
+  for _, s in pairs(segments2) do
+    s.refs = nil
+    s.intersections = nil
+    --print(ref, s)
+    --print(assert(s.name))
+    --for k,v in pairs(s) do print(k, type(v)) end
+    nSegments = nSegments + 1
   end
-  intersection.segments = filtered
-  --print("Segments", unpack(intersection.segments))
-  -- local inter = {}
-  -- for i, ref in ipairs(intersection.segments) do
-  --   inter[i] = segments2[ref].name
-  -- end
-  --print(table.concat(inter,'\t'))
-  intersection.ref = nil
-  nLinks = nLinks + 1
-end
 
-local nSegments = 0
-for _, s in pairs(segments2) do
-  s.refs = nil
-  s.intersections = nil
-  --print(ref, s)
-  --print(assert(s.name))
-  --for k,v in pairs(s) do print(k, type(v)) end
-  nSegments = nSegments + 1
+  bounds.nSegments = nSegments
+  bounds.nLinks = nLinks
+  return segments2, intersections, bounds
 end
 
-bounds.nSegments = nSegments
-bounds.nLinks = nLinks
+local segments2, intersections, bounds
+local has_graph, road_graph = pcall(require, 'road_graph')
+if has_graph then
+  -- Stream natively, through the cache of the road graph
+  local graph = assert(road_graph.open(fname))
+  io.stderr:write(tostring(graph), '\n')
+  segments2, intersections = graph:segments()
+  bounds = graph:bounds()
+  local nSegments, nLinks = 0, 0
+  for _ in pairs(segments2) do nSegments = nSegments + 1 end
+  for _ in pairs(intersections) do nLinks = nLinks + 1 end
+  bounds.nSegments = nSegments
+  bounds.nLinks = nLinks
+else
+  segments2, intersections, bounds = parse_lua(fname)
+end
 
 local has_json, json = pcall(require, 'cjson')
 local has_mp, mp = pcall(require, 'MessagePack')
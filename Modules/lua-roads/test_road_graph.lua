@@ -0,0 +1,108 @@
+#!/usr/bin/env luajit
+local road_graph = require'road_graph'
+
+-- A crossroads of a two-way street and a one-way street
+local fname = "/tmp/test_roads.osm"
+local osm = [[
+<?xml version="1.0" encoding="UTF-8"?>
+<osm version="0.6" generator="Overpass API">
+  <bounds minlat="42.5187" minlon="-71.6094" maxlat="42.5247" maxlon="-71.6010"/>
+  <node id="1" lat="42.5190" lon="-71.6090"/>
+  <node id="2" lat="42.5195" lon="-71.6070">
+    <tag k="highway" v="traffic_signals"/>
+  </node>
+  <node id="3" lat="42.5200" lon="-71.6050"/>
+  <node id="4" lat="42.5210" lon="-71.6070"/>
+  <node id="5" lat="42.5190" lon="-71.6070"/>
+  <node id="6" lat="42.5230" lon="-71.6030"/>
+  <way id="100">
+    <nd ref="1"/>
+    <nd ref="2"/>
+    <nd ref="3"/>
+    <tag k="highway" v="primary"/>
+    <tag k="name" v="Main &amp; Co Street"/>
+    <tag k="lanes" v="2"/>
+  </way>
+  <way id="101">
+    <nd ref="4"/>
+    <nd ref="2"/>
+    <nd ref="5"/>
+    <tag k="highway" v="residential"/>
+    <tag k="oneway" v="yes"/>
+  </way>
+  <way id="102">
+    <nd ref="6"/>
+    <nd ref="3"/>
+    <tag k="building" v="yes"/>
+  </way>
+</osm>
+]]
+local f = assert(io.open(fname, 'w'))
+f:write(osm)
+f:close()
+
+local graph = assert(road_graph.parse(fname))
+print(graph)
+assert(graph.c.n_nodes == 5, "Buildings are not roads")
+assert(graph.c.n_ways == 2)
+-- Both ways of the two-way street, and one of the one-way street
+assert(graph.c.n_edges == 6)
+
+local main = graph:way(0)
+assert(main.id == 100 and main.name == "Main & Co Street")
+assert(main.highway == "primary" and main.lanes == 2 and main.oneway == 0)
+local side = graph:way(1)
+assert(side.oneway == 1 and not side.name and side.highway == "residential")
+
+-- Projected in meters about the middle of the bounds
+local i_signal = main.nodes[2]
+local dx = graph.c.x[main.nodes[3]] - graph.c.x[main.nodes[1]]
+assert(dx > 300 and dx < 360, "Bad projection")
+
+-- The one-way street only leaves the crossroads southwards
+local n_out = 0
+for j, w in graph:neighbors(i_signal) do
+  n_out = n_out + 1
+  if w == 1 then assert(j == side.nodes[3], "Against the one-way street") end
+end
+assert(n_out == 3)
+
+-- Split at the crossroads, as roads.lua writes them
+local segments, intersections = graph:segments()
+local n_segments = 0
+for _ in pairs(segments) do n_segments = n_segments + 1 end
+assert(n_segments == 4)
+assert(#intersections["2"].segments == 4)
+assert(segments.W100_1.links[1] == false and segments.W100_1.links[2] == "2")
+
+-- Load the cache, and compare
+local cache = "/tmp/test_roads.graph"
+assert(graph:save(cache))
+local graph1 = assert(road_graph.load(cache))
+print(graph1)
+for i=0, graph.c.n_nodes - 1 do
+  assert(graph1.c.node_id[i] == graph.c.node_id[i])
+  assert(graph1.c.x[i] == graph.c.x[i] and graph1.c.y[i] == graph.c.y[i])
+end
+for e=0, graph.c.n_edges - 1 do
+  assert(graph1.c.col[e] == graph.c.col[e])
+end
+assert(graph1:way(0).name == main.name)
+
+-- A file that is not a cache
+assert(not road_graph.load(fname))
+
+-- A cache of an older OSM file is parsed again
+assert(road_graph.open(fname, cache))
+f = assert(io.open(fname, 'w'))
+f:write((osm:gsub('v="yes"', 'v="-1"')))
+f:close()
+local graph2 = assert(road_graph.open(fname, cache))
+assert(graph2:way(1).oneway == -1, "Stale cache")
+-- Against the nodes, so the segment is reversed to run with the traffic
+local seg = graph2:segments().W101_1
+assert(seg.oneway and seg.points[1][1] == 42.5195 and seg.points[2][1] == 42.5210)
+assert(seg.links[1] == "2" and seg.links[2] == false)
+os.remove(cache)
+os.remove(fname)
+print("OK")
@@ -18,6 +18,35 @@ int dijkstra_nonholonomic(double* cost_to_go, // output
                           unsigned int m, unsigned int n,
                           int* p_goal, int* p_start,
                           int nNeighbors);
+typedef struct {
+  const double *costmap;
+  int m, n;
+  double xmin, ymin, scale;
+  double cost_threshold;
+  double wheel_base;
+  double max_steering;
+  double step;
+  int n_steering;
+  int reverse;
+  int n_headings;
+  double reverse_factor;
+  double steering_factor;
+  double switch_cost;
+  double analytic_distance;
+  double goal_distance;
+  double goal_angle;
+  int max_nodes;
+} HAStarParameters;
+struct hastar;
+void hastar_default_parameters(HAStarParameters *params);
+struct hastar *hastar_create(const HAStarParameters *params);
+void hastar_free(struct hastar *planner);
+void hastar_set_costmap(struct hastar *planner, const double *costmap);
+int hastar_plan(struct hastar *planner, const double start[3],
+                const double goal[3]);
+const double *hastar_path(const struct hastar *planner);
+double hastar_cost(const struct hastar *planner);
+int hastar_expanded(const struct hastar *planner);
 ]]
 local dijkstra = ffi.load('dijkstra')
 
@@ -176,10 +205,14 @@ local function plan(self, start, goal)
   local indices_goal = ffi.new(tp_arr, {unpack(goal, 1, state_sz)})
   -- TODO: Support many starting indices, since the cost-to-go map is made
   local indices_start = ffi.new(tp_arr, {unpack(start, 1, state_sz)})
-  -- Form the output memory for the cost-to-go map
+  -- Form the output memory for the cost-to-go map, kept for the next plan
   local cost_to_go
   if #goal==3 then
-    cost_to_go = ffi.new('double[?]', n_cells * nNeighbors)
+    cost_to_go = self.cost_to_go
+    if self.cost_to_go_sz ~= n_cells * nNeighbors then
+      cost_to_go = ffi.new('double[?]', n_cells * nNeighbors)
+      self.cost_to_go_sz = n_cells * nNeighbors
+    end
     dijkstra.dijkstra_nonholonomic(cost_to_go, self.costmap.grid,
                                    m, n,
                                    indices_goal, indices_start,
@@ -189,7 +222,11 @@ local function plan(self, start, goal)
     self.cost_to_go = cost_to_go
     return path, err
   elseif #goal==2 then
-    cost_to_go = ffi.new('double[?]', n_cells)
+    cost_to_go = self.cost_to_go
+    if self.cost_to_go_sz ~= n_cells then
+      cost_to_go = ffi.new('double[?]', n_cells)
+      self.cost_to_go_sz = n_cells
+    end
     dijkstra.dijkstra_holonomic(cost_to_go, self.costmap.grid,
                                 m, n,
                                 indices_goal, indices_start,
@@ -213,4 +250,83 @@ local function new(parameters)
 end
 lib.new = new
 
+local hastar_errors = {
+  [-1] = "Could not reach goal",
+  [-2] = "Start in collision",
+  [-3] = "Goal in collision",
+  [-4] = "Out of memory",
+}
+
+-- Path of {x, y, heading, is_backwards}, and its cost
+local function plan_hybrid(self, start, goal)
+  local q_start, q_goal = self.q_start, self.q_goal
+  q_start[0], q_start[1], q_start[2] = unpack(start, 1, 3)
+  q_goal[0], q_goal[1], q_goal[2] = unpack(goal, 1, 3)
+  local n = dijkstra.hastar_plan(self.planner, q_start, q_goal)
+  if n < 0 then
+    return false, hastar_errors[n] or "Bad plan"
+  end
+  local xyad = dijkstra.hastar_path(self.planner)
+  local path = {}
+  for i=0,n-1 do
+    local k = 4 * i
+    path[i+1] = {xyad[k], xyad[k+1], xyad[k+2], xyad[k+3] < 0}
+  end
+  return path, dijkstra.hastar_cost(self.planner)
+end
+
+-- Call after changing the costmap memory, to renew the heuristic
+local function update_costmap(self, costmap)
+  if costmap then
+    if costmap.m ~= self.costmap.m or costmap.n ~= self.costmap.n then
+      return false, "Costmap size mismatch"
+    end
+    self.costmap = costmap
+  end
+  dijkstra.hastar_set_costmap(self.planner, self.costmap.grid)
+  return self
+end
+
+local function expanded(self)
+  return dijkstra.hastar_expanded(self.planner)
+end
+
+-- Hybrid A* for a car over a costmap of doubles from luajit-grid.
+-- Optional parameters are the fields of HAStarParameters, e.g. wheel_base,
+-- max_steering, reverse (boolean), n_headings and max_nodes
+function lib.hybrid_astar(parameters)
+  local costmap = parameters.costmap
+  if type(costmap)~='table' or costmap.datatype~='double' then
+    return false, "Need a costmap of doubles"
+  end
+  local params = ffi.new'HAStarParameters'
+  dijkstra.hastar_default_parameters(params)
+  for _, k in ipairs{
+      'cost_threshold', 'wheel_base', 'max_steering', 'step', 'n_steering',
+      'n_headings', 'reverse_factor', 'steering_factor', 'switch_cost',
+      'analytic_distance', 'goal_distance', 'goal_angle', 'max_nodes'} do
+    if tonumber(parameters[k]) then params[k] = parameters[k] end
+  end
+  if parameters.reverse ~= nil then
+    params.reverse = parameters.reverse and 1 or 0
+  end
+  params.costmap = costmap.grid
+  params.m, params.n = costmap.m, costmap.n
+  params.xmin, params.ymin = costmap.xmin, costmap.ymin
+  params.scale = costmap.scale
+  local planner = dijkstra.hastar_create(params)
+  if planner == nil then return false, "Bad parameters" end
+  ffi.gc(planner, dijkstra.hastar_free)
+  return {
+    planner = planner,
+    -- Keep the costmap memory alive
+    costmap = costmap,
+    q_start = ffi.new'double[3]',
+    q_goal = ffi.new'double[3]',
+    plan = plan_hybrid,
+    update_costmap = update_costmap,
+    expanded = expanded,
+  }
+end
+
 return lib
@@ -0,0 +1,606 @@
+/*
+Hybrid A* for car-like vehicles
+The heuristic is the larger of a holonomic cost-to-go from the goal, kept
+until the goal cell or costmap changes, and, when only driving forwards,
+the obstacle free Dubins length at the cheapest cost.
+*/
+
+// C parts
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+// C++ parts
+#include <algorithm>
+#include <functional>
+#include <new>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include "dubins.h"
+}
+#include "hybrid_astar.h"
+
+// Ratio of the straight line to the longest 16-connected path,
+// cos(atan(1/2) / 2), so that the grid cost-to-go does not overestimate
+#define GRID_SCALE 0.9732489894677302
+
+typedef std::pair<double, int> CostNodePair; // (cost, node)
+typedef std::greater<CostNodePair> CostNodeGreater;
+
+namespace {
+
+struct Primitive {
+  double kappa;
+  int direction;
+  // Multiplier of the cost of travel
+  double factor;
+  // Body frame {dx, dy, da} samples, ending at the arc end
+  int first;
+};
+
+struct Node {
+  double q[3];
+  double g;
+  int32_t parent;
+  int16_t primitive;
+  int8_t direction;
+};
+
+struct Bin {
+  uint64_t key;
+  uint32_t stamp;
+  int32_t node : 31;
+  uint32_t closed : 1;
+};
+
+struct NeighborStruct {
+  int joffset;
+  int ioffset;
+  double distance;
+};
+
+// As dijkstra.cc
+const NeighborStruct neighbors16[] = {
+  {1,0,1.0}, {2,1,sqrt(5)}, {1,1,M_SQRT2}, {1,2,sqrt(5)},
+  {0,1,1.0}, {-1,2,sqrt(5)}, {-1,1,M_SQRT2}, {-2,1,sqrt(5)},
+  {-1,0,1.0}, {-2,-1,sqrt(5)}, {-1,-1,M_SQRT2}, {-1,-2,sqrt(5)},
+  {0,-1,1.0}, {1,-2,sqrt(5)}, {1,-1,M_SQRT2}, {2,-1,sqrt(5)},
+};
+
+} // namespace
+
+struct hastar {
+  HAStarParameters params;
+  double kappa_max;
+  double turning_radius;
+  double step;
+  // Spacing of the samples checked against the costmap
+  double sample_step;
+  int n_samples;
+  double bin_size;
+  int bins_x;
+  std::vector<Primitive> primitives;
+  std::vector<double> samples;
+  // Search memory, reused across plans
+  std::vector<Node> nodes;
+  std::vector<CostNodePair> open;
+  std::vector<Bin> bins;
+  uint64_t bin_mask;
+  uint32_t stamp;
+  // Holonomic cost-to-go from the goal cell
+  std::vector<double> cost_to_go;
+  std::vector<CostNodePair> cost_to_go_open;
+  int cost_to_go_goal;
+  double cost_min;
+  // Result
+  int goal_parent;
+  DubinsPath shortcut;
+  int has_shortcut;
+  double cost;
+  int n_expanded;
+  std::vector<double> path;
+};
+
+static double mod2pi_angle(double a) {
+  a = fmod(a, 2 * M_PI);
+  return a < 0 ? a + 2 * M_PI : a;
+}
+
+static double angle_diff(double a, double b) {
+  double d = mod2pi_angle(a - b);
+  return d > M_PI ? 2 * M_PI - d : d;
+}
+
+void hastar_default_parameters(HAStarParameters *params) {
+  memset(params, 0, sizeof(HAStarParameters));
+  params->scale = 0.05;
+  params->cost_threshold = 127;
+  params->wheel_base = 0.325;
+  params->max_steering = M_PI / 4;
+  params->step = 0;
+  params->n_steering = 5;
+  params->reverse = 1;
+  params->n_headings = 36;
+  params->reverse_factor = 2;
+  params->steering_factor = 0.1;
+  params->switch_cost = 1;
+  params->analytic_distance = 3;
+  params->goal_distance = 0.1;
+  params->goal_angle = 10 * M_PI / 180;
+  params->max_nodes = 1 << 20;
+}
+
+// Pose at arc length s along a curvature, from the origin
+static void arc_pose(double kappa, double s, double q[3]) {
+  double da = kappa * s;
+  if (fabs(kappa) < 1e-9) {
+    q[0] = s;
+    q[1] = 0;
+  } else {
+    q[0] = sin(da) / kappa;
+    q[1] = (1 - cos(da)) / kappa;
+  }
+  q[2] = da;
+}
+
+static void make_primitives(struct hastar *planner) {
+  const HAStarParameters *p = &planner->params;
+  int n_directions = p->reverse ? 2 : 1;
+  int half = p->n_steering / 2;
+  planner->primitives.clear();
+  planner->samples.clear();
+  for (int d = 0; d < n_directions; d++) {
+    int direction = d == 0 ? 1 : -1;
+    for (int k = -half; k <= half; k++) {
+      Primitive prim;
+      prim.kappa = half > 0 ? planner->kappa_max * k / half : 0;
+      prim.direction = direction;
+      prim.factor = (direction < 0 ? p->reverse_factor : 1) *
+                    (1 + p->steering_factor * (half > 0 ? fabs(k) / half : 0));
+      prim.first = planner->samples.size();
+      for (int i = 1; i <= planner->n_samples; i++) {
+        double q[3];
+        arc_pose(prim.kappa, direction * i * planner->sample_step, q);
+        planner->samples.insert(planner->samples.end(), q, q + 3);
+      }
+      planner->primitives.push_back(prim);
+    }
+  }
+}
+
+struct hastar *hastar_create(const HAStarParameters *params) {
+  if (!params->costmap || params->m <= 0 || params->n <= 0 ||
+      params->scale <= 0 || params->wheel_base <= 0 ||
+      params->max_steering <= 0 || params->max_steering >= M_PI / 2 ||
+      params->n_steering < 1 || params->n_steering > 255 ||
+      params->n_headings < 4 || params->max_nodes < 1 ||
+      params->max_nodes > (1 << 30)) {
+    return NULL;
+  }
+  struct hastar *planner = new (std::nothrow) hastar;
+  if (!planner) {
+    return NULL;
+  }
+  try {
+    planner->params = *params;
+    HAStarParameters *p = &planner->params;
+    // Even counts would not include driving straight
+    p->n_steering |= 1;
+    planner->kappa_max = tan(p->max_steering) / p->wheel_base;
+    planner->turning_radius = 1 / planner->kappa_max;
+    // Leave the bin, and turn by at least one heading bin at the limit
+    planner->step = p->step > 0 ? p->step
+                                : std::max(1.5 * M_SQRT2 * p->scale,
+                                           2 * M_PI * planner->turning_radius /
+                                               p->n_headings);
+    planner->n_samples = (int)ceil(planner->step / (0.5 * p->scale));
+    planner->sample_step = planner->step / planner->n_samples;
+    planner->bin_size = std::max(p->scale, planner->step);
+    planner->bins_x = (int)ceil(p->n * p->scale / planner->bin_size) + 1;
+    make_primitives(planner);
+    // Bins in an open addressed table, at most half full
+    size_t n_bins = 1;
+    while (n_bins < 2 * (size_t)p->max_nodes) {
+      n_bins <<= 1;
+    }
+    planner->bins.resize(n_bins);
+    planner->bin_mask = n_bins - 1;
+    planner->stamp = 0;
+    // The node pool grows as needed, and is kept for the next plan
+    planner->cost_to_go.resize((size_t)p->m * p->n);
+    planner->cost_to_go_open.reserve((size_t)p->m * p->n);
+    planner->cost_to_go_goal = -1;
+    planner->cost_min = 0;
+    planner->goal_parent = -1;
+    planner->has_shortcut = 0;
+    planner->cost = INFINITY;
+    planner->n_expanded = 0;
+  } catch (const std::bad_alloc &) {
+    delete planner;
+    return NULL;
+  }
+  return planner;
+}
+
+void hastar_free(struct hastar *planner) { delete planner; }
+
+void hastar_set_costmap(struct hastar *planner, const double *costmap) {
+  if (costmap) {
+    planner->params.costmap = costmap;
+  }
+  planner->cost_to_go_goal = -1;
+}
+
+// Linear index of the cell under (x, y), or -1 off the map
+static int cell_index(const HAStarParameters *p, double x, double y) {
+  double fj = floor((x - p->xmin) / p->scale);
+  double fi = floor((y - p->ymin) / p->scale);
+  if (fi < 0 || fi >= p->m || fj < 0 || fj >= p->n) {
+    return -1;
+  }
+  return (int)fj * p->m + (int)fi;
+}
+
+// Cost per meter at (x, y), or INFINITY in collision
+static double cell_cost(const HAStarParameters *p, double x, double y) {
+  int ind = cell_index(p, x, y);
+  if (ind < 0) {
+    return INFINITY;
+  }
+  double c = p->costmap[ind];
+  return c >= p->cost_threshold ? INFINITY : c;
+}
+
+// Dijkstra over the 16-connected cells, from the goal cell
+static void make_cost_to_go(struct hastar *planner, int ind_goal) {
+  const HAStarParameters *p = &planner->params;
+  std::vector<double> &c2g = planner->cost_to_go;
+  std::vector<CostNodePair> &Q = planner->cost_to_go_open;
+  size_t n_cells = (size_t)p->m * p->n;
+  double cost_min = INFINITY;
+  for (size_t i = 0; i < n_cells; i++) {
+    c2g[i] = INFINITY;
+    double c = p->costmap[i];
+    if (c < cost_min) {
+      cost_min = c;
+    }
+  }
+  planner->cost_min = cost_min > 0 ? cost_min : 0;
+  Q.clear();
+  c2g[ind_goal] = 0;
+  Q.push_back(CostNodePair(0, ind_goal));
+  while (!Q.empty()) {
+    std::pop_heap(Q.begin(), Q.end(), CostNodeGreater());
+    CostNodePair top = Q.back();
+    Q.pop_back();
+    int ind0 = top.second;
+    if (top.first > c2g[ind0]) {
+      continue;
+    }
+    double cost0 = p->costmap[ind0];
+    int j0 = ind0 / p->m;
+    int i0 = ind0 % p->m;
+    for (int k = 0; k < 16; k++) {
+      const NeighborStruct *nbr = &neighbors16[k];
+      int i1 = i0 + nbr->ioffset;
+      int j1 = j0 + nbr->joffset;
+      if (i1 < 0 || i1 >= p->m || j1 < 0 || j1 >= p->n) {
+        continue;
+      }
+      int ind1 = j1 * p->m + i1;
+      double cost = std::min(cost0, p->costmap[ind1]);
+      if (p->costmap[ind1] >= p->cost_threshold) {
+        continue;
+      }
+      // Knight moves pass by two more cells
+      if (nbr->distance > M_SQRT2) {
+        int di = nbr->ioffset / 2, dj = nbr->joffset / 2;
+        int ind_a = (j0 + dj) * p->m + (i0 + di);
+        int ind_b = (j1 - dj) * p->m + (i1 - di);
+        if (p->costmap[ind_a] >= p->cost_threshold ||
+            p->costmap[ind_b] >= p->cost_threshold) {
+          continue;
+        }
+        cost = std::min(cost, std::min(p->costmap[ind_a], p->costmap[ind_b]));
+      }
+      double c1 = top.first + GRID_SCALE * p->scale * nbr->distance * cost;
+      if (c1 < c2g[ind1]) {
+        c2g[ind1] = c1;
+        Q.push_back(CostNodePair(c1, ind1));
+        std::push_heap(Q.begin(), Q.end(), CostNodeGreater());
+      }
+    }
+  }
+  planner->cost_to_go_goal = ind_goal;
+}
+
+static double heuristic(struct hastar *planner, const double q[3],
+                        const double goal[3]) {
+  const HAStarParameters *p = &planner->params;
+  int ind = cell_index(p, q[0], q[1]);
+  if (ind < 0) {
+    return INFINITY;
+  }
+  // Anywhere in the cell, so less half a diagonal
+  double h = planner->cost_to_go[ind] -
+             planner->cost_min * M_SQRT1_2 * p->scale;
+  h = std::max(h, 0.0);
+  if (!p->reverse) {
+    DubinsPath path;
+    if (dubins_shortest_path(&path, (double *)q, (double *)goal,
+                             planner->turning_radius) == EDUBOK) {
+      h = std::max(h, planner->cost_min * dubins_path_length(&path));
+    }
+  }
+  return h;
+}
+
+// Open addressed bin of a pose in this plan, added if asked, else NULL
+static Bin *find_bin(struct hastar *planner, const double q[3], int add) {
+  const HAStarParameters *p = &planner->params;
+  uint64_t bx = (uint64_t)floor((q[0] - p->xmin) / planner->bin_size);
+  uint64_t by = (uint64_t)floor((q[1] - p->ymin) / planner->bin_size);
+  uint64_t ba = (uint64_t)floor(mod2pi_angle(q[2]) * p->n_headings /
+                                    (2 * M_PI) + 0.5) % p->n_headings;
+  uint64_t key = ((by * planner->bins_x) + bx) * p->n_headings + ba;
+  uint64_t h = key * 0x9E3779B97F4A7C15ULL;
+  for (uint64_t i = h >> 32;; i++) {
+    Bin *bin = &planner->bins[i & planner->bin_mask];
+    if (bin->stamp != planner->stamp) {
+      if (!add) {
+        return NULL;
+      }
+      bin->stamp = planner->stamp;
+      bin->key = key;
+      bin->node = -1;
+      bin->closed = 0;
+      return bin;
+    }
+    if (bin->key == key) {
+      return bin;
+    }
+  }
+}
+
+// Follow a primitive from q0, giving the end pose and the cost of travel
+static double follow(const struct hastar *planner, const Primitive *prim,
+                     const double q0[3], double q1[3]) {
+  const HAStarParameters *p = &planner->params;
+  double c = cos(q0[2]), s = sin(q0[2]);
+  const double *sample = &planner->samples[prim->first];
+  double cost = 0;
+  for (int i = 0; i < planner->n_samples; i++, sample += 3) {
+    q1[0] = q0[0] + c * sample[0] - s * sample[1];
+    q1[1] = q0[1] + s * sample[0] + c * sample[1];
+    double cost_cell = cell_cost(p, q1[0], q1[1]);
+    if (isinf(cost_cell)) {
+      return INFINITY;
+    }
+    cost += cost_cell;
+  }
+  q1[2] = mod2pi_angle(q0[2] + sample[-1]);
+  return cost * planner->sample_step * prim->factor;
+}
+
+// Cost of a Dubins curve to the goal, or INFINITY through an obstacle
+static double try_shortcut(struct hastar *planner, const double q[3],
+                           const double goal[3]) {
+  const HAStarParameters *p = &planner->params;
+  DubinsPath *path = &planner->shortcut;
+  if (dubins_shortest_path(path, (double *)q, (double *)goal,
+                           planner->turning_radius) != EDUBOK) {
+    return INFINITY;
+  }
+  double length = dubins_path_length(path);
+  int n = (int)ceil(length / planner->sample_step);
+  if (n < 1) {
+    return 0;
+  }
+  double ds = length / n;
+  double cost = 0;
+  for (int i = 1; i <= n; i++) {
+    double qi[3];
+    if (i == n) {
+      dubins_path_endpoint(path, qi);
+    } else {
+      dubins_path_sample(path, i * ds, qi);
+    }
+    double cost_cell = cell_cost(p, qi[0], qi[1]);
+    if (isinf(cost_cell)) {
+      return INFINITY;
+    }
+    cost += cost_cell;
+  }
+  return cost * ds;
+}
+
+static void push_point(struct hastar *planner, const double q[3],
+                       int direction) {
+  planner->path.push_back(q[0]);
+  planner->path.push_back(q[1]);
+  planner->path.push_back(mod2pi_angle(q[2]));
+  planner->path.push_back(direction);
+}
+
+// Walk back from the goal parent, then sample each primitive forwards
+static int make_path(struct hastar *planner, const double goal[3]) {
+  std::vector<double> &path = planner->path;
+  path.clear();
+  // Reuse the open list for the chain of nodes
+  std::vector<CostNodePair> &chain = planner->open;
+  chain.clear();
+  for (int id = planner->goal_parent; id >= 0;
+       id = planner->nodes[id].parent) {
+    chain.push_back(CostNodePair(0, id));
+  }
+  std::reverse(chain.begin(), chain.end());
+  const Node *root = &planner->nodes[chain[0].second];
+  int direction0 = chain.size() > 1
+      ? planner->nodes[chain[1].second].direction : 1;
+  push_point(planner, root->q, direction0);
+  for (size_t k = 1; k < chain.size(); k++) {
+    const Node *node = &planner->nodes[chain[k].second];
+    const Node *parent = &planner->nodes[node->parent];
+    const Primitive *prim = &planner->primitives[node->primitive];
+    double c = cos(parent->q[2]), s = sin(parent->q[2]);
+    const double *sample = &planner->samples[prim->first];
+    for (int i = 0; i < planner->n_samples; i++, sample += 3) {
+      double q[3] = {parent->q[0] + c * sample[0] - s * sample[1],
+                     parent->q[1] + s * sample[0] + c * sample[1],
+                     parent->q[2] + sample[2]};
+      push_point(planner, q, node->direction);
+    }
+  }
+  if (planner->has_shortcut) {
+    DubinsPath *shortcut = &planner->shortcut;
+    double length = dubins_path_length(shortcut);
+    int n = (int)ceil(length / planner->sample_step);
+    for (int i = 1; i < n; i++) {
+      double q[3];
+      dubins_path_sample(shortcut, i * length / n, q);
+      push_point(planner, q, 1);
+    }
+    push_point(planner, goal, 1);
+  }
+  return path.size() / 4;
+}
+
+static int plan(struct hastar *planner, const double start[3],
+                const double goal[3]) {
+  const HAStarParameters *p = &planner->params;
+
+  if (isinf(cell_cost(p, start[0], start[1]))) {
+    return HASTAR_BAD_START;
+  }
+  if (isinf(cell_cost(p, goal[0], goal[1]))) {
+    return HASTAR_BAD_GOAL;
+  }
+  int ind_goal = cell_index(p, goal[0], goal[1]);
+  if (ind_goal != planner->cost_to_go_goal) {
+    make_cost_to_go(planner, ind_goal);
+  }
+
+  // Forget the bins of the last plan
+  if (++planner->stamp == 0) {
+    for (size_t i = 0; i < planner->bins.size(); i++) {
+      planner->bins[i].stamp = 0;
+    }
+    planner->stamp = 1;
+  }
+  std::vector<Node> &nodes = planner->nodes;
+  std::vector<CostNodePair> &Q = planner->open;
+  nodes.clear();
+  Q.clear();
+
+  Node root;
+  root.q[0] = start[0];
+  root.q[1] = start[1];
+  root.q[2] = mod2pi_angle(start[2]);
+  root.g = 0;
+  root.parent = -1;
+  root.primitive = -1;
+  root.direction = 1;
+  nodes.push_back(root);
+  find_bin(planner, root.q, 1)->node = 0;
+  Q.push_back(CostNodePair(heuristic(planner, root.q, goal), 0));
+
+  double analytic_distance_sq = p->analytic_distance * p->analytic_distance;
+  while (!Q.empty()) {
+    std::pop_heap(Q.begin(), Q.end(), CostNodeGreater());
+    int id = Q.back().second;
+    Q.pop_back();
+    // Copy, since the pool may grow below
+    Node node = nodes[id];
+    Bin *bin = find_bin(planner, node.q, 0);
+    if (bin->closed || bin->node != id) {
+      continue;
+    }
+    bin->closed = 1;
+    planner->n_expanded++;
+
+    double dx = goal[0] - node.q[0];
+    double dy = goal[1] - node.q[1];
+    double d_sq = dx * dx + dy * dy;
+    if (d_sq <= p->goal_distance * p->goal_distance &&
+        angle_diff(node.q[2], goal[2]) <= p->goal_angle) {
+      planner->goal_parent = id;
+      planner->cost = node.g;
+      break;
+    }
+    if (d_sq <= analytic_distance_sq) {
+      double cost = try_shortcut(planner, node.q, goal);
+      if (!isinf(cost)) {
+        planner->goal_parent = id;
+        planner->has_shortcut = 1;
+        planner->cost = node.g + cost;
+        break;
+      }
+    }
+
+    for (size_t k = 0; k < planner->primitives.size(); k++) {
+      const Primitive *prim = &planner->primitives[k];
+      Node next;
+      double cost = follow(planner, prim, node.q, next.q);
+      if (isinf(cost)) {
+        continue;
+      }
+      next.g = node.g + cost;
+      if (node.parent >= 0 && prim->direction != node.direction) {
+        next.g += p->switch_cost;
+      }
+      Bin *next_bin = find_bin(planner, next.q, 0);
+      if (next_bin &&
+          (next_bin->closed || nodes[next_bin->node].g <= next.g)) {
+        continue;
+      }
+      // Bins only fill with nodes, so the table stays half empty
+      if ((int)nodes.size() >= p->max_nodes) {
+        continue;
+      }
+      if (!next_bin) {
+        next_bin = find_bin(planner, next.q, 1);
+      }
+      next.parent = id;
+      next.primitive = k;
+      next.direction = prim->direction;
+      int next_id = nodes.size();
+      next_bin->node = next_id;
+      nodes.push_back(next);
+      Q.push_back(CostNodePair(next.g + heuristic(planner, next.q, goal),
+                               next_id));
+      std::push_heap(Q.begin(), Q.end(), CostNodeGreater());
+    }
+  }
+
+  if (planner->goal_parent < 0) {
+    return HASTAR_NO_PATH;
+  }
+  return make_path(planner, goal);
+}
+
+int hastar_plan(struct hastar *planner, const double start[3],
+                const double goal[3]) {
+  planner->goal_parent = -1;
+  planner->has_shortcut = 0;
+  planner->cost = INFINITY;
+  planner->n_expanded = 0;
+  planner->path.clear();
+  try {
+    return plan(planner, start, goal);
+  } catch (const std::bad_alloc &) {
+    planner->cost = INFINITY;
+    planner->path.clear();
+    return HASTAR_NO_MEMORY;
+  }
+}
+
+const double *hastar_path(const struct hastar *planner) {
+  return planner->path.empty() ? NULL : &planner->path[0];
+}
+
+double hastar_cost(const struct hastar *planner) { return planner->cost; }
+
+int hastar_expanded(const struct hastar *planner) {
+  return planner->n_expanded;
+}
@@ -0,0 +1,87 @@
+#pragma once
+/*
+Hybrid A* for car-like vehicles over a costmap from luajit-grid
+Nodes keep a continuous pose, and only the cheapest node per
+(x, y, heading) bin is expanded. Successors follow a precomputed table of
+arcs up to the steering limit, and Dubins curves to the goal are tried as a
+shortcut when near. All search memory is kept across plans.
+*/
+
+#include <stdint.h>
+
+/* Errors of hastar_plan */
+#define HASTAR_NO_PATH (-1)
+#define HASTAR_BAD_START (-2)
+#define HASTAR_BAD_GOAL (-3)
+#define HASTAR_NO_MEMORY (-4)
+
+typedef struct {
+  /* Costmap of doubles from luajit-grid, indexed as j * m + i, where x
+   * follows j and y follows i. Costs are per meter travelled.
+   */
+  const double *costmap;
+  int m, n;
+  double xmin, ymin, scale;
+  /* Cells at or above this are in collision */
+  double cost_threshold;
+  /* Vehicle: wheel base in meters and steering limit in radians */
+  double wheel_base;
+  double max_steering;
+  /* Arc length of each primitive, where 0 picks one from the grid */
+  double step;
+  /* Curvatures from -max to max, including straight, so odd */
+  int n_steering;
+  /* Allow driving backwards */
+  int reverse;
+  /* Heading bins for closing nodes */
+  int n_headings;
+  /* Multipliers of the cost of reversing and of steering at the limit,
+   * and the cost, in meters, of changing direction
+   */
+  double reverse_factor;
+  double steering_factor;
+  double switch_cost;
+  /* Try a Dubins curve to the goal within this distance */
+  double analytic_distance;
+  /* Closeness to the goal when not reached by a Dubins curve */
+  double goal_distance;
+  double goal_angle;
+  /* Capacity of the node pool */
+  int max_nodes;
+} HAStarParameters;
+
+struct hastar;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Defaults for the racecar, on a 5 cm costmap */
+void hastar_default_parameters(HAStarParameters *params);
+
+struct hastar *hastar_create(const HAStarParameters *params);
+void hastar_free(struct hastar *planner);
+
+/* Swap in a costmap of the same size, or mark the same memory as changed,
+ * so that the cached cost-to-go is made again on the next plan
+ */
+void hastar_set_costmap(struct hastar *planner, const double *costmap);
+
+/* Search from start to goal, each {x, y, heading}.
+ * Returns the number of points in the path, or one of the errors
+ */
+int hastar_plan(struct hastar *planner, const double start[3],
+                const double goal[3]);
+
+/* Path of the last plan as {x, y, heading, direction} quads, with
+ * direction 1 forwards and -1 backwards. Valid until the next plan
+ */
+const double *hastar_path(const struct hastar *planner);
+/* Cost of the last path, or INFINITY */
+double hastar_cost(const struct hastar *planner);
+/* Nodes expanded by the last plan */
+int hastar_expanded(const struct hastar *planner);
+
+#ifdef __cplusplus
+}
+#endif
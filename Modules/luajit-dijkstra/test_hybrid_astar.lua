@@ -0,0 +1,84 @@
+#!/usr/bin/env luajit
+
+local unpack = unpack or require'table'.unpack
+local time = require'unix'.time
+
+local grid_params = {
+  scale = 0.05,
+  xmin = -10, xmax = 10,
+  ymin = -10, ymax = 10,
+  datatype = 'double'
+}
+local costmap = require'grid'.new(grid_params)
+
+for ind=0, costmap.n_cells-1 do
+  costmap.grid[ind] = 1
+end
+
+-- Wall across the middle, around which to drive
+local maxvalLine = 1e5
+local function set_max(map, idx)
+  map[idx] = maxvalLine
+end
+costmap:bresenham(
+  {-7, 7},
+  {7, -7},
+  set_max
+):bresenham(
+  {-7+costmap.scale, 7},
+  {7+costmap.scale, -7},
+  set_max
+):bresenham(
+  {-7-costmap.scale, 7},
+  {7-costmap.scale, -7},
+  set_max
+)
+
+-- Costly, but free, area
+local function set_circle(map, idx)
+  map[idx] = 50
+end
+costmap:circle({0, 0}, 2, set_circle)
+
+-- The racecar
+local planner = assert(require'dijkstra'.hybrid_astar{
+  costmap = costmap,
+  wheel_base = 0.325,
+  max_steering = math.rad(45),
+  reverse = true,
+})
+
+local start_xya = {-9, -9, math.pi/2}
+local goal_xya = {9, 9, 0}
+
+for i=1,3 do
+  local t0 = time()
+  local path, cost = planner:plan(start_xya, goal_xya)
+  local t1 = time()
+  assert(path, cost)
+  print(string.format("Plan %d: %d points, cost %.3f, %d expanded, %.1f ms",
+    i, #path, cost, planner:expanded(), 1e3 * (t1 - t0)))
+  -- Every point is free
+  for _, xya in ipairs(path) do
+    local idx = costmap.xy2idx(unpack(xya, 1, 2))
+    assert(idx and costmap.grid[idx] < maxvalLine, "Path in collision")
+  end
+  local last = path[#path]
+  assert(math.abs(last[1] - goal_xya[1]) < 0.1, "Goal x")
+  assert(math.abs(last[2] - goal_xya[2]) < 0.1, "Goal y")
+end
+
+-- Blocking the goal is caught after updating the costmap
+local goal_idx = costmap.xy2idx(unpack(goal_xya, 1, 2))
+costmap.grid[goal_idx] = maxvalLine
+planner:update_costmap()
+assert(not planner:plan(start_xya, goal_xya), "Goal is blocked")
+costmap.grid[goal_idx] = 1
+planner:update_costmap()
+
+local path = assert(planner:plan(start_xya, goal_xya))
+local function color_path(map, idx, i)
+  map[idx] = path[i][4] and (maxvalLine/4) or (maxvalLine/2)
+end
+costmap:path(path, color_path)
+assert(costmap:save"/tmp/costmapH_path")
@@ -0,0 +1,861 @@
+/*
+Native Dynamixel Protocol 2.0 engine
+Each cycle: command write, then one sync or bulk read whose status packets
+are parsed as the bytes arrive and published by joint
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
+
+#include "dxl_engine.h"
+
+/* Header and reserved byte of every packet */
+#define HEADER_SIZE 4
+/* Header, id and length */
+#define PREFIX_SIZE 7
+
+static const uint8_t header[HEADER_SIZE] = {0xFF, 0xFF, 0xFD, 0x00};
+
+/* CRC-16 (IBM, polynomial 0x8005), as in DynamixelPacket2 */
+static const uint16_t crc_table[256] = {
+  0x0000, 0x8005, 0x800F, 0x000A, 0x801B, 0x001E, 0x0014, 0x8011,
+  0x8033, 0x0036, 0x003C, 0x8039, 0x0028, 0x802D, 0x8027, 0x0022,
+  0x8063, 0x0066, 0x006C, 0x8069, 0x0078, 0x807D, 0x8077, 0x0072,
+  0x0050, 0x8055, 0x805F, 0x005A, 0x804B, 0x004E, 0x0044, 0x8041,
+  0x80C3, 0x00C6, 0x00CC, 0x80C9, 0x00D8, 0x80DD, 0x80D7, 0x00D2,
+  0x00F0, 0x80F5, 0x80FF, 0x00FA, 0x80EB, 0x00EE, 0x00E4, 0x80E1,
+  0x00A0, 0x80A5, 0x80AF, 0x00AA, 0x80BB, 0x00BE, 0x00B4, 0x80B1,
+  0x8093, 0x0096, 0x009C, 0x8099, 0x0088, 0x808D, 0x8087, 0x0082,
+  0x8183, 0x0186, 0x018C, 0x8189, 0x0198, 0x819D, 0x8197, 0x0192,
+  0x01B0, 0x81B5, 0x81BF, 0x01BA, 0x81AB, 0x01AE, 0x01A4, 0x81A1,
+  0x01E0, 0x81E5, 0x81EF, 0x01EA, 0x81FB, 0x01FE, 0x01F4, 0x81F1,
+  0x81D3, 0x01D6, 0x01DC, 0x81D9, 0x01C8, 0x81CD, 0x81C7, 0x01C2,
+  0x0140, 0x8145, 0x814F, 0x014A, 0x815B, 0x015E, 0x0154, 0x8151,
+  0x8173, 0x0176, 0x017C, 0x8179, 0x0168, 0x816D, 0x8167, 0x0162,
+  0x8123, 0x0126, 0x012C, 0x8129, 0x0138, 0x813D, 0x8137, 0x0132,
+  0x0110, 0x8115, 0x811F, 0x011A, 0x810B, 0x010E, 0x0104, 0x8101,
+  0x8303, 0x0306, 0x030C, 0x8309, 0x0318, 0x831D, 0x8317, 0x0312,
+  0x0330, 0x8335, 0x833F, 0x033A, 0x832B, 0x032E, 0x0324, 0x8321,
+  0x0360, 0x8365, 0x836F, 0x036A, 0x837B, 0x037E, 0x0374, 0x8371,
+  0x8353, 0x0356, 0x035C, 0x8359, 0x0348, 0x834D, 0x8347, 0x0342,
+  0x03C0, 0x83C5, 0x83CF, 0x03CA, 0x83DB, 0x03DE, 0x03D4, 0x83D1,
+  0x83F3, 0x03F6, 0x03FC, 0x83F9, 0x03E8, 0x83ED, 0x83E7, 0x03E2,
+  0x83A3, 0x03A6, 0x03AC, 0x83A9, 0x03B8, 0x83BD, 0x83B7, 0x03B2,
+  0x0390, 0x8395, 0x839F, 0x039A, 0x838B, 0x038E, 0x0384, 0x8381,
+  0x0280, 0x8285, 0x828F, 0x028A, 0x829B, 0x029E, 0x0294, 0x8291,
+  0x82B3, 0x02B6, 0x02BC, 0x82B9, 0x02A8, 0x82AD, 0x82A7, 0x02A2,
+  0x82E3, 0x02E6, 0x02EC, 0x82E9, 0x02F8, 0x82FD, 0x82F7, 0x02F2,
+  0x02D0, 0x82D5, 0x82DF, 0x02DA, 0x82CB, 0x02CE, 0x02C4, 0x82C1,
+  0x8243, 0x0246, 0x024C, 0x8249, 0x0258, 0x825D, 0x8257, 0x0252,
+  0x0270, 0x8275, 0x827F, 0x027A, 0x826B, 0x026E, 0x0264, 0x8261,
+  0x0220, 0x8225, 0x822F, 0x022A, 0x823B, 0x023E, 0x0234, 0x8231,
+  0x8213, 0x0216, 0x021C, 0x8219, 0x0208, 0x820D, 0x8207, 0x0202
+};
+
+struct dxl_bus {
+  struct dxl_engine *engine;
+  DXLBusConfig config;
+  int fd;
+  pthread_t thread;
+  int started;
+  /* Motor index by id, or -1 */
+  int8_t slot[256];
+  /* Prebuilt read request */
+  uint8_t read_packet[DXL_MAX_PACKET];
+  int read_size;
+  /* Command parameters: the sync write address and size stay in front,
+   * values are filled in every cycle */
+  int sync_write;
+  int has_command;
+  uint8_t write_params[DXL_MAX_PACKET];
+  uint8_t write_packet[DXL_MAX_PACKET];
+  uint8_t rx[DXL_MAX_PACKET];
+  DXLParser parser;
+  /* Kept by the bus thread, copied out every cycle under stats_lock */
+  DXLBusStats local;
+  DXLBusStats stats;
+  pthread_mutex_t stats_lock;
+  int reset_stats;
+  /* One pending dxl_transact, served between cycles */
+  pthread_mutex_t mail_lock;
+  pthread_cond_t mail_cond;
+  int mail_pending;
+  int mail_done;
+  const uint8_t *mail_packet;
+  int mail_size;
+  int mail_n_status;
+  uint8_t *mail_reply;
+  int mail_max_reply;
+  double mail_timeout;
+  int mail_result;
+};
+
+struct dxl_engine {
+  DXLJointState state;
+  struct dxl_bus *buses[DXL_MAX_BUSES];
+  int n_buses;
+  int running;
+};
+
+uint16_t dxl_crc(uint16_t crc, const uint8_t *data, int n) {
+  int i;
+  for (i = 0; i < n; i++) {
+    crc = (crc << 8) ^ crc_table[((crc >> 8) ^ data[i]) & 0xFF];
+  }
+  return crc;
+}
+
+/* Track the trailing FF FF FD pattern, shared by stuffing and unstuffing */
+static inline int next_pattern(int pattern, uint8_t c) {
+  if (c == 0xFF) return (pattern == 1 || pattern == 2) ? 2 : 1;
+  if (c == 0xFD) return pattern == 2 ? 3 : 0;
+  return 0;
+}
+
+int dxl_packet(uint8_t *out, uint8_t id, uint8_t instruction,
+               const uint8_t *params, int n_params) {
+  int i, n = PREFIX_SIZE, pattern;
+  uint16_t crc, length;
+  memcpy(out, header, HEADER_SIZE);
+  out[4] = id;
+  out[n++] = instruction;
+  pattern = next_pattern(0, instruction);
+  for (i = 0; i < n_params; i++) {
+    if (n + 4 > DXL_MAX_PACKET) return -1;
+    out[n++] = params[i];
+    pattern = next_pattern(pattern, params[i]);
+    if (pattern == 3) {
+      out[n++] = 0xFD;
+      pattern = 0;
+    }
+  }
+  if (n + 2 > DXL_MAX_PACKET) return -1;
+  /* Instruction, parameters and CRC, after stuffing */
+  length = n - PREFIX_SIZE + 2;
+  out[5] = length & 0xFF;
+  out[6] = length >> 8;
+  crc = dxl_crc(0, out, n);
+  out[n++] = crc & 0xFF;
+  out[n++] = crc >> 8;
+  return n;
+}
+
+void dxl_parser_reset(DXLParser *parser) {
+  parser->state = 0;
+  parser->count = 0;
+  parser->pattern = 0;
+  parser->crc = 0;
+}
+
+/* Restart the header search, keeping the current byte if it may begin one */
+static void parser_resync(DXLParser *parser, uint8_t c) {
+  dxl_parser_reset(parser);
+  if (c == 0xFF) {
+    parser->state = 1;
+    parser->crc = dxl_crc(0, header, 1);
+  }
+}
+
+int dxl_parse(DXLParser *p, const uint8_t *data, int n, int *n_used) {
+  int i;
+  for (i = 0; i < n; i++) {
+    uint8_t c = data[i];
+    if (p->state < HEADER_SIZE) {
+      if (c == header[p->state]) {
+        p->state++;
+        p->crc = dxl_crc(0, header, p->state);
+      } else if (p->state == 2 && c == 0xFF) {
+        /* Still FF FF */
+      } else {
+        parser_resync(p, c);
+      }
+      continue;
+    }
+    if (p->state > 6) {
+      /* Body: instruction, parameters, then the CRC bytes */
+      int remaining = p->length - p->count;
+      p->count++;
+      if (remaining > 2) {
+        p->crc = dxl_crc(p->crc, &c, 1);
+        if (p->pattern == 3 && c == 0xFD) {
+          /* Stuffed byte */
+          p->pattern = 0;
+          continue;
+        }
+        p->pattern = next_pattern(p->pattern, c);
+        if (p->state == 7) {
+          p->instruction = c;
+          p->state = 8;
+        } else if (p->state == 8 && p->instruction == DXL_INST_STATUS) {
+          p->error = c;
+          p->state = 9;
+        } else {
+          p->params[p->n_params++] = c;
+          p->state = 9;
+        }
+      } else if (remaining == 2) {
+        p->crc_rx = c;
+      } else {
+        p->crc_rx |= c << 8;
+        if (n_used) *n_used = i + 1;
+        if (p->crc_rx != p->crc) {
+          dxl_parser_reset(p);
+          return DXL_PARSE_CRC_ERROR;
+        }
+        dxl_parser_reset(p);
+        return DXL_PARSE_PACKET;
+      }
+      continue;
+    }
+    p->crc = dxl_crc(p->crc, &c, 1);
+    if (p->state == 4) {
+      p->id = c;
+      p->state = 5;
+    } else if (p->state == 5) {
+      p->length = c;
+      p->state = 6;
+    } else {
+      p->length |= c << 8;
+      /* Instruction and CRC at least, and room for the parameters */
+      if (p->length < 3 || p->length > DXL_MAX_PACKET - PREFIX_SIZE) {
+        parser_resync(p, c);
+        continue;
+      }
+      p->state = 7;
+      p->count = 0;
+      p->pattern = 0;
+      p->error = 0;
+      p->n_params = 0;
+    }
+  }
+  if (n_used) *n_used = n;
+  return DXL_PARSE_MORE;
+}
+
+void dxl_default_bus(DXLBusConfig *bus) {
+  int i;
+  memset(bus, 0, sizeof(DXLBusConfig));
+  bus->baud = 1000000;
+  for (i = 0; i < DXL_MAX_MOTORS; i++) {
+    bus->joint[i] = i;
+    /* Present position through present current */
+    bus->read_address[i] = 0x263;
+    bus->read_length[i] = 12;
+    bus->position_offset[i] = 0;
+    bus->position_size[i] = 4;
+    bus->current_offset[i] = 10;
+    bus->current_size[i] = 2;
+    bus->command_address[i] = 0x254;
+    bus->command_size[i] = 4;
+    bus->scale[i] = 1;
+    bus->current_scale[i] = 1;
+  }
+  bus->period = 1 / 250.0;
+  bus->timeout = 1 / 250.0;
+  bus->priority = 0;
+  bus->cpu = -1;
+}
+
+static double timespec_seconds(const struct timespec *ts) {
+  return ts->tv_sec + 1e-9 * ts->tv_nsec;
+}
+
+static double now(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return timespec_seconds(&ts);
+}
+
+static void timespec_add(struct timespec *ts, double dt) {
+  long ns = ts->tv_nsec + (long)(dt * 1e9);
+  ts->tv_sec += ns / 1000000000L;
+  ts->tv_nsec = ns % 1000000000L;
+}
+
+static speed_t baud_constant(int baud) {
+  switch (baud) {
+  case 57600: return B57600;
+  case 115200: return B115200;
+  case 230400: return B230400;
+#ifdef __linux__
+  case 460800: return B460800;
+  case 500000: return B500000;
+  case 576000: return B576000;
+  case 921600: return B921600;
+  case 1000000: return B1000000;
+  case 1152000: return B1152000;
+  case 1500000: return B1500000;
+  case 2000000: return B2000000;
+  case 2500000: return B2500000;
+  case 3000000: return B3000000;
+  case 3500000: return B3500000;
+  case 4000000: return B4000000;
+#endif
+  default: return 0;
+  }
+}
+
+/* Raw 8N1, non blocking, as lua-stty sets up the ports for run_dcm.lua */
+static int open_port(const char *device, int baud) {
+  struct termios tio;
+  speed_t speed = baud_constant(baud);
+  int fd = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd < 0) return -1;
+  if (tcgetattr(fd, &tio) != 0) {
+    close(fd);
+    return -1;
+  }
+  cfmakeraw(&tio);
+  tio.c_cflag |= CLOCAL | CREAD;
+  tio.c_cc[VTIME] = 0;
+  tio.c_cc[VMIN] = 0;
+  if (speed) {
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+  }
+#ifdef __linux__
+  {
+    /* Low latency for the FTDI adapters, and a custom divisor if needed */
+    struct serial_struct serinfo;
+    if (ioctl(fd, TIOCGSERIAL, &serinfo) == 0) {
+      serinfo.flags |= ASYNC_LOW_LATENCY;
+      if (!speed) {
+        serinfo.flags &= ~ASYNC_SPD_MASK;
+        serinfo.flags |= ASYNC_SPD_CUST;
+        serinfo.custom_divisor = (serinfo.baud_base + baud / 2) / baud;
+        cfsetispeed(&tio, B38400);
+        cfsetospeed(&tio, B38400);
+      }
+      if (ioctl(fd, TIOCSSERIAL, &serinfo) != 0 && !speed) {
+        close(fd);
+        return -1;
+      }
+    } else if (!speed) {
+      close(fd);
+      return -1;
+    }
+  }
+#else
+  if (!speed) {
+    close(fd);
+    return -1;
+  }
+#endif
+  if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+    close(fd);
+    return -1;
+  }
+  tcflush(fd, TCIOFLUSH);
+  return fd;
+}
+
+static int write_all(struct dxl_bus *bus, const uint8_t *data, int n) {
+  int sent = 0;
+  while (sent < n) {
+    ssize_t ret = write(bus->fd, data + sent, n - sent);
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN) {
+        struct pollfd pfd = {bus->fd, POLLOUT, 0};
+        poll(&pfd, 1, 1);
+        continue;
+      }
+      bus->local.write_errors++;
+      return -1;
+    }
+    sent += ret;
+  }
+  bus->local.bytes_tx += n;
+  return 0;
+}
+
+/* Wait for bytes until the deadline on the monotonic clock */
+static int read_some(struct dxl_bus *bus, const struct timespec *deadline) {
+  struct pollfd pfd = {bus->fd, POLLIN, 0};
+  struct timespec ts, wait;
+  ssize_t ret;
+  for (;;) {
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    wait.tv_sec = deadline->tv_sec - ts.tv_sec;
+    wait.tv_nsec = deadline->tv_nsec - ts.tv_nsec;
+    if (wait.tv_nsec < 0) {
+      wait.tv_sec--;
+      wait.tv_nsec += 1000000000L;
+    }
+    if (wait.tv_sec < 0) return 0;
+    ret = ppoll(&pfd, 1, &wait, NULL);
+    if (ret < 0 && errno == EINTR) continue;
+    if (ret <= 0) return 0;
+    ret = read(bus->fd, bus->rx, sizeof(bus->rx));
+    if (ret < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+    if (ret <= 0) return -1;
+    bus->local.bytes_rx += ret;
+    return ret;
+  }
+}
+
+static inline int32_t get_value(const uint8_t *b, int size, int is_signed) {
+  switch (size) {
+  case 1: return b[0];
+  case 2: {
+    uint16_t v = b[0] | (b[1] << 8);
+    return is_signed ? (int16_t)v : v;
+  }
+  default:
+    return (int32_t)((uint32_t)b[0] | ((uint32_t)b[1] << 8) |
+                     ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24));
+  }
+}
+
+static inline void put_value(uint8_t *b, int size, int32_t v) {
+  int i;
+  for (i = 0; i < size; i++) b[i] = (v >> (8 * i)) & 0xFF;
+}
+
+static void build_read(struct dxl_bus *bus) {
+  const DXLBusConfig *c = &bus->config;
+  uint8_t params[5 * DXL_MAX_MOTORS];
+  int i, n = 0, sync = 1;
+  for (i = 1; i < c->n_motors; i++) {
+    if (c->read_address[i] != c->read_address[0] ||
+        c->read_length[i] != c->read_length[0]) sync = 0;
+  }
+  if (sync) {
+    put_value(params, 2, c->read_address[0]);
+    put_value(params + 2, 2, c->read_length[0]);
+    n = 4;
+    for (i = 0; i < c->n_motors; i++) params[n++] = c->id[i];
+  } else {
+    for (i = 0; i < c->n_motors; i++) {
+      params[n++] = c->id[i];
+      put_value(params + n, 2, c->read_address[i]);
+      put_value(params + n + 2, 2, c->read_length[i]);
+      n += 4;
+    }
+  }
+  bus->read_size = dxl_packet(bus->read_packet, DXL_BROADCAST_ID,
+                              sync ? DXL_INST_SYNC_READ : DXL_INST_BULK_READ,
+                              params, n);
+}
+
+static void build_write_header(struct dxl_bus *bus) {
+  const DXLBusConfig *c = &bus->config;
+  int i;
+  bus->sync_write = 1;
+  bus->has_command = 0;
+  for (i = 0; i < c->n_motors; i++) {
+    if (c->command_address[i] != c->command_address[0] ||
+        c->command_size[i] != c->command_size[0]) bus->sync_write = 0;
+    if (c->command_size[i]) bus->has_command = 1;
+  }
+  if (bus->sync_write) {
+    put_value(bus->write_params, 2, c->command_address[0]);
+    put_value(bus->write_params + 2, 2, c->command_size[0]);
+  }
+}
+
+/* Fill the command values of the enabled motors.
+ * Returns the packet size, or 0 if nothing is commanded
+ */
+static int build_write(struct dxl_bus *bus) {
+  const DXLBusConfig *c = &bus->config;
+  const DXLJointState *state = &bus->engine->state;
+  uint8_t *p = bus->write_params;
+  int i, n = bus->sync_write ? 4 : 0, n_cmd = 0;
+  for (i = 0; i < c->n_motors; i++) {
+    int j = c->joint[i], size = c->command_size[i];
+    double rad;
+    if (!size || (state->torque_enable && state->torque_enable[j] == 0)) {
+      continue;
+    }
+    rad = state->command_position[j];
+    if (c->min_rad[i] < c->max_rad[i]) {
+      rad = rad < c->min_rad[i] ? c->min_rad[i] :
+        (rad > c->max_rad[i] ? c->max_rad[i] : rad);
+    }
+    p[n++] = c->id[i];
+    if (!bus->sync_write) {
+      put_value(p + n, 2, c->command_address[i]);
+      put_value(p + n + 2, 2, size);
+      n += 4;
+    }
+    put_value(p + n, size, (int32_t)floor(rad / c->scale[i] + c->zero[i]));
+    n += size;
+    n_cmd++;
+  }
+  if (!n_cmd) return 0;
+  return dxl_packet(bus->write_packet, DXL_BROADCAST_ID,
+                    bus->sync_write ? DXL_INST_SYNC_WRITE : DXL_INST_BULK_WRITE,
+                    p, n);
+}
+
+static void publish(struct dxl_bus *bus, int k, const uint8_t *block,
+                    double t) {
+  const DXLBusConfig *c = &bus->config;
+  const DXLJointState *state = &bus->engine->state;
+  int j = c->joint[k];
+  if (c->position_size[k]) {
+    int32_t step = get_value(block + c->position_offset[k],
+                             c->position_size[k], 0);
+    if (state->position) {
+      state->position[j] = c->scale[k] * (step - c->zero[k]);
+    }
+    if (state->position_t) state->position_t[j] = t;
+  }
+  if (c->current_size[k]) {
+    int32_t raw = get_value(block + c->current_offset[k],
+                            c->current_size[k], 1);
+    if (state->current) {
+      state->current[j] = c->current_scale[k] * (raw - c->current_zero[k]);
+    }
+    if (state->current_t) state->current_t[j] = t;
+  }
+}
+
+/* One command write and read, publishing status packets as they arrive */
+static void bus_cycle(struct dxl_bus *bus) {
+  const DXLBusConfig *c = &bus->config;
+  DXLBusStats *s = &bus->local;
+  struct timespec t0, deadline;
+  uint32_t received = 0;
+  int n_received = 0;
+  double dt;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  if (bus->has_command && bus->engine->state.command_position) {
+    int n = build_write(bus);
+    if (n > 0) write_all(bus, bus->write_packet, n);
+  }
+  dxl_parser_reset(&bus->parser);
+  write_all(bus, bus->read_packet, bus->read_size);
+
+  deadline = t0;
+  timespec_add(&deadline, c->timeout);
+  while (n_received < c->n_motors) {
+    int used, off = 0, n = read_some(bus, &deadline);
+    double t;
+    if (n <= 0) break;
+    t = now(CLOCK_REALTIME);
+    while (off < n) {
+      int ret = dxl_parse(&bus->parser, bus->rx + off, n - off, &used);
+      DXLParser *p = &bus->parser;
+      int k;
+      off += used;
+      if (ret == DXL_PARSE_CRC_ERROR) {
+        s->crc_errors++;
+        continue;
+      } else if (ret != DXL_PARSE_PACKET ||
+                 p->instruction != DXL_INST_STATUS) {
+        continue;
+      }
+      k = bus->slot[p->id];
+      if (k < 0 || (received & (1u << k)) || p->n_params < c->read_length[k]) {
+        continue;
+      }
+      received |= 1u << k;
+      n_received++;
+      s->packets++;
+      s->error[k] = p->error;
+      if (p->error) s->servo_errors++;
+      publish(bus, k, p->params, t);
+    }
+  }
+  if (n_received < c->n_motors) {
+    s->timeouts++;
+    s->missing += c->n_motors - n_received;
+  }
+
+  dt = now(CLOCK_MONOTONIC) - timespec_seconds(&t0);
+  s->cycle_last = dt;
+  s->cycle_mean += (dt - s->cycle_mean) / (s->cycles + 1);
+  if (s->cycles == 0 || dt < s->cycle_min) s->cycle_min = dt;
+  if (dt > s->cycle_max) s->cycle_max = dt;
+  s->cycles++;
+}
+
+static int bus_transact(struct dxl_bus *bus, const uint8_t *packet, int size,
+                        int n_status, uint8_t *reply, int max_reply,
+                        double timeout) {
+  struct timespec deadline;
+  int n_reply = 0, n_packets = 0;
+  tcflush(bus->fd, TCIFLUSH);
+  if (write_all(bus, packet, size)) return -1;
+  dxl_parser_reset(&bus->parser);
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  timespec_add(&deadline, timeout);
+  while (n_packets < n_status) {
+    int used, off = 0, n = read_some(bus, &deadline);
+    if (n <= 0) break;
+    if (n > max_reply - n_reply) n = max_reply - n_reply;
+    memcpy(reply + n_reply, bus->rx, n);
+    n_reply += n;
+    while (off < n) {
+      int ret = dxl_parse(&bus->parser, bus->rx + off, n - off, &used);
+      off += used;
+      if (ret == DXL_PARSE_PACKET) n_packets++;
+      else if (ret == DXL_PARSE_CRC_ERROR) bus->local.crc_errors++;
+    }
+    if (n_reply == max_reply) break;
+  }
+  return n_reply;
+}
+
+/* Serve a pending dxl_transact, or fail it if the thread is exiting */
+static void serve_mail(struct dxl_bus *bus, int fail) {
+  pthread_mutex_lock(&bus->mail_lock);
+  if (bus->mail_pending && !bus->mail_done) {
+    bus->mail_result = fail ? -1 :
+      bus_transact(bus, bus->mail_packet, bus->mail_size, bus->mail_n_status,
+                   bus->mail_reply, bus->mail_max_reply, bus->mail_timeout);
+    bus->mail_done = 1;
+    pthread_cond_broadcast(&bus->mail_cond);
+  }
+  pthread_mutex_unlock(&bus->mail_lock);
+}
+
+static void *bus_thread(void *arg) {
+  struct dxl_bus *bus = arg;
+  struct dxl_engine *engine = bus->engine;
+  struct timespec next;
+  double period = bus->config.period;
+
+#ifdef __linux__
+  if (bus->config.cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(bus->config.cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+#endif
+
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  while (__atomic_load_n(&engine->running, __ATOMIC_ACQUIRE)) {
+    double late;
+    if (__atomic_exchange_n(&bus->reset_stats, 0, __ATOMIC_ACQ_REL)) {
+      int realtime = bus->local.realtime;
+      memset(&bus->local, 0, sizeof(DXLBusStats));
+      bus->local.realtime = realtime;
+    }
+    bus_cycle(bus);
+    if (__atomic_load_n(&bus->mail_pending, __ATOMIC_ACQUIRE)) {
+      serve_mail(bus, 0);
+    }
+
+    timespec_add(&next, period);
+    late = now(CLOCK_MONOTONIC) - timespec_seconds(&next);
+    if (late > 0) {
+      bus->local.overruns++;
+      /* Skip the missed cycles rather than bursting to catch up */
+      if (late > period) clock_gettime(CLOCK_MONOTONIC, &next);
+    }
+
+    pthread_mutex_lock(&bus->stats_lock);
+    bus->stats = bus->local;
+    pthread_mutex_unlock(&bus->stats_lock);
+
+    if (late <= 0) {
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) ==
+             EINTR) {}
+    }
+  }
+  serve_mail(bus, 1);
+  return NULL;
+}
+
+struct dxl_engine *dxl_create(const DXLJointState *state) {
+  struct dxl_engine *engine = calloc(1, sizeof(struct dxl_engine));
+  if (!engine) return NULL;
+  if (state) engine->state = *state;
+  return engine;
+}
+
+void dxl_free(struct dxl_engine *engine) {
+  int i;
+  if (!engine) return;
+  dxl_stop(engine);
+  for (i = 0; i < engine->n_buses; i++) {
+    struct dxl_bus *bus = engine->buses[i];
+    close(bus->fd);
+    pthread_mutex_destroy(&bus->stats_lock);
+    pthread_mutex_destroy(&bus->mail_lock);
+    pthread_cond_destroy(&bus->mail_cond);
+    free(bus);
+  }
+  free(engine);
+}
+
+int dxl_add_bus(struct dxl_engine *engine, const DXLBusConfig *config) {
+  struct dxl_bus *bus;
+  pthread_mutexattr_t attr;
+  int i;
+  if (engine->running || engine->n_buses >= DXL_MAX_BUSES) return -1;
+  if (config->n_motors < 1 || config->n_motors > DXL_MAX_MOTORS ||
+      config->period <= 0 || config->timeout <= 0) {
+    return -1;
+  }
+  for (i = 0; i < config->n_motors; i++) {
+    if (config->scale[i] == 0 || config->joint[i] < 0 ||
+        config->position_offset[i] + config->position_size[i] >
+        config->read_length[i] ||
+        config->current_offset[i] + config->current_size[i] >
+        config->read_length[i] ||
+        config->read_length[i] > DXL_MAX_PACKET / 2 ||
+        config->position_size[i] > 4 || config->position_size[i] == 3 ||
+        config->current_size[i] > 4 || config->current_size[i] == 3 ||
+        config->command_size[i] > 4 || config->command_size[i] == 3) {
+      return -1;
+    }
+  }
+
+  bus = calloc(1, sizeof(struct dxl_bus));
+  if (!bus) return -1;
+  bus->engine = engine;
+  bus->config = *config;
+  bus->config.device[sizeof(bus->config.device) - 1] = '\0';
+  memset(bus->slot, -1, sizeof(bus->slot));
+  for (i = 0; i < config->n_motors; i++) {
+    if (bus->slot[config->id[i]] >= 0) {
+      free(bus);
+      return -1;
+    }
+    bus->slot[config->id[i]] = i;
+  }
+  bus->fd = open_port(bus->config.device, config->baud);
+  if (bus->fd < 0) {
+    free(bus);
+    return -1;
+  }
+  build_read(bus);
+  build_write_header(bus);
+  dxl_parser_reset(&bus->parser);
+
+  /* The bus thread may hold these at a real-time priority */
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+  pthread_mutex_init(&bus->stats_lock, &attr);
+  pthread_mutex_init(&bus->mail_lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+  pthread_cond_init(&bus->mail_cond, NULL);
+
+  engine->buses[engine->n_buses] = bus;
+  return engine->n_buses++;
+}
+
+int dxl_start(struct dxl_engine *engine) {
+  int i;
+  if (engine->running || engine->n_buses == 0) return -1;
+  engine->running = 1;
+  for (i = 0; i < engine->n_buses; i++) {
+    struct dxl_bus *bus = engine->buses[i];
+    pthread_attr_t attr;
+    int ret = -1;
+    if (bus->config.priority > 0) {
+      struct sched_param param;
+      param.sched_priority = bus->config.priority;
+      pthread_attr_init(&attr);
+      pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+      pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+      pthread_attr_setschedparam(&attr, &param);
+      bus->local.realtime = 1;
+      ret = pthread_create(&bus->thread, &attr, bus_thread, bus);
+      pthread_attr_destroy(&attr);
+    }
+    /* Without the privilege for SCHED_FIFO, run at the default priority */
+    if (ret != 0) {
+      bus->local.realtime = 0;
+      ret = pthread_create(&bus->thread, NULL, bus_thread, bus);
+    }
+    if (ret != 0) {
+      dxl_stop(engine);
+      return -1;
+    }
+    bus->started = 1;
+  }
+  return engine->n_buses;
+}
+
+int dxl_stop(struct dxl_engine *engine) {
+  int i;
+  if (!engine->running) return 0;
+  __atomic_store_n(&engine->running, 0, __ATOMIC_RELEASE);
+  for (i = 0; i < engine->n_buses; i++) {
+    struct dxl_bus *bus = engine->buses[i];
+    if (!bus->started) continue;
+    pthread_join(bus->thread, NULL);
+    bus->started = 0;
+    /* A dxl_transact posted while the thread was exiting */
+    serve_mail(bus, 1);
+  }
+  return 0;
+}
+
+int dxl_transact(struct dxl_engine *engine, int index,
+                 const uint8_t *packet, int size, int n_status,
+                 uint8_t *reply, int max_reply, double timeout) {
+  struct dxl_bus *bus;
+  int result;
+  if (index < 0 || index >= engine->n_buses) return -1;
+  bus = engine->buses[index];
+  if (!bus->started) {
+    return bus_transact(bus, packet, size, n_status, reply, max_reply,
+                        timeout);
+  }
+  pthread_mutex_lock(&bus->mail_lock);
+  while (bus->mail_pending) pthread_cond_wait(&bus->mail_cond, &bus->mail_lock);
+  bus->mail_packet = packet;
+  bus->mail_size = size;
+  bus->mail_n_status = n_status;
+  bus->mail_reply = reply;
+  bus->mail_max_reply = max_reply;
+  bus->mail_timeout = timeout;
+  bus->mail_done = 0;
+  __atomic_store_n(&bus->mail_pending, 1, __ATOMIC_RELEASE);
+  while (!bus->mail_done) pthread_cond_wait(&bus->mail_cond, &bus->mail_lock);
+  result = bus->mail_result;
+  __atomic_store_n(&bus->mail_pending, 0, __ATOMIC_RELEASE);
+  /* Wake any other caller waiting to post */
+  pthread_cond_broadcast(&bus->mail_cond);
+  pthread_mutex_unlock(&bus->mail_lock);
+  return result;
+}
+
+int dxl_stats(struct dxl_engine *engine, int index, DXLBusStats *stats) {
+  struct dxl_bus *bus;
+  if (index < 0 || index >= engine->n_buses) return -1;
+  bus = engine->buses[index];
+  if (!bus->started) {
+    *stats = bus->local;
+    return 0;
+  }
+  pthread_mutex_lock(&bus->stats_lock);
+  *stats = bus->stats;
+  pthread_mutex_unlock(&bus->stats_lock);
+  return 0;
+}
+
+void dxl_reset_stats(struct dxl_engine *engine, int index) {
+  struct dxl_bus *bus;
+  if (index < 0 || index >= engine->n_buses) return;
+  bus = engine->buses[index];
+  if (bus->started) {
+    __atomic_store_n(&bus->reset_stats, 1, __ATOMIC_RELEASE);
+  } else {
+    int realtime = bus->local.realtime;
+    memset(&bus->local, 0, sizeof(DXLBusStats));
+    bus->local.realtime = realtime;
+  }
+}
@@ -0,0 +1,174 @@
+#pragma once
+/*
+Native Dynamixel Protocol 2.0 engine, for use via the LuaJIT FFI
+One real-time thread per chain sends the prebuilt command and read packets
+each cycle and publishes positions and currents into a joint state block,
+e.g. the dcm shared memory
+*/
+
+#include <stdint.h>
+
+#define DXL_MAX_BUSES 8
+#define DXL_MAX_MOTORS 32
+/* Largest packet on the wire, after byte stuffing */
+#define DXL_MAX_PACKET 1024
+
+#define DXL_BROADCAST_ID 0xFE
+#define DXL_INST_PING 0x01
+#define DXL_INST_READ 0x02
+#define DXL_INST_WRITE 0x03
+#define DXL_INST_STATUS 0x55
+#define DXL_INST_SYNC_READ 0x82
+#define DXL_INST_SYNC_WRITE 0x83
+#define DXL_INST_BULK_READ 0x92
+#define DXL_INST_BULK_WRITE 0x93
+
+/* Results of dxl_parse */
+#define DXL_PARSE_MORE 0
+#define DXL_PARSE_PACKET 1
+#define DXL_PARSE_CRC_ERROR -1
+
+typedef struct {
+  /* Serial port */
+  char device[64];
+  int baud;
+  /* Motors on the chain, and their index in the joint state block */
+  int n_motors;
+  uint8_t id[DXL_MAX_MOTORS];
+  int joint[DXL_MAX_MOTORS];
+  /* Block read from each motor every cycle. Sync read when all motors share
+   * it, else bulk read, so that MX and NX motors may share a chain */
+  uint16_t read_address[DXL_MAX_MOTORS];
+  uint16_t read_length[DXL_MAX_MOTORS];
+  /* Offsets of the values in the read block, and their size in bytes.
+   * A size of zero skips the value */
+  uint8_t position_offset[DXL_MAX_MOTORS];
+  uint8_t position_size[DXL_MAX_MOTORS];
+  uint8_t current_offset[DXL_MAX_MOTORS];
+  uint8_t current_size[DXL_MAX_MOTORS];
+  /* Goal position register. Sync write when all motors share it, else bulk
+   * write. A size of zero leaves the motor uncommanded */
+  uint16_t command_address[DXL_MAX_MOTORS];
+  uint8_t command_size[DXL_MAX_MOTORS];
+  /* radian = scale * (step - zero), as step_to_radian in run_dcm.lua */
+  double scale[DXL_MAX_MOTORS];
+  double zero[DXL_MAX_MOTORS];
+  double current_scale[DXL_MAX_MOTORS];
+  double current_zero[DXL_MAX_MOTORS];
+  /* Commands are clamped unless min_rad >= max_rad */
+  double min_rad[DXL_MAX_MOTORS];
+  double max_rad[DXL_MAX_MOTORS];
+  /* Cycle period and the wait for all status packets, in seconds */
+  double period;
+  double timeout;
+  /* SCHED_FIFO priority, or 0 for the default scheduler */
+  int priority;
+  /* CPU to pin the thread to, or -1 */
+  int cpu;
+} DXLBusConfig;
+
+/* Joint state block, indexed by joint. Any pointer may be NULL */
+typedef struct {
+  double *position;
+  double *position_t;
+  double *current;
+  double *current_t;
+  /* Read every cycle. Joints with a zero torque_enable are not commanded */
+  const double *command_position;
+  const double *torque_enable;
+} DXLJointState;
+
+typedef struct {
+  uint64_t cycles;
+  /* Status packets accepted, and those expected but not received */
+  uint64_t packets;
+  uint64_t missing;
+  /* Cycles where some status did not arrive in time */
+  uint64_t timeouts;
+  uint64_t crc_errors;
+  /* Status packets with error bits set, and the last bits by motor */
+  uint64_t servo_errors;
+  uint8_t error[DXL_MAX_MOTORS];
+  /* Cycles running past their period */
+  uint64_t overruns;
+  uint64_t write_errors;
+  uint64_t bytes_tx;
+  uint64_t bytes_rx;
+  /* Cycle time from the command write to the last status, in seconds */
+  double cycle_last;
+  double cycle_mean;
+  double cycle_min;
+  double cycle_max;
+  /* Whether the thread got SCHED_FIFO */
+  int realtime;
+} DXLBusStats;
+
+/* Incremental status packet parser, fed with whatever the port returns */
+typedef struct {
+  int state;
+  int count;
+  /* Trailing bytes matching the FF FF FD stuffing pattern */
+  int pattern;
+  uint16_t length;
+  uint16_t crc;
+  uint16_t crc_rx;
+  /* Last packet: instruction, error and parameters, unstuffed */
+  uint8_t id;
+  uint8_t instruction;
+  uint8_t error;
+  int n_params;
+  uint8_t params[DXL_MAX_PACKET];
+} DXLParser;
+
+struct dxl_engine;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint16_t dxl_crc(uint16_t crc, const uint8_t *data, int n);
+/* Write a full packet with byte stuffing and CRC into out.
+ * Returns the packet size, or -1 if it would exceed DXL_MAX_PACKET
+ */
+int dxl_packet(uint8_t *out, uint8_t id, uint8_t instruction,
+               const uint8_t *params, int n_params);
+
+void dxl_parser_reset(DXLParser *parser);
+/* Consume bytes until a packet completes or the data runs out.
+ * n_used is set to the bytes consumed.
+ * Returns DXL_PARSE_PACKET with the packet in the parser,
+ * DXL_PARSE_CRC_ERROR, or DXL_PARSE_MORE
+ */
+int dxl_parse(DXLParser *parser, const uint8_t *data, int n, int *n_used);
+
+/* Fill in the defaults: 1Mbps, read position/current from the NX
+ * registers, command the NX goal position, at 250Hz */
+void dxl_default_bus(DXLBusConfig *bus);
+
+struct dxl_engine *dxl_create(const DXLJointState *state);
+void dxl_free(struct dxl_engine *engine);
+
+/* Open the port and prebuild the packets of a chain.
+ * Fails while threads run.
+ * Returns the bus index, or -1 on failure
+ */
+int dxl_add_bus(struct dxl_engine *engine, const DXLBusConfig *bus);
+
+/* Start one thread per bus. Returns the number of threads, or -1 */
+int dxl_start(struct dxl_engine *engine);
+int dxl_stop(struct dxl_engine *engine);
+
+/* Send a packet on the bus between cycles, and wait for n_status status
+ * packets or the timeout. The raw replies are copied into reply.
+ * Returns the bytes copied, or -1 on failure
+ */
+int dxl_transact(struct dxl_engine *engine, int bus,
+                 const uint8_t *packet, int len, int n_status,
+                 uint8_t *reply, int max_reply, double timeout);
+
+int dxl_stats(struct dxl_engine *engine, int bus, DXLBusStats *stats);
+void dxl_reset_stats(struct dxl_engine *engine, int bus);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,290 @@
+-- Native Dynamixel engine: one real-time thread per chain
+local lib = {}
+local ffi = require'ffi'
+ffi.cdef[[
+typedef struct {
+  char device[64];
+  int baud;
+  int n_motors;
+  uint8_t id[32];
+  int joint[32];
+  uint16_t read_address[32];
+  uint16_t read_length[32];
+  uint8_t position_offset[32];
+  uint8_t position_size[32];
+  uint8_t current_offset[32];
+  uint8_t current_size[32];
+  uint16_t command_address[32];
+  uint8_t command_size[32];
+  double scale[32];
+  double zero[32];
+  double current_scale[32];
+  double current_zero[32];
+  double min_rad[32];
+  double max_rad[32];
+  double period;
+  double timeout;
+  int priority;
+  int cpu;
+} DXLBusConfig;
+typedef struct {
+  double *position;
+  double *position_t;
+  double *current;
+  double *current_t;
+  const double *command_position;
+  const double *torque_enable;
+} DXLJointState;
+typedef struct {
+  uint64_t cycles;
+  uint64_t packets;
+  uint64_t missing;
+  uint64_t timeouts;
+  uint64_t crc_errors;
+  uint64_t servo_errors;
+  uint8_t error[32];
+  uint64_t overruns;
+  uint64_t write_errors;
+  uint64_t bytes_tx;
+  uint64_t bytes_rx;
+  double cycle_last;
+  double cycle_mean;
+  double cycle_min;
+  double cycle_max;
+  int realtime;
+} DXLBusStats;
+typedef struct {
+  int state;
+  int count;
+  int pattern;
+  uint16_t length;
+  uint16_t crc;
+  uint16_t crc_rx;
+  uint8_t id;
+  uint8_t instruction;
+  uint8_t error;
+  int n_params;
+  uint8_t params[1024];
+} DXLParser;
+struct dxl_engine;
+uint16_t dxl_crc(uint16_t crc, const uint8_t *data, int n);
+int dxl_packet(uint8_t *out, uint8_t id, uint8_t instruction,
+               const uint8_t *params, int n_params);
+void dxl_parser_reset(DXLParser *parser);
+int dxl_parse(DXLParser *parser, const uint8_t *data, int n, int *n_used);
+void dxl_default_bus(DXLBusConfig *bus);
+struct dxl_engine *dxl_create(const DXLJointState *state);
+void dxl_free(struct dxl_engine *engine);
+int dxl_add_bus(struct dxl_engine *engine, const DXLBusConfig *bus);
+int dxl_start(struct dxl_engine *engine);
+int dxl_stop(struct dxl_engine *engine);
+int dxl_transact(struct dxl_engine *engine, int bus,
+                 const uint8_t *packet, int len, int n_status,
+                 uint8_t *reply, int max_reply, double timeout);
+int dxl_stats(struct dxl_engine *engine, int bus, DXLBusStats *stats);
+void dxl_reset_stats(struct dxl_engine *engine, int bus);
+]]
+local dxl = ffi.load'dxl_engine'
+lib.C = dxl
+
+local MAX_MOTORS = 32
+local MAX_PACKET = 1024
+local INST_STATUS = 0x55
+
+-- Read blocks and goal position of each family, as in libDynamixel
+local registers = {
+  -- Present position through present current
+  nx = {read = {0x263, 12}, position = {0, 4}, current = {10, 2},
+        command = {0x254, 4}},
+  -- Present position only; current is far from it on the MX
+  mx = {read = {36, 2}, position = {0, 2}, current = {0, 0},
+        command = {30, 2}},
+}
+lib.registers = registers
+
+-- Full packet with stuffing and CRC, as a string
+function lib.packet(id, instruction, params)
+  params = params or ''
+  local out = ffi.new('uint8_t[?]', MAX_PACKET)
+  local n = dxl.dxl_packet(out, id, instruction, params, #params)
+  if n < 0 then return false, "Packet too large" end
+  return ffi.string(out, n)
+end
+
+-- Incremental parser: feed strings, get a table per complete packet
+function lib.parser()
+  local parser = ffi.new'DXLParser'
+  local used = ffi.new'int[1]'
+  dxl.dxl_parser_reset(parser)
+  return function(str)
+    local pkts = {}
+    local raw, n = ffi.cast('const uint8_t*', str), #str
+    local off, n_crc = 0, 0
+    while off < n do
+      local ret = dxl.dxl_parse(parser, raw + off, n - off, used)
+      off = off + used[0]
+      if ret == 1 then
+        table.insert(pkts, {
+          id = parser.id,
+          instruction = parser.instruction,
+          error = parser.error,
+          parameter = ffi.string(parser.params, parser.n_params),
+        })
+      elseif ret < 0 then
+        n_crc = n_crc + 1
+      end
+    end
+    return pkts, n_crc
+  end
+end
+
+local function set_per_motor(arr, values, n, default)
+  for i=1,n do
+    local v = type(values)=='table' and values[i] or values
+    arr[i-1] = v or default
+  end
+end
+
+-- bus: {ttyname, m_ids, joints, [baud, period, timeout, priority, cpu],
+--       [family], [scale, zero, current_scale, current_zero, min_rad, max_rad]}
+-- where family is 'nx', 'mx' or a table of those by motor,
+-- and joints and the conversions are indexed like m_ids
+local function add_bus(self, bus)
+  local n = #bus.m_ids
+  if n > MAX_MOTORS then return false, "Too many motors" end
+  local cfg = ffi.new'DXLBusConfig'
+  dxl.dxl_default_bus(cfg)
+  local device = bus.ttyname or bus.device
+  if #device > 63 then return false, "Device name too long" end
+  ffi.copy(cfg.device, device)
+  cfg.baud = tonumber(bus.baud) or cfg.baud
+  cfg.period = tonumber(bus.period) or cfg.period
+  cfg.timeout = tonumber(bus.timeout) or cfg.timeout
+  cfg.priority = tonumber(bus.priority) or cfg.priority
+  cfg.cpu = tonumber(bus.cpu) or cfg.cpu
+  cfg.n_motors = n
+  for i, m_id in ipairs(bus.m_ids) do
+    cfg.id[i-1] = m_id
+    -- Joint state is indexed from zero, as the dcm pointers
+    cfg.joint[i-1] = (bus.joints and bus.joints[i] or i) - 1
+    local family = type(bus.family)=='table' and bus.family[i] or bus.family
+    local reg = registers[family or 'nx']
+    cfg.read_address[i-1], cfg.read_length[i-1] = reg.read[1], reg.read[2]
+    cfg.position_offset[i-1], cfg.position_size[i-1] =
+      reg.position[1], reg.position[2]
+    cfg.current_offset[i-1], cfg.current_size[i-1] =
+      reg.current[1], reg.current[2]
+    cfg.command_address[i-1], cfg.command_size[i-1] =
+      reg.command[1], bus.command==false and 0 or reg.command[2]
+  end
+  set_per_motor(cfg.scale, bus.scale, n, 1)
+  set_per_motor(cfg.zero, bus.zero, n, 0)
+  set_per_motor(cfg.current_scale, bus.current_scale, n, 1)
+  set_per_motor(cfg.current_zero, bus.current_zero, n, 0)
+  set_per_motor(cfg.min_rad, bus.min_rad, n, 0)
+  set_per_motor(cfg.max_rad, bus.max_rad, n, 0)
+  local index = dxl.dxl_add_bus(self.engine, cfg)
+  if index < 0 then return false, "Could not add "..ffi.string(cfg.device) end
+  self.n_buses = index + 1
+  return index + 1
+end
+
+-- Bus from a Config.chain entry and Config.servo
+function lib.servo_bus(chain, servo, options)
+  local bus = {
+    ttyname = chain.ttyname, m_ids = chain.m_ids, joints = {}, family = {},
+    scale = {}, zero = {}, min_rad = {}, max_rad = {},
+  }
+  for k, v in pairs(options or {}) do bus[k] = v end
+  for i, m_id in ipairs(chain.m_ids) do
+    local j = servo.motor_to_joint[m_id]
+    bus.joints[i] = j
+    bus.family[i] = servo.steps[j]==4096 and 'mx' or 'nx'
+    -- step_to_radian and radian_to_step of run_dcm.lua
+    bus.scale[i] = servo.direction[j] * servo.to_radians[j]
+    bus.zero[i] = servo.step_zero[j] + servo.step_offset[j]
+    if not servo.is_unclamped[j] then
+      bus.min_rad[i], bus.max_rad[i] = servo.min_rad[j], servo.max_rad[j]
+    end
+  end
+  return bus
+end
+
+local function start(self)
+  local ret = dxl.dxl_start(self.engine)
+  if ret < 0 then return false, "Could not start" end
+  return ret
+end
+
+local function stop(self)
+  return dxl.dxl_stop(self.engine)
+end
+
+-- Send a raw packet string between cycles, and return the raw replies
+local function transact(self, bus, pkt, n_status, timeout)
+  local reply = ffi.new('uint8_t[?]', MAX_PACKET)
+  local n = dxl.dxl_transact(self.engine, bus - 1, pkt, #pkt, n_status or 1,
+                             reply, MAX_PACKET, timeout or 0.01)
+  if n < 0 then return false, "Transaction failed" end
+  return ffi.string(reply, n)
+end
+
+local function stats(self, bus)
+  local s = ffi.new'DXLBusStats'
+  if dxl.dxl_stats(self.engine, bus - 1, s) < 0 then
+    return false, "No bus"
+  end
+  local errors = {}
+  for i=1,MAX_MOTORS do errors[i] = s.error[i-1] end
+  return {
+    cycles = tonumber(s.cycles),
+    packets = tonumber(s.packets),
+    missing = tonumber(s.missing),
+    timeouts = tonumber(s.timeouts),
+    crc_errors = tonumber(s.crc_errors),
+    servo_errors = tonumber(s.servo_errors),
+    error = errors,
+    overruns = tonumber(s.overruns),
+    write_errors = tonumber(s.write_errors),
+    bytes_tx = tonumber(s.bytes_tx),
+    bytes_rx = tonumber(s.bytes_rx),
+    cycle_last = s.cycle_last,
+    cycle_mean = s.cycle_mean,
+    cycle_min = s.cycle_min,
+    cycle_max = s.cycle_max,
+    realtime = s.realtime == 1,
+  }
+end
+
+local function reset_stats(self, bus)
+  dxl.dxl_reset_stats(self.engine, bus - 1)
+end
+
+-- state: {position, position_t, current, current_t, command_position,
+--         torque_enable} as double pointers, e.g. from dcm.sensorPtr,
+--         dcm.tsensorPtr and dcm.actuatorPtr
+function lib.new(state)
+  local js = ffi.new'DXLJointState'
+  for _, k in ipairs{'position', 'position_t', 'current', 'current_t',
+                     'command_position', 'torque_enable'} do
+    if state[k] then js[k] = state[k] end
+  end
+  local engine = dxl.dxl_create(js)
+  if engine == nil then return false, "Could not create" end
+  ffi.gc(engine, dxl.dxl_free)
+  return {
+    engine = engine,
+    -- Keep the joint state memory alive
+    state = state,
+    n_buses = 0,
+    add_bus = add_bus,
+    start = start,
+    stop = stop,
+    transact = transact,
+    stats = stats,
+    reset_stats = reset_stats,
+  }
+end
+
+lib.INST_STATUS = INST_STATUS
+return lib
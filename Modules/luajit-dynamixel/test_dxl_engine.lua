@@ -0,0 +1,75 @@
+#!/usr/bin/env luajit
+
+-- Packet building and incremental parsing, then an optional live chain:
+-- luajit test_dxl_engine.lua /dev/ttyUSB0 1 3 5
+local dxl_engine = require'dxl_engine'
+local unix = require'unix'
+local char = string.char
+
+local function hex(str)
+  return (str:gsub('.', function(c) return string.format('%02X ', c:byte()) end))
+end
+
+-- Ping of id 1, from the Protocol 2.0 manual
+local ping = dxl_engine.packet(1, 0x01)
+print('Ping', hex(ping))
+assert(ping == char(0xFF,0xFF,0xFD,0x00,0x01,0x03,0x00,0x01,0x19,0x4E))
+
+-- Parameters holding the header pattern are stuffed
+local params = char(0x00, 0xFF,0xFF,0xFD, 0x01, 0xFF,0xFF,0xFD)
+local status = dxl_engine.packet(7, dxl_engine.INST_STATUS, params)
+print('Status', hex(status))
+assert(#status == 12 + #params, 'Two stuffed bytes expected')
+
+-- Fed one byte at a time after some noise
+local parse = dxl_engine.parser()
+local pkts = {}
+for c in (char(0x00, 0xFF, 0xFF, 0xFF)..status):gmatch'.' do
+  for _, pkt in ipairs(parse(c)) do table.insert(pkts, pkt) end
+end
+assert(#pkts == 1)
+assert(pkts[1].id == 7 and pkts[1].error == 0)
+assert(pkts[1].parameter == params:sub(2), 'Unstuffed parameters')
+
+-- Two packets in one read, the second corrupted
+local bad = status:sub(1, 8)..char(status:byte(9) + 1)..status:sub(10)
+local pkts2, n_crc = parse(status..bad)
+assert(#pkts2 == 1 and n_crc == 1)
+print('Parser OK')
+
+local ttyname = arg[1]
+if not ttyname then return end
+local m_ids = {}
+for i=2,#arg do table.insert(m_ids, tonumber(arg[i])) end
+
+local ffi = require'ffi'
+local n = #m_ids
+local position = ffi.new('double[?]', n)
+local position_t = ffi.new('double[?]', n)
+local current = ffi.new('double[?]', n)
+local current_t = ffi.new('double[?]', n)
+local engine = assert(dxl_engine.new{
+  position = position, position_t = position_t,
+  current = current, current_t = current_t,
+})
+-- Read only: no command_position, so nothing is written
+local bus = assert(engine:add_bus{
+  ttyname = ttyname, m_ids = m_ids, priority = 50,
+})
+for _, m_id in ipairs(m_ids) do
+  local reply = engine:transact(bus, dxl_engine.packet(m_id, 0x01), 1)
+  print('Ping', m_id, reply and #parse(reply))
+end
+assert(engine:start())
+for _=1,10 do
+  unix.usleep(1e5)
+  local s = engine:stats(bus)
+  print(string.format('Cycles %d | Missing %d | CRC %d | Cycle %.2f/%.2f/%.2f ms | RT %s',
+    s.cycles, s.missing, s.crc_errors,
+    1e3 * s.cycle_min, 1e3 * s.cycle_mean, 1e3 * s.cycle_max,
+    tostring(s.realtime)))
+  for i=1,n do
+    print('', m_ids[i], position[i-1], current[i-1], position_t[i-1])
+  end
+end
+engine:stop()
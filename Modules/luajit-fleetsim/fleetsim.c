@@ -0,0 +1,637 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fleetsim.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+typedef struct {
+  double *x, *y;
+  /* Distance along the path to each point */
+  double *s;
+  int n;
+  int closed;
+  double length;
+} Path;
+
+/* Follower, for sorting by station along each path */
+typedef struct {
+  int32_t path;
+  int32_t vehicle;
+  double station;
+} Order;
+
+struct fleetsim {
+  FleetSimParameters params;
+  FleetSimState state;
+  int capacity;
+  char (*names)[FLEETSIM_NAME_MAX + 1];
+  uint64_t *rng;
+  Path *paths;
+  int n_paths;
+  Order *order;
+  int64_t steps;
+};
+
+void fleetsim_default_parameters(FleetSimParameters *params) {
+  params->dt = 1.0 / 60;
+  params->t0_us = 0;
+  params->seed = 123;
+  params->wheel_base = 0.325;
+  params->max_steering = 45 * M_PI / 180;
+  params->process_noise[0] = 0.01;
+  params->process_noise[1] = 0.01;
+  params->process_noise[2] = M_PI / 180;
+  params->measurement_noise[0] = 0.01;
+  params->measurement_noise[1] = 0.01;
+  params->measurement_noise[2] = M_PI / 180;
+  params->t_lookahead = 1;
+  params->min_lookahead = 0.2;
+  params->speed_noise = 0.1;
+  params->min_speed = 0.2;
+  params->max_speed = 0.75;
+  params->limiting_radius = 2 * params->wheel_base;
+  params->d_stop = params->wheel_base + 0.22;
+  params->d_near = 3 * params->wheel_base;
+}
+
+/* https://prng.di.unimi.it/splitmix64.c */
+static uint64_t splitmix64(uint64_t *state) {
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+/* Uniform on (0, 1] */
+static double uniform(uint64_t *state) {
+  return ((splitmix64(state) >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+static double randn(uint64_t *state) {
+  double u1 = uniform(state);
+  double u2 = uniform(state);
+  return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+/* FNV-1a of the name, so that each vehicle keeps its stream */
+static uint64_t hash_name(const char *name) {
+  uint64_t h = 0xCBF29CE484222325ULL;
+  for (; *name; name++) {
+    h = (h ^ (uint8_t)*name) * 0x100000001B3ULL;
+  }
+  return h;
+}
+
+static double mod_angle(double a) {
+  return a - 2 * M_PI * floor((a + M_PI) / (2 * M_PI));
+}
+
+struct fleetsim *fleetsim_create(const FleetSimParameters *params,
+                                 int capacity) {
+  struct fleetsim *sim;
+  FleetSimState *st;
+  size_t n;
+  if (capacity < 1) {
+    return NULL;
+  }
+  sim = calloc(1, sizeof(struct fleetsim));
+  if (!sim) {
+    return NULL;
+  }
+  if (params) {
+    sim->params = *params;
+  } else {
+    fleetsim_default_parameters(&sim->params);
+  }
+  sim->capacity = capacity;
+  n = capacity;
+  st = &sim->state;
+  st->x = calloc(n, sizeof(double));
+  st->y = calloc(n, sizeof(double));
+  st->a = calloc(n, sizeof(double));
+  st->steering = calloc(n, sizeof(double));
+  st->velocity = calloc(n, sizeof(double));
+  st->x_obs = calloc(n, sizeof(double));
+  st->y_obs = calloc(n, sizeof(double));
+  st->a_obs = calloc(n, sizeof(double));
+  st->path = calloc(n, sizeof(int32_t));
+  st->point = calloc(n, sizeof(int32_t));
+  st->speed = calloc(n, sizeof(double));
+  st->station = calloc(n, sizeof(double));
+  st->leader = calloc(n, sizeof(int32_t));
+  st->gap = calloc(n, sizeof(double));
+  st->done = calloc(n, sizeof(uint8_t));
+  sim->names = calloc(n, sizeof(*sim->names));
+  sim->rng = calloc(n, sizeof(uint64_t));
+  sim->order = calloc(n, sizeof(Order));
+  if (!st->x || !st->y || !st->a || !st->steering || !st->velocity ||
+      !st->x_obs || !st->y_obs || !st->a_obs || !st->path || !st->point ||
+      !st->speed || !st->station || !st->leader || !st->gap || !st->done ||
+      !sim->names || !sim->rng || !sim->order) {
+    fleetsim_free(sim);
+    return NULL;
+  }
+  return sim;
+}
+
+void fleetsim_free(struct fleetsim *sim) {
+  FleetSimState *st;
+  int i;
+  if (!sim) {
+    return;
+  }
+  st = &sim->state;
+  free(st->x);
+  free(st->y);
+  free(st->a);
+  free(st->steering);
+  free(st->velocity);
+  free(st->x_obs);
+  free(st->y_obs);
+  free(st->a_obs);
+  free(st->path);
+  free(st->point);
+  free(st->speed);
+  free(st->station);
+  free(st->leader);
+  free(st->gap);
+  free(st->done);
+  free(sim->names);
+  free(sim->rng);
+  free(sim->order);
+  for (i = 0; i < sim->n_paths; i++) {
+    free(sim->paths[i].x);
+    free(sim->paths[i].y);
+    free(sim->paths[i].s);
+  }
+  free(sim->paths);
+  free(sim);
+}
+
+const FleetSimState *fleetsim_state(const struct fleetsim *sim) {
+  return &sim->state;
+}
+
+int fleetsim_find(const struct fleetsim *sim, const char *name) {
+  int i;
+  for (i = 0; i < sim->state.n; i++) {
+    if (strcmp(sim->names[i], name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int fleetsim_add_vehicle(struct fleetsim *sim, const char *name, double x,
+                         double y, double a) {
+  FleetSimState *st = &sim->state;
+  uint64_t seed;
+  int i;
+  if (!name || strlen(name) == 0 || strlen(name) > FLEETSIM_NAME_MAX ||
+      fleetsim_find(sim, name) >= 0) {
+    return FLEETSIM_ERR_NAME;
+  } else if (st->n >= sim->capacity) {
+    return FLEETSIM_ERR_FULL;
+  }
+  i = st->n;
+  strcpy(sim->names[i], name);
+  seed = sim->params.seed ^ hash_name(name);
+  sim->rng[i] = splitmix64(&seed);
+  st->x[i] = x;
+  st->y[i] = y;
+  st->a[i] = a;
+  st->x_obs[i] = x;
+  st->y_obs[i] = y;
+  st->a_obs[i] = a;
+  st->steering[i] = 0;
+  st->velocity[i] = 0;
+  st->path[i] = -1;
+  st->point[i] = 0;
+  st->speed[i] = 0;
+  st->station[i] = 0;
+  st->leader[i] = -1;
+  st->gap[i] = INFINITY;
+  st->done[i] = 0;
+  st->n = i + 1;
+  return i;
+}
+
+int fleetsim_add_path(struct fleetsim *sim, const double *xy, int n_points,
+                      int closed) {
+  Path *paths;
+  Path *p;
+  int k;
+  if (n_points < 2) {
+    return FLEETSIM_ERR_INDEX;
+  }
+  paths = realloc(sim->paths, (sim->n_paths + 1) * sizeof(Path));
+  if (!paths) {
+    return FLEETSIM_ERR_MEMORY;
+  }
+  sim->paths = paths;
+  p = &paths[sim->n_paths];
+  p->x = malloc(n_points * sizeof(double));
+  p->y = malloc(n_points * sizeof(double));
+  p->s = malloc(n_points * sizeof(double));
+  if (!p->x || !p->y || !p->s) {
+    free(p->x);
+    free(p->y);
+    free(p->s);
+    return FLEETSIM_ERR_MEMORY;
+  }
+  p->n = n_points;
+  p->closed = closed != 0;
+  for (k = 0; k < n_points; k++) {
+    p->x[k] = xy[2 * k];
+    p->y[k] = xy[2 * k + 1];
+    p->s[k] = k == 0 ? 0
+                     : p->s[k - 1] + hypot(p->x[k] - p->x[k - 1],
+                                           p->y[k] - p->y[k - 1]);
+  }
+  p->length = p->s[n_points - 1];
+  if (p->closed) {
+    p->length +=
+        hypot(p->x[0] - p->x[n_points - 1], p->y[0] - p->y[n_points - 1]);
+  }
+  return sim->n_paths++;
+}
+
+static inline double dist2(const Path *p, int k, double x, double y) {
+  double dx = p->x[k] - x;
+  double dy = p->y[k] - y;
+  return dx * dx + dy * dy;
+}
+
+static inline int next_point(const Path *p, int k) {
+  return k + 1 < p->n ? k + 1 : (p->closed ? 0 : -1);
+}
+
+static inline int prev_point(const Path *p, int k) {
+  return k > 0 ? k - 1 : (p->closed ? p->n - 1 : -1);
+}
+
+/* Walk from the last nearest point, as vehicles move little in a step */
+static int track_point(const Path *p, int k, double x, double y) {
+  double d = dist2(p, k, x, y);
+  int j;
+  while ((j = next_point(p, k)) >= 0 && dist2(p, j, x, y) < d) {
+    k = j;
+    d = dist2(p, k, x, y);
+  }
+  while ((j = prev_point(p, k)) >= 0 && dist2(p, j, x, y) < d) {
+    k = j;
+    d = dist2(p, k, x, y);
+  }
+  return k;
+}
+
+/* Distance along the path of the projection onto a segment by point k */
+static double project(const Path *p, int k, double x, double y) {
+  int k0 = k;
+  int k1 = next_point(p, k);
+  double dx, dy, len2, t, s0;
+  if (k1 < 0) {
+    k1 = k;
+    k0 = prev_point(p, k);
+  }
+  dx = p->x[k1] - p->x[k0];
+  dy = p->y[k1] - p->y[k0];
+  len2 = dx * dx + dy * dy;
+  if (len2 <= 0) {
+    return p->s[k];
+  }
+  t = ((x - p->x[k0]) * dx + (y - p->y[k0]) * dy) / len2;
+  t = t < 0 ? 0 : (t > 1 ? 1 : t);
+  s0 = p->s[k0];
+  return s0 + t * sqrt(len2);
+}
+
+/* Point at a distance along the path */
+static void point_at(const Path *p, double s, double *x, double *y) {
+  int lo = 0;
+  int hi = p->n - 1;
+  int k1;
+  double ds, t;
+  if (p->closed) {
+    s = fmod(s, p->length);
+    if (s < 0) {
+      s += p->length;
+    }
+  } else if (s >= p->s[p->n - 1]) {
+    *x = p->x[p->n - 1];
+    *y = p->y[p->n - 1];
+    return;
+  } else if (s <= 0) {
+    *x = p->x[0];
+    *y = p->y[0];
+    return;
+  }
+  /* Last point at or before s */
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (p->s[mid] <= s) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  k1 = next_point(p, lo);
+  ds = (k1 == 0 ? p->length : p->s[k1]) - p->s[lo];
+  t = ds > 0 ? (s - p->s[lo]) / ds : 0;
+  *x = p->x[lo] + t * (p->x[k1] - p->x[lo]);
+  *y = p->y[lo] + t * (p->y[k1] - p->y[lo]);
+}
+
+int fleetsim_follow(struct fleetsim *sim, int vehicle, int path,
+                    double speed) {
+  FleetSimState *st = &sim->state;
+  const Path *p;
+  double d, d_best;
+  int k, k_best = 0;
+  if (vehicle < 0 || vehicle >= st->n || path >= sim->n_paths) {
+    return FLEETSIM_ERR_INDEX;
+  }
+  st->path[vehicle] = path < 0 ? -1 : path;
+  st->speed[vehicle] = speed;
+  st->leader[vehicle] = -1;
+  st->gap[vehicle] = INFINITY;
+  st->done[vehicle] = 0;
+  if (path < 0) {
+    return 0;
+  }
+  /* Search the whole path, once */
+  p = &sim->paths[path];
+  d_best = INFINITY;
+  for (k = 0; k < p->n; k++) {
+    d = dist2(p, k, st->x[vehicle], st->y[vehicle]);
+    if (d < d_best) {
+      d_best = d;
+      k_best = k;
+    }
+  }
+  st->point[vehicle] = k_best;
+  st->station[vehicle] = project(p, k_best, st->x[vehicle], st->y[vehicle]);
+  return 0;
+}
+
+int fleetsim_command(struct fleetsim *sim, int vehicle, double steering,
+                     double velocity) {
+  if (vehicle < 0 || vehicle >= sim->state.n) {
+    return FLEETSIM_ERR_INDEX;
+  }
+  sim->state.steering[vehicle] = steering;
+  sim->state.velocity[vehicle] = velocity;
+  return 0;
+}
+
+static int by_path_station(const void *a, const void *b) {
+  const Order *oa = a;
+  const Order *ob = b;
+  if (oa->path != ob->path) {
+    return oa->path < ob->path ? -1 : 1;
+  } else if (oa->station != ob->station) {
+    return oa->station < ob->station ? -1 : 1;
+  }
+  /* Stable across platforms, for the same run on every machine */
+  return oa->vehicle < ob->vehicle ? -1 : (oa->vehicle > ob->vehicle);
+}
+
+/* Localize the followers and find who is ahead of whom on each path */
+static void update_leaders(struct fleetsim *sim) {
+  FleetSimState *st = &sim->state;
+  Order *order = sim->order;
+  int n_order = 0;
+  int i, j, j0;
+  for (i = 0; i < st->n; i++) {
+    const Path *p;
+    if (st->path[i] < 0) {
+      continue;
+    }
+    p = &sim->paths[st->path[i]];
+    st->point[i] = track_point(p, st->point[i], st->x[i], st->y[i]);
+    st->station[i] = project(p, st->point[i], st->x[i], st->y[i]);
+    order[n_order].path = st->path[i];
+    order[n_order].vehicle = i;
+    order[n_order].station = st->station[i];
+    n_order++;
+  }
+  qsort(order, n_order, sizeof(Order), by_path_station);
+  for (j0 = 0; j0 < n_order; j0 = j) {
+    const Path *p = &sim->paths[order[j0].path];
+    /* Vehicles on this path are j0 to j - 1 */
+    for (j = j0 + 1; j < n_order && order[j].path == order[j0].path; j++) {
+      int v = order[j - 1].vehicle;
+      st->leader[v] = order[j].vehicle;
+      st->gap[v] = order[j].station - order[j - 1].station;
+    }
+    /* Around a loop, the last follows the first */
+    if (p->closed && j - j0 > 1) {
+      int v = order[j - 1].vehicle;
+      st->leader[v] = order[j0].vehicle;
+      st->gap[v] = order[j0].station + p->length - order[j - 1].station;
+    } else {
+      st->leader[order[j - 1].vehicle] = -1;
+      st->gap[order[j - 1].vehicle] = INFINITY;
+    }
+  }
+}
+
+/* Pure pursuit of a lookahead point, slowing in turns and behind the
+ * leader, as update_params in run_control
+ */
+static void pursue(struct fleetsim *sim, int i) {
+  const FleetSimParameters *params = &sim->params;
+  FleetSimState *st = &sim->state;
+  const Path *p = &sim->paths[st->path[i]];
+  double speed, d_lookahead, lx, ly, dx, dy, lookahead, alpha, two_sa;
+  double ratio, ratio_turning, ratio_lead;
+  /* Sample the speed every step, even when done, to keep the stream */
+  speed = st->speed[i] * (1 + params->speed_noise * randn(&sim->rng[i]));
+  if (!p->closed && st->point[i] == p->n - 1) {
+    st->done[i] = 1;
+  }
+  if (st->done[i]) {
+    st->steering[i] = 0;
+    st->velocity[i] = 0;
+    return;
+  }
+  d_lookahead = params->t_lookahead * speed;
+  if (d_lookahead < params->min_lookahead) {
+    d_lookahead = params->min_lookahead;
+  }
+  point_at(p, st->station[i] + d_lookahead, &lx, &ly);
+  dx = lx - st->x[i];
+  dy = ly - st->y[i];
+  lookahead = sqrt(dx * dx + dy * dy);
+  if (lookahead <= 0) {
+    st->steering[i] = 0;
+    st->velocity[i] = 0;
+    return;
+  }
+  alpha = atan2(dy, dx) - st->a[i];
+  two_sa = 2 * sin(alpha);
+  st->steering[i] = atan(two_sa / lookahead * params->wheel_base);
+  /* Radius of curvature over the limit */
+  ratio_turning = fabs(lookahead / two_sa) / params->limiting_radius;
+  ratio_lead =
+      (st->gap[i] - params->d_stop) / (params->d_near - params->d_stop);
+  ratio = ratio_turning < ratio_lead ? ratio_turning : ratio_lead;
+  ratio = ratio < 0 ? 0 : (ratio > 1 ? 1 : ratio);
+  speed *= ratio;
+  if (speed < params->min_speed) {
+    st->velocity[i] = 0;
+  } else {
+    st->velocity[i] = speed < params->max_speed ? speed : params->max_speed;
+  }
+}
+
+int64_t fleetsim_step(struct fleetsim *sim, int n_steps) {
+  const FleetSimParameters *params = &sim->params;
+  FleetSimState *st = &sim->state;
+  const double dt = params->dt;
+  const double max_steering = params->max_steering;
+  int has_followers = 0;
+  int i, t;
+  for (i = 0; i < st->n; i++) {
+    has_followers |= st->path[i] >= 0;
+  }
+  for (t = 0; t < n_steps; t++) {
+    if (has_followers) {
+      update_leaders(sim);
+      for (i = 0; i < st->n; i++) {
+        if (st->path[i] >= 0) {
+          pursue(sim, i);
+        }
+      }
+    }
+    /* Kinematic bicycle, all vehicles together */
+    for (i = 0; i < st->n; i++) {
+      double v = st->velocity[i];
+      double steering = st->steering[i];
+      double a = st->a[i];
+      steering = steering < -max_steering
+                     ? -max_steering
+                     : (steering > max_steering ? max_steering : steering);
+      st->x[i] += v * dt * cos(a);
+      st->y[i] += v * dt * sin(a);
+      a += v * dt / params->wheel_base * tan(steering);
+      /* Noise only if moving */
+      if (v > 0) {
+        uint64_t *rng = &sim->rng[i];
+        st->x[i] += params->process_noise[0] * dt * randn(rng);
+        st->y[i] += params->process_noise[1] * dt * randn(rng);
+        a += params->process_noise[2] * dt * randn(rng);
+      }
+      st->a[i] = mod_angle(a);
+    }
+    sim->steps++;
+  }
+  return sim->steps;
+}
+
+int64_t fleetsim_steps(const struct fleetsim *sim) { return sim->steps; }
+
+uint64_t fleetsim_time_us(const struct fleetsim *sim) {
+  /* From the step count, so that the clock does not drift */
+  return sim->params.t0_us +
+         (uint64_t)llround((double)sim->steps * sim->params.dt * 1e6);
+}
+
+void fleetsim_observe(struct fleetsim *sim) {
+  const FleetSimParameters *params = &sim->params;
+  FleetSimState *st = &sim->state;
+  const double dt = params->dt;
+  int i;
+  for (i = 0; i < st->n; i++) {
+    uint64_t *rng = &sim->rng[i];
+    st->x_obs[i] = st->x[i] + params->measurement_noise[0] * dt * randn(rng);
+    st->y_obs[i] = st->y[i] + params->measurement_noise[1] * dt * randn(rng);
+    st->a_obs[i] = st->a[i] + params->measurement_noise[2] * dt * randn(rng);
+  }
+}
+
+/* Largest entry: fixstr name, fixmap of 2, two keys and two fixarrays of 3
+ * float 64s
+ */
+#define VICON_ENTRY_MAX (1 + FLEETSIM_NAME_MAX + 1 + 9 + 12 + 2 * (1 + 3 * 9))
+
+size_t fleetsim_vicon_size(const struct fleetsim *sim) {
+  /* map 32 header, "frame" and a uint 64 */
+  return 5 + 6 + 9 + (size_t)sim->capacity * VICON_ENTRY_MAX;
+}
+
+static uint8_t *put_be(uint8_t *b, uint64_t v, int n) {
+  int k;
+  for (k = n - 1; k >= 0; k--) {
+    b[k] = (uint8_t)v;
+    v >>= 8;
+  }
+  return b + n;
+}
+
+static uint8_t *put_str(uint8_t *b, const char *str) {
+  size_t len = strlen(str);
+  /* Names are at most 31 bytes, so always a fixstr */
+  *b++ = 0xa0 | (uint8_t)len;
+  memcpy(b, str, len);
+  return b + len;
+}
+
+static uint8_t *put_double(uint8_t *b, double v) {
+  uint64_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  *b++ = 0xcb;
+  return put_be(b, bits, 8);
+}
+
+static uint8_t *put_uint(uint8_t *b, uint64_t v) {
+  if (v < 128) {
+    *b++ = (uint8_t)v;
+    return b;
+  }
+  *b++ = 0xcf;
+  return put_be(b, v, 8);
+}
+
+static uint8_t *put_xyz(uint8_t *b, double x, double y, double z) {
+  *b++ = 0x93;
+  b = put_double(b, x);
+  b = put_double(b, y);
+  return put_double(b, z);
+}
+
+int fleetsim_encode_vicon(const struct fleetsim *sim, int64_t frame,
+                          uint8_t *buf, size_t sz) {
+  const FleetSimState *st = &sim->state;
+  uint32_t n_keys = st->n + 1;
+  uint8_t *b = buf;
+  int i;
+  if (sz < fleetsim_vicon_size(sim)) {
+    return FLEETSIM_ERR_SPACE;
+  }
+  if (n_keys < 16) {
+    *b++ = 0x80 | n_keys;
+  } else if (n_keys < 65536) {
+    *b++ = 0xde;
+    b = put_be(b, n_keys, 2);
+  } else {
+    *b++ = 0xdf;
+    b = put_be(b, n_keys, 4);
+  }
+  b = put_str(b, "frame");
+  b = put_uint(b, frame < 0 ? 0 : (uint64_t)frame);
+  /* Millimeters, on the z = 0 plane, as run_vicon */
+  for (i = 0; i < st->n; i++) {
+    b = put_str(b, sim->names[i]);
+    *b++ = 0x82;
+    b = put_str(b, "rotation");
+    b = put_xyz(b, 0, 0, st->a_obs[i]);
+    b = put_str(b, "translation");
+    b = put_xyz(b, 1e3 * st->x_obs[i], 1e3 * st->y_obs[i], 0);
+  }
+  return (int)(b - buf);
+}
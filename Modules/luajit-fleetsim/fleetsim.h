@@ -0,0 +1,132 @@
+#pragma once
+/*
+Fixed step simulation of a fleet of racecars, for platoons of hundreds of
+vehicles run faster than real time. Vehicles are kinematic bicycles, held
+as a structure of arrays, and each either follows a path with pure pursuit
+behind its leader, as run_control drives them, or takes external commands.
+Every vehicle draws its noise from its own stream, seeded by its name, so a
+run depends only on the seed and not on the order vehicles were added.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Errors */
+#define FLEETSIM_ERR_FULL (-1)
+#define FLEETSIM_ERR_NAME (-2)
+#define FLEETSIM_ERR_MEMORY (-3)
+#define FLEETSIM_ERR_INDEX (-4)
+#define FLEETSIM_ERR_SPACE (-5)
+
+/* Longest vehicle name, as in the vicon message */
+#define FLEETSIM_NAME_MAX 31
+
+typedef struct {
+  /* Fixed step, in seconds */
+  double dt;
+  /* Simulated time of step 0, in microseconds */
+  uint64_t t0_us;
+  uint64_t seed;
+  /* Vehicle, in meters and radians of the front wheels */
+  double wheel_base;
+  double max_steering;
+  /* Standard deviation of the pose, {x, y, a}, per second of driving,
+   * added each step, and of each vicon measurement, per second of step
+   */
+  double process_noise[3];
+  double measurement_noise[3];
+  /* Pure pursuit: lookahead in seconds at the sampled speed, with a floor
+   * in meters, and the speed sampled each step with this relative
+   * standard deviation
+   */
+  double t_lookahead;
+  double min_lookahead;
+  double speed_noise;
+  double min_speed, max_speed;
+  /* Slow down in turns tighter than this radius */
+  double limiting_radius;
+  /* Stop this far behind the leader, and slow down from d_near */
+  double d_stop, d_near;
+} FleetSimParameters;
+
+typedef struct {
+  int32_t n;
+  /* Rear axle pose, in meters and radians */
+  double *x, *y, *a;
+  /* Commands, in radians and meters per second */
+  double *steering, *velocity;
+  /* Noisy poses from the last fleetsim_observe */
+  double *x_obs, *y_obs, *a_obs;
+  /* Path followed, or -1 for external commands, and the nearest point */
+  int32_t *path;
+  int32_t *point;
+  /* Desired speed on the path, and distance along it */
+  double *speed;
+  double *station;
+  /* Next vehicle ahead on the same path, or -1, and the gap to it */
+  int32_t *leader;
+  double *gap;
+  /* Reached the end of an open path */
+  uint8_t *done;
+} FleetSimState;
+
+struct fleetsim;
+
+/* Defaults for the racecar, at 60 Hz, as run_simulation and run_control */
+void fleetsim_default_parameters(FleetSimParameters *params);
+
+/* Room for capacity vehicles, so that the state arrays never move */
+struct fleetsim *fleetsim_create(const FleetSimParameters *params,
+                                 int capacity);
+void fleetsim_free(struct fleetsim *sim);
+
+/* Arrays of every vehicle, from index 0 in order added */
+const FleetSimState *fleetsim_state(const struct fleetsim *sim);
+
+/* Add a stopped vehicle, taking external commands.
+ * Returns its index, or an error
+ */
+int fleetsim_add_vehicle(struct fleetsim *sim, const char *name, double x,
+                         double y, double a);
+
+/* Index of the vehicle with this name, or -1 */
+int fleetsim_find(const struct fleetsim *sim, const char *name);
+
+/* Add a path of n_points {x, y} pairs, closing it back to the first point
+ * if closed. Returns the path id, from 0, or an error
+ */
+int fleetsim_add_path(struct fleetsim *sim, const double *xy, int n_points,
+                      int closed);
+
+/* Drive a vehicle along a path at a desired speed, from its nearest point,
+ * or return it to external commands with path -1. Returns 0 or an error
+ */
+int fleetsim_follow(struct fleetsim *sim, int vehicle, int path,
+                    double speed);
+
+/* Commands for a vehicle, used until the next, if not following a path */
+int fleetsim_command(struct fleetsim *sim, int vehicle, double steering,
+                     double velocity);
+
+/* Advance every vehicle n_steps of dt: pure pursuit for the followers,
+ * then the bicycle model with process noise. Returns the step count
+ */
+int64_t fleetsim_step(struct fleetsim *sim, int n_steps);
+
+/* Steps taken, and the simulated time of the last */
+int64_t fleetsim_steps(const struct fleetsim *sim);
+uint64_t fleetsim_time_us(const struct fleetsim *sim);
+
+/* Sample a vicon measurement of every vehicle into the observed arrays */
+void fleetsim_observe(struct fleetsim *sim);
+
+/* Bytes enough for the vicon message of a full fleet */
+size_t fleetsim_vicon_size(const struct fleetsim *sim);
+
+/* MessagePack of the vicon message of the observed poses, as
+ * {frame = frame, [name] = {rotation = {0, 0, a},
+ * translation = {mm, mm, 0}}}, to log and announce without building
+ * tables. Returns the length, or an error if sz is short
+ */
+int fleetsim_encode_vicon(const struct fleetsim *sim, int64_t frame,
+                          uint8_t *buf, size_t sz);
@@ -0,0 +1,182 @@
+-- Native fleet simulation, for platoons faster than real time
+local lib = {}
+
+local ffi = require'ffi'
+
+ffi.cdef[[
+typedef struct {
+  double dt;
+  uint64_t t0_us;
+  uint64_t seed;
+  double wheel_base;
+  double max_steering;
+  double process_noise[3];
+  double measurement_noise[3];
+  double t_lookahead;
+  double min_lookahead;
+  double speed_noise;
+  double min_speed, max_speed;
+  double limiting_radius;
+  double d_stop, d_near;
+} FleetSimParameters;
+typedef struct {
+  int32_t n;
+  double *x, *y, *a;
+  double *steering, *velocity;
+  double *x_obs, *y_obs, *a_obs;
+  int32_t *path;
+  int32_t *point;
+  double *speed;
+  double *station;
+  int32_t *leader;
+  double *gap;
+  uint8_t *done;
+} FleetSimState;
+struct fleetsim;
+void fleetsim_default_parameters(FleetSimParameters *params);
+struct fleetsim *fleetsim_create(const FleetSimParameters *params,
+                                 int capacity);
+void fleetsim_free(struct fleetsim *sim);
+const FleetSimState *fleetsim_state(const struct fleetsim *sim);
+int fleetsim_add_vehicle(struct fleetsim *sim, const char *name, double x,
+                         double y, double a);
+int fleetsim_find(const struct fleetsim *sim, const char *name);
+int fleetsim_add_path(struct fleetsim *sim, const double *xy, int n_points,
+                      int closed);
+int fleetsim_follow(struct fleetsim *sim, int vehicle, int path,
+                    double speed);
+int fleetsim_command(struct fleetsim *sim, int vehicle, double steering,
+                     double velocity);
+int64_t fleetsim_step(struct fleetsim *sim, int n_steps);
+int64_t fleetsim_steps(const struct fleetsim *sim);
+uint64_t fleetsim_time_us(const struct fleetsim *sim);
+void fleetsim_observe(struct fleetsim *sim);
+size_t fleetsim_vicon_size(const struct fleetsim *sim);
+int fleetsim_encode_vicon(const struct fleetsim *sim, int64_t frame,
+                          uint8_t *buf, size_t sz);
+]]
+local has_fleetsim, fleetsim = pcall(ffi.load, 'fleetsim')
+
+local errors = {
+  [-1] = "Fleet is full",
+  [-2] = "Bad or repeated name",
+  [-3] = "Out of memory",
+  [-4] = "No such vehicle or path",
+  [-5] = "Buffer too small",
+}
+
+-- Vehicles are found by name, and kept by index in the C arrays
+local function add(self, name, pose)
+  local i = fleetsim.fleetsim_add_vehicle(self.c, name, pose[1], pose[2], pose[3])
+  if i < 0 then return false, errors[i] end
+  self.ids[name] = i
+  self.names[i + 1] = name
+  return i
+end
+
+-- Paths, as from path_from_waypoints, are copied in once, by name
+local function add_path(self, name, my_path)
+  local points = my_path.points
+  local xy = ffi.new('double[?]', 2 * #points)
+  for k, p in ipairs(points) do
+    xy[2 * k - 2], xy[2 * k - 1] = p[1], p[2]
+  end
+  local id = fleetsim.fleetsim_add_path(self.c, xy, #points, my_path.closed and 1 or 0)
+  if id < 0 then return false, errors[id] end
+  self.paths[name] = id
+  return id
+end
+
+-- Follow a path by name at a desired speed, or take commands with no path
+local function follow(self, name, pathname, speed)
+  local i = self.ids[name]
+  if not i then return false, "No such vehicle" end
+  local id = -1
+  if pathname then
+    id = self.paths[pathname]
+    if not id then return false, "No such path" end
+  end
+  local ret = fleetsim.fleetsim_follow(self.c, i, id, tonumber(speed) or 0)
+  if ret < 0 then return false, errors[ret] end
+  return true
+end
+
+local function command(self, name, steering, velocity)
+  local i = self.ids[name]
+  if not i then return false, "No such vehicle" end
+  fleetsim.fleetsim_command(self.c, i, steering, velocity)
+  return true
+end
+
+local function step(self, n_steps)
+  return tonumber(fleetsim.fleetsim_step(self.c, n_steps or 1))
+end
+
+-- Simulated time, in microseconds
+local function time_us(self)
+  return tonumber(fleetsim.fleetsim_time_us(self.c))
+end
+
+local function get_pose(self, name)
+  local i = self.ids[name]
+  if not i then return false, "No such vehicle" end
+  local st = self.state
+  return {st.x[i], st.y[i], st.a[i]}
+end
+
+-- Sample vicon and give its MessagePack, for log:write_raw and announce
+local function vicon(self, frame)
+  fleetsim.fleetsim_observe(self.c)
+  local len = fleetsim.fleetsim_encode_vicon(self.c, frame or 0, self.buf, self.sz_buf)
+  if len < 0 then return false, errors[len] end
+  return ffi.string(self.buf, len)
+end
+
+local function tostring_fleetsim(self)
+  return string.format("FleetSim | %d vehicles, %d steps of %.4f s",
+    self.state.n, tonumber(fleetsim.fleetsim_steps(self.c)), self.params.dt)
+end
+
+local mt = {
+  __tostring = tostring_fleetsim
+}
+
+-- Parameters default to fleetsim_default_parameters, and override the
+-- fields of FleetSimParameters that are given. capacity bounds the fleet
+function lib.new(params)
+  if not has_fleetsim then return false, fleetsim end
+  if type(params) ~= 'table' then params = {} end
+  local c_params = ffi.new'FleetSimParameters'
+  fleetsim.fleetsim_default_parameters(c_params)
+  for k, v in pairs(params) do
+    if type(v) == 'table' then
+      for i, vi in ipairs(v) do c_params[k][i - 1] = vi end
+    elseif k ~= 'capacity' then
+      c_params[k] = v
+    end
+  end
+  local c = fleetsim.fleetsim_create(c_params, tonumber(params.capacity) or 1024)
+  if c == nil then return false, "Bad parameters" end
+  local sz_buf = tonumber(fleetsim.fleetsim_vicon_size(c))
+  return setmetatable({
+    c = ffi.gc(c, fleetsim.fleetsim_free),
+    params = c_params,
+    -- Arrays of every vehicle, from 0, that never move
+    state = fleetsim.fleetsim_state(c),
+    ids = {},
+    names = {},
+    paths = {},
+    buf = ffi.new('uint8_t[?]', sz_buf),
+    sz_buf = sz_buf,
+    add = add,
+    add_path = add_path,
+    follow = follow,
+    command = command,
+    step = step,
+    time_us = time_us,
+    pose = get_pose,
+    vicon = vicon,
+  }, mt)
+end
+
+return lib
@@ -0,0 +1,74 @@
+#!/usr/bin/env luajit
+local fleetsim = require'fleetsim'
+local has_logger, logger = pcall(require, 'logger')
+local clock = require'os'.clock
+
+-- A loop of radius 30, counterclockwise about (0, 30)
+local radius = 30
+local n_points = 2000
+local points = {}
+for k=1, n_points do
+  local th = 2 * math.pi * (k - 1) / n_points
+  points[k] = {radius * math.sin(th), radius * (1 - math.cos(th)), th}
+end
+local loop = {points = points, closed = true}
+
+-- Platoon of n, evenly spaced, added in the given order
+local n = tonumber(arg[1]) or 200
+local function platoon(order)
+  local sim = assert(fleetsim.new{seed = 123, capacity = n})
+  assert(sim:add_path('loop', loop))
+  for _, i in ipairs(order) do
+    local th = 2 * math.pi * (i - 1) / n
+    local name = string.format("sim%03d", i)
+    assert(sim:add(name, {radius * math.sin(th), radius * (1 - math.cos(th)), th}))
+    assert(sim:follow(name, 'loop', 0.5 + 0.1 * (i % 3)))
+  end
+  return sim
+end
+local forwards, backwards = {}, {}
+for i=1, n do forwards[i], backwards[n - i + 1] = i, i end
+
+-- A minute of simulated time
+local sim = platoon(forwards)
+print(sim)
+local t0 = clock()
+sim:step(3600)
+local dt = clock() - t0
+print(string.format("%d vehicles, 60 s simulated in %.3f s, %.0fx real time",
+  n, dt, 60 / dt))
+assert(sim:time_us() == 60e6)
+
+-- The same run, whatever the order the vehicles were added
+local sim2 = platoon(backwards)
+sim2:step(3600)
+local st = sim.state
+for i=1, n do
+  local name = string.format("sim%03d", i)
+  local p1, p2 = sim:pose(name), sim2:pose(name)
+  assert(p1[1] == p2[1] and p1[2] == p2[2] and p1[3] == p2[3], "Deterministic")
+  -- On the loop, and not into the vehicle ahead
+  local j = sim.ids[name]
+  local r = math.sqrt(p1[1]^2 + (p1[2] - radius)^2)
+  assert(math.abs(r - radius) < 0.1, "Off the path")
+  assert(st.leader[j] >= 0 and st.gap[j] > 0.3, "Too close")
+end
+
+-- External commands: a straight line, with no noise
+local sim3 = assert(fleetsim.new{process_noise = {0, 0, 0}, measurement_noise = {0, 0, 0}})
+assert(sim3:add('tri1', {0, 0.5, 0}))
+assert(not sim3:add('tri1', {0, 0, 0}), "Repeated name")
+assert(sim3:command('tri1', 0, 1.0))
+sim3:step(60)
+local p = sim3:pose('tri1')
+assert(math.abs(p[1] - 1) < 1e-9 and p[2] == 0.5)
+
+-- Vicon, as run_vicon gives it
+local str = assert(sim3:vicon(60))
+if has_logger then
+  local msg = assert(logger.decode(str))
+  assert(msg.frame == 60)
+  assert(math.abs(msg.tri1.translation[1] - 1e3) < 1e-6)
+  assert(msg.tri1.translation[2] == 500 and msg.tri1.rotation[3] == 0)
+end
+print("OK")
@@ -2,6 +2,35 @@ local lib = {}
 
 local ffi = require'ffi'
 
+ffi.cdef[[
+typedef struct {
+  double threshold;
+  double scale;
+  double radius;
+  double decay;
+  double max_distance;
+  double lethal;
+  double inscribed;
+  double free;
+} GridInflation;
+int grid_distance(const void *src, int src_type, void *dst, int dst_type,
+                  int m, int n, double threshold, double scale, int is_signed,
+                  int n_threads);
+int grid_inflate(const void *src, int src_type, void *dst, int dst_type,
+                 int m, int n, const GridInflation *params, int n_threads);
+int grid_voronoi(const int32_t *seeds, void *dst, int dst_type, int m, int n,
+                 int n_threads);
+int grid_gvd(const void *src, int src_type, void *dst, int dst_type, int m,
+             int n, double threshold, double value, int n_threads);
+]]
+-- Native distance transforms, if built
+local has_edt, edt = pcall(ffi.load, 'grid_edt')
+-- Datatypes that the native code reads and writes
+local edt_types = {
+  uint8_t = 1,
+  double = 2,
+}
+
 local has_ff, ff = pcall(require, 'fileformats')
 local has_png, png = pcall(require, 'png')
 local has_jpeg, jpeg = pcall(require, 'jpeg')
@@ -183,6 +212,94 @@ local function arc(self, pc, rc, a1, a2, cb)
   return self
 end
 
+-- Check that the native code can go from self to out
+local function edt_types_of(self, out)
+  if not has_edt then return false, edt end
+  local src_type, dst_type = edt_types[self.datatype], edt_types[out.datatype]
+  if not (src_type and dst_type) then
+    return false, "Unsupported datatype"
+  end
+  if out.m ~= self.m or out.n ~= self.n then
+    return false, "Size mismatch"
+  end
+  return src_type, dst_type
+end
+
+-- Distance, in meters, to the nearest obstacle of at least threshold.
+-- is_signed gives obstacle cells the negative distance to free space.
+-- out: grid to write, which may be self, as it is by default
+local function distance(self, params)
+  if type(params)~='table' then params = {} end
+  local out = params.out or self
+  local src_type, dst_type = edt_types_of(self, out)
+  if not src_type then return false, dst_type end
+  local ret = edt.grid_distance(self.grid, src_type, out.grid, dst_type,
+    self.m, self.n, tonumber(params.threshold) or 127, self.scale,
+    params.is_signed and 1 or 0, tonumber(params.n_threads) or 0)
+  if ret < 0 then return false, "Out of memory" end
+  return out
+end
+
+-- Costs that decay exponentially away from obstacles, as for a round robot
+-- of the given radius, in place by default. Costs are never lowered.
+-- Defaults suit uint8_t maps drawn with 255 as obstacles
+local function inflate(self, params)
+  if type(params)~='table' then params = {} end
+  local out = params.out or self
+  local src_type, dst_type = edt_types_of(self, out)
+  if not src_type then return false, dst_type end
+  local lethal = tonumber(params.lethal) or 255
+  local inflation = ffi.new('GridInflation', {
+    threshold = tonumber(params.threshold) or 127,
+    scale = self.scale,
+    radius = tonumber(params.radius) or 0,
+    decay = tonumber(params.decay) or 10,
+    max_distance = tonumber(params.max_distance) or math.huge,
+    lethal = lethal,
+    inscribed = tonumber(params.inscribed) or (lethal - 1),
+    free = tonumber(params.free) or 0,
+  })
+  local ret = edt.grid_inflate(self.grid, src_type, out.grid, dst_type,
+    self.m, self.n, inflation, tonumber(params.n_threads) or 0)
+  if ret < 0 then return false, "Out of memory" end
+  return out
+end
+
+-- Generalized Voronoi diagram: free cells between two different obstacles
+-- get value, and other cells 0. Returns out and the number of obstacles
+local function gvd(self, params)
+  if type(params)~='table' then params = {} end
+  local out = params.out or self
+  local src_type, dst_type = edt_types_of(self, out)
+  if not src_type then return false, dst_type end
+  local n_obstacles = edt.grid_gvd(self.grid, src_type, out.grid, dst_type,
+    self.m, self.n, tonumber(params.threshold) or 127,
+    tonumber(params.value) or 255, tonumber(params.n_threads) or 0)
+  if n_obstacles < 0 then return false, "Out of memory" end
+  return out, n_obstacles
+end
+
+-- Label each cell with the nearest center, approximately, from seeds at the
+-- cells of the centers. Unlike voronoi, centers are snapped to their cells,
+-- only the first of centers in the same cell is kept, and cells are labelled
+-- by the distance between cell centers, so labels may differ near the
+-- boundaries. Returns self, or false if a center is off the map
+local function voronoi_cells(self, centers)
+  local dst_type, err = edt_types_of(self, self)
+  if not dst_type then return false, err end
+  local seeds = ffi.new('int32_t[?]', self.n_cells)
+  local xy2idx = self.xy2idx
+  for idc, c in ipairs(centers) do
+    local idx = xy2idx(unpack(c, 1, 2))
+    if not idx then return false, "Center off the map" end
+    if seeds[idx] == 0 then seeds[idx] = idc end
+  end
+  if edt.grid_voronoi(seeds, self.grid, dst_type, self.m, self.n, 0) < 0 then
+    return false, "Out of memory"
+  end
+  return self
+end
+
 local function voronoi(self, centers)
   local grid = self.grid
   local idx2xy = self.idx2xy
@@ -471,11 +588,15 @@ function lib.new(params)
   obj.arc = arc
   obj.bresenham = bresenham
   obj.circle = circle
+  obj.distance = distance
   obj.fill = fill
+  obj.gvd = gvd
+  obj.inflate = inflate
   obj.path = path
   obj.point = point
   obj.potential_field = potential_field
   obj.voronoi = voronoi
+  obj.voronoi_cells = voronoi_cells
   obj.save = save
 
   return obj
@@ -0,0 +1,578 @@
+/*
+Exact Euclidean distance transform of luajit-grid maps
+*/
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "grid_edt.h"
+
+#define MAX_THREADS 16
+/* Stands in for infinity, so that the envelope arithmetic stays finite */
+#define EDT_FAR 1e20
+/* Lines of i transformed together along j */
+#define TILE 16
+
+/* Apply fn to the lines [begin, end) of a range, with scratch per thread */
+typedef void (*LineFn)(void *ctx, int begin, int end, void *scratch);
+
+typedef struct {
+  LineFn fn;
+  void *ctx;
+  int begin, end;
+  size_t scratch_sz;
+  int failed;
+  pthread_t thread;
+} LineJob;
+
+static void *line_job(void *arg) {
+  LineJob *job = (LineJob *)arg;
+  void *scratch = NULL;
+  if (job->scratch_sz > 0) {
+    scratch = malloc(job->scratch_sz);
+    if (!scratch) {
+      job->failed = 1;
+      return NULL;
+    }
+  }
+  job->fn(job->ctx, job->begin, job->end, scratch);
+  free(scratch);
+  return NULL;
+}
+
+static int run_lines(LineFn fn, void *ctx, int count, size_t scratch_sz,
+                     int n_threads) {
+  LineJob jobs[MAX_THREADS];
+  int started[MAX_THREADS];
+  int i, failed = 0;
+  if (n_threads <= 0) {
+    n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if (n_threads > MAX_THREADS) {
+    n_threads = MAX_THREADS;
+  }
+  if (n_threads > count) {
+    n_threads = count;
+  }
+  if (n_threads < 1) {
+    n_threads = 1;
+  }
+  for (i = 0; i < n_threads; i++) {
+    jobs[i].fn = fn;
+    jobs[i].ctx = ctx;
+    jobs[i].begin = (int)((long)count * i / n_threads);
+    jobs[i].end = (int)((long)count * (i + 1) / n_threads);
+    jobs[i].scratch_sz = scratch_sz;
+    jobs[i].failed = 0;
+    started[i] = 0;
+  }
+  /* The calling thread takes the first range */
+  for (i = 1; i < n_threads; i++) {
+    started[i] = pthread_create(&jobs[i].thread, NULL, line_job, &jobs[i]) == 0;
+    if (!started[i]) {
+      line_job(&jobs[i]);
+    }
+  }
+  line_job(&jobs[0]);
+  for (i = 0; i < n_threads; i++) {
+    if (started[i]) {
+      pthread_join(jobs[i].thread, NULL);
+    }
+    failed |= jobs[i].failed;
+  }
+  return failed ? -1 : 0;
+}
+
+/* Lower envelope of parabolas rooted at (q, f[q]), sampled at each q */
+static void edt_1d(const double *f, int len, double *d, int *arg, int *v,
+                   double *z) {
+  int k = 0, q;
+  v[0] = 0;
+  z[0] = -INFINITY;
+  z[1] = INFINITY;
+  for (q = 1; q < len; q++) {
+    /* Finite f keeps s above z[0], so k stays at least 0 */
+    double s;
+    for (;;) {
+      int r = v[k];
+      s = ((f[q] + (double)q * q) - (f[r] + (double)r * r)) / (2.0 * (q - r));
+      if (s > z[k]) {
+        break;
+      }
+      k--;
+    }
+    k++;
+    v[k] = q;
+    z[k] = s;
+    z[k + 1] = INFINITY;
+  }
+  k = 0;
+  for (q = 0; q < len; q++) {
+    while (z[k + 1] < q) {
+      k++;
+    }
+    d[q] = (double)(q - v[k]) * (q - v[k]) + f[v[k]];
+    arg[q] = v[k];
+  }
+}
+
+typedef struct {
+  const uint8_t *mask;
+  int m, n;
+  double *dist_sq;
+  int32_t *nearest;
+} EDTContext;
+
+static size_t edt_scratch(int len) {
+  return (size_t)len * (2 * sizeof(double) + 2 * sizeof(int)) +
+         (size_t)(len + 1) * sizeof(double) + (size_t)len * sizeof(int32_t);
+}
+
+/* Along i, within each j, where cells are contiguous */
+static void edt_pass_i(void *arg, int begin, int end, void *scratch) {
+  EDTContext *ctx = (EDTContext *)arg;
+  int m = ctx->m;
+  double *f = (double *)scratch;
+  double *d = f + m;
+  double *z = d + m;
+  int *where = (int *)(z + m + 1);
+  int *v = where + m;
+  int i, j;
+  for (j = begin; j < end; j++) {
+    size_t offset = (size_t)j * m;
+    const uint8_t *mask = ctx->mask + offset;
+    for (i = 0; i < m; i++) {
+      f[i] = mask[i] ? 0 : EDT_FAR;
+    }
+    edt_1d(f, m, d, where, v, z);
+    memcpy(ctx->dist_sq + offset, d, m * sizeof(double));
+    for (i = 0; i < m; i++) {
+      ctx->nearest[offset + i] = where[i];
+    }
+  }
+}
+
+/* Along j, gathering TILE lines of i at a time, so that reads of each j
+ * stay within a cache line or two
+ */
+static void edt_pass_j(void *arg, int begin, int end, void *scratch) {
+  EDTContext *ctx = (EDTContext *)arg;
+  int m = ctx->m, n = ctx->n;
+  double *f = (double *)scratch;
+  double *d = f + n;
+  double *z = d + n;
+  int *where = (int *)(z + n + 1);
+  int *v = where + n;
+  double *tile_f = (double *)(v + n);
+  int32_t *tile_i = (int32_t *)(tile_f + TILE * n);
+  int i0, j, t;
+  for (i0 = begin; i0 < end; i0 += TILE) {
+    int width = end - i0 < TILE ? end - i0 : TILE;
+    for (j = 0; j < n; j++) {
+      size_t offset = (size_t)j * m + i0;
+      for (t = 0; t < width; t++) {
+        tile_f[t * n + j] = ctx->dist_sq[offset + t];
+        tile_i[t * n + j] = ctx->nearest[offset + t];
+      }
+    }
+    for (t = 0; t < width; t++) {
+      double *line = tile_f + t * n;
+      int32_t *near_i = tile_i + t * n;
+      memcpy(f, line, n * sizeof(double));
+      edt_1d(f, n, d, where, v, z);
+      /* Indices are made in where, as near_i is read throughout */
+      for (j = 0; j < n; j++) {
+        if (d[j] >= 0.5 * EDT_FAR) {
+          line[j] = INFINITY;
+          where[j] = -1;
+        } else {
+          line[j] = d[j];
+          where[j] = where[j] * m + near_i[where[j]];
+        }
+      }
+      memcpy(near_i, where, n * sizeof(int));
+    }
+    for (j = 0; j < n; j++) {
+      size_t offset = (size_t)j * m + i0;
+      for (t = 0; t < width; t++) {
+        ctx->dist_sq[offset + t] = tile_f[t * n + j];
+        ctx->nearest[offset + t] = tile_i[t * n + j];
+      }
+    }
+  }
+}
+
+static size_t edt_tile_scratch(int len) {
+  return edt_scratch(len) + sizeof(int) +
+         (size_t)TILE * len * (sizeof(double) + sizeof(int32_t));
+}
+
+static int edt(const uint8_t *mask, int m, int n, double *dist_sq,
+               int32_t *nearest, int n_threads) {
+  EDTContext ctx;
+  ctx.mask = mask;
+  ctx.m = m;
+  ctx.n = n;
+  ctx.dist_sq = dist_sq;
+  ctx.nearest = nearest;
+  if (run_lines(edt_pass_i, &ctx, n, edt_scratch(m), n_threads) < 0) {
+    return -1;
+  }
+  return run_lines(edt_pass_j, &ctx, m, edt_tile_scratch(n), n_threads);
+}
+
+int grid_edt(const uint8_t *mask, int m, int n, double *dist_sq,
+             int32_t *nearest, int n_threads) {
+  int ret;
+  int32_t *own = NULL;
+  if (m <= 0 || n <= 0) {
+    return -1;
+  }
+  if (!nearest) {
+    own = (int32_t *)malloc((size_t)m * n * sizeof(int32_t));
+    if (!own) {
+      return -1;
+    }
+    nearest = own;
+  }
+  ret = edt(mask, m, n, dist_sq, nearest, n_threads);
+  free(own);
+  return ret;
+}
+
+static double get_value(const void *src, int type, size_t idx) {
+  return type == GRID_UINT8 ? ((const uint8_t *)src)[idx]
+                            : ((const double *)src)[idx];
+}
+
+static void set_value(void *dst, int type, size_t idx, double value) {
+  if (type == GRID_UINT8) {
+    value = value < 0 ? 0 : (value > 255 ? 255 : value + 0.5);
+    ((uint8_t *)dst)[idx] = (uint8_t)value;
+  } else {
+    ((double *)dst)[idx] = value;
+  }
+}
+
+static int valid_type(int type) {
+  return type == GRID_UINT8 || type == GRID_DOUBLE;
+}
+
+/* Working memory for a whole map */
+typedef struct {
+  uint8_t *mask;
+  double *dist_sq;
+  int32_t *nearest;
+  /* For signed distances and obstacle labels */
+  double *dist_sq_in;
+  int32_t *labels;
+} EDTMaps;
+
+static int maps_alloc(EDTMaps *maps, size_t n_cells, int with_inside,
+                      int with_labels) {
+  memset(maps, 0, sizeof(EDTMaps));
+  maps->mask = (uint8_t *)malloc(n_cells);
+  maps->dist_sq = (double *)malloc(n_cells * sizeof(double));
+  maps->nearest = (int32_t *)malloc(n_cells * sizeof(int32_t));
+  if (with_inside) {
+    maps->dist_sq_in = (double *)malloc(n_cells * sizeof(double));
+  }
+  if (with_labels) {
+    maps->labels = (int32_t *)malloc(n_cells * sizeof(int32_t));
+  }
+  return (maps->mask && maps->dist_sq && maps->nearest &&
+          (!with_inside || maps->dist_sq_in) &&
+          (!with_labels || maps->labels))
+             ? 0
+             : -1;
+}
+
+static void maps_free(EDTMaps *maps) {
+  free(maps->mask);
+  free(maps->dist_sq);
+  free(maps->nearest);
+  free(maps->dist_sq_in);
+  free(maps->labels);
+}
+
+static void make_mask(uint8_t *mask, const void *src, int type,
+                      size_t n_cells, double threshold, int invert) {
+  size_t idx;
+  for (idx = 0; idx < n_cells; idx++) {
+    mask[idx] = (get_value(src, type, idx) >= threshold) != invert;
+  }
+}
+
+/* Per cell outputs, over lines of j */
+typedef struct {
+  const void *src;
+  int src_type;
+  void *dst;
+  int dst_type;
+  int m, n;
+  const EDTMaps *maps;
+  const GridInflation *inflation;
+  double scale;
+  double value;
+  const int32_t *seeds;
+} OutputContext;
+
+static void distance_lines(void *arg, int begin, int end, void *scratch) {
+  const OutputContext *ctx = (const OutputContext *)arg;
+  const EDTMaps *maps = ctx->maps;
+  size_t idx = (size_t)begin * ctx->m, idx_end = (size_t)end * ctx->m;
+  (void)scratch;
+  for (; idx < idx_end; idx++) {
+    double d;
+    if (!maps->mask[idx]) {
+      d = ctx->scale * sqrt(maps->dist_sq[idx]);
+    } else if (maps->dist_sq_in) {
+      d = -ctx->scale * sqrt(maps->dist_sq_in[idx]);
+    } else {
+      d = 0;
+    }
+    set_value(ctx->dst, ctx->dst_type, idx, d);
+  }
+}
+
+int grid_distance(const void *src, int src_type, void *dst, int dst_type,
+                  int m, int n, double threshold, double scale, int is_signed,
+                  int n_threads) {
+  EDTMaps maps;
+  OutputContext ctx;
+  size_t n_cells = (size_t)m * n;
+  int ret = -1;
+  if (m <= 0 || n <= 0 || !valid_type(src_type) || !valid_type(dst_type)) {
+    return -1;
+  }
+  if (maps_alloc(&maps, n_cells, is_signed, 0) < 0) {
+    maps_free(&maps);
+    return -1;
+  }
+  if (is_signed) {
+    /* Distance within obstacles, to the nearest free cell */
+    make_mask(maps.mask, src, src_type, n_cells, threshold, 1);
+    if (edt(maps.mask, m, n, maps.dist_sq_in, maps.nearest, n_threads) < 0) {
+      goto done;
+    }
+  }
+  make_mask(maps.mask, src, src_type, n_cells, threshold, 0);
+  if (edt(maps.mask, m, n, maps.dist_sq, maps.nearest, n_threads) < 0) {
+    goto done;
+  }
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.dst = dst;
+  ctx.dst_type = dst_type;
+  ctx.m = m;
+  ctx.n = n;
+  ctx.maps = &maps;
+  ctx.scale = scale;
+  ret = run_lines(distance_lines, &ctx, n, 0, n_threads);
+done:
+  maps_free(&maps);
+  return ret;
+}
+
+static void inflate_lines(void *arg, int begin, int end, void *scratch) {
+  const OutputContext *ctx = (const OutputContext *)arg;
+  const GridInflation *p = ctx->inflation;
+  const EDTMaps *maps = ctx->maps;
+  size_t idx = (size_t)begin * ctx->m, idx_end = (size_t)end * ctx->m;
+  (void)scratch;
+  for (; idx < idx_end; idx++) {
+    double cost;
+    double cost0 = get_value(ctx->src, ctx->src_type, idx);
+    if (maps->mask[idx]) {
+      cost = p->lethal;
+    } else {
+      double d = p->scale * sqrt(maps->dist_sq[idx]);
+      if (d > p->max_distance) {
+        cost = cost0;
+      } else if (d <= p->radius) {
+        cost = p->inscribed;
+      } else {
+        cost = p->free +
+               (p->inscribed - p->free) * exp(-p->decay * (d - p->radius));
+      }
+    }
+    set_value(ctx->dst, ctx->dst_type, idx, cost > cost0 ? cost : cost0);
+  }
+}
+
+int grid_inflate(const void *src, int src_type, void *dst, int dst_type,
+                 int m, int n, const GridInflation *params, int n_threads) {
+  EDTMaps maps;
+  OutputContext ctx;
+  size_t n_cells = (size_t)m * n;
+  int ret = -1;
+  if (m <= 0 || n <= 0 || !valid_type(src_type) || !valid_type(dst_type) ||
+      params->scale <= 0) {
+    return -1;
+  }
+  if (maps_alloc(&maps, n_cells, 0, 0) < 0) {
+    maps_free(&maps);
+    return -1;
+  }
+  make_mask(maps.mask, src, src_type, n_cells, params->threshold, 0);
+  if (edt(maps.mask, m, n, maps.dist_sq, maps.nearest, n_threads) == 0) {
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.src = src;
+    ctx.src_type = src_type;
+    ctx.dst = dst;
+    ctx.dst_type = dst_type;
+    ctx.m = m;
+    ctx.n = n;
+    ctx.maps = &maps;
+    ctx.inflation = params;
+    ret = run_lines(inflate_lines, &ctx, n, 0, n_threads);
+  }
+  maps_free(&maps);
+  return ret;
+}
+
+static void voronoi_lines(void *arg, int begin, int end, void *scratch) {
+  const OutputContext *ctx = (const OutputContext *)arg;
+  const EDTMaps *maps = ctx->maps;
+  size_t idx = (size_t)begin * ctx->m, idx_end = (size_t)end * ctx->m;
+  (void)scratch;
+  for (; idx < idx_end; idx++) {
+    int32_t nearest = maps->nearest[idx];
+    set_value(ctx->dst, ctx->dst_type, idx,
+              nearest < 0 ? 0 : ctx->seeds[nearest]);
+  }
+}
+
+int grid_voronoi(const int32_t *seeds, void *dst, int dst_type, int m, int n,
+                 int n_threads) {
+  EDTMaps maps;
+  OutputContext ctx;
+  size_t n_cells = (size_t)m * n, idx;
+  int ret = -1;
+  if (m <= 0 || n <= 0 || !valid_type(dst_type)) {
+    return -1;
+  }
+  if (maps_alloc(&maps, n_cells, 0, 0) < 0) {
+    maps_free(&maps);
+    return -1;
+  }
+  for (idx = 0; idx < n_cells; idx++) {
+    maps.mask[idx] = seeds[idx] != 0;
+  }
+  if (edt(maps.mask, m, n, maps.dist_sq, maps.nearest, n_threads) == 0) {
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.dst = dst;
+    ctx.dst_type = dst_type;
+    ctx.m = m;
+    ctx.n = n;
+    ctx.maps = &maps;
+    ctx.seeds = seeds;
+    ret = run_lines(voronoi_lines, &ctx, n, 0, n_threads);
+  }
+  maps_free(&maps);
+  return ret;
+}
+
+/* Label 8-connected obstacles from 1, using nearest as the stack */
+static int label_obstacles(const uint8_t *mask, int m, int n, int32_t *labels,
+                           int32_t *stack) {
+  size_t n_cells = (size_t)m * n, idx;
+  int n_labels = 0;
+  memset(labels, 0, n_cells * sizeof(int32_t));
+  for (idx = 0; idx < n_cells; idx++) {
+    size_t top = 0;
+    if (!mask[idx] || labels[idx]) {
+      continue;
+    }
+    labels[idx] = ++n_labels;
+    stack[top++] = idx;
+    while (top > 0) {
+      int32_t cur = stack[--top];
+      int i0 = cur % m, j0 = cur / m, di, dj;
+      for (dj = -1; dj <= 1; dj++) {
+        int j1 = j0 + dj;
+        if (j1 < 0 || j1 >= n) {
+          continue;
+        }
+        for (di = -1; di <= 1; di++) {
+          int i1 = i0 + di;
+          int32_t next;
+          if (i1 < 0 || i1 >= m) {
+            continue;
+          }
+          next = j1 * m + i1;
+          if (mask[next] && !labels[next]) {
+            labels[next] = n_labels;
+            stack[top++] = next;
+          }
+        }
+      }
+    }
+  }
+  return n_labels;
+}
+
+static void gvd_lines(void *arg, int begin, int end, void *scratch) {
+  const OutputContext *ctx = (const OutputContext *)arg;
+  const EDTMaps *maps = ctx->maps;
+  int m = ctx->m, n = ctx->n, i, j;
+  (void)scratch;
+  for (j = begin; j < end; j++) {
+    for (i = 0; i < m; i++) {
+      size_t idx = (size_t)j * m + i;
+      int32_t nearest = maps->nearest[idx];
+      int32_t label;
+      int on_diagram = 0;
+      if (!maps->mask[idx] && nearest >= 0) {
+        label = maps->labels[nearest];
+        /* Compare with the free 4-connected neighbors */
+        if (i + 1 < m && !maps->mask[idx + 1]) {
+          on_diagram |= maps->labels[maps->nearest[idx + 1]] != label;
+        }
+        if (i > 0 && !maps->mask[idx - 1]) {
+          on_diagram |= maps->labels[maps->nearest[idx - 1]] != label;
+        }
+        if (j + 1 < n && !maps->mask[idx + m]) {
+          on_diagram |= maps->labels[maps->nearest[idx + m]] != label;
+        }
+        if (j > 0 && !maps->mask[idx - m]) {
+          on_diagram |= maps->labels[maps->nearest[idx - m]] != label;
+        }
+      }
+      set_value(ctx->dst, ctx->dst_type, idx, on_diagram ? ctx->value : 0);
+    }
+  }
+}
+
+int grid_gvd(const void *src, int src_type, void *dst, int dst_type, int m,
+             int n, double threshold, double value, int n_threads) {
+  EDTMaps maps;
+  OutputContext ctx;
+  size_t n_cells = (size_t)m * n;
+  int n_labels, ret = -1;
+  if (m <= 0 || n <= 0 || !valid_type(src_type) || !valid_type(dst_type)) {
+    return -1;
+  }
+  if (maps_alloc(&maps, n_cells, 0, 1) < 0) {
+    maps_free(&maps);
+    return -1;
+  }
+  make_mask(maps.mask, src, src_type, n_cells, threshold, 0);
+  n_labels = label_obstacles(maps.mask, m, n, maps.labels, maps.nearest);
+  if (edt(maps.mask, m, n, maps.dist_sq, maps.nearest, n_threads) == 0) {
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.dst = dst;
+    ctx.dst_type = dst_type;
+    ctx.m = m;
+    ctx.n = n;
+    ctx.maps = &maps;
+    ctx.value = value;
+    if (run_lines(gvd_lines, &ctx, n, 0, n_threads) == 0) {
+      ret = n_labels;
+    }
+  }
+  maps_free(&maps);
+  return ret;
+}
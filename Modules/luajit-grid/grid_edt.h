@@ -0,0 +1,63 @@
+#pragma once
+/*
+Exact Euclidean distance transform of luajit-grid maps
+Felzenszwalb and Huttenlocher, "Distance Transforms of Sampled Functions":
+a 1D lower envelope of parabolas along i, then along j, each linear in the
+number of cells. Rows of each pass are split over threads.
+Maps are indexed as j * m + i, and may be read and written in place.
+*/
+
+#include <stdint.h>
+
+/* Datatypes of the map memory, matching luajit-grid */
+#define GRID_UINT8 1
+#define GRID_DOUBLE 2
+
+typedef struct {
+  /* Cells at or above this are obstacles */
+  double threshold;
+  /* Meters per cell */
+  double scale;
+  /* Cells within this many meters of an obstacle are inscribed */
+  double radius;
+  /* Rate, per meter beyond the radius, at which the cost falls */
+  double decay;
+  /* Cells farther than this many meters keep their cost */
+  double max_distance;
+  /* Costs of obstacles, of inscribed cells, and far from obstacles */
+  double lethal;
+  double inscribed;
+  double free;
+} GridInflation;
+
+/* Squared distance, in cells, to the nearest nonzero cell of mask, and
+ * optionally the index of that cell. No nonzero cells gives INFINITY and
+ * -1. n_threads of 0 uses every processor.
+ * Returns 0, or -1 if out of memory
+ */
+int grid_edt(const uint8_t *mask, int m, int n, double *dist_sq,
+             int32_t *nearest, int n_threads);
+
+/* Distance in meters to the nearest obstacle. Signed gives obstacle cells
+ * the negative distance to the nearest free cell
+ */
+int grid_distance(const void *src, int src_type, void *dst, int dst_type,
+                  int m, int n, double threshold, double scale, int is_signed,
+                  int n_threads);
+
+/* Cost that decays exponentially away from obstacles, never lowering the
+ * cost of src
+ */
+int grid_inflate(const void *src, int src_type, void *dst, int dst_type,
+                 int m, int n, const GridInflation *params, int n_threads);
+
+/* Label every cell with that of the nearest labelled (nonzero) seed */
+int grid_voronoi(const int32_t *seeds, void *dst, int dst_type, int m, int n,
+                 int n_threads);
+
+/* Generalized Voronoi diagram: free cells between two different
+ * 8-connected obstacles are set to value, and others to 0.
+ * Returns the number of obstacles, or -1 if out of memory
+ */
+int grid_gvd(const void *src, int src_type, void *dst, int dst_type, int m,
+             int n, double threshold, double value, int n_threads);
@@ -68,3 +68,54 @@ grid.new({
   }):voronoi({
     {75, 55},{40, 30, r_obs}, {20, 15, r_obs}, {60, 45, r_obs}
   }):save("test_voronoi.pgm", {use_max = true})
+
+-- Native distance transforms, on the lines and circle drawn above
+if pcall(require'ffi'.load, 'grid_edt') then
+  local t0 = os.clock()
+  local dist = assert(grid.new{
+    scale = my_grid.scale,
+    xmin = my_grid.xmin, xmax = my_grid.xmax,
+    ymin = my_grid.ymin, ymax = my_grid.ymax,
+    datatype = 'double'
+  })
+  assert(my_grid:distance{out = dist, is_signed = true})
+  -- Positive in free space and otherwise not
+  local d_max = 0
+  for idx=0,dist.n_cells-1 do
+    local d = dist.grid[idx]
+    assert((d > 0) == (my_grid.grid[idx] < 127), "Sign of the distance")
+    if d > d_max then d_max = d end
+  end
+  print("Farthest from obstacles", d_max)
+
+  local inflated = assert(grid.new{
+    scale = my_grid.scale,
+    xmin = my_grid.xmin, xmax = my_grid.xmax,
+    ymin = my_grid.ymin, ymax = my_grid.ymax,
+  })
+  assert(my_grid:inflate{out = inflated, radius = 0.2, decay = 5})
+  assert(inflated:save"test_inflated.pgm")
+
+  local _, n_obstacles = assert(my_grid:gvd{out = inflated})
+  print("Obstacles", n_obstacles)
+  assert(inflated:save"test_gvd.pgm")
+  print(string.format("Transforms: %.1f ms", 1e3 * (os.clock() - t0)))
+
+  -- Centers at cells: the nearest label is as near as that of the exact loop
+  local centers = {{10, 20}, {40, 30}, {20, 60}, {50, 70}}
+  local exact = grid.new{scale = 1, xmin = 0, xmax = 60, ymin = 0, ymax = 80}
+  local cells = grid.new{scale = 1, xmin = 0, xmax = 60, ymin = 0, ymax = 80}
+  for i, c in ipairs(centers) do
+    centers[i] = {exact.idx2xy(exact.xy2idx(c[1], c[2]))}
+  end
+  exact:voronoi(centers)
+  assert(cells:voronoi_cells(centers))
+  for idx=0,exact.n_cells-1 do
+    local x, y = exact.idx2xy(idx)
+    local ce, cc = centers[exact.grid[idx]], centers[cells.grid[idx]]
+    local de = math.sqrt((x - ce[1])^2 + (y - ce[2])^2)
+    local dc = math.sqrt((x - cc[1])^2 + (y - cc[2])^2)
+    assert(math.abs(de - dc) < 1e-9, "Voronoi label")
+  end
+  assert(not cells:voronoi_cells{{-100, 0}}, "Center off the map")
+end
@@ -275,6 +275,132 @@ function lib.update(new_data)
   return false
 end
 
+-- Native decoder, fed the raw bytes, that checks every checksum and keeps
+-- each scan in arrays allocated once
+local has_ffi, ffi = pcall(require, 'ffi')
+local has_scip, scip = false, "No FFI"
+if has_ffi then
+  ffi.cdef[[
+typedef struct {
+  int n_steps;
+  double angle0;
+  double angle_increment;
+  uint32_t min_distance;
+  double max_range;
+} ScipParameters;
+typedef struct {
+  char cmd[3];
+  char status[3];
+  int32_t ready;
+  int32_t valid;
+  int32_t remaining;
+  uint32_t time;
+  int32_t start, stop, cluster;
+  int32_t has_intensity;
+  int32_t n;
+  uint32_t *distances;
+  uint32_t *intensities;
+  double *x, *y;
+  uint8_t *hits;
+  char *text;
+  int32_t text_len;
+} ScipPacket;
+struct scip;
+void scip_default_parameters(ScipParameters *params);
+struct scip *scip_create(const ScipParameters *params);
+void scip_free(struct scip *scip);
+const ScipPacket *scip_packet(const struct scip *scip);
+size_t scip_feed(struct scip *scip, const uint8_t *data, size_t n);
+int64_t scip_checksum_errors(const struct scip *scip);
+void scip_reset(struct scip *scip);
+]]
+  has_scip, scip = pcall(ffi.load, 'hokuyo_scip')
+end
+
+-- Iterate the packets that data finishes. Each is the same ScipPacket,
+-- overwritten on the next iteration
+local function packets(self, data)
+  local ptr = ffi.cast('const uint8_t *', data)
+  local offset = 0
+  return function()
+    local n = #data
+    while offset < n do
+      offset = offset + tonumber(scip.scip_feed(self.c, ptr + offset, n - offset))
+      if self.packet.ready == 1 then return self.packet end
+    end
+  end
+end
+
+-- Copy n values of a cdata array into t, dropping any past n
+local function fill(t, arr, n)
+  for i=0, n - 1 do t[i + 1] = arr[i] end
+  for i=#t, n + 1, -1 do t[i] = nil end
+  return t
+end
+
+-- Copy a packet to a table, as lib.update gives it, for logging.
+-- obj, if given, is cleared and filled in place, reusing its arrays, for
+-- callers that serialize each packet before the next
+local function packet2table(pkt, obj)
+  local distances = obj and obj.distances
+  local intensities = obj and obj.intensities
+  if obj then
+    for k in pairs(obj) do obj[k] = nil end
+  else
+    obj = {}
+  end
+  obj.cmd = ffi.string(pkt.cmd)
+  obj.status = ffi.string(pkt.status)
+  obj.valid = pkt.valid == 1
+  if pkt.remaining >= 0 then obj.remaining = pkt.remaining end
+  if pkt.n > 0 then
+    obj.TIME = pkt.time
+    obj.distances = fill(distances or {}, pkt.distances, pkt.n)
+    if pkt.has_intensity == 1 then
+      obj.intensities = fill(intensities or {}, pkt.intensities, pkt.n)
+    end
+  end
+  for line in ffi.string(pkt.text, pkt.text_len):gmatch"[^\n]+" do
+    local key, val = line:match"(%w+)%:(.+)%;(.)"
+    if key=="TIME" then
+      obj[key] = line2time(val)
+    elseif key then
+      obj[key] = tonumber(val) or val
+    end
+  end
+  return obj
+end
+lib.packet2table = packet2table
+
+local function checksum_errors(self)
+  return tonumber(scip.scip_checksum_errors(self.c))
+end
+
+local function reset(self)
+  scip.scip_reset(self.c)
+end
+
+-- Parameters default to the UTM-30LX, and override the fields of
+-- ScipParameters that are given
+function lib.decoder(params)
+  if not has_scip then return false, scip end
+  local c_params = ffi.new'ScipParameters'
+  scip.scip_default_parameters(c_params)
+  if type(params) == 'table' then
+    for k, v in pairs(params) do c_params[k] = v end
+  end
+  local c = scip.scip_create(c_params)
+  if c == nil then return false, "Bad parameters" end
+  return {
+    c = ffi.gc(c, scip.scip_free),
+    params = c_params,
+    packet = scip.scip_packet(c),
+    packets = packets,
+    checksum_errors = checksum_errors,
+    reset = reset,
+  }
+end
+
 local has_skt, skt = pcall(require, 'skt')
 if has_skt then
 
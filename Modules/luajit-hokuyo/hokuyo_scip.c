@@ -0,0 +1,334 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hokuyo_scip.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* Lines of a packet, in order */
+enum { SCIP_ECHO, SCIP_STATUS, SCIP_TIME, SCIP_DATA, SCIP_TEXT };
+
+struct scip {
+  ScipParameters params;
+  ScipPacket packet;
+  /* Beam angles of each step */
+  double *cos_step, *sin_step;
+  int state;
+  char line[SCIP_LINE_MAX];
+  int line_len;
+  int line_overflow;
+  /* Encoded scan data of every data line, without the checksums */
+  char *payload;
+  size_t payload_len;
+  size_t payload_max;
+  int64_t checksum_errors;
+};
+
+void scip_default_parameters(ScipParameters *params) {
+  params->n_steps = 1081;
+  params->angle0 = 135 * M_PI / 180;
+  params->angle_increment = -0.25 * M_PI / 180;
+  params->min_distance = 20;
+  params->max_range = 10;
+}
+
+struct scip *scip_create(const ScipParameters *params) {
+  struct scip *scip = calloc(1, sizeof(struct scip));
+  ScipPacket *pkt;
+  size_t n;
+  int i;
+  if (!scip) {
+    return NULL;
+  }
+  if (params) {
+    scip->params = *params;
+  } else {
+    scip_default_parameters(&scip->params);
+  }
+  if (scip->params.n_steps < 1) {
+    free(scip);
+    return NULL;
+  }
+  n = scip->params.n_steps;
+  pkt = &scip->packet;
+  pkt->distances = calloc(n, sizeof(uint32_t));
+  pkt->intensities = calloc(n, sizeof(uint32_t));
+  pkt->x = calloc(n, sizeof(double));
+  pkt->y = calloc(n, sizeof(double));
+  pkt->hits = calloc(n, sizeof(uint8_t));
+  pkt->text = calloc(SCIP_TEXT_MAX + 1, 1);
+  scip->cos_step = malloc(n * sizeof(double));
+  scip->sin_step = malloc(n * sizeof(double));
+  /* Distance and intensity, of 3 characters each */
+  scip->payload_max = 6 * n;
+  scip->payload = malloc(scip->payload_max);
+  if (!pkt->distances || !pkt->intensities || !pkt->x || !pkt->y ||
+      !pkt->hits || !pkt->text || !scip->cos_step || !scip->sin_step ||
+      !scip->payload) {
+    scip_free(scip);
+    return NULL;
+  }
+  for (i = 0; i < scip->params.n_steps; i++) {
+    double a = scip->params.angle0 + i * scip->params.angle_increment;
+    scip->cos_step[i] = cos(a);
+    scip->sin_step[i] = sin(a);
+  }
+  scip_reset(scip);
+  return scip;
+}
+
+void scip_free(struct scip *scip) {
+  if (!scip) {
+    return;
+  }
+  free(scip->packet.distances);
+  free(scip->packet.intensities);
+  free(scip->packet.x);
+  free(scip->packet.y);
+  free(scip->packet.hits);
+  free(scip->packet.text);
+  free(scip->cos_step);
+  free(scip->sin_step);
+  free(scip->payload);
+  free(scip);
+}
+
+const ScipPacket *scip_packet(const struct scip *scip) {
+  return &scip->packet;
+}
+
+int64_t scip_checksum_errors(const struct scip *scip) {
+  return scip->checksum_errors;
+}
+
+void scip_reset(struct scip *scip) {
+  scip->state = SCIP_ECHO;
+  scip->line_len = 0;
+  scip->line_overflow = 0;
+  scip->payload_len = 0;
+  scip->packet.ready = 0;
+}
+
+/* Decimal digits of the echo, or -1 if any is not a digit */
+static int32_t decimal(const char *s, int n) {
+  int32_t v = 0;
+  int k;
+  for (k = 0; k < n; k++) {
+    if (s[k] < '0' || s[k] > '9') {
+      return -1;
+    }
+    v = 10 * v + (s[k] - '0');
+  }
+  return v;
+}
+
+/* The last character is the sum of the others, in 6 bits, plus 0x30 */
+static int checksum_ok(struct scip *scip, const char *s, int len) {
+  uint32_t sum = 0;
+  int k;
+  if (len < 2) {
+    return 0;
+  }
+  for (k = 0; k < len - 1; k++) {
+    sum += (uint8_t)s[k];
+  }
+  if ((char)((sum & 0x3F) + 0x30) == s[len - 1]) {
+    return 1;
+  }
+  scip->checksum_errors++;
+  return 0;
+}
+
+static void begin_packet(struct scip *scip, const char *line, int len) {
+  ScipPacket *pkt = &scip->packet;
+  pkt->cmd[0] = line[0];
+  pkt->cmd[1] = len > 1 ? line[1] : '\0';
+  pkt->cmd[2] = '\0';
+  pkt->status[0] = '\0';
+  pkt->valid = 1;
+  pkt->remaining = -1;
+  pkt->time = 0;
+  pkt->start = 0;
+  pkt->stop = 0;
+  pkt->cluster = 0;
+  pkt->has_intensity = 0;
+  pkt->n = 0;
+  pkt->text_len = 0;
+  pkt->text[0] = '\0';
+  scip->payload_len = 0;
+  /* GD0000108000 and MD0000108000101, then maybe ;string */
+  if ((line[0] == 'G' || line[0] == 'M') && len >= 12) {
+    pkt->start = decimal(line + 2, 4);
+    pkt->stop = decimal(line + 6, 4);
+    pkt->cluster = decimal(line + 10, 2);
+    pkt->has_intensity = line[1] == 'E';
+    if (line[0] == 'M' && len >= 15) {
+      pkt->remaining = decimal(line + 13, 2);
+    }
+    /* The echo has no checksum, so check that it names real steps */
+    if (pkt->start < 0 || pkt->stop < pkt->start ||
+        pkt->stop >= scip->params.n_steps || pkt->cluster < 0) {
+      pkt->valid = 0;
+    }
+  }
+}
+
+/* Decode the scan and find its points, in loops the compiler can unroll */
+static void finish_scan(struct scip *scip) {
+  ScipPacket *pkt = &scip->packet;
+  const char *p = scip->payload;
+  const int stride = pkt->has_intensity ? 6 : 3;
+  const int step_cluster = pkt->cluster > 1 ? pkt->cluster : 1;
+  const uint32_t min_distance = scip->params.min_distance;
+  const double max_range = scip->params.max_range;
+  int n = (int)(scip->payload_len / stride);
+  int k;
+  /* Steps out of the tables of angles, from a corrupt echo */
+  if (pkt->start < 0 || pkt->stop < pkt->start ||
+      pkt->stop >= scip->params.n_steps || pkt->cluster < 0) {
+    pkt->valid = 0;
+    pkt->n = 0;
+    return;
+  }
+  if (scip->payload_len % stride) {
+    pkt->valid = 0;
+  }
+  if (n > scip->params.n_steps) {
+    n = scip->params.n_steps;
+    pkt->valid = 0;
+  }
+  for (k = 0; k < n; k++) {
+    const char *q = p + k * stride;
+    pkt->distances[k] = ((uint32_t)(q[0] - 0x30) << 12) |
+                        ((uint32_t)(q[1] - 0x30) << 6) | (uint32_t)(q[2] - 0x30);
+  }
+  if (pkt->has_intensity) {
+    for (k = 0; k < n; k++) {
+      const char *q = p + k * stride + 3;
+      pkt->intensities[k] = ((uint32_t)(q[0] - 0x30) << 12) |
+                            ((uint32_t)(q[1] - 0x30) << 6) |
+                            (uint32_t)(q[2] - 0x30);
+    }
+  }
+  /* Points past the tables of angles are not there */
+  if (pkt->start + (n - 1) * step_cluster >= scip->params.n_steps) {
+    n = (scip->params.n_steps - 1 - pkt->start) / step_cluster + 1;
+    if (n < 0) {
+      n = 0;
+    }
+    pkt->valid = 0;
+  }
+  for (k = 0; k < n; k++) {
+    const int step = pkt->start + k * step_cluster;
+    const uint32_t d = pkt->distances[k];
+    const int hit = d >= min_distance && d != SCIP_NO_RETURN;
+    const double range = hit ? 1e-3 * d : max_range;
+    pkt->hits[k] = (uint8_t)hit;
+    pkt->x[k] = range * scip->cos_step[step];
+    pkt->y[k] = range * scip->sin_step[step];
+  }
+  pkt->n = n;
+}
+
+static void end_packet(struct scip *scip) {
+  ScipPacket *pkt = &scip->packet;
+  if (scip->state == SCIP_DATA) {
+    finish_scan(scip);
+  }
+  pkt->ready = 1;
+  scip->state = SCIP_ECHO;
+}
+
+static void end_line(struct scip *scip) {
+  ScipPacket *pkt = &scip->packet;
+  const char *line = scip->line;
+  const int len = scip->line_len;
+  int is_data;
+  if (scip->line_overflow) {
+    pkt->valid = 0;
+  }
+  /* A blank line ends the packet, and is ignored between packets */
+  if (len == 0) {
+    if (scip->state != SCIP_ECHO) {
+      end_packet(scip);
+    }
+    return;
+  }
+  switch (scip->state) {
+  case SCIP_ECHO:
+    begin_packet(scip, line, len);
+    scip->state = SCIP_STATUS;
+    break;
+  case SCIP_STATUS:
+    pkt->status[0] = line[0];
+    pkt->status[1] = len > 1 ? line[1] : '\0';
+    pkt->status[2] = '\0';
+    if (len >= 3 && !checksum_ok(scip, line, len)) {
+      pkt->valid = 0;
+    }
+    /* Scans follow 00 of a single scan, and 99 of a multiscan */
+    is_data = (pkt->cmd[0] == 'G' && strcmp(pkt->status, "00") == 0) ||
+              (pkt->cmd[0] == 'M' && strcmp(pkt->status, "99") == 0);
+    scip->state = is_data ? SCIP_TIME : SCIP_TEXT;
+    break;
+  case SCIP_TIME:
+    if (len != 5 || !checksum_ok(scip, line, len)) {
+      pkt->valid = 0;
+    } else {
+      pkt->time = ((uint32_t)(line[0] - 0x30) << 18) |
+                  ((uint32_t)(line[1] - 0x30) << 12) |
+                  ((uint32_t)(line[2] - 0x30) << 6) | (uint32_t)(line[3] - 0x30);
+    }
+    scip->state = SCIP_DATA;
+    break;
+  case SCIP_DATA:
+    if (!checksum_ok(scip, line, len)) {
+      pkt->valid = 0;
+    }
+    if (scip->payload_len + len - 1 > scip->payload_max) {
+      pkt->valid = 0;
+    } else {
+      memcpy(scip->payload + scip->payload_len, line, len - 1);
+      scip->payload_len += len - 1;
+    }
+    break;
+  case SCIP_TEXT:
+    if (pkt->text_len + len + 1 > SCIP_TEXT_MAX) {
+      pkt->valid = 0;
+    } else {
+      memcpy(pkt->text + pkt->text_len, line, len);
+      pkt->text_len += len;
+      pkt->text[pkt->text_len++] = '\n';
+      pkt->text[pkt->text_len] = '\0';
+    }
+    break;
+  }
+}
+
+size_t scip_feed(struct scip *scip, const uint8_t *data, size_t n) {
+  size_t i;
+  scip->packet.ready = 0;
+  for (i = 0; i < n; i++) {
+    const char c = (char)data[i];
+    if (c == '\r') {
+      continue;
+    } else if (c != '\n') {
+      if (scip->line_len < SCIP_LINE_MAX) {
+        scip->line[scip->line_len++] = c;
+      } else {
+        scip->line_overflow = 1;
+      }
+      continue;
+    }
+    end_line(scip);
+    scip->line_len = 0;
+    scip->line_overflow = 0;
+    if (scip->packet.ready) {
+      return i + 1;
+    }
+  }
+  return n;
+}
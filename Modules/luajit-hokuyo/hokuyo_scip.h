@@ -0,0 +1,85 @@
+#pragma once
+/*
+Incremental SCIP 2.0 parser for the Hokuyo, fed bytes as they come off the
+socket or serial port. Each byte is consumed once, into a short line
+buffer, and the scan data of checked lines is gathered without checksums,
+to be decoded from its 3 character encoding in one flat pass at the end of
+the packet, into arrays allocated once, along with the points, from tables
+of the beam angles.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Errors */
+#define SCIP_ERR_MEMORY (-1)
+
+/* Longest line, as the data lines are 64 characters and a checksum */
+#define SCIP_LINE_MAX 128
+#define SCIP_TEXT_MAX 2048
+
+/* Distance reported when nothing returned within range */
+#define SCIP_NO_RETURN 0xFFFD
+
+typedef struct {
+  /* Steps of the sensor, as the tables of angles cover */
+  int n_steps;
+  /* Angle of step 0, and from one step to the next, in radians */
+  double angle0;
+  double angle_increment;
+  /* Distances below this, in millimeters, are error codes */
+  uint32_t min_distance;
+  /* Where to put the points of no return, in meters. These are the error
+   * codes and SCIP_NO_RETURN, as distances2points in hokuyo.lua treats them
+   */
+  double max_range;
+} ScipParameters;
+
+typedef struct {
+  /* Command echoed, and the status, as strings */
+  char cmd[3];
+  char status[3];
+  /* A whole packet has been read, and every checksum in it matched */
+  int32_t ready;
+  int32_t valid;
+  /* Scans left of a multiscan, or -1 */
+  int32_t remaining;
+  /* Sensor time, in milliseconds, wrapping at 2^24 */
+  uint32_t time;
+  /* Steps of the scan, and steps per point */
+  int32_t start, stop, cluster;
+  int32_t has_intensity;
+  /* Points decoded */
+  int32_t n;
+  uint32_t *distances;
+  uint32_t *intensities;
+  /* Points in the sensor frame, in meters, and if each is a return */
+  double *x, *y;
+  uint8_t *hits;
+  /* Lines after the status, of other commands, each ending in a newline */
+  char *text;
+  int32_t text_len;
+} ScipPacket;
+
+struct scip;
+
+/* For the UTM-30LX, as hokuyo.lua, with step 0 at 135 degrees */
+void scip_default_parameters(ScipParameters *params);
+
+struct scip *scip_create(const ScipParameters *params);
+void scip_free(struct scip *scip);
+
+/* Packet being read, whose arrays hold n_steps points */
+const ScipPacket *scip_packet(const struct scip *scip);
+
+/* Read bytes up to the end of a packet, so that the packet is not
+ * overwritten before it is used. Returns the bytes consumed, with ready set
+ * if they finished a packet
+ */
+size_t scip_feed(struct scip *scip, const uint8_t *data, size_t n);
+
+/* Lines that failed their checksum, since created */
+int64_t scip_checksum_errors(const struct scip *scip);
+
+/* Forget any partial packet, as after reconnecting */
+void scip_reset(struct scip *scip);
@@ -0,0 +1,114 @@
+#!/usr/bin/env luajit
+local hokuyo = require'hokuyo'
+local bit = require'bit'
+local band, rshift = bit.band, bit.rshift
+local clock = require'os'.clock
+
+local decoder = assert(hokuyo.decoder())
+
+local function checksum(str)
+  local sum = 0
+  for i=1, #str do sum = sum + str:byte(i) end
+  return string.char(band(sum, 0x3F) + 0x30)
+end
+
+local function encode(v, n)
+  local chars = {}
+  for i=1, n do
+    chars[i] = string.char(band(rshift(v, 6 * (n - i)), 0x3F) + 0x30)
+  end
+  return table.concat(chars)
+end
+
+-- A multiscan reply, as the UTM-30LX gives, with the data in 64 character lines
+local function multiscan(distances, intensities, time)
+  local data = {}
+  for i, d in ipairs(distances) do
+    table.insert(data, encode(d, 3))
+    if intensities then table.insert(data, encode(intensities[i], 3)) end
+  end
+  data = table.concat(data)
+  local lines = {
+    (intensities and "ME" or "MD").."0000108000099",
+    "99"..checksum"99",
+    encode(time, 4)..checksum(encode(time, 4)),
+  }
+  for i=1, #data, 64 do
+    local line = data:sub(i, i + 63)
+    table.insert(lines, line..checksum(line))
+  end
+  table.insert(lines, "\n")
+  return table.concat(lines, "\n")
+end
+
+local distances, intensities = {}, {}
+for i=1, 1081 do
+  distances[i] = i == 541 and 3 or i == 2 and 0xFFFD or 1000 + i
+  intensities[i] = 7 * i
+end
+local str = multiscan(distances, intensities, 12345)
+
+-- One byte at a time, as from a slow serial port
+local n = 0
+for i=1, #str do
+  for pkt in decoder:packets(str:sub(i, i)) do
+    n = n + 1
+    assert(i == #str, "Early packet")
+    assert(pkt.valid == 1 and pkt.n == 1081 and pkt.time == 12345)
+    assert(pkt.distances[0] == 1001 and pkt.intensities[1080] == 7 * 1081)
+    -- Straight ahead is an error code, so no return
+    assert(pkt.hits[540] == 0 and pkt.hits[0] == 1)
+    assert(math.abs(pkt.x[540] - 10) < 1e-9 and math.abs(pkt.y[540]) < 1e-9)
+    assert(math.abs(pkt.x[0] + 1.001 / math.sqrt(2)) < 1e-9)
+    -- As is 0xFFFD, rather than a hit at 65.5 m
+    assert(pkt.hits[1] == 0)
+    assert(math.abs(math.sqrt(pkt.x[1]^2 + pkt.y[1]^2) - 10) < 1e-9)
+    local obj = hokuyo.packet2table(pkt)
+    assert(obj.cmd == 'ME' and obj.status == '99' and obj.remaining == 99)
+    assert(#obj.distances == 1081 and obj.TIME == 12345)
+  end
+end
+assert(n == 1)
+
+-- Several packets in one read, and a bad checksum in the second
+local bad = multiscan(distances, nil, 1)
+local i_line = 0
+for _=1, 4 do i_line = bad:find("\n", i_line + 1, true) end
+bad = bad:sub(1, i_line)..string.char(bad:byte(i_line + 1) + 1)..bad:sub(i_line + 2)
+n = 0
+local obj_reused = {}
+for pkt in decoder:packets(str..bad.."VV\n00P\nVEND:Hokuyo;[\n\n") do
+  n = n + 1
+  if n == 1 then
+    assert(pkt.valid == 1 and pkt.has_intensity == 1)
+    assert(#hokuyo.packet2table(pkt, obj_reused).intensities == 1081)
+  end
+  if n == 2 then assert(pkt.valid == 0 and pkt.cmd[1] == string.byte'D') end
+  if n == 3 then
+    -- Filled in place, without the scan of the last packet
+    local obj = hokuyo.packet2table(pkt, obj_reused)
+    assert(obj == obj_reused and not obj.distances and not obj.remaining)
+    assert(obj.valid and obj.status == '00' and obj.VEND == 'Hokuyo')
+  end
+end
+assert(n == 3 and decoder:checksum_errors() == 1)
+
+-- A corrupt echo names no steps, so the scan gives no points
+n = 0
+for pkt in decoder:packets((str:gsub("^ME0000", "ME-000"))) do
+  n = n + 1
+  assert(pkt.valid == 0 and pkt.n == 0, "Corrupt echo")
+end
+assert(n == 1)
+
+-- Compare with the coroutine parser
+local coro = coroutine.create(hokuyo.update)
+local t0 = clock()
+local status, obj = coroutine.resume(coro, str)
+local dt_lua = clock() - t0
+assert(status and obj.distances[1] == 1001)
+t0 = clock()
+for _=1, 1000 do for _ in decoder:packets(str) do end end
+local dt_scip = (clock() - t0) / 1000
+print(string.format("Lua: %.1f us, native: %.1f us per scan", 1e6 * dt_lua, 1e6 * dt_scip))
+print("OK")
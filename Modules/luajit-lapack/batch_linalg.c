@@ -0,0 +1,216 @@
+#include <math.h>
+
+#include "batch_linalg.h"
+
+/* Inlined with constant n for the common sizes */
+static inline int chol1(const int n, double *A, const int lda) {
+  int i, j, k;
+  for (j = 0; j < n; j++) {
+    double *a_j = A + j * lda;
+    double d = a_j[j];
+    for (k = 0; k < j; k++) {
+      d -= A[j + k * lda] * A[j + k * lda];
+    }
+    if (!(d > 0)) {
+      return j + 1;
+    }
+    d = sqrt(d);
+    a_j[j] = d;
+    for (i = j + 1; i < n; i++) {
+      double s = a_j[i];
+      for (k = 0; k < j; k++) {
+        s -= A[i + k * lda] * A[j + k * lda];
+      }
+      a_j[i] = s / d;
+    }
+  }
+  return 0;
+}
+
+static inline void chol_solve1(const int n, const int nrhs, const double *L,
+                               const int lda, double *B, const int ldb) {
+  int i, k, r;
+  for (r = 0; r < nrhs; r++) {
+    double *b = B + r * ldb;
+    /* L y = b */
+    for (i = 0; i < n; i++) {
+      double s = b[i];
+      for (k = 0; k < i; k++) {
+        s -= L[i + k * lda] * b[k];
+      }
+      b[i] = s / L[i + i * lda];
+    }
+    /* L' x = y */
+    for (i = n - 1; i >= 0; i--) {
+      double s = b[i];
+      for (k = i + 1; k < n; k++) {
+        s -= L[k + i * lda] * b[k];
+      }
+      b[i] = s / L[i + i * lda];
+    }
+  }
+}
+
+static inline int lu_solve1(const int n, const int nrhs, double *A,
+                            const int lda, double *B, const int ldb) {
+  int i, j, k, r;
+  for (j = 0; j < n; j++) {
+    /* Pivot on the largest in the column, swapping the rows of A and B */
+    int p = j;
+    double big = fabs(A[j + j * lda]);
+    double pivot;
+    for (i = j + 1; i < n; i++) {
+      if (fabs(A[i + j * lda]) > big) {
+        big = fabs(A[i + j * lda]);
+        p = i;
+      }
+    }
+    if (big == 0) {
+      return j + 1;
+    }
+    if (p != j) {
+      double t;
+      for (k = 0; k < n; k++) {
+        t = A[j + k * lda];
+        A[j + k * lda] = A[p + k * lda];
+        A[p + k * lda] = t;
+      }
+      for (r = 0; r < nrhs; r++) {
+        t = B[j + r * ldb];
+        B[j + r * ldb] = B[p + r * ldb];
+        B[p + r * ldb] = t;
+      }
+    }
+    pivot = A[j + j * lda];
+    for (i = j + 1; i < n; i++) {
+      double f = A[i + j * lda] / pivot;
+      A[i + j * lda] = f;
+      for (k = j + 1; k < n; k++) {
+        A[i + k * lda] -= f * A[j + k * lda];
+      }
+      for (r = 0; r < nrhs; r++) {
+        B[i + r * ldb] -= f * B[j + r * ldb];
+      }
+    }
+  }
+  /* U x = y */
+  for (r = 0; r < nrhs; r++) {
+    double *b = B + r * ldb;
+    for (i = n - 1; i >= 0; i--) {
+      double s = b[i];
+      for (k = i + 1; k < n; k++) {
+        s -= A[i + k * lda] * b[k];
+      }
+      b[i] = s / A[i + i * lda];
+    }
+  }
+  return 0;
+}
+
+static int check(int n, int count, int ld, int stride) {
+  return n < 1 || count < 0 || ld < n || stride < 0;
+}
+
+int batch_chol(int n, int count, double *A, int lda, int stride_a, int *info) {
+  int n_failed = 0;
+  int i, j, k;
+  if (check(n, count, lda, stride_a)) {
+    return BATCH_ERR_SIZE;
+  }
+  for (k = 0; k < count; k++) {
+    double *a = A + (long)k * stride_a;
+    int ret;
+    switch (n) {
+    case 3:
+      ret = chol1(3, a, lda);
+      break;
+    case 6:
+      ret = chol1(6, a, lda);
+      break;
+    default:
+      ret = chol1(n, a, lda);
+      break;
+    }
+    for (j = 1; j < n; j++) {
+      for (i = 0; i < j; i++) {
+        a[i + j * lda] = 0;
+      }
+    }
+    if (info) {
+      info[k] = ret;
+    }
+    n_failed += ret != 0;
+  }
+  return n_failed;
+}
+
+int batch_solve_pd(int n, int nrhs, int count, double *A, int lda,
+                   int stride_a, double *B, int ldb, int stride_b, int *info) {
+  int n_failed = 0;
+  int k;
+  if (check(n, count, lda, stride_a) || check(n, count, ldb, stride_b) ||
+      nrhs < 0) {
+    return BATCH_ERR_SIZE;
+  }
+  for (k = 0; k < count; k++) {
+    double *a = A + (long)k * stride_a;
+    double *b = B + (long)k * stride_b;
+    int ret;
+    switch (n) {
+    case 3:
+      ret = chol1(3, a, lda);
+      if (!ret) {
+        chol_solve1(3, nrhs, a, lda, b, ldb);
+      }
+      break;
+    case 6:
+      ret = chol1(6, a, lda);
+      if (!ret) {
+        chol_solve1(6, nrhs, a, lda, b, ldb);
+      }
+      break;
+    default:
+      ret = chol1(n, a, lda);
+      if (!ret) {
+        chol_solve1(n, nrhs, a, lda, b, ldb);
+      }
+      break;
+    }
+    if (info) {
+      info[k] = ret;
+    }
+    n_failed += ret != 0;
+  }
+  return n_failed;
+}
+
+int batch_solve(int n, int nrhs, int count, double *A, int lda, int stride_a,
+                double *B, int ldb, int stride_b, int *info) {
+  int n_failed = 0;
+  int k;
+  if (check(n, count, lda, stride_a) || check(n, count, ldb, stride_b) ||
+      nrhs < 0) {
+    return BATCH_ERR_SIZE;
+  }
+  for (k = 0; k < count; k++) {
+    double *a = A + (long)k * stride_a;
+    double *b = B + (long)k * stride_b;
+    int ret;
+    switch (n) {
+    case 3:
+      ret = lu_solve1(3, nrhs, a, lda, b, ldb);
+      break;
+    case 6:
+      ret = lu_solve1(6, nrhs, a, lda, b, ldb);
+      break;
+    default:
+      ret = lu_solve1(n, nrhs, a, lda, b, ldb);
+      break;
+    }
+    if (info) {
+      info[k] = ret;
+    }
+    n_failed += ret != 0;
+  }
+  return n_failed;
+}
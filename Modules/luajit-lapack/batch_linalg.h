@@ -0,0 +1,30 @@
+#pragma once
+/*
+Batched linear algebra on many small matrices, as the estimators have
+LAPACK's call overhead dominates at 3x3 and 6x6, so these are plain loops
+that the compiler unrolls for those sizes. Matrices are column major with
+leading dimension ld, as in LAPACK, and matrix k of a batch starts stride
+doubles after matrix k - 1.
+*/
+
+/* Errors */
+#define BATCH_ERR_SIZE (-1)
+
+/* Lower Cholesky factor of each symmetric positive definite A, in place,
+ * reading only the lower triangle and zeroing the upper.
+ * info[k], when info is not NULL, is 0, or j when column j, from 1, is not
+ * positive definite. Returns the number of failures, or an error
+ */
+int batch_chol(int n, int count, double *A, int lda, int stride_a, int *info);
+
+/* Solve A X = B for each symmetric positive definite A, overwriting the
+ * lower triangle of A with its Cholesky factor, and B, n by nrhs, with X
+ */
+int batch_solve_pd(int n, int nrhs, int count, double *A, int lda,
+                   int stride_a, double *B, int ldb, int stride_b, int *info);
+
+/* Solve A X = B for each general A, overwriting A with its LU factors with
+ * partial pivoting, and B with X. info[k] is j when U(j, j) is zero
+ */
+int batch_solve(int n, int nrhs, int count, double *A, int lda, int stride_a,
+                double *B, int ldb, int stride_b, int *info);
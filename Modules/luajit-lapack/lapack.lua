@@ -5,193 +5,208 @@ local lib = {}
 -- TODO: https://github.com/flame/libflame/
 -- TODO: https://www.edx.org/course/linear-algebra-foundations-to-frontiers
 local ffi = require'ffi'
-local sformat = require'string'.format
--- local matrix = require'matrix'
+local tinsert = require'table'.insert
+local matrix_view = require'matrix_view'
+local from_matrix = matrix_view.from_matrix
+local is_view = matrix_view.is_view
+local new_view = matrix_view.new
 
-local function transpose_mtx(mtx)
-  local n_rows = #mtx
-  local n_cols = #mtx[1]
-  local xtm = {}
-  for ic=1,n_cols do
-    local xtm_row = {}
-    for ir=1,n_rows do
-      xtm_row[ir] = mtx[ir][ic]
-    end
-    xtm[ic] = xtm_row
-  end
-  return xtm
-end
--- Transpose cdata into fdata and vice versa
-local function transpose_data(data, rc)
-  local n_rows = rc[0]
-  local n_cols = rc[1]
-  local atad = ffi.new(sformat("double[%d][%d]", n_cols, n_rows))
-  for ir=0,n_rows-1 do
-    for ic=0,n_cols-1 do
-      atad[ic][ir] = data[ir][ic]
-    end
-  end
-  return atad, ffi.new("int[2]", {n_cols, n_rows})
-end
+-- The Fortran interface, which every LAPACK has, unlike LAPACKE.
+-- Matrices are column major, as the views
+ffi.cdef[[
+void dposv_(const char *uplo, const int *n, const int *nrhs, double *a,
+            const int *lda, double *b, const int *ldb, int *info);
+void dgesv_(const int *n, const int *nrhs, double *a, const int *lda,
+            int *ipiv, double *b, const int *ldb, int *info);
+void dpotrf_(const char *uplo, const int *n, double *a, const int *lda,
+             int *info);
+void dsyev_(const char *jobz, const char *uplo, const int *n, double *a,
+            const int *lda, double *w, double *work, const int *lwork,
+            int *info);
+void dgemm_(const char *transa, const char *transb,
+            const int *m, const int *n, const int *k,
+            const double *alpha, const double *a, const int *lda,
+            const double *b, const int *ldb,
+            const double *beta, double *c, const int *ldc);
+]]
 
--- Input: Row major
--- Output: Row major
-local function mtx2cdata(mtx)
-  local n_rows = #mtx
-  local n_cols = #mtx[1]
-  local mtx_cdata = ffi.new(sformat("double[%d][%d]", n_rows, n_cols), mtx)
-  return mtx_cdata, ffi.new("int[2]", {n_rows, n_cols})
-end
--- Input: Row major
--- Output: Row major
-local function cdata2mtx(mtx_cdata, rc)
-  local n_rows = rc[0]
-  local n_cols = rc[1]
-  local mtx = {}
-  for ir=1,n_rows do
-    local row = {}
-    for ic=1,n_cols do
-      row[ic] = mtx_cdata[ir-1][ic-1]
-    end
-    mtx[ir] = row
-  end
-  return mtx
-end
--- Input: Row major
--- Output: Column major
-local function mtx2fortran(mtx)
-  local n_rows = #mtx
-  local n_cols = #mtx[1]
-  local mtx_cdata = ffi.new(sformat("double[%d][%d]", n_cols, n_rows))
-  for ir, row in ipairs(mtx) do
-    for ic, v in ipairs(row) do
-      mtx_cdata[ic-1][ir-1] = v
+-- Find a library with symbol, at runtime
+local function find_library(names, symbol)
+  for _, name in ipairs(names) do
+    local ok, clib = pcall(ffi.load, name)
+    if ok and pcall(function() return clib[symbol] end) then
+      return clib, name
     end
   end
-  return mtx_cdata, ffi.new("int[2]", {n_rows, n_cols})
-end
--- Input: Column major
--- Output: Row major
-local function fortran2mtx(mtx_cdata, rc)
-  local n_row = rc[0]
-  local n_col = rc[1]
-  local mtx = {}
-  for ir=1,n_row do
-    local row = {}
-    for ic=1,n_col do
-      row[ic] = mtx_cdata[ic-1][ir-1]
-    end
-    mtx[ir] = row
-  end
-  return mtx
+  return false, "No library with "..symbol
 end
 
+local lapack_names = {}
+if os.getenv'LAPACK_LIBRARY' then tinsert(lapack_names, os.getenv'LAPACK_LIBRARY') end
+for _, name in ipairs{
+  'openblas', 'libopenblas.so.0', 'lapack', 'liblapack.so.3',
+  '/usr/local/opt/openblas/lib/libopenblas.dylib',
+  '/System/Library/Frameworks/Accelerate.framework/Accelerate',
+} do tinsert(lapack_names, name) end
+local lapack, lapack_name = find_library(lapack_names, 'dposv_')
+-- OpenBLAS and Accelerate include BLAS. Reference LAPACK does not
+local blas = lapack and find_library({lapack_name, 'blas', 'libblas.so.3'}, 'dgemm_')
+lib.backend = lapack and lapack_name
+lib.has_lapack = lapack and true or false
+
+-- Small matrices, in batches or not, skip LAPACK
 ffi.cdef[[
-typedef int lapack_int;
-lapack_int LAPACKE_dsyev(int matrix_layout, char jobz, char uplo,
-                         lapack_int n, double* a,
-                         lapack_int lda, double* w);
-lapack_int LAPACKE_dpstrf(int matrix_layout, char uplo,
-                          lapack_int n, double* a,
-                          lapack_int lda, lapack_int* piv, lapack_int* rank,
-                          double tol);
-lapack_int LAPACKE_dpotrf(int matrix_layout, char uplo,
-                          lapack_int n, double* a,
-                          lapack_int lda);
-/* Linear solver for positive definite matrices */
-lapack_int LAPACKE_dposv(int matrix_layout, char uplo, lapack_int n,
-                         lapack_int nrhs, double* a, lapack_int lda, double* b,
-                         lapack_int ldb );
+int batch_chol(int n, int count, double *A, int lda, int stride_a, int *info);
+int batch_solve_pd(int n, int nrhs, int count, double *A, int lda,
+                   int stride_a, double *B, int ldb, int stride_b, int *info);
+int batch_solve(int n, int nrhs, int count, double *A, int lda, int stride_a,
+                double *B, int ldb, int stride_b, int *info);
 ]]
-local lapack = ffi.load('/usr/local/opt/openblas/lib/liblapack.dylib')
-local LAPACK_ROW_MAJOR = 101
-local LAPACK_COL_MAJOR = 102
-local LAPACK_UPPER = require'string'.byte'U'
-local LAPACK_LOWER = require'string'.byte'L'
+local has_batch, batch = pcall(ffi.load, 'batch_linalg')
+local BATCH_MAX_N = 16
+local function use_batch(n)
+  return has_batch and (n <= BATCH_MAX_N or not lapack)
+end
+lib.has_batch = has_batch
 
--- Solve positive definite matrix equation
-local function solve_pd(A_mtx, B_mtx)
-  local A_fdata, A_rc = mtx2fortran(A_mtx)
-  local B_fdata, B_rc = mtx2fortran(B_mtx)
-  local ret = lapack.LAPACKE_dposv(
-    LAPACK_COL_MAJOR, LAPACK_UPPER,
-    B_rc[0], B_rc[1],
-    ffi.cast('double*', A_fdata), A_rc[0],
-    ffi.cast('double*', B_fdata), B_rc[0]
-  )
+-- Scratch for the scalar arguments of Fortran calls
+local ints = ffi.new('int[8]')
+local info = ints + 7
+
+local function check_info(ret, k)
   if ret < 0 then
     return false, "Invalid"
   elseif ret > 0 then
-    return false, string.format("Failed: %d", ret)
+    return false, string.format("Failed: %d, in matrix %d", ret, k or 1)
   end
-  return fortran2mtx(B_fdata, B_rc)
+  return true
+end
+
+-- Solve positive definite matrix equation, A X = B
+-- Views are solved in place: B becomes X, and the lower triangle of A its
+-- Cholesky factor. Tables are copied, and left alone
+local function solve_pd(A, B)
+  if not is_view(A) then
+    local X, err = solve_pd(from_matrix(A), from_matrix(B))
+    if not X then return false, err end
+    return X:to_matrix()
+  end
+  local n, nrhs, count = A.rows, B.cols, A.count
+  if A.cols ~= n or B.rows ~= n or B.count ~= count then
+    return false, "Bad dimensions"
+  end
+  if use_batch(n) then
+    local ret = batch.batch_solve_pd(n, nrhs, count,
+      A.data, A.ld, A.stride, B.data, B.ld, B.stride, nil)
+    if ret ~= 0 then return false, "Not positive definite" end
+    return B, A
+  elseif not lapack then
+    return false, lapack_name
+  end
+  ints[0], ints[1], ints[2], ints[3] = n, nrhs, A.ld, B.ld
+  for k=0, count - 1 do
+    lapack.dposv_("L", ints, ints + 1, A.data + k * A.stride, ints + 2,
+      B.data + k * B.stride, ints + 3, info)
+    local ok, err = check_info(info[0], k + 1)
+    if not ok then return false, err end
+  end
+  return B, A
 end
 lib.solve_pd = solve_pd
 
--- Compute the eigenvalues and eigenvectors
-local function eigs(mtx)
-  local mtx_cdata, rc = mtx2cdata(mtx)
-  local eigvals = ffi.new("double[?]", rc[0])
-  local ret = lapack.LAPACKE_dsyev(
-    LAPACK_ROW_MAJOR, string.byte'V', LAPACK_LOWER,--LAPACK_UPPER,
-    rc[0], ffi.cast('double*', mtx_cdata),
-    rc[0], eigvals
-  )
-  if ret<0 then
-    return false, "Invalid"
-  elseif ret>0 then
-    return false, string.format("Failed: %d", ret)
+-- Solve general matrix equation, A X = B, in place as solve_pd
+local function solve(A, B)
+  if not is_view(A) then
+    local X, err = solve(from_matrix(A), from_matrix(B))
+    if not X then return false, err end
+    return X:to_matrix()
+  end
+  local n, nrhs, count = A.rows, B.cols, A.count
+  if A.cols ~= n or B.rows ~= n or B.count ~= count then
+    return false, "Bad dimensions"
+  end
+  if use_batch(n) then
+    local ret = batch.batch_solve(n, nrhs, count,
+      A.data, A.ld, A.stride, B.data, B.ld, B.stride, nil)
+    if ret ~= 0 then return false, "Singular" end
+    return B, A
+  elseif not lapack then
+    return false, lapack_name
   end
-  local evals = {}
-  for j=1,rc[0] do
-    evals[j] = eigvals[j-1]
+  local ipiv = ffi.new('int[?]', n)
+  ints[0], ints[1], ints[2], ints[3] = n, nrhs, A.ld, B.ld
+  for k=0, count - 1 do
+    lapack.dgesv_(ints, ints + 1, A.data + k * A.stride, ints + 2, ipiv,
+      B.data + k * B.stride, ints + 3, info)
+    local ok, err = check_info(info[0], k + 1)
+    if not ok then return false, err end
   end
-  local emtx = cdata2mtx(mtx_cdata, rc)
-  return evals, emtx
+  return B, A
+end
+lib.solve = solve
+
+-- Compute the eigenvalues and eigenvectors of a symmetric matrix
+-- A view is overwritten with the eigenvectors, as columns, and the
+-- eigenvalues are returned as an n by 1 view
+local function eigs(A)
+  if not is_view(A) then
+    local evals, evecs = eigs(from_matrix(A))
+    if not evals then return false, evecs end
+    local t_evals = {}
+    for j=1, evals.rows do t_evals[j] = evals:get(j, 1) end
+    return t_evals, evecs:to_matrix()
+  end
+  local n = A.rows
+  if A.cols ~= n then return false, "Not square" end
+  if not lapack then return false, lapack_name end
+  local w = new_view(n, 1, A.count)
+  -- Query the workspace
+  local lwork_opt = ffi.new('double[1]')
+  ints[0], ints[1], ints[2] = n, A.ld, -1
+  lapack.dsyev_("V", "L", ints, A.data, ints + 1, w.data, lwork_opt, ints + 2, info)
+  ints[2] = math.max(1, 3 * n - 1, lwork_opt[0])
+  local work = ffi.new('double[?]', ints[2])
+  for k=0, A.count - 1 do
+    lapack.dsyev_("V", "L", ints, A.data + k * A.stride, ints + 1,
+      w.data + k * w.stride, work, ints + 2, info)
+    local ok, err = check_info(info[0], k + 1)
+    if not ok then return false, err end
+  end
+  return w, A
 end
 lib.eigs = eigs
 
 -- Cholesky factorization using lower triangular matrices
-local function chol(mtx)
-  local mtx_cdata, rc = mtx2cdata(mtx)
-  local ret = lapack.LAPACKE_dpotrf(
-    LAPACK_ROW_MAJOR, LAPACK_LOWER,
-    rc[0], ffi.cast('double*', mtx_cdata),
-    rc[0]
-  )
-  if ret<0 then
-    return false, "Invalid"
-  elseif ret>0 then
-    return false, string.format("Failed: %d", ret)
+-- A view is factored in place, with the upper triangle zeroed
+local function chol(A)
+  if not is_view(A) then
+    local L, err = chol(from_matrix(A))
+    if not L then return false, err end
+    return L:to_matrix()
+  end
+  local n, count = A.rows, A.count
+  if A.cols ~= n then return false, "Not square" end
+  if use_batch(n) then
+    local ret = batch.batch_chol(n, count, A.data, A.ld, A.stride, nil)
+    if ret ~= 0 then return false, "Not positive definite" end
+    return A
+  elseif not lapack then
+    return false, lapack_name
   end
-  -- Zero the non-triangular
-  local lower_mtx = cdata2mtx(mtx_cdata, rc)
-  for j=1, rc[1] do
-    for i=j+1, rc[0] do
-      lower_mtx[j][i] = 0
+  ints[0], ints[1] = n, A.ld
+  for k=1, count do
+    lapack.dpotrf_("L", ints, A.data + (k - 1) * A.stride, ints + 1, info)
+    local ok, err = check_info(info[0], k)
+    if not ok then return false, err end
+    -- Zero the non-triangular
+    for j=2, n do
+      for i=1, j - 1 do A:set(i, j, 0, k) end
     end
   end
-  return lower_mtx
+  return A
 end
 lib.chol = chol
 
-ffi.cdef[[
-/* FORTRAN matrix multiply interface */
-void dsymm_(
-  unsigned char* SIDE,
-  unsigned char*   UPLO,
-  int* M,
-  int* N,
-  double * ALPHA,
-  double * A, int* LDA,
-  double * B, int* LDB,
-  double * BETA,
-  double * C, int* LDC
-);
-]]
-local openblas = ffi.load('/usr/local/opt/openblas/lib/libopenblas.dylib')
-
-
 local has_slicot, slicot = pcall(ffi.load, "slicot")
 if has_slicot then
   ffi.cdef[[
@@ -234,29 +249,34 @@ if has_slicot then
   );
   ]]
 end
+
+-- Working copy of a view or table, for routines that overwrite it
+local function to_work(m)
+  return is_view(m) and m:copy() or from_matrix(m)
+end
+
 -- https://en.wikipedia.org/wiki/Linear–quadratic_regulator#Infinite-horizon,_continuous-time_LQR
 -- https://github.com/RobotLocomotion/drake/blob/a4d9661244fbbda0e817b784e56951268350e045/systems/controllers/linear_quadratic_regulator.cc
+-- Takes and gives views, or tables
 local function lqr(A0, B0, Q0, R0, L0)
   -- Solve CARE
-  local A_fdata, A_rc = mtx2fortran(A0) -- n_states * n_states
-  local B_fdata, B_rc = mtx2fortran(B0) -- n_states * n_inputs
-  local n_states, n_inputs = B_rc[0], B_rc[1]
-  local Q_fdata, Q_rc = mtx2fortran(Q0)
-  local R_fdata, R_rc = mtx2fortran(R0)
-  local L_fdata, L_rc = mtx2fortran(L0)
+  local A, B, Q, R, L = to_work(A0), to_work(B0), to_work(Q0), to_work(R0), to_work(L0)
+  local n_states, n_inputs = B.rows, B.cols
+  local dims = ffi.new("int[8]", {
+    n_states, n_inputs, A.ld, B.ld, Q.ld, R.ld, L.ld, n_states
+  })
   --
   local ipiv = ffi.new("int[?]", n_inputs)
   local oufact = ffi.new("int[1]")
   -- Create the output matrix
-  local G_fdata = ffi.new(string.format("double[%d][%d]", n_states, n_states))
-  local G_rc = ffi.new("int[2]", {n_states, n_states})
+  local G = new_view(n_states, n_states)
   --
   local iwork = ffi.new("int[?]", 2 * n_inputs)
   local ldwork = ffi.new("int[1]",
     math.max(2, 3 * n_inputs, n_states * n_inputs))
   local dwork = ffi.new("double[?]", ldwork[0])
   --
-  local info = ffi.new("int[1]")
+  local info_slicot = ffi.new("int[1]")
   --
   local jobg = ffi.new("unsigned char[1]", 'G')
   local jobl = ffi.new("unsigned char[1]", 'Z')
@@ -266,24 +286,23 @@ local function lqr(A0, B0, Q0, R0, L0)
   slicot.sb02mt_(
     jobg, jobl, fact, uplo,
     --
-    B_rc + 0, B_rc + 1,
-    ffi.cast('double*', A_fdata), A_rc, -- A is not referenced when jobl is Z
-    ffi.cast('double*', B_fdata), B_rc,
+    dims + 0, dims + 1,
+    A.data, dims + 2, -- A is not referenced when jobl is Z
+    B.data, dims + 3,
     --
-    ffi.cast('double*', Q_fdata), Q_rc,
-    ffi.cast('double*', R_fdata), R_rc,
+    Q.data, dims + 4,
+    R.data, dims + 5,
     --
-    ffi.cast('double*', L_fdata), L_rc,
+    L.data, dims + 6,
     --
     ipiv, oufact,
-    ffi.cast('double*', G_fdata), G_rc,
+    G.data, dims + 7,
     --
     iwork, dwork, ldwork,
     --
-    info
+    info_slicot
   )
-  local ret = info[0]
-  if ret ~=0 then
+  if info_slicot[0] ~= 0 then
     return false, "Bad prep"
   end
 
@@ -301,60 +320,47 @@ local function lqr(A0, B0, Q0, R0, L0)
   local wr = ffi.new("double[?]", 2 * n_states)
   local wi = ffi.new("double[?]", 2 * n_states)
   --
-  local S_fdata = ffi.new(string.format("double[%d][%d]", 2*n_states, 2*n_states))
-  local S_rc = ffi.new("int[2]", {2 * n_states, 2 * n_states})
-  --
-  local U_fdata = ffi.new(string.format("double[%d][%d]", 2*n_states, 2*n_states))
-  local U_rc = ffi.new("int[2]", {2 * n_states, 2 * n_states})
+  local S = new_view(2 * n_states, 2 * n_states)
+  local U = new_view(2 * n_states, 2 * n_states)
+  local dims2 = ffi.new("int[3]", {n_states, 2 * n_states, 2 * n_states})
 
   slicot.sb02md_(
     dico, hinv, uplo, scaling, sorting,
     --
-    A_rc,
-    ffi.cast('double*', A_fdata), A_rc, -- Inverted on exit
-    ffi.cast('double*', G_fdata), G_rc,
-    ffi.cast('double*', Q_fdata), Q_rc, -- Solution, X, on exit
+    dims + 0,
+    A.data, dims + 2, -- Inverted on exit
+    G.data, dims + 7,
+    Q.data, dims + 4, -- Solution, X, on exit
     --
     rcond, wr, wi,
-    ffi.cast('double*', S_fdata), S_rc,
-    ffi.cast('double*', U_fdata), U_rc,
+    S.data, dims2 + 1,
+    U.data, dims2 + 2,
     --
     iwork, dwork, ldwork, bwork,
     --
-    info
+    info_slicot
   )
-  ret = info[0]
-  if ret ~=0 then
+  if info_slicot[0] ~= 0 then
     return false, "Bad Riccati"
   end
 
-  B_fdata, B_rc = mtx2fortran(B0)
-  local side = ffi.new("unsigned char[1]", 'L')
-  local alpha = ffi.new("double[1]", {1})
-  local beta = ffi.new("double[1]", {0})
-  local ptb_rc = ffi.new("int[2]", {n_states, n_inputs})
-  local ptb_fdata = ffi.new(string.format("double[%d][%d]", ptb_rc[1], ptb_rc[0]))
-  openblas.dsymm_(
-    side,
-    uplo,
-    ptb_rc + 0,
-    ptb_rc + 1,
-    alpha,
-    ffi.cast("double*", Q_fdata), Q_rc,
-    ffi.cast("double*", B_fdata), B_rc,
-    beta,
-    ffi.cast("double*", ptb_fdata), ptb_rc
-  )
-  -- local K, err = solve_pd(R0, matrix.transpose(B0) * matrix:new(fortran2mtx(Q_fdata, Q_rc)))
-  -- local btp = matrix.transpose(fortran2mtx(ptb_fdata, ptb_rc))
-  local btp = transpose_mtx(fortran2mtx(ptb_fdata, ptb_rc))
-  local K, err = solve_pd(R0, btp)
+  -- B' X, from the B that was given, then K = R^-1 B' X
+  if not blas then return false, "No BLAS" end
+  local B1 = is_view(B0) and B0 or from_matrix(B0)
+  local BtX = new_view(n_inputs, n_states)
+  local alpha = ffi.new("double[2]", {1, 0})
+  ints[0], ints[1], ints[2], ints[3], ints[4], ints[5] =
+    n_inputs, n_states, n_states, B1.ld, Q.ld, BtX.ld
+  blas.dgemm_("T", "N", ints, ints + 1, ints + 2,
+    alpha, B1.data, ints + 3, Q.data, ints + 4,
+    alpha + 1, BtX.data, ints + 5)
+  local K, err = solve_pd(to_work(R0), BtX)
   if not K then
     return false, err
   end
   -- Optimal feedback: u = -K * x
-  return K
+  return is_view(A0) and K or K:to_matrix()
 end
-lib.lqr = has_slicot and lqr
+lib.lqr = has_slicot and lapack and lqr
 
 return lib
@@ -0,0 +1,111 @@
+#!/usr/bin/env luajit
+-- Views and batches against the table path, on the small positive
+-- definite solves of the estimators
+local lapack = require'lapack'
+local matrix_view = require'matrix_view'
+local ffi = require'ffi'
+local clock = require'os'.clock
+
+print("LAPACK", lapack.backend, "Batched", lapack.has_batch)
+math.randomseed(123)
+
+-- Random symmetric positive definite, as a table of tables
+local function random_pd(n)
+  local G = {}
+  for i=1, n do
+    G[i] = {}
+    for j=1, n do G[i][j] = math.random() - 0.5 end
+  end
+  local A = {}
+  for i=1, n do
+    A[i] = {}
+    for j=1, n do
+      local v = i == j and 0.1 * n or 0
+      for k=1, n do v = v + G[i][k] * G[j][k] end
+      A[i][j] = v
+    end
+  end
+  return A
+end
+
+local function random_rhs(n, nrhs)
+  local B = {}
+  for i=1, n do
+    B[i] = {}
+    for j=1, nrhs do B[i][j] = math.random() - 0.5 end
+  end
+  return B
+end
+
+-- Same answers, each way
+local A, B = random_pd(3), random_rhs(3, 2)
+local X = assert(lapack.solve_pd(A, B))
+local A_view, B_view = matrix_view.from_matrix(A), matrix_view.from_matrix(B)
+local X_view = assert(lapack.solve_pd(A_view, B_view))
+assert(X_view == B_view, "Solved in place")
+for i=1, 3 do
+  for j=1, 2 do
+    assert(math.abs(X[i][j] - X_view:get(i, j)) < 1e-12)
+    -- A X = B
+    local s = 0
+    for k=1, 3 do s = s + A[i][k] * X[k][j] end
+    assert(math.abs(s - B[i][j]) < 1e-12)
+  end
+end
+
+-- https://en.wikipedia.org/wiki/Cholesky_decomposition#Example
+local L = assert(lapack.chol(matrix_view.from_matrix{
+  {4, 12, -16},
+  {12, 37, -43},
+  {-16, -43, 98},
+}))
+assert(L:get(1, 1) == 2 and L:get(3, 2) == 5 and L:get(3, 3) == 3)
+assert(L:get(1, 3) == 0)
+-- A block of a larger matrix, without copying it out
+local big = matrix_view.from_matrix(random_pd(6))
+local block = big:sub(4, 4, 6, 6)
+assert(block.ld == 6 and block.rows == 3)
+assert(lapack.chol(block))
+assert(big:get(4, 6) == 0, "Factored in place")
+
+-- Benchmark: count solves of n by n with one right hand side
+local count = tonumber(arg[1]) or 10000
+for _, n in ipairs{3, 6} do
+  local As, Bs = {}, {}
+  for k=1, count do
+    As[k], Bs[k] = random_pd(n), random_rhs(n, 1)
+  end
+
+  -- Tables to Fortran order and back, on every call
+  local t0 = clock()
+  for k=1, count do assert(lapack.solve_pd(As[k], Bs[k])) end
+  local t_tables = clock() - t0
+
+  -- Views, converted once, then one call per matrix
+  local A_batch, B_batch = matrix_view.from_matrix(As), matrix_view.from_matrix(Bs)
+  local A_work, B_work = A_batch:copy(), B_batch:copy()
+  t0 = clock()
+  for k=1, count do
+    assert(lapack.solve_pd(A_work:batch(k), B_work:batch(k)))
+  end
+  local t_views = clock() - t0
+
+  -- One call for the whole batch
+  ffi.copy(A_work.data, A_batch.data, ffi.sizeof'double' * n * n * count)
+  ffi.copy(B_work.data, B_batch.data, ffi.sizeof'double' * n * count)
+  t0 = clock()
+  assert(lapack.solve_pd(A_work, B_work))
+  local t_batch = clock() - t0
+
+  -- Compare the last solution with the table path
+  local X_last = assert(lapack.solve_pd(As[count], Bs[count]))
+  for i=1, n do
+    assert(math.abs(X_last[i][1] - B_work:get(i, 1, count)) < 1e-9)
+  end
+
+  print(string.format(
+    "%dx%d, %d solves | tables %.2f us, views %.2f us, batch %.3f us each",
+    n, n, count, t_tables / count * 1e6, t_views / count * 1e6,
+    t_batch / count * 1e6))
+end
+print("OK")
@@ -65,6 +65,9 @@ lib.lmp_match = lmp_match
 -- return math.type(v) == 'integer' or ffi.istype('uint64_t', t_us)
 local identity = function(x) return x end
 local bswap = identity
+-- Set below, for the FFI or for string.pack
+local form_entry, parse_header, utime
+local lcm_hdr_t, LCM_HDR_SZ
 if has_ffi then
   if ffi.abi'le' then
     local has_bit, bit = pcall(require, 'bit')
@@ -86,12 +89,12 @@ if has_ffi then
   } __attribute__((packed));
   ]]
   -- TODO: Allow a non-FFI version, here
-  local lcm_hdr_t = ffi.typeof"struct lcm_hdr_t"
-  local LCM_HDR_SZ = ffi.sizeof"struct lcm_hdr_t"
+  lcm_hdr_t = ffi.typeof"struct lcm_hdr_t"
+  LCM_HDR_SZ = ffi.sizeof"struct lcm_hdr_t"
   local lcm_hdr_ptr = ffi.typeof"struct lcm_hdr_t *"
   local SYNC_WORD = bswap(0xEDA1DA01)
 
-  local function form_entry(str, channel, t_us, count)
+  function form_entry(str, channel, t_us, count)
     local hdr = lcm_hdr_t{
       SYNC_WORD,
       bswap(count),
@@ -103,7 +106,7 @@ if has_ffi then
     return entry
   end
 
-  local function parse_header(lcm_hdr)
+  function parse_header(lcm_hdr)
     assert(lcm_hdr.sync == SYNC_WORD, sformat("Bad sync word! %X", lcm_hdr.sync))
     local t_us = bswap(lcm_hdr.t)
     local count = bswap(lcm_hdr.count)
@@ -121,7 +124,7 @@ if has_ffi then
   } timeval;
   int gettimeofday(struct timeval *restrict tp, void *restrict tzp);
   ]]
-  local function utime()
+  function utime()
     local t = ffi.new'timeval'
     C.gettimeofday(t, nil)
     return 1e6 * ffi.cast('uint64_t', t.tv_sec) + t.tv_usec
@@ -144,7 +147,7 @@ elseif spack then
     return entry
   end
 
-  local function parse_header(lcm_hdr)
+  function parse_header(lcm_hdr)
     local sync, count, t_us, sz_channel, sz_data = sunpack(LCM_HDR_FMT, lcm_hdr)
     assert(sync == SYNC_WORD, sformat("Bad sync word! %X", sync))
     assert(sz_channel < 256, sformat("Channel length too long: [%d]", sz_channel))
@@ -153,7 +156,7 @@ elseif spack then
 
   -- Precision in seconds... not great, but just to have some placeholder
   local otime = require'os'.time
-  local function utime()
+  function utime()
     return 1e6 * otime()
   end
 
@@ -257,8 +260,8 @@ local function playback(self, options)
   local skip_data = options.skip_data
   local skip_channel = options.skip_channel
 
-  -- Go back to the start of the file
-  f_log:seek("set")
+  -- Go back to the start of the file, or where seek left us
+  f_log:seek("set", self.offset_start or 0)
   -- Give the log size
   local log_info = {
     sz_log = sz_log, -- file size
@@ -554,6 +557,48 @@ local function reopen_log(self)
   return self
 end
 
+-- Header of the entry at a byte offset
+local function read_header(f_log, offset)
+  f_log:seek("set", offset)
+  local lcm_hdr_str = f_log:read(LCM_HDR_SZ)
+  if not lcm_hdr_str or #lcm_hdr_str ~= LCM_HDR_SZ then return false end
+  return parse_header(ffi.cast('const struct lcm_hdr_t *', lcm_hdr_str))
+end
+
+-- Timestamp of the first entry
+local function start_time(self)
+  local _, _, t_us = read_header(self.f_log, 0)
+  return t_us
+end
+
+-- Start playback at the first entry at or after t_us, bisecting the index
+-- if there is one, else stepping over the entries from the start
+local function seek(self, t_us)
+  local f_log = self.f_log
+  local offset = 0
+  if self.idx_offsets then
+    local lo, hi = 0, self.n_idx
+    while lo < hi do
+      local mid = math.floor((lo + hi) / 2)
+      local _, _, t_mid = read_header(f_log, self.idx_offsets[mid])
+      if t_mid and t_mid < t_us then
+        lo = mid + 1
+      else
+        hi = mid
+      end
+    end
+    offset = lo < self.n_idx and self.idx_offsets[lo] or f_log:seek("end")
+  else
+    while true do
+      local sz_data, sz_channel, t_entry = read_header(f_log, offset)
+      if not sz_data or t_entry >= t_us then break end
+      offset = offset + LCM_HDR_SZ + sz_channel + sz_data
+    end
+  end
+  self.offset_start = offset
+  return offset
+end
+
 -- Open a filename
 local function open_log(log_fname)
   -- Check if we already have a log object
@@ -583,24 +628,49 @@ local function open_log(log_fname)
 
 
   -- Open the file
-  local f_log = io.open(fname, "r")
+  local f_log = io.open(log_fname, "r")
   if not f_log then
     return false, "Cannot open log file"
   end
-  -- TODO: Try to open an index file
-  -- TODO: Open index if it exists
   local f_idx = false
+  -- Offsets of each entry, from the index if it exists, for seeking
+  local idx_offsets, n_idx = false, 0
+  local f_idx_read = io.open(log_fname..".idx", "r")
+  if f_idx_read then
+    local str_idx = f_idx_read:read"*all"
+    f_idx_read:close()
+    -- Records of [entry_chunk entry_offset entry_size]
+    n_idx = math.floor(#str_idx / 12)
+    idx_offsets = ffi.new('uint32_t[?]', n_idx)
+    local records = ffi.cast('const uint32_t *', str_idx)
+    for i=0, n_idx - 1 do
+      idx_offsets[i] = bswap(records[3 * i + 1])
+    end
+    -- An empty index, or one of another file, would seek to the wrong place
+    for i=1, n_idx - 1 do
+      if idx_offsets[i] <= idx_offsets[i - 1] then
+        n_idx = 0
+        break
+      end
+    end
+    if n_idx == 0 then idx_offsets = false end
+  end
   -- Return a log object
   return setmetatable({
     write = encode and write,
     write_raw = write_raw,
     close = close,
     play = play,
+    seek = seek,
+    start_time = start_time,
     -- File handles
     f_log = f_log,
     f_idx = f_idx,
     --
     idx_name = false,
+    idx_offsets = idx_offsets,
+    n_idx = n_idx,
+    offset_start = 0,
     log_name = log_name,
     log_dir = log_dir,
     log_fname = log_fname,
@@ -12,6 +12,7 @@ local unpack = unpack or require'table'.unpack
 local tconcat = require'table'.concat
 local tinsert = require'table'.insert
 local tremove = require'table'.remove
+local tsort = require'table'.sort
 local has_logger, logger = pcall(require, 'logger')
 local has_lcm, lcm = pcall(require, 'lcm')
 local has_signal, signal = pcall(require, 'signal')
@@ -63,7 +64,7 @@ end
 lib.init = init
 
 -- local exit_handler = false
--- lib.running = true
+lib.running = true
 -- if has_signal then
 --   local function shutdown()
 --     if lib.running == false then
@@ -227,6 +228,20 @@ local function listen(options)
       assert(mcl_obj:fd_register(fd, update))
     end
   end
+  -- Simulated time, as a function giving microseconds, or 'sim' to follow
+  -- the clock channel of run_simulation. The loop rate is then in simulated
+  -- milliseconds, while polling and debug stay on the wall clock
+  local clock = time_us
+  if options.clock == 'sim' then
+    assert(has_logger, logger)
+    local t_clock = false
+    assert(mcl_obj:cb_register('clock', function(msg)
+      t_clock = tonumber(msg.t_us) or t_clock
+    end, logger.decode))
+    clock = function() return t_clock end
+  elseif type(options.clock)=='function' then
+    clock = options.clock
+  end
   local loop_rate = tonumber(options.loop_rate)
   local loop_rate1
   local fn_loop = type(options.fn_loop)=='function' and options.fn_loop
@@ -243,19 +258,23 @@ local function listen(options)
   local status = true
   local err
   while lib.running do
-    local t = time_us()
-    if loop_rate then
+    -- No simulated time until the first clock message
+    local t = clock()
+    if loop_rate and t then
       dt_loop = tonumber(t - t_loop) / 1e3
       loop_rate1 = max(1, min(loop_rate - dt_loop, dt_poll))
+    elseif loop_rate then
+      loop_rate1 = dt_poll
     else
       loop_rate1 = -1
     end
     status, err = mcl_obj:update(loop_rate1)
     t_update = time_us()
     if not status then lib.running = false; break end
-    dt_loop = tonumber(t_update - t_loop)/1e3
-    if fn_loop and dt_loop >= loop_rate then
-      t_loop = t_update
+    t = clock()
+    dt_loop = t and tonumber(t - t_loop)/1e3
+    if fn_loop and t and dt_loop >= loop_rate then
+      t_loop = t
       local ok, msg = fn_loop(t_loop, cnt_loop)
       -- if not ok then print(msg) end
       cnt_loop = cnt_loop + 1
@@ -281,33 +300,132 @@ local function listen(options)
 end
 lib.listen = listen
 
+-- Log time of the replay, in microseconds, while one runs
+local t_replay = false
+-- Time of the replay, else of the host, for code that runs either way
+function lib.time_us()
+  return t_replay or time_us()
+end
+
+-- Replay logs on a virtual clock, giving the same results on every run
+-- speed: multiple of real time, or 0 for as fast as possible (default)
+-- start: seconds after the first entry, found with the log index
+-- include, exclude: patterns of the channels to play
+-- loop_rate: run fn_loop every loop_rate ms of log time, before the first
+--   entry after each tick, else after every entry
+-- seed: for math.random, so that noise repeats from run to run
+-- announce: send the entries, and the time on the clock channel, over MCL
+-- sync: when announcing, every sync_period ms of log time, wait up to
+--   sync_timeout ms for a message on this channel from the subscribers
+-- control: channel of {evt = pause|resume|step|speed|seek, val = number}
+-- While replaying, unix.time_us gives the log time, unless inject_clock is
+-- false. Code that kept its own reference to unix.time_us does not see it
 local function replay(fnames, options)
   if type(options)~='table' then options = {} end
-  local realtime = options.realtime
+  if type(fnames)=='string' then fnames = {fnames} end
+  if type(fnames)~='table' or #fnames==0 then
+    return false, "Invalid logs"
+  end
+  -- Entries at the same time come in the order of the names
+  local logs = {}
+  for i, fname in ipairs(fnames) do logs[i] = fname end
+  tsort(logs)
+  for i, fname in ipairs(logs) do
+    logs[i] = assert(logger.open(fname))
+  end
+  local speed = tonumber(options.speed) or (options.realtime and 1) or 0
+  local loop_us = tonumber(options.loop_rate) and 1e3 * options.loop_rate
   local fn_loop = type(options.fn_loop)=='function' and options.fn_loop
   local fn_debug = type(options.fn_debug)=='function' and options.fn_debug
   local debug_timeout = tonumber(options.debug_timeout) or 1e3
-  -- TODO: Add fn_loop, fn_debug
   local channel_callbacks = {}
   if type(options.channel_callbacks)=='table' then
     channel_callbacks = options.channel_callbacks
   end
+  local include = type(options.include)=='string' and options.include
+  local exclude = type(options.exclude)=='string' and options.exclude
+  local use_announce = options.announce and mcl_obj
+  local sync_channel = use_announce and type(options.sync)=='string' and options.sync
+  local sync_us = 1e3 * (tonumber(options.sync_period) or 100)
+  local sync_timeout_us = 1e3 * (tonumber(options.sync_timeout) or 1e3)
+  if options.seed then math.randomseed(options.seed) end
+
+  -- Seek from the earliest entry of all the logs
+  local t_first
+  for _, log in ipairs(logs) do
+    local t = log:start_time()
+    if t and (not t_first or t < t_first) then t_first = tonumber(t) end
+  end
+  if not t_first then return false, "Empty logs" end
   local co_play
-  if type(fnames)=='string' then
-    local log = logger.open(fnames)
-    co_play = assert(log:play())
-    -- co_play = assert(logger.play(fnames, options))
-  elseif type(fnames)=='table' and #fnames>0 then
-    co_play = assert(logger.play_many(fnames, options))
-  else
-    return false, "Invalid logs"
+  local t_loop, t_sync
+  -- Pacing, from the log time and host time when last (re)started
+  local t_log0, t_host0
+  local function seek(seconds)
+    local t_start = t_first + math.max(0, math.floor(1e6 * seconds))
+    for _, log in ipairs(logs) do log:seek(t_start) end
+    co_play = assert(logger.play_many(logs))
+    -- Keep the loop on the same ticks of log time
+    t_loop = loop_us and t_first + loop_us * math.ceil((t_start - t_first) / loop_us)
+    t_sync = t_start
+    t_log0 = false
   end
+  seek(tonumber(options.start) or 0)
+
+  -- Pause, step and change speed from another process
+  local paused, n_steps = false, 0
+  if mcl_obj and type(options.control)=='string' then
+    assert(mcl_obj:cb_register(options.control, function(msg)
+      local evt, val = msg.evt, tonumber(msg.val)
+      if evt == 'pause' then
+        paused = true
+      elseif evt == 'resume' then
+        paused = false
+      elseif evt == 'step' then
+        paused = true
+        n_steps = n_steps + (val or 1)
+      elseif evt == 'speed' and val then
+        speed = val
+      elseif evt == 'seek' and val then
+        seek(val)
+      end
+      t_log0 = false
+    end, logger.decode))
+  end
+  local n_sync = 0
+  if sync_channel then
+    assert(mcl_obj:cb_register(sync_channel, function()
+      n_sync = n_sync + 1
+    end, logger.decode))
+  end
+  -- Poll for control while waiting on the host clock
+  local t_poll = 0
+  local function wait_until(t_host)
+    while lib.running do
+      local t_now = tonumber(time_us())
+      local dt_wait = t_host - t_now
+      if mcl_obj and (dt_wait > 0 or t_now - t_poll > 1e4) then
+        t_poll = t_now
+        mcl_obj:update(max(0, math.ceil(dt_wait / 1e3)))
+      elseif dt_wait > 0 then
+        usleep(dt_wait)
+      end
+      if dt_wait <= 0 or paused or not t_log0 then break end
+    end
+  end
+
+  local unix = require'unix'
+  local time_us_unix = unix.time_us
+  if options.inject_clock ~= false then unix.time_us = lib.time_us end
   local t_debug = 0
+  local cnt_loop = 0
   local cnt_debug = 0
-  local t_log0, t_log1
-  local t_host0
   while lib.running do
+    while paused and n_steps == 0 and lib.running do
+      mcl_obj:update(10)
+    end
     if costatus(co_play)~='suspended' then break end
+    local co_entry = co_play
     local ok, str, ch, t_us = coresume(co_play)
     if not ok then
       io.stderr:write(sformat("Error: %s\n", str))
@@ -315,17 +433,55 @@ local function replay(fnames, options)
     elseif not str then
       break
     end
-    -- Run a callback
-    local cb = channel_callbacks[ch]
-    if type(cb)=='function' then
-      local obj = assert(logger.decode(str))
-      cb(obj, t_us)
+    local t = tonumber(t_us)
+    -- Ticks of the loop up to this entry
+    while t_loop and t_loop < t do
+      t_replay = t_loop
+      if fn_loop then fn_loop(t_loop, cnt_loop) end
+      cnt_loop = cnt_loop + 1
+      t_loop = t_loop + loop_us
+    end
+    local is_played = (not include or ch:find(include)) and not (exclude and ch:find(exclude))
+    if is_played then
+      if speed > 0 then
+        if not t_log0 then
+          t_log0, t_host0 = t, tonumber(time_us())
+        end
+        wait_until(t_host0 + (t - t_log0) / speed)
+      elseif mcl_obj then
+        wait_until(0)
+      end
     end
-    if fn_loop then fn_loop(t_us) end
-    local dt_debug = tonumber(t_us - t_debug)
+    -- Unless we sought elsewhere while waiting
+    if is_played and co_entry == co_play then
+      t_replay = t
+      -- Run a callback
+      local cb = channel_callbacks[ch]
+      if type(cb)=='function' then
+        local obj = assert(logger.decode(str))
+        cb(obj, t_us)
+      end
+      if fn_loop and not loop_us then fn_loop(t_us) end
+      if use_announce then
+        announce("clock", {t_us = t})
+        announce(ch, str)
+      end
+      if n_steps > 0 then n_steps = n_steps - 1 end
+    end
+    -- Let the subscribers catch up
+    if sync_channel and t - t_sync >= sync_us then
+      t_sync = t
+      local n_sync0 = n_sync
+      local t_timeout = tonumber(time_us()) + sync_timeout_us
+      while n_sync == n_sync0 and lib.running and tonumber(time_us()) < t_timeout do
+        mcl_obj:update(1)
+      end
+      t_log0 = false
+    end
+    local dt_debug = t - t_debug
     if dt_debug / 1e3 > debug_timeout then
-      t_debug = t_us
-      local jt = mcl_obj:jitter_info(true)
+      t_debug = t
+      local jt = mcl_obj and mcl_obj:jitter_info(true) or {}
       if fn_debug then
         local msg_debug = fn_debug(t_debug, cnt_debug)
         cnt_debug = cnt_debug + 1
@@ -338,19 +494,9 @@ local function replay(fnames, options)
         io.flush()
       end
     end
-    local t_host = time_us()
-    if not t_log0 then
-      t_log0 = t_log0 or t_us
-      t_host0 = t_host
-    end
-    local dt_log = t_log1 and tonumber(t_us - t_log1) or 0
-    local dt0_log = tonumber(t_us - t_log0)
-    local dt0_host = tonumber(t_host - t_host0)
-    local lag_to_host = dt0_log - dt0_host
-    local dt_host = dt_log + lag_to_host
-    if realtime then usleep(dt_host) end
-    t_log1 = t_us
   end
+  unix.time_us = time_us_unix
+  t_replay = false
   return true
 end
 lib.replay = replay
@@ -361,9 +507,18 @@ if IS_MAIN then
   local flags = parse_arg(arg, false)
   if flags.replay then
     print("Replay", flags.replay, unpack(flags))
+    -- Only send the entries over MCL when asked, with --announce true
     return replay({flags.replay, unpack(flags)},
       {
+        speed = flags.speed,
         realtime = flags.realtime,
+        start = flags.start,
+        include = flags.include,
+        exclude = flags.exclude,
+        seed = flags.seed,
+        announce = flags.announce == true or flags.announce == 1,
+        sync = flags.sync,
+        control = 'replay',
       })
   elseif flags.spy then
     local function print_message(msg, ch, t_us)
@@ -26,6 +26,17 @@ racecar.init()
 local path_list = {} -- Path list now and into the future. Should hold path_rollout_time seconds
 local path_rollout_time = 5 -- How far ahead to look given the speed limit of each path
 local planner_state = false
+-- Index of the planner paths, and where each vehicle is on each path
+local route_index = false
+local route_matches = {}
+local orientation_threshold = math.rad(60)
+-- Reach of the index from each path, in meters. Vehicles further away are
+-- found on the kd-tree of the path, which is unbounded
+local route_distance = 1.0
+-- Model predictive control in place of pure pursuit, when asked for
+local has_mpc, mpc = pcall(require, 'mpc')
+local use_mpc = flags.mpc and has_mpc
+local mpc_controllers = setmetatable({}, {__mode = 'k'})
 -- Parameters for each robot
 local vehicle_params = {}
 
@@ -71,6 +82,7 @@ local function update_params(pp_params)
   end
 
   -- The controller, by default, stops
+  local velocity_last = pp_params.velocity
   pp_params.steering = 0
   pp_params.velocity = 0
 
@@ -109,13 +121,20 @@ local function update_params(pp_params)
 
   -- Assign all vehicles to a lane
   local closeness = 0.4
-  for _, params_veh in pairs(vehicle_params) do
+  local matches = route_matches[pp_params.pathname]
+  for name_veh, params_veh in pairs(vehicle_params) do
     local pose_veh = params_veh.pose
     -- Back axle
-    local path_info, err_find = my_path:find(pose_veh, {
-      closeness=closeness,
-      orientation_threshold=math.rad(60)
-    })
+    local path_info, err_find
+    if matches then
+      path_info, err_find = matches[name_veh], "No well-oriented candidates"
+    end
+    if not path_info then
+      path_info, err_find = my_path:find(pose_veh, {
+        closeness=closeness,
+        orientation_threshold=orientation_threshold
+      })
+    end
     params_veh.lane_current = path_info and path_info.idx_lane or err_find
     params_veh.longitudinal_id_current = path_info and path_info.idx_path or err_find
     if not params_veh.lane_desired then
@@ -250,6 +269,36 @@ local function update_params(pp_params)
     else
       pp_params.velocity = math.min(vel_desired, pp_params.velocity_max)
     end
+    -- Track the path at that speed, rather than the lookahead point
+    if use_mpc and not my_path.markers then
+      local mpc_state = mpc_controllers[pp_params]
+      if not mpc_state then
+        mpc_state = {controller = assert(mpc.new{
+          wheel_base = pp_params.wheel_base,
+          max_speed = pp_params.velocity_max,
+        })}
+        mpc_controllers[pp_params] = mpc_state
+      end
+      local controller = mpc_state.controller
+      if mpc_state.pathname ~= pp_params.pathname then
+        controller:reset()
+        mpc_state.pathname = pp_params.pathname
+      end
+      local reference = mpc.reference(my_path, pp_params.longitudinal_id_current,
+        pp_params.velocity, controller.params.dt, controller.params.horizon)
+      local steering, accel, info = controller:solve(
+        {pose_rbt[1], pose_rbt[2], pose_rbt[3], velocity_last}, reference)
+      if type(info) == 'string' then
+        -- Failed: keep the pure pursuit commands, and plan afresh next time
+        pp_params.mpc_error = info
+        controller:reset()
+      else
+        pp_params.mpc_error = nil
+        pp_params.steering = steering
+        pp_params.velocity = math.max(0, math.min(pp_params.velocity_max,
+          velocity_last + accel * controller.params.period))
+      end
+    end
   end
 end
 -- Update the pure pursuit
@@ -290,9 +339,37 @@ end
 -- Update the poses
 -------------------
 
+-- Whether two sets of paths have the same points
+local function same_paths(paths_a, paths_b)
+  if type(paths_a)~='table' or type(paths_b)~='table' then return false end
+  for name, path_a in pairs(paths_a) do
+    local path_b = paths_b[name]
+    if type(path_b)~='table' or path_a.closed ~= path_b.closed
+      or #path_a.points ~= #path_b.points then
+      return false
+    end
+    local points_b = path_b.points
+    for i, p in ipairs(path_a.points) do
+      local q = points_b[i]
+      if p[1]~=q[1] or p[2]~=q[2] or p[3]~=q[3] then return false end
+    end
+  end
+  for name in pairs(paths_b) do
+    if paths_a[name]==nil then return false end
+  end
+  return true
+end
+
 local function cb_plan(msg, ch, t_us)
   -- Update the information available
   planner_state = msg
+  -- Index the paths, for finding all vehicles at once. The planner repeats
+  -- its paths, so only index a new set of them
+  if route_index and same_paths(msg.paths, route_index.paths) then return end
+  route_index = type(msg.paths)=='table' and path.index(msg.paths, {
+    max_distance = route_distance,
+    max_angle = orientation_threshold
+  })
 end
 
 local function cb_houston(msg, ch, t_us)
@@ -327,6 +404,29 @@ local function cb_loop(t_us)
     return false, "No planner information"
   end
 
+  -- Find every vehicle along the path of each vehicle, one query per path
+  route_matches = {}
+  if route_index then
+    local names_veh, poses_veh = {}, {}
+    for name_veh, params_veh in pairs(vehicle_params) do
+      table.insert(names_veh, name_veh)
+      table.insert(poses_veh, params_veh.pose)
+    end
+    for _, params_veh in pairs(vehicle_params) do
+      local pathname = params_veh.pathname
+      if pathname and route_index.ids[pathname] and not route_matches[pathname] then
+        local found = route_index:find_all(poses_veh, {
+          path = pathname,
+          distance_threshold = route_distance,
+          orientation_threshold = orientation_threshold
+        })
+        local matches = {}
+        for i, name_veh in ipairs(names_veh) do matches[name_veh] = found[i] end
+        route_matches[pathname] = matches
+      end
+    end
+  end
+
   -- Update the control parameters
   for _, params_veh in pairs(vehicle_params) do
     update_params(params_veh)
@@ -374,7 +474,9 @@ racecar.listen{
     planner = cb_plan,
     houston = cb_houston
   },
-  loop_rate = 100, -- 100ms loop
+  loop_rate = use_mpc and 20 or 100, -- 20ms loop for MPC, else 100ms
+  -- With --clock sim, keep time with run_simulation
+  clock = flags.clock,
   fn_loop = cb_loop,
   fn_debug = cb_debug
 }
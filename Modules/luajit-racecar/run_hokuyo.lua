@@ -72,8 +72,26 @@ local function exit()
 end
 -- racecar.handle_shutdown(exit)
 
+-- Prefer the native decoder, which drops packets that fail their checksums
+local decoder = hokuyo.decoder()
 local coro = coroutine.create(hokuyo.update)
+-- Logged before the next packet, so one table serves every scan
+local obj_scan = {}
 local function process(data)
+  if decoder then
+    for pkt in decoder:packets(data) do
+      local obj = hokuyo.packet2table(pkt, obj_scan)
+      if not obj.valid then
+        io.stderr:write(string.format("Bad %s packet, %d checksum errors\n",
+          obj.cmd, decoder:checksum_errors()))
+      elseif obj.status=='00' then
+        log_announce(log, obj, 'hokuyo_info')
+      else
+        log_announce(log, obj, channel)
+      end
+    end
+    return true
+  end
   repeat
     local status, obj = coroutine.resume(coro, data)
     data = nil
@@ -25,6 +25,31 @@ end
 
 local co_imu = coroutine.create(razor_imu.co_update)
 
+-- Optional attitude from the native UKF, updated on batches of samples
+local filter_ukf = flags.ukf and flags.ukf~=0
+                   and assert(require'kalman'.squkf, "No native UKF")()
+local UKF_BATCH = tonumber(flags.ukf_batch) or 10
+-- As run_slam.lua
+local gyroSensitivity = 131
+local vnew = require'vector'.new
+local vrad = require'vector'.rad
+local gyros, accels, dts = {}, {}, {}
+local t_last_imu
+local function filter_imu(obj)
+  if not (obj.timeM and obj.gyro and obj.accel) then return end
+  local dt_imu = tonumber(obj.timeM - (t_last_imu or obj.timeM)) / 1e3
+  t_last_imu = obj.timeM
+  if dt_imu <= 0 or dt_imu >= 0.20 then return end
+  table.insert(gyros, vrad(vnew(obj.gyro) / gyroSensitivity))
+  table.insert(accels, vnew(obj.accel))
+  table.insert(dts, dt_imu)
+  if #dts < UKF_BATCH then return end
+  local ret, err = filter_ukf:update_imu(gyros, accels, dts)
+  if not ret then io.stderr:write('UKF ', err, '\n') end
+  gyros, accels, dts = {}, {}, {}
+  obj.q_ukf = filter_ukf.orientation
+end
+
 local function on_imu(e)
   if e~=1 and f_imu then
     print("Reading", e)
@@ -45,6 +70,7 @@ local function on_imu(e)
     return
   end
   --]]
+  if filter_ukf and obj then filter_imu(obj) end
   log_announce(log, obj, "imu")
 end
 
@@ -4,21 +4,41 @@ local unpack = unpack or require'table'.unpack
 local racecar = require'racecar'
 racecar.init()
 local flags = racecar.parse_arg(arg)
-local log_announce = racecar.log_announce
+local announce = racecar.announce
 
 local transform = require'transform'
-local t0_us = require'unix'.time_us()
-local vector = require'vector'
+local time_us = require'unix'.time_us
+local fleetsim = require'fleetsim'
 
 local has_logger, logger = pcall(require, 'logger')
 local log = has_logger and flags.log ~= 0 and assert(logger.new('control', racecar.ROBOT_HOME.."/logs"))
 
 -- Simulation parameters
-math.randomseed(123)
+-- realtime: step at 60 Hz of the wall clock, as the vehicles would
+-- lockstep: step once every vehicle under run_control has its commands
+-- fast: step as fast as possible, every vehicle on a path, straight to log
+local mode = flags.mode or 'realtime'
 local dt_sim = 1 / 60
 local dt_ms = 1.0e3 / 60 -- ms loop: Try 60 Hz
-local dheading_max = math.rad(45) -- radians of front wheels
-local wheel_base = 0.325
+-- Seconds of simulated time to run in fast mode
+local duration = tonumber(flags.duration) or 60
+-- Lockstep: commands are due from run_control each period, in seconds, and
+-- we step anyway after a timeout, in milliseconds of the wall clock
+local control_period_us = 1e6 * (tonumber(flags.control_period) or 0.1)
+local lockstep_timeout_us = 1e3 * (tonumber(flags.lockstep_timeout) or 1000)
+-- Extra vehicles, following a path behind one another
+local n_extra = tonumber(flags.vehicles) or 0
+local spacing = tonumber(flags.spacing) or 1.0
+local speed = tonumber(flags.speed) or 0.5
+
+local t0_us = tonumber(time_us())
+local sim = assert(fleetsim.new{
+  dt = dt_sim,
+  t0_us = t0_us,
+  seed = tonumber(flags.seed) or 123,
+  capacity = n_extra + 1024,
+})
+local st = sim.state
 
 -- Start configurations - this is a JSON file
 local has_cjson, cjson = pcall(require, 'cjson')
@@ -31,33 +51,20 @@ else
   configuration = {}
 end
 
--- Input: pose
--- Output: vicon table
-local function pose2vicon(p)
-  -- Just on the z=0 plane
-  return {
-    rotation = {0, 0, p[3]},
-    translation = {1e3 * p[1], 1e3 * p[2], 0},
-  }
-end
-
--- Globally accessible variables
-local veh_states = {}
-
-local function new_state(state0)
-  -- Copy
-  local px, py, pa
-  if state0 and state0.pose then
-    px, py, pa = unpack(state0.pose)
-  else
-    px, py, pa = 0, 0, 0
+local function initial_pose(id_robot)
+  local config_initial = configuration["initialization"]
+  if type(config_initial)=='table' then
+    config_initial = config_initial[id_robot] or config_initial[""]
   end
-  return {
-    pose = {px, py, pa},
-    controls = {steering=0, velocity=0}
-  }
+  if type(config_initial)=='table' and config_initial.pose then
+    return {unpack(config_initial.pose)}
+  end
+  return {0, 0, 0}
 end
 
+-- Simulated time of the last commands of each vehicle under run_control
+local t_controls = {}
+
 --
 local function cb_debug(t_us, cnt)
 
@@ -67,119 +74,130 @@ local function cb_debug(t_us, cnt)
     viewBox = configuration.viewBox or {-2, -2, 8, 4},
     reference_vehicle = configuration.reference_vehicle
   }
-  racecar.announce("debug", info_debug, cnt)
+  announce("debug", info_debug, cnt)
   local info = {
-  string.format("Simulation time: %.2f", tonumber(t_us - t0_us)/1e6)
+  string.format("Simulation time: %.2f | %s", (sim:time_us() - t0_us)/1e6, tostring(sim))
   }
-  for id_rbt, state_rbt in pairs(veh_states) do
-    local px, py, pa = unpack(state_rbt.pose)
+  for i=0, math.min(st.n, 10) - 1 do
     table.insert(info,
-      string.format("Robot: %s | x=%.2fm, y=%.2fm, a=%.2f°",
-        id_rbt, px, py, math.deg(transform.mod_angle(pa)))
+      string.format("Robot: %s | x=%.2fm, y=%.2fm, a=%.2f°, %.2f m/s",
+        sim.names[i + 1], st.x[i], st.y[i],
+        math.deg(transform.mod_angle(st.a[i])), st.velocity[i])
     )
   end
+  if st.n > 10 then
+    table.insert(info, string.format("... and %d more", st.n - 10))
+  end
   return table.concat(info, "\n")
 end
 
-local function simulate_vehicle(state, dt)
-  local control_inp = state.controls
-  local steering = control_inp.steering
-  local velocity = control_inp.velocity
-  local pose_x, pose_y, pose_a = unpack(state.pose)
-  -- Kinematic model propagation
-  steering = math.min(math.max(-dheading_max, steering), dheading_max)
-  local dpose_a = (velocity * dt) / wheel_base * math.tan(steering)
-  local dpose_x, dpose_y = transform.rot2D(velocity * dt, 0, pose_a)
-  -- Give the new pose, deterministically
-  local pose_process = {
-    pose_x + dpose_x,
-    pose_y + dpose_y,
-    pose_a + dpose_a
-  }
-  -- Add noise to the process
-  -- Only if moving!
-  local use_noise = velocity > 0
-  local pose_noisy
-  if use_noise then
-    pose_noisy = vector.randn_pose(
-      {0.01 * dt, 0.01 * dt, math.rad(1) * dt},
-      pose_process)
-  else
-    pose_noisy = pose_process
+-- Path that the extra vehicles and, in fast mode, every vehicle follows
+local function use_paths(paths)
+  for name, my_path in pairs(paths) do
+    if not sim.paths[name] then assert(sim:add_path(name, my_path)) end
   end
-  return {
-    pose = pose_noisy,
-    controls = control_inp
-  }
+  local pathname = flags.path or next(paths)
+  local my_path = paths[pathname]
+  if not my_path then return false, "No such path" end
+  -- Spread the extra vehicles along the path, spacing meters apart
+  local points = my_path.points
+  local k, s = 1, 0
+  for i=0, n_extra - 1 do
+    while k < #points and s < i * spacing do
+      local dx = points[k + 1][1] - points[k][1]
+      local dy = points[k + 1][2] - points[k][2]
+      s = s + math.sqrt(dx * dx + dy * dy)
+      k = k + 1
+    end
+    local p = points[k]
+    local name = string.format("sim%03d", i)
+    if not sim.ids[name] then
+      assert(sim:add(name, {p[1], p[2], p[3] or 0}))
+      assert(sim:follow(name, pathname, speed))
+    end
+  end
+  -- Every vehicle, when no one else is driving
+  if mode == 'fast' then
+    for name, i in pairs(sim.ids) do
+      if st.path[i] < 0 then assert(sim:follow(name, pathname, speed)) end
+    end
+  end
+  return true
 end
 
 local function cb_control(inp, ch, t_us)
   local id_robot = inp.id
   if not id_robot then return false, "No ID to simulate" end
   -- Add this car
-  -- TODO: Smarter way to initialize the state?
   -- TODO: Maybe randomly select until the pose is collision free, w.r.t to other poses?
-  local state_robot = veh_states[id_robot]
-  if not state_robot then
+  if not sim.ids[id_robot] then
     -- Special start state, based on the name
-    local config_initial = configuration["initialization"]
-    if type(config_initial)=='table' then
-      config_initial = config_initial[id_robot] or config_initial[""]
-    end
-    state_robot = new_state(config_initial)
-    veh_states[id_robot] = state_robot
+    assert(sim:add(id_robot, initial_pose(id_robot)))
   end
-  -- TODO: Break out the steering, etc.
-  state_robot.controls = inp
-  -- Control the steering, this way
-  -- local steering_pid = has_control and control.pid{
-  --   r = 0
-  -- }
+  -- Vehicles that we drive ourselves ignore run_control
+  if st.path[sim.ids[id_robot]] >= 0 then return end
+  sim:command(id_robot, tonumber(inp.steering) or 0, tonumber(inp.velocity) or 0)
+  t_controls[id_robot] = sim:time_us()
+end
+
+local function cb_plan(msg)
+  if type(msg.paths)=='table' then use_paths(msg.paths) end
 end
 
 --------------------------
--- Update the pure pursuit
+-- Step the fleet, then publish the clock and what vicon would see
 local count_frame = 0
--- local t_last_us
-local function cb_loop(t_us)
-  local msg_vicon = {
-    frame = count_frame
-  }
-  -- Simulate and publish this timestep
-  local dt_us = t_us - (t_last_us or t_us)
-  t_last_us = t_us
-  local dt = tonumber(dt_us) / 1e6
-  local dt_diff = dt - dt_sim
+local function step()
+  sim:step(1)
   count_frame = count_frame + 1
-  for id_rbt, state_now in pairs(veh_states) do
-    -- Simulate a timestep
-    local state_new = simulate_vehicle(state_now, dt_sim)
-    -- Update the internal state
-    veh_states[id_rbt] = state_new
-    -- Give noisy measurements
-    local pose_noisy = vector.randn_pose(
-      {0.01 * dt_sim, 0.01 * dt_sim, math.rad(1) * dt_sim},
-      state_new.pose)
-    -- Set the publishing message
-    msg_vicon[id_rbt] = pose2vicon(pose_noisy)
+  local t_us = sim:time_us()
+  local str_vicon = assert(sim:vicon(count_frame))
+  if log then log:write_raw(str_vicon, "vicon", t_us) end
+  if mode ~= 'fast' then
+    announce("clock", {t_us = t_us})
+    announce("vicon", str_vicon)
+  end
+end
+
+local function cb_loop(t_us)
+  step()
+end
+
+-- Wait on the vehicles under run_control to catch up, to at most a timeout.
+-- Only vehicles that have sent controls are waited on, so those without a
+-- run_control do not hold every step to the timeout
+local t_step_us = 0
+local function cb_lockstep(t_us)
+  local t_now = time_us()
+  local t_sim = sim:time_us()
+  local is_ready = true
+  for name, i in pairs(sim.ids) do
+    local t_control = t_controls[name]
+    if st.path[i] < 0 and t_control and t_sim - t_control > control_period_us then
+      is_ready = false
+      break
+    end
+  end
+  if is_ready or tonumber(t_now - t_step_us) > lockstep_timeout_us then
+    t_step_us = t_now
+    step()
   end
-  -- Publish or return the vicon message
-  log_announce(log, msg_vicon, "vicon")
 end
--- Update the pure pursuit
+-- Step the fleet
 --------------------------
 
 local cb_tbl = {
   control = cb_control,
+  planner = cb_plan,
 }
 
 local function entry()
   -- Special start state, based on the name
   local config_initial = configuration["initialization"]
   if type(config_initial)=='table' then
-    for id_robot, state0 in pairs(config_initial) do
+    for id_robot in pairs(config_initial) do
       if #id_robot > 0 then
-        veh_states[id_robot] = new_state(state0)
+        assert(sim:add(id_robot, initial_pose(id_robot)))
       end
     end
   end
@@ -192,10 +210,40 @@ end
 -- racecar.handle_shutdown(exit)
 
 entry()
-racecar.listen{
-  channel_callbacks = cb_tbl,
-  loop_rate = dt_ms,
-  fn_loop = cb_loop,
-  fn_debug = cb_debug
-}
+if mode == 'fast' then
+  -- Paths from a log of run_planner
+  assert(has_logger, logger)
+  assert(type(flags.plan)=='string', "Need a planner log: --plan file.lmp")
+  local co_play = assert(logger.open(flags.plan):play())
+  while coroutine.status(co_play)=='suspended' do
+    local ok, str, ch = coroutine.resume(co_play)
+    if not ok or not str then break end
+    if ch == 'planner' then
+      cb_plan(assert(logger.decode(str)))
+      break
+    end
+  end
+  assert(next(sim.paths), "No paths in the planner log")
+  local n_steps = math.ceil(duration / dt_sim)
+  local t0 = time_us()
+  for _=1, n_steps do step() end
+  local dt_wall = tonumber(time_us() - t0) / 1e6
+  print(string.format("%d vehicles, %.1f s simulated in %.2f s, %.0fx real time",
+    st.n, duration, dt_wall, duration / dt_wall))
+elseif mode == 'lockstep' then
+  racecar.listen{
+    channel_callbacks = cb_tbl,
+    clock = function() return sim:time_us() end,
+    loop_rate = 0,
+    fn_loop = cb_lockstep,
+    fn_debug = cb_debug
+  }
+else
+  racecar.listen{
+    channel_callbacks = cb_tbl,
+    loop_rate = dt_ms,
+    fn_loop = cb_loop,
+    fn_debug = cb_debug
+  }
+end
 exit()
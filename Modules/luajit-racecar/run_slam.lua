@@ -33,7 +33,8 @@ local filter_slam = slam.new({
   ymax = 10,
   scale = 0.025,
 })
-local filter_ukf = kalman.ukf()
+-- The native filter, if built, has the same methods
+local filter_ukf = (kalman.squkf or kalman.ukf)()
 
 -- callbacks
 local cb_tbl = setmetatable({}, {
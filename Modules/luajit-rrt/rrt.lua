@@ -1,7 +1,54 @@
 -- Rapidly-exploring Random Trees
 local lib = {}
+local ffi = require'ffi'
 local kdtree = require'kdtree'
 local has_dubins, dubins = pcall(require, 'dubins')
+ffi.cdef[[
+typedef struct {
+  double intervals[3][2];
+  double turning_radius;
+  double discretization_step;
+  double bias_threshold;
+  double goal_perturbation;
+  double eps_rewire;
+  double gamma;
+  double goal_distance;
+  double goal_angle;
+  double circles[64][3];
+  int n_circles;
+  const void *costmap;
+  int costmap_type;
+  int m, n;
+  double xmin, ymin, scale;
+  double cost_threshold;
+  int max_vertices;
+  int max_neighbors;
+  double cell_size;
+  uint64_t seed;
+} RRTParameters;
+typedef struct {
+  double q[3];
+  double cost_from_root;
+  double cost_from_parent;
+  int32_t parent;
+  int32_t next;
+} RRTVertex;
+struct rrts;
+void rrts_default_parameters(RRTParameters *params);
+struct rrts *rrts_create(const RRTParameters *params);
+void rrts_free(struct rrts *planner);
+int rrts_plan(struct rrts *planner, const double start[3],
+              const double goal[3]);
+int rrts_iterate(struct rrts *planner, int n_iterations);
+int rrts_start(struct rrts *planner, int n_threads);
+int rrts_stop(struct rrts *planner);
+int64_t rrts_iterations(const struct rrts *planner);
+int rrts_size(const struct rrts *planner);
+const RRTVertex *rrts_vertices(const struct rrts *planner);
+double rrts_cost(const struct rrts *planner);
+int rrts_trace(struct rrts *planner, double *xya, int max_points);
+]]
+local has_rrtstar, rrtstar = pcall(ffi.load, 'rrtstar')
 local unpack = unpack or require'table'.unpack
 local systems = {}
 
@@ -235,15 +282,21 @@ local function iterate(self)
   local numVertices = self.kd:size()
   -- // 3.b Extend the best parent within the near vertices
   local r = get_ball_radius(numVertices, self.nDim)
-  local nearby = self.kd:nearest(stateRandom, r)
-  local within_ball = type(nearby) == 'table'
+  -- Query into the reusable buffers, rather than a new table of tables
+  local n_nearby = self.kd:nearest_into(stateRandom, self.MAX_NEIGHBORS, r,
+    self.ptr_nearby_id, self.ptr_nearby_dist_sq)
+  local within_ball = n_nearby > 0
   -- // 3.a Extend the nearest
-  nearby = within_ball and nearby or self.kd:nearest(stateRandom)
+  if not within_ball then
+    n_nearby = self.kd:nearest_into(stateRandom, 1, nil,
+      self.ptr_nearby_id, self.ptr_nearby_dist_sq)
+  end
   -- Link the kd-tree output the node variables
-  for i=1,#nearby do
-    local id = nearby[i].user
-    nearby[i] = self.tree[id]
+  local nearby = self.nearby
+  for i=1,n_nearby do
+    nearby[i] = self.tree[tonumber(self.nearby_id[i - 1])]
   end
+  for i=#nearby,n_nearby+1,-1 do nearby[i] = nil end
   -- // 3. Find the best parent and extend from that parent
   local candidate, err = findBestCandidate(self, stateRandom, nearby)
   if not candidate then return false, err end
@@ -335,6 +388,10 @@ function lib.new(parameters)
     table.insert(centers, (a + b)/2)
     table.insert(ranges, b - a)
   end
+  -- Neighbor query results, reused each iteration
+  local MAX_NEIGHBORS = tonumber(parameters.MAX_NEIGHBORS) or 64
+  local nearby_id = ffi.new('int64_t[?]', MAX_NEIGHBORS)
+  local nearby_dist_sq = ffi.new('double[?]', MAX_NEIGHBORS)
   -- Rapidly-exploring Random Tree
   -- List of the vertices. Don't touch ;)
   -- Hash table of methods and properties
@@ -351,6 +408,11 @@ function lib.new(parameters)
     lowerBoundCost = math.huge,
     -- k-d tree for fast lookup
     kd = kdtree.create(nDim),
+    nearby = {},
+    nearby_id = nearby_id,
+    nearby_dist_sq = nearby_dist_sq,
+    ptr_nearby_id = tonumber(ffi.cast('intptr_t', ffi.cast('void *', nearby_id))),
+    ptr_nearby_dist_sq = tonumber(ffi.cast('intptr_t', ffi.cast('void *', nearby_dist_sq))),
     -- Plan from start to goal
     plan = plan,
     -- Iterate the plan,
@@ -362,6 +424,8 @@ function lib.new(parameters)
     -- TODO: Units...?
     DISCRETIZATION_STEP = tonumber(parameters.DISCRETIZATION_STEP) or 0.005,
     EPS_REWIRE = 0.001, --0, --0.001
+    -- Closest neighbors within the ball to consider
+    MAX_NEIGHBORS = MAX_NEIGHBORS,
   }
   obj:set_system(systems.default())
 
@@ -369,6 +433,138 @@ function lib.new(parameters)
   return obj
 end
 
+-- Native RRT* with Dubins steering
+local function plan_native(self, start, goal)
+  -- The planner copies the start, so keep the start method unshadowed
+  local q_start = ffi.new('double[3]', start)
+  self.goal = ffi.new('double[3]', goal)
+  if rrtstar.rrts_plan(self.planner, q_start, self.goal) < 0 then
+    return false, "Bad plan"
+  end
+  self.lowerBoundCost = math.huge
+  return self
+end
+
+local function iterate_native(self, n_iterations)
+  local n_added = rrtstar.rrts_iterate(self.planner, n_iterations or 1)
+  self.lowerBoundCost = rrtstar.rrts_cost(self.planner)
+  return n_added
+end
+
+local function trace_native(self)
+  local cost = rrtstar.rrts_cost(self.planner)
+  if cost == math.huge then return false, "No path" end
+  -- Room for every step along the path, plus the partial step per vertex
+  local max_points = math.ceil(cost / self.DISCRETIZATION_STEP)
+    + rrtstar.rrts_size(self.planner) + 1
+  local xya = ffi.new('double[?]', 3 * max_points)
+  local n = rrtstar.rrts_trace(self.planner, xya, max_points)
+  -- Workers may have found a longer path meanwhile, so trace it with room
+  while n > max_points do
+    max_points = n
+    xya = ffi.new('double[?]', 3 * max_points)
+    n = rrtstar.rrts_trace(self.planner, xya, max_points)
+  end
+  if n < 0 then return false, "No path" end
+  local path_xy = {}
+  for i=0,n-1 do
+    path_xy[i+1] = {xya[3*i], xya[3*i+1], xya[3*i+2]}
+  end
+  return path_xy, cost
+end
+
+local function size_native(self)
+  return rrtstar.rrts_size(self.planner)
+end
+
+-- Anytime planning: grow the tree on worker threads, while the best path
+-- so far is available from trace and cost
+local function start_native(self, n_threads)
+  local n = rrtstar.rrts_start(self.planner, n_threads or 1)
+  if n < 0 then return false, "Cannot start" end
+  return n
+end
+
+local function stop_native(self)
+  rrtstar.rrts_stop(self.planner)
+  self.lowerBoundCost = rrtstar.rrts_cost(self.planner)
+  return self
+end
+
+local function cost_native(self)
+  self.lowerBoundCost = rrtstar.rrts_cost(self.planner)
+  return self.lowerBoundCost
+end
+
+local function iterations_native(self)
+  return tonumber(rrtstar.rrts_iterations(self.planner))
+end
+
+-- Same parameters as lib.new and systems.dubins, all in one table.
+-- costmap: optional luajit-grid object, with cells above COST_THRESHOLD
+-- in collision
+function lib.new_native(parameters)
+  if not has_rrtstar then
+    return false, rrtstar
+  end
+  local params = ffi.new'RRTParameters'
+  rrtstar.rrts_default_parameters(params)
+  for i, interval in ipairs(parameters.intervals) do
+    params.intervals[i-1][0], params.intervals[i-1][1] = unpack(interval)
+  end
+  params.turning_radius = tonumber(parameters.TURNING_RADIUS)
+    or params.turning_radius
+  params.discretization_step = tonumber(parameters.DISCRETIZATION_STEP)
+    or params.discretization_step
+  params.bias_threshold = tonumber(parameters.BIAS_THRESHOLD)
+    or params.bias_threshold
+  params.goal_perturbation = tonumber(parameters.GOAL_PERTURBATION)
+    or params.goal_perturbation
+  params.eps_rewire = tonumber(parameters.EPS_REWIRE) or params.eps_rewire
+  params.gamma = tonumber(parameters.GAMMA) or params.gamma
+  params.max_vertices = tonumber(parameters.MAX_VERTICES)
+    or params.max_vertices
+  params.max_neighbors = tonumber(parameters.MAX_NEIGHBORS)
+    or params.max_neighbors
+  params.cell_size = tonumber(parameters.CELL_SIZE) or params.cell_size
+  params.seed = tonumber(parameters.seed) or params.seed
+  -- circular_obstacles: {{x_center, y_center, radius}, ...}
+  local obs_circles = parameters.circular_obstacles or {}
+  if #obs_circles > 64 then return false, "Too many obstacles" end
+  for i, obs in ipairs(obs_circles) do
+    params.circles[i-1][0], params.circles[i-1][1], params.circles[i-1][2] =
+      unpack(obs)
+  end
+  params.n_circles = #obs_circles
+  local costmap = parameters.costmap
+  if costmap then
+    params.costmap = costmap.grid
+    params.costmap_type = costmap.datatype == 'double' and 2 or 1
+    params.m, params.n = costmap.m, costmap.n
+    params.xmin, params.ymin = costmap.xmin, costmap.ymin
+    params.scale = costmap.scale
+    params.cost_threshold = tonumber(parameters.COST_THRESHOLD)
+      or params.cost_threshold
+  end
+  local planner = rrtstar.rrts_create(params)
+  if planner == nil then return false, "Bad parameters" end
+  ffi.gc(planner, rrtstar.rrts_free)
+  return {
+    planner = planner,
+    -- Keep the costmap memory alive
+    costmap = costmap,
+    DISCRETIZATION_STEP = params.discretization_step,
+    lowerBoundCost = math.huge,
+    plan = plan_native,
+    iterate = iterate_native,
+    trace = trace_native,
+    size = size_native,
+    start = start_native,
+    stop = stop_native,
+    cost = cost_native,
+    iterations = iterations_native,
+  }
+end
 
 function systems.dubins(parameters)
   if not has_dubins then
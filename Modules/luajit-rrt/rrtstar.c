@@ -0,0 +1,843 @@
+/*
+Native RRT* core with Dubins steering
+Follows rrt.lua: sample, find the best parent among neighbors, then rewire
+*/
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dubins.h"
+#include "rrtstar.h"
+
+#define MAX_SAMPLE_TRIES 100
+/* Iterations counted locally before adding to the shared total */
+#define ITERATIONS_PER_COUNT 64
+
+typedef struct {
+  int32_t id;
+  double cost_from_root;
+  double cost_from_parent;
+  DubinsPath path;
+} RRTCandidate;
+
+/* Sampling state and per-iteration scratch, sized by max_neighbors */
+struct rrts_worker {
+  struct rrts *planner;
+  pthread_t thread;
+  uint64_t rng;
+  int32_t *neighbors;
+  double *neighbors_dist_sq;
+  RRTCandidate *candidates;
+  int *order;
+};
+
+/*
+Workers share one tree. Vertex ids are reserved atomically and a vertex is
+published by linking it into its grid cell, after which its state and cell
+link never change, so the grid is read without locks. Cell inserts lock a
+stripe by cell. The parent and cost of a vertex change on rewires, so they
+are read and written under a stripe lock by vertex, and rewires also hold
+tree_lock for reading, so that tracing can hold it to see a whole chain at
+once. The best cost is read atomically and updated together with the goal
+parent under best_lock. No thread holds two of these locks, except tracing,
+which takes best_lock and then tree_lock.
+*/
+struct rrts {
+  RRTParameters params;
+  /* Vertex arena */
+  RRTVertex *vertices;
+  int n_vertices;
+  /* Uniform grid of vertex lists over (x, y) */
+  int32_t *cells;
+  int cells_x, cells_y;
+  double cell_inv;
+  pthread_mutex_t cell_locks[RRTS_LOCK_STRIPES];
+  pthread_mutex_t vertex_locks[RRTS_LOCK_STRIPES];
+  pthread_rwlock_t tree_lock;
+  /* Workers, where the first also serves rrts_iterate */
+  struct rrts_worker *workers[RRTS_MAX_THREADS];
+  int n_threads;
+  int running;
+  int64_t n_iterations;
+  /* Trace scratch, sized by max_vertices */
+  int32_t *chain;
+  /* Problem */
+  double start[3], goal[3];
+  pthread_mutex_t best_lock;
+  int32_t goal_parent;
+  int goal_exact;
+  double lower_bound_cost;
+};
+
+/* xorshift64* for repeatable sampling */
+static double rand_uniform(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+  return ((x * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double get_bound(const struct rrts *planner) {
+  double cost;
+  __atomic_load(&planner->lower_bound_cost, &cost, __ATOMIC_ACQUIRE);
+  return cost;
+}
+
+static void set_bound(struct rrts *planner, double cost) {
+  __atomic_store(&planner->lower_bound_cost, &cost, __ATOMIC_RELEASE);
+}
+
+static int get_size(const struct rrts *planner) {
+  int n = __atomic_load_n(&planner->n_vertices, __ATOMIC_ACQUIRE);
+  return n < planner->params.max_vertices ? n : planner->params.max_vertices;
+}
+
+/* Cost from the root, which rewires lower */
+static double vertex_cost(struct rrts *planner, int32_t id) {
+  pthread_mutex_t *lock = planner->vertex_locks + id % RRTS_LOCK_STRIPES;
+  double cost;
+  pthread_mutex_lock(lock);
+  cost = planner->vertices[id].cost_from_root;
+  pthread_mutex_unlock(lock);
+  return cost;
+}
+
+static double mod_angle(double a) {
+  a = fmod(a + M_PI, 2 * M_PI);
+  return a < 0 ? a + M_PI : a - M_PI;
+}
+
+void rrts_default_parameters(RRTParameters *params) {
+  int i;
+  memset(params, 0, sizeof(RRTParameters));
+  for (i = 0; i < 2; i++) {
+    params->intervals[i][0] = -1;
+    params->intervals[i][1] = 1;
+  }
+  params->intervals[2][0] = 0;
+  params->intervals[2][1] = 2 * M_PI;
+  params->turning_radius = 1;
+  params->discretization_step = 0.005;
+  params->bias_threshold = 0.1;
+  params->goal_perturbation = 0.1;
+  params->eps_rewire = 0.001;
+  params->gamma = 1;
+  params->goal_distance = 0.25;
+  params->goal_angle = 10 * M_PI / 180;
+  params->costmap_type = RRTS_COSTMAP_NONE;
+  params->cost_threshold = 127;
+  params->max_vertices = 1 << 20;
+  params->max_neighbors = 64;
+  params->cell_size = 0;
+  params->seed = 1;
+}
+
+static int is_collision(const struct rrts *planner, const double q[3]) {
+  const RRTParameters *p = &planner->params;
+  int i;
+  for (i = 0; i < 2; i++) {
+    if (q[i] < p->intervals[i][0] || q[i] > p->intervals[i][1]) {
+      return 1;
+    }
+  }
+  for (i = 0; i < p->n_circles; i++) {
+    double dx = q[0] - p->circles[i][0];
+    double dy = q[1] - p->circles[i][1];
+    if (dx * dx + dy * dy < p->circles[i][2] * p->circles[i][2]) {
+      return 1;
+    }
+  }
+  if (p->costmap) {
+    /* Same indexing as luajit-grid: x maps to j, y maps to i */
+    int j = floor((q[0] - p->xmin) / p->scale);
+    int ii = floor((q[1] - p->ymin) / p->scale);
+    double v;
+    if (ii < 0 || ii >= p->m || j < 0 || j >= p->n) {
+      return 1;
+    }
+    switch (p->costmap_type) {
+    case RRTS_COSTMAP_UINT8:
+      v = ((const uint8_t *)p->costmap)[j * p->m + ii];
+      break;
+    case RRTS_COSTMAP_DOUBLE:
+      v = ((const double *)p->costmap)[j * p->m + ii];
+      break;
+    default:
+      v = 0;
+    }
+    if (v > p->cost_threshold) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Walk along the path and check each discretization step */
+static int is_path_free(const struct rrts *planner, DubinsPath *path,
+                        double length) {
+  double q[3], t;
+  for (t = 0; t < length; t += planner->params.discretization_step) {
+    dubins_path_sample(path, t, q);
+    if (is_collision(planner, q)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int cell_x(const struct rrts *planner, double x) {
+  int cx = floor((x - planner->params.intervals[0][0]) * planner->cell_inv);
+  return cx < 0 ? 0 : (cx >= planner->cells_x ? planner->cells_x - 1 : cx);
+}
+
+static int cell_y(const struct rrts *planner, double y) {
+  int cy = floor((y - planner->params.intervals[1][0]) * planner->cell_inv);
+  return cy < 0 ? 0 : (cy >= planner->cells_y ? planner->cells_y - 1 : cy);
+}
+
+static void worker_free(struct rrts_worker *worker) {
+  if (!worker) {
+    return;
+  }
+  free(worker->neighbors);
+  free(worker->neighbors_dist_sq);
+  free(worker->candidates);
+  free(worker->order);
+  free(worker);
+}
+
+static struct rrts_worker *worker_create(struct rrts *planner, int index) {
+  int n_neighbors = planner->params.max_neighbors;
+  struct rrts_worker *worker = calloc(1, sizeof(struct rrts_worker));
+  if (!worker) {
+    return NULL;
+  }
+  worker->planner = planner;
+  /* Distinct, repeatable streams per worker */
+  worker->rng = (planner->params.seed ? planner->params.seed : 1) +
+                index * 0x9E3779B97F4A7C15ULL;
+  worker->neighbors = malloc(n_neighbors * sizeof(int32_t));
+  worker->neighbors_dist_sq = malloc(n_neighbors * sizeof(double));
+  worker->candidates = malloc(n_neighbors * sizeof(RRTCandidate));
+  worker->order = malloc(n_neighbors * sizeof(int));
+  if (!worker->neighbors || !worker->neighbors_dist_sq ||
+      !worker->candidates || !worker->order) {
+    worker_free(worker);
+    return NULL;
+  }
+  return worker;
+}
+
+struct rrts *rrts_create(const RRTParameters *params) {
+  struct rrts *planner;
+  double range_x, range_y;
+  int i;
+
+  if (!params || params->max_vertices <= 0 || params->max_neighbors <= 0 ||
+      params->discretization_step <= 0 || params->turning_radius <= 0) {
+    return NULL;
+  }
+  if (!(planner = calloc(1, sizeof(struct rrts)))) {
+    return NULL;
+  }
+  planner->params = *params;
+  if (planner->params.n_circles > RRTS_MAX_CIRCLES) {
+    planner->params.n_circles = RRTS_MAX_CIRCLES;
+  }
+
+  range_x = params->intervals[0][1] - params->intervals[0][0];
+  range_y = params->intervals[1][1] - params->intervals[1][0];
+  if (planner->params.cell_size <= 0) {
+    planner->params.cell_size = fmax(range_x, range_y) / 128;
+  }
+  planner->cell_inv = 1 / planner->params.cell_size;
+  planner->cells_x = ceil(range_x * planner->cell_inv) + 1;
+  planner->cells_y = ceil(range_y * planner->cell_inv) + 1;
+
+  for (i = 0; i < RRTS_LOCK_STRIPES; i++) {
+    pthread_mutex_init(planner->cell_locks + i, NULL);
+    pthread_mutex_init(planner->vertex_locks + i, NULL);
+  }
+  pthread_mutex_init(&planner->best_lock, NULL);
+  pthread_rwlock_init(&planner->tree_lock, NULL);
+
+  planner->vertices = malloc(params->max_vertices * sizeof(RRTVertex));
+  planner->chain = malloc(params->max_vertices * sizeof(int32_t));
+  planner->cells =
+      malloc(planner->cells_x * planner->cells_y * sizeof(int32_t));
+  planner->workers[0] = worker_create(planner, 0);
+  if (!planner->vertices || !planner->chain || !planner->cells ||
+      !planner->workers[0]) {
+    rrts_free(planner);
+    return NULL;
+  }
+  planner->goal_parent = -1;
+  planner->lower_bound_cost = INFINITY;
+  return planner;
+}
+
+void rrts_free(struct rrts *planner) {
+  int i;
+  if (!planner) {
+    return;
+  }
+  rrts_stop(planner);
+  for (i = 0; i < RRTS_LOCK_STRIPES; i++) {
+    pthread_mutex_destroy(planner->cell_locks + i);
+    pthread_mutex_destroy(planner->vertex_locks + i);
+  }
+  pthread_mutex_destroy(&planner->best_lock);
+  pthread_rwlock_destroy(&planner->tree_lock);
+  for (i = 0; i < RRTS_MAX_THREADS; i++) {
+    worker_free(planner->workers[i]);
+  }
+  free(planner->vertices);
+  free(planner->chain);
+  free(planner->cells);
+  free(planner);
+}
+
+static int32_t add_vertex(struct rrts *planner, const double q[3],
+                          int32_t parent, double cost_from_root,
+                          double cost_from_parent) {
+  int32_t id, cell;
+  RRTVertex *v;
+  pthread_mutex_t *lock;
+  if (get_size(planner) >= planner->params.max_vertices) {
+    return -1;
+  }
+  id = __atomic_fetch_add(&planner->n_vertices, 1, __ATOMIC_ACQ_REL);
+  if (id >= planner->params.max_vertices) {
+    return -1;
+  }
+  v = planner->vertices + id;
+  memcpy(v->q, q, sizeof(v->q));
+  v->parent = parent;
+  v->cost_from_root = cost_from_root;
+  v->cost_from_parent = cost_from_parent;
+  /* Publish: the vertex is complete before it is reachable from its cell */
+  cell = cell_y(planner, q[1]) * planner->cells_x + cell_x(planner, q[0]);
+  lock = planner->cell_locks + cell % RRTS_LOCK_STRIPES;
+  pthread_mutex_lock(lock);
+  v->next = planner->cells[cell];
+  __atomic_store_n(planner->cells + cell, id, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(lock);
+  return id;
+}
+
+int rrts_plan(struct rrts *planner, const double start[3],
+              const double goal[3]) {
+  int i;
+  if (!planner || planner->n_threads > 0) {
+    return -1;
+  }
+  for (i = 0; i < planner->cells_x * planner->cells_y; i++) {
+    planner->cells[i] = -1;
+  }
+  planner->n_vertices = 0;
+  memcpy(planner->start, start, sizeof(planner->start));
+  memcpy(planner->goal, goal, sizeof(planner->goal));
+  planner->goal_parent = -1;
+  planner->goal_exact = 0;
+  planner->lower_bound_cost = INFINITY;
+  planner->n_iterations = 0;
+  return add_vertex(planner, start, -1, 0, 0);
+}
+
+static void sample(struct rrts_worker *worker, double q[3]) {
+  const struct rrts *planner = worker->planner;
+  const RRTParameters *p = &planner->params;
+  int i;
+  if (rand_uniform(&worker->rng) < p->bias_threshold) {
+    for (i = 0; i < 3; i++) {
+      double perturbation =
+          (2 * rand_uniform(&worker->rng) - 1) * p->goal_perturbation;
+      q[i] = fmax(p->intervals[i][0],
+                  fmin(p->intervals[i][1], planner->goal[i] + perturbation));
+    }
+  } else {
+    for (i = 0; i < 3; i++) {
+      q[i] = p->intervals[i][0] + rand_uniform(&worker->rng) *
+                                      (p->intervals[i][1] - p->intervals[i][0]);
+    }
+  }
+}
+
+/* Max heap of neighbors by distance, with the furthest first */
+static void heap_up(int32_t *ids, double *d_sq, int i) {
+  int32_t id = ids[i];
+  double d = d_sq[i];
+  while (i > 0 && d_sq[(i - 1) / 2] < d) {
+    ids[i] = ids[(i - 1) / 2];
+    d_sq[i] = d_sq[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  ids[i] = id;
+  d_sq[i] = d;
+}
+
+static void heap_down(int32_t *ids, double *d_sq, int n) {
+  int32_t id = ids[0];
+  double d = d_sq[0];
+  int i = 0, child;
+  while ((child = 2 * i + 1) < n) {
+    if (child + 1 < n && d_sq[child + 1] > d_sq[child]) {
+      child++;
+    }
+    if (d_sq[child] <= d) {
+      break;
+    }
+    ids[i] = ids[child];
+    d_sq[i] = d_sq[child];
+    i = child;
+  }
+  ids[i] = id;
+  d_sq[i] = d;
+}
+
+/* Vertices within radius r in (x, y), keeping the closest max_neighbors.
+ * Cells are searched in rings outward, until the kept ones are all closer
+ * than the next ring
+ */
+static int near_vertices(struct rrts_worker *worker, const double q[3],
+                         double r) {
+  const struct rrts *planner = worker->planner;
+  const int cap = planner->params.max_neighbors;
+  int32_t *ids = worker->neighbors;
+  double *dists_sq = worker->neighbors_dist_sq;
+  int cx0 = cell_x(planner, q[0] - r), cx1 = cell_x(planner, q[0] + r);
+  int cy0 = cell_y(planner, q[1] - r), cy1 = cell_y(planner, q[1] + r);
+  int cxq = cell_x(planner, q[0]), cyq = cell_y(planner, q[1]);
+  int ring, max_ring, cx, cy, step, n_near = 0;
+  double r_sq = r * r, reach;
+  int32_t id;
+  max_ring = cxq - cx0;
+  if (cx1 - cxq > max_ring) max_ring = cx1 - cxq;
+  if (cyq - cy0 > max_ring) max_ring = cyq - cy0;
+  if (cy1 - cyq > max_ring) max_ring = cy1 - cyq;
+  for (ring = 0; ring <= max_ring; ring++) {
+    for (cy = cyq - ring; cy <= cyq + ring; cy++) {
+      if (cy < cy0 || cy > cy1) {
+        continue;
+      }
+      /* Only the border of the ring */
+      step = (cy == cyq - ring || cy == cyq + ring) ? 1 : 2 * ring;
+      for (cx = cxq - ring; cx <= cxq + ring; cx += step) {
+        if (cx < cx0 || cx > cx1) {
+          continue;
+        }
+        for (id = __atomic_load_n(planner->cells + cy * planner->cells_x + cx,
+                                  __ATOMIC_ACQUIRE);
+             id >= 0; id = planner->vertices[id].next) {
+          const RRTVertex *v = planner->vertices + id;
+          double dx = v->q[0] - q[0], dy = v->q[1] - q[1];
+          double d_sq = dx * dx + dy * dy;
+          if (d_sq > r_sq) {
+            continue;
+          }
+          if (n_near < cap) {
+            ids[n_near] = id;
+            dists_sq[n_near] = d_sq;
+            heap_up(ids, dists_sq, n_near++);
+          } else if (d_sq < dists_sq[0]) {
+            /* Full: replace the furthest */
+            ids[0] = id;
+            dists_sq[0] = d_sq;
+            heap_down(ids, dists_sq, cap);
+          }
+        }
+      }
+    }
+    /* Anything in the next ring is at least this far away */
+    reach = ring * planner->params.cell_size;
+    if (n_near == cap && dists_sq[0] <= reach * reach) {
+      break;
+    }
+  }
+  return n_near;
+}
+
+/* Search rings of cells outward until nothing closer can remain */
+static int32_t nearest_vertex(const struct rrts *planner, const double q[3]) {
+  int cx0 = cell_x(planner, q[0]), cy0 = cell_y(planner, q[1]);
+  int ring, cx, cy, step, max_ring = planner->cells_x > planner->cells_y
+                                         ? planner->cells_x
+                                         : planner->cells_y;
+  int32_t id, best = -1;
+  double best_sq = INFINITY, reach;
+  for (ring = 0; ring <= max_ring; ring++) {
+    for (cy = cy0 - ring; cy <= cy0 + ring; cy++) {
+      if (cy < 0 || cy >= planner->cells_y) {
+        continue;
+      }
+      /* Only the border of the ring */
+      step = (cy == cy0 - ring || cy == cy0 + ring) ? 1 : 2 * ring;
+      for (cx = cx0 - ring; cx <= cx0 + ring; cx += step) {
+        if (cx < 0 || cx >= planner->cells_x) {
+          continue;
+        }
+        for (id = __atomic_load_n(planner->cells + cy * planner->cells_x + cx,
+                                  __ATOMIC_ACQUIRE);
+             id >= 0; id = planner->vertices[id].next) {
+          const RRTVertex *v = planner->vertices + id;
+          double dx = v->q[0] - q[0], dy = v->q[1] - q[1];
+          double d_sq = dx * dx + dy * dy;
+          if (d_sq < best_sq) {
+            best_sq = d_sq;
+            best = id;
+          }
+        }
+      }
+    }
+    /* Anything in the next ring is at least this far away */
+    reach = ring * planner->params.cell_size;
+    if (best >= 0 && best_sq <= reach * reach) {
+      break;
+    }
+  }
+  return best;
+}
+
+/* Another worker may have found a better path meanwhile */
+static void set_goal(struct rrts *planner, int32_t id, double cost,
+                     int exact) {
+  pthread_mutex_lock(&planner->best_lock);
+  if (cost < planner->lower_bound_cost) {
+    planner->goal_parent = id;
+    planner->goal_exact = exact;
+    set_bound(planner, cost);
+  }
+  pthread_mutex_unlock(&planner->best_lock);
+}
+
+/* Check if the vertex reaches the goal more cheaply than the best path */
+static void check_goal(struct rrts *planner, int32_t id) {
+  const RRTParameters *p = &planner->params;
+  const RRTVertex *v = planner->vertices + id;
+  const double cost_v = vertex_cost(planner, id);
+  double dx = planner->goal[0] - v->q[0], dy = planner->goal[1] - v->q[1];
+  double d_xy = sqrt(dx * dx + dy * dy), length;
+  DubinsPath path;
+  /* The Dubins length is never shorter than the straight line */
+  if (cost_v + d_xy >= get_bound(planner)) {
+    return;
+  }
+  if (dubins_shortest_path(&path, (double *)v->q, planner->goal,
+                           p->turning_radius) == EDUBOK) {
+    length = dubins_path_length(&path);
+    if (cost_v + length < get_bound(planner) &&
+        is_path_free(planner, &path, length)) {
+      set_goal(planner, id, cost_v + length, 1);
+      return;
+    }
+  }
+  /* Else, check if close enough already */
+  if (d_xy < p->goal_distance &&
+      fabs(mod_angle(v->q[2] - planner->goal[2])) < p->goal_angle) {
+    set_goal(planner, id, cost_v + d_xy, 0);
+  }
+}
+
+static void rewire(struct rrts_worker *worker, int32_t id_new, int n_near) {
+  struct rrts *planner = worker->planner;
+  const RRTParameters *p = &planner->params;
+  RRTVertex *v_new = planner->vertices + id_new;
+  pthread_mutex_t *lock = planner->vertex_locks + id_new % RRTS_LOCK_STRIPES;
+  DubinsPath path;
+  double length, cost, cost_new;
+  int32_t parent_new;
+  int k;
+  /*
+  Another worker may rewire the new vertex meanwhile, which only lowers its
+  cost. A child's cost then stays above its parent's, so no rewire can make
+  a cycle.
+  */
+  pthread_mutex_lock(lock);
+  parent_new = v_new->parent;
+  cost_new = v_new->cost_from_root;
+  pthread_mutex_unlock(lock);
+  for (k = 0; k < n_near; k++) {
+    int32_t id = worker->neighbors[k];
+    RRTVertex *v = planner->vertices + id;
+    int rewired = 0;
+    if (id == parent_new) {
+      continue;
+    }
+    if (dubins_shortest_path(&path, v_new->q, v->q, p->turning_radius) !=
+        EDUBOK) {
+      continue;
+    }
+    length = dubins_path_length(&path);
+    cost = cost_new + length;
+    /* Reach the neighbor via the new vertex, if cheaper */
+    if (cost >= vertex_cost(planner, id) - p->eps_rewire ||
+        !is_path_free(planner, &path, length)) {
+      continue;
+    }
+    /* Check again, in case another worker rewired it meanwhile */
+    lock = planner->vertex_locks + id % RRTS_LOCK_STRIPES;
+    pthread_rwlock_rdlock(&planner->tree_lock);
+    pthread_mutex_lock(lock);
+    if (cost < v->cost_from_root - p->eps_rewire) {
+      v->parent = id_new;
+      v->cost_from_root = cost;
+      v->cost_from_parent = length;
+      rewired = 1;
+    }
+    pthread_mutex_unlock(lock);
+    pthread_rwlock_unlock(&planner->tree_lock);
+    if (rewired) {
+      check_goal(planner, id);
+    }
+  }
+}
+
+static int iterate_once(struct rrts_worker *worker) {
+  struct rrts *planner = worker->planner;
+  const RRTParameters *p = &planner->params;
+  double q[3], r, n1, length, budget, dx, dy;
+  int tries = 0, n_near, n_candidates = 0, k, j, within_ball;
+  int32_t id;
+  RRTCandidate *c = NULL;
+  DubinsPath to_goal;
+
+  // 1. Sample a new state
+  do {
+    if (tries++ > MAX_SAMPLE_TRIES) {
+      return 0;
+    }
+    sample(worker, q);
+  } while (is_collision(planner, q));
+
+  // Samples that cannot improve on the best path are ignored (the A* bit)
+  budget = get_bound(planner);
+  if (budget < INFINITY &&
+      dubins_shortest_path(&to_goal, q, planner->goal, p->turning_radius) ==
+          EDUBOK) {
+    budget -= dubins_path_length(&to_goal);
+  }
+  // Any parent costs at least the straight line from the start, so skip the
+  // neighbor search when even that is over budget
+  dx = q[0] - planner->start[0];
+  dy = q[1] - planner->start[1];
+  if (sqrt(dx * dx + dy * dy) > budget) {
+    return 0;
+  }
+
+  // 2. Compute the set of all near vertices
+  n1 = get_size(planner) + 1.0;
+  r = p->gamma * log(n1) / pow(n1, 1.0 / 3.0);
+  n_near = near_vertices(worker, q, r);
+  within_ball = n_near > 0;
+  if (!within_ball) {
+    // Extend the nearest
+    if ((id = nearest_vertex(planner, q)) < 0) {
+      return 0;
+    }
+    worker->neighbors[0] = id;
+    worker->neighbors_dist_sq[0] = 0;
+    n_near = 1;
+  }
+
+  // 3. Find the best parent and extend from that parent
+  for (k = 0; k < n_near; k++) {
+    const RRTVertex *v = planner->vertices + worker->neighbors[k];
+    const double cost_v = vertex_cost(planner, worker->neighbors[k]);
+    // The straight line bounds the Dubins length from below
+    if (cost_v + sqrt(worker->neighbors_dist_sq[k]) > budget) {
+      continue;
+    }
+    c = worker->candidates + n_candidates;
+    if (dubins_shortest_path(&c->path, (double *)v->q, q, p->turning_radius) !=
+        EDUBOK) {
+      continue;
+    }
+    length = dubins_path_length(&c->path);
+    if (length <= 0 || cost_v + length > budget) {
+      continue;
+    }
+    c->id = worker->neighbors[k];
+    c->cost_from_parent = length;
+    c->cost_from_root = cost_v + length;
+    // Insertion sort of the candidate order by cost from the root
+    for (j = n_candidates; j > 0 &&
+                           worker->candidates[worker->order[j - 1]]
+                                   .cost_from_root > c->cost_from_root;
+         j--) {
+      worker->order[j] = worker->order[j - 1];
+    }
+    worker->order[j] = n_candidates++;
+  }
+  if (n_candidates == 0) {
+    return 0;
+  }
+
+  for (k = 0; k < n_candidates; k++) {
+    c = worker->candidates + worker->order[k];
+    if (is_path_free(planner, &c->path, c->cost_from_parent)) {
+      break;
+    }
+  }
+  if (k == n_candidates) {
+    return 0;
+  }
+
+  // Add the trajectory from the best parent to the tree
+  id = add_vertex(planner, q, c->id, c->cost_from_root, c->cost_from_parent);
+  if (id < 0) {
+    return 0;
+  }
+  check_goal(planner, id);
+
+  // 4. Rewire the tree
+  if (within_ball) {
+    rewire(worker, id, n_near);
+  }
+  return 1;
+}
+
+int rrts_iterate(struct rrts *planner, int n_iterations) {
+  int i, n_added = 0;
+  if (!planner || planner->n_vertices == 0 || planner->n_threads > 0) {
+    return 0;
+  }
+  for (i = 0; i < n_iterations; i++) {
+    n_added += iterate_once(planner->workers[0]);
+  }
+  planner->n_iterations += n_iterations;
+  return n_added;
+}
+
+static void *worker_loop(void *arg) {
+  struct rrts_worker *worker = arg;
+  struct rrts *planner = worker->planner;
+  int i;
+  while (__atomic_load_n(&planner->running, __ATOMIC_ACQUIRE)) {
+    for (i = 0; i < ITERATIONS_PER_COUNT; i++) {
+      iterate_once(worker);
+    }
+    __atomic_fetch_add(&planner->n_iterations, ITERATIONS_PER_COUNT,
+                       __ATOMIC_RELAXED);
+  }
+  return NULL;
+}
+
+int rrts_start(struct rrts *planner, int n_threads) {
+  int i;
+  if (!planner || planner->n_vertices == 0 || planner->n_threads > 0 ||
+      n_threads < 1 || n_threads > RRTS_MAX_THREADS) {
+    return -1;
+  }
+  for (i = 0; i < n_threads; i++) {
+    if (!planner->workers[i] &&
+        !(planner->workers[i] = worker_create(planner, i))) {
+      return -1;
+    }
+  }
+  __atomic_store_n(&planner->running, 1, __ATOMIC_RELEASE);
+  for (i = 0; i < n_threads; i++) {
+    if (pthread_create(&planner->workers[i]->thread, NULL, worker_loop,
+                       planner->workers[i])) {
+      break;
+    }
+    planner->n_threads++;
+  }
+  if (planner->n_threads < n_threads) {
+    rrts_stop(planner);
+    return -1;
+  }
+  return n_threads;
+}
+
+int rrts_stop(struct rrts *planner) {
+  int i;
+  if (!planner || planner->n_threads == 0) {
+    return 0;
+  }
+  __atomic_store_n(&planner->running, 0, __ATOMIC_RELEASE);
+  for (i = 0; i < planner->n_threads; i++) {
+    pthread_join(planner->workers[i]->thread, NULL);
+  }
+  planner->n_threads = 0;
+  return 0;
+}
+
+int64_t rrts_iterations(const struct rrts *planner) {
+  return planner ? __atomic_load_n(&planner->n_iterations, __ATOMIC_RELAXED)
+                 : 0;
+}
+
+int rrts_size(const struct rrts *planner) {
+  return planner ? get_size(planner) : 0;
+}
+
+const RRTVertex *rrts_vertices(const struct rrts *planner) {
+  return planner ? planner->vertices : NULL;
+}
+
+double rrts_cost(const struct rrts *planner) {
+  return planner ? get_bound(planner) : INFINITY;
+}
+
+static int sample_segment(const struct rrts *planner, const double from[3],
+                          const double to[3], double *xya, int n_points,
+                          int max_points) {
+  DubinsPath path;
+  double t, length;
+  if (dubins_shortest_path(&path, (double *)from, (double *)to,
+                           planner->params.turning_radius) != EDUBOK) {
+    return n_points;
+  }
+  length = dubins_path_length(&path);
+  /* Count every sample, so that the caller knows how many are needed */
+  for (t = 0; t < length; t += planner->params.discretization_step) {
+    if (n_points < max_points) {
+      dubins_path_sample(&path, t, xya + 3 * n_points);
+    }
+    n_points++;
+  }
+  return n_points;
+}
+
+int rrts_trace(struct rrts *planner, double *xya, int max_points) {
+  int n_chain = 0, n_points = 0, n_vertices, k, goal_exact;
+  int32_t id, goal_parent;
+  if (!planner) {
+    return -1;
+  }
+  /* Hold the best path, and stop rewires, while walking its chain */
+  pthread_mutex_lock(&planner->best_lock);
+  goal_parent = planner->goal_parent;
+  goal_exact = planner->goal_exact;
+  if (goal_parent < 0) {
+    pthread_mutex_unlock(&planner->best_lock);
+    return -1;
+  }
+  pthread_rwlock_wrlock(&planner->tree_lock);
+  // Walk back from the goal to the root
+  n_vertices = get_size(planner);
+  for (id = goal_parent; id >= 0 && n_chain < n_vertices;
+       id = planner->vertices[id].parent) {
+    planner->chain[n_chain++] = id;
+  }
+  pthread_rwlock_unlock(&planner->tree_lock);
+  pthread_mutex_unlock(&planner->best_lock);
+  // Sample forward from the root, as the states of vertices never change
+  for (k = n_chain - 1; k > 0; k--) {
+    n_points = sample_segment(
+        planner, planner->vertices[planner->chain[k]].q,
+        planner->vertices[planner->chain[k - 1]].q, xya, n_points, max_points);
+  }
+  if (goal_exact) {
+    n_points = sample_segment(planner, planner->vertices[goal_parent].q,
+                              planner->goal, xya, n_points, max_points);
+  }
+  if (n_points < max_points) {
+    memcpy(xya + 3 * n_points, planner->goal, 3 * sizeof(double));
+  }
+  return n_points + 1;
+}
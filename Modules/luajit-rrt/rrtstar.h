@@ -0,0 +1,110 @@
+#pragma once
+/*
+Native RRT* core with Dubins steering, for use via the LuaJIT FFI
+Vertices live in a fixed arena and are indexed by a uniform grid over (x, y)
+Worker threads may grow the same tree, for anytime planning
+*/
+
+#include <stdint.h>
+
+#define RRTS_MAX_CIRCLES 64
+#define RRTS_MAX_THREADS 16
+/* Mutexes guarding the grid cells and the vertices, by index */
+#define RRTS_LOCK_STRIPES 64
+
+/* Datatypes of the costmap memory, matching luajit-grid */
+#define RRTS_COSTMAP_NONE 0
+#define RRTS_COSTMAP_UINT8 1
+#define RRTS_COSTMAP_DOUBLE 2
+
+typedef struct {
+  /* Sampling bounds of x, y and heading */
+  double intervals[3][2];
+  /* Same meaning as the parameters of rrt.lua and systems.dubins */
+  double turning_radius;
+  double discretization_step;
+  double bias_threshold;
+  double goal_perturbation;
+  double eps_rewire;
+  double gamma;
+  /* Closeness to the goal when it cannot be reached exactly */
+  double goal_distance;
+  double goal_angle;
+  /* Circular obstacles as {x, y, radius} triplets */
+  double circles[RRTS_MAX_CIRCLES][3];
+  int n_circles;
+  /* Optional costmap from luajit-grid, indexed as j * m + i */
+  const void *costmap;
+  int costmap_type;
+  int m, n;
+  double xmin, ymin, scale;
+  /* Cells with a cost above this are in collision */
+  double cost_threshold;
+  /* Capacities */
+  int max_vertices;
+  int max_neighbors;
+  /* Width of the neighbor grid cells */
+  double cell_size;
+  uint64_t seed;
+} RRTParameters;
+
+typedef struct {
+  double q[3];
+  double cost_from_root;
+  double cost_from_parent;
+  int32_t parent;
+  /* Next vertex in the same grid cell */
+  int32_t next;
+} RRTVertex;
+
+struct rrts;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Fill in the defaults of rrt.lua */
+void rrts_default_parameters(RRTParameters *params);
+
+struct rrts *rrts_create(const RRTParameters *params);
+void rrts_free(struct rrts *planner);
+
+/* Clear the tree and root it at the start state.
+ * Fails while worker threads run.
+ */
+int rrts_plan(struct rrts *planner, const double start[3],
+              const double goal[3]);
+
+/* Run a number of iterations on the calling thread.
+ * Returns the number of vertices added to the tree
+ */
+int rrts_iterate(struct rrts *planner, int n_iterations);
+
+/* Grow the tree on n_threads workers until rrts_stop.
+ * Meanwhile, rrts_cost, rrts_size, rrts_iterations and rrts_trace may be
+ * called from one other thread.
+ * Returns the number of workers, or -1 on failure
+ */
+int rrts_start(struct rrts *planner, int n_threads);
+int rrts_stop(struct rrts *planner);
+/* Iterations run so far, on all threads */
+int64_t rrts_iterations(const struct rrts *planner);
+
+/* Number of vertices in the tree */
+int rrts_size(const struct rrts *planner);
+/* Read only access to the vertex arena, while no workers run */
+const RRTVertex *rrts_vertices(const struct rrts *planner);
+/* Cost of the best path to the goal, or INFINITY */
+double rrts_cost(const struct rrts *planner);
+
+/* Sample the best path from start to goal, every discretization step,
+ * as {x, y, heading} triplets into xya, writing at most max_points.
+ * Returns the number of samples in the path, or -1 if no path. When that is
+ * more than max_points, the path was cut short, as it may grow while
+ * workers run, so trace again with more room.
+ */
+int rrts_trace(struct rrts *planner, double *xya, int max_points);
+
+#ifdef __cplusplus
+}
+#endif
@@ -128,3 +128,34 @@ print("Path length", path_length)
 local function color_path(map, idx, i) map[idx] = 127 end
 costmap:path(path_xy, color_path)
 assert(costmap:save"/tmp/costmapRRT_path.pgm")
+
+-- Same car problem, with the native planner
+print("Planning the car route natively!")
+local planner_native, err = rrt.new_native{
+  intervals = intervals,
+  DISCRETIZATION_STEP = DISCRETIZATION_STEP,
+  TURNING_RADIUS = 3,
+  GAMMA = 5,
+  costmap = costmap,
+}
+if not planner_native then
+  print("No native planner", err)
+  return
+end
+assert(planner_native:plan(start, goal))
+local n_iterations = 0
+local t0 = os.clock()
+repeat
+  planner_native:iterate(1e4)
+  n_iterations = n_iterations + 1e4
+  print(string.format("Iteration %d | Vertices %d | Cost: %f",
+                      n_iterations, planner_native:size(),
+                      planner_native.lowerBoundCost))
+until os.clock() - t0 > 2
+print(string.format("%.0f iterations per second",
+                    n_iterations / (os.clock() - t0)))
+
+local path_xy, path_length = assert(planner_native:trace())
+print("Native path length", path_length, #path_xy)
+costmap:path(path_xy, color_path)
+assert(costmap:save"/tmp/costmapRRT_path_native.pgm")
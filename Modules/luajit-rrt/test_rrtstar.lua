@@ -0,0 +1,115 @@
+#!/usr/bin/env luajit
+
+-- Benchmark the anytime planner: best cost against wall time,
+-- across thread counts
+local rrt = require'rrt'
+local unix = require'unix'
+local ffi = require'ffi'
+local dubins = require'dubins'
+
+local intervals = {{-10, 10}, {-10, 10}, {0, 2*math.pi}}
+local circular_obstacles = {
+  {2, -2, 2},
+  {0, 0, 2},
+  {-2, 2, 2},
+}
+local start = {-7.5, -7.5, 0}
+local goal = {7.5, 7.5, 0}
+
+local TURNING_RADIUS = 3
+local DISCRETIZATION_STEP = 0.1
+
+local function is_free(q)
+  if q[1] < intervals[1][1] or q[1] > intervals[1][2] or
+     q[2] < intervals[2][1] or q[2] > intervals[2][2] then
+    return false
+  end
+  for _, c in ipairs(circular_obstacles) do
+    local dx, dy = q[1] - c[1], q[2] - c[2]
+    if dx * dx + dy * dy < c[3] * c[3] then return false end
+  end
+  return true
+end
+
+-- Path from the start to the goal, clear of the obstacles
+local function check_path(path_xy)
+  assert(path_xy, "No path")
+  for i=1,3 do
+    assert(math.abs(path_xy[1][i] - start[i]) < 1e-9, "Path does not start")
+    assert(math.abs(path_xy[#path_xy][i] - goal[i]) < 1e-9, "Path does not end")
+  end
+  for i, q in ipairs(path_xy) do
+    assert(is_free(q), "Path point "..i.." in collision")
+  end
+end
+
+-- Grow on this thread, where the best cost may only go down
+local planner = assert(rrt.new_native{
+  intervals = intervals,
+  DISCRETIZATION_STEP = DISCRETIZATION_STEP,
+  TURNING_RADIUS = TURNING_RADIUS,
+  GAMMA = 5,
+  circular_obstacles = circular_obstacles,
+})
+assert(planner:plan(start, goal))
+local cost_prev = math.huge
+for _=1,50 do
+  planner:iterate(200)
+  local cost = planner:cost()
+  assert(cost <= cost_prev, "Best cost went up")
+  cost_prev = cost
+end
+assert(cost_prev < math.huge, "No path to the goal")
+check_path(planner:trace())
+
+-- Every edge of the tree is clear, at each step along it, as planned
+local vertices = ffi.load'rrtstar'.rrts_vertices(planner.planner)
+for id=1,planner:size()-1 do
+  local v = vertices[id]
+  assert(v.parent >= 0 and v.parent < planner:size(), "Bad parent")
+  local u = vertices[v.parent]
+  local path = assert(dubins.shortest_path(
+    {u.q[0], u.q[1], u.q[2]}, {v.q[0], v.q[1], v.q[2]}, TURNING_RADIUS))
+  local length = dubins.path_length(path)
+  assert(math.abs(length - v.cost_from_parent) < 1e-9, "Bad edge length")
+  for t=0,length-1e-12,DISCRETIZATION_STEP do
+    assert(is_free(dubins.path_sample(path, t)), "Edge "..id.." in collision")
+  end
+end
+print(string.format("Single thread | Vertices %d | Cost: %f",
+                    planner:size(), cost_prev))
+
+-- Times to sample the best cost, in seconds after starting
+local checkpoints = {0.005, 0.01, 0.05, 0.1, 0.5, 1, 2}
+
+local n_threads_max = tonumber(arg[1]) or 8
+local n_threads = 1
+while n_threads <= n_threads_max do
+  local planner = assert(rrt.new_native{
+    intervals = intervals,
+    DISCRETIZATION_STEP = DISCRETIZATION_STEP,
+    TURNING_RADIUS = TURNING_RADIUS,
+    GAMMA = 5,
+    circular_obstacles = circular_obstacles,
+  })
+  assert(planner:plan(start, goal))
+  local t0 = unix.time()
+  local cost_prev = math.huge
+  assert(planner:start(n_threads))
+  for _, t in ipairs(checkpoints) do
+    local dt = t - (unix.time() - t0)
+    if dt > 0 then unix.usleep(1e6 * dt) end
+    -- The best path so far is available while the workers run
+    local path_xy = planner:trace()
+    local cost = planner:cost()
+    assert(cost <= cost_prev, "Best cost went up")
+    cost_prev = cost
+    if path_xy then check_path(path_xy) end
+    print(string.format("Threads %d | %.3f s | Iterations %d | Vertices %d | Cost: %f | Points %d",
+                        n_threads, unix.time() - t0, planner:iterations(),
+                        planner:size(), planner:cost(),
+                        path_xy and #path_xy or 0))
+  end
+  planner:stop()
+  n_threads = 2 * n_threads
+end
@@ -0,0 +1,325 @@
+/*
+Shared memory state blocks
+Seqlock per block for readers, compare and swap on the sequence for
+writers, and a futex on the generation for waiters
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include "shmstate.h"
+
+/* Spins before yielding to a writer that holds the block */
+#define SPINS_BEFORE_YIELD 64
+/* Milliseconds to wait for the creator of a segment to set it up */
+#define SHMSTATE_ATTACH_TRIES 1000
+/* Milliseconds a block may stay mid-write before a read gives up on it */
+#define SHMSTATE_READ_TIMEOUT_MS 100
+
+uint64_t shmstate_hash(const char *description) {
+  /* FNV-1a */
+  uint64_t h = 14695981039346656037ULL;
+  for (; *description; description++) {
+    h ^= (uint8_t)*description;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+/* Set up the blocks of a segment that this process created */
+static void *init_segment(int fd, uint64_t size, uint64_t layout,
+                          const uint32_t *offsets, const uint32_t *counts,
+                          int n_blocks) {
+  ShmSegment *seg;
+  void *ptr;
+  int i;
+  for (i = 0; i < n_blocks; i++) {
+    if (offsets[i] + sizeof(ShmBlock) + 8 * (uint64_t)counts[i] > size) {
+      errno = EINVAL;
+      return NULL;
+    }
+  }
+  /* Shared between users, as the boost segments were */
+  fchmod(fd, 0666);
+  if (ftruncate(fd, size) != 0) return NULL;
+  ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (ptr == MAP_FAILED) return NULL;
+  /* Fresh from ftruncate, so all zeros */
+  seg = ptr;
+  for (i = 0; i < n_blocks; i++) {
+    ((ShmBlock *)((uint8_t *)ptr + offsets[i]))->n = counts[i];
+  }
+  seg->n_blocks = n_blocks;
+  seg->layout = layout;
+  seg->size = size;
+  __atomic_store_n(&seg->magic, SHMSTATE_MAGIC, __ATOMIC_RELEASE);
+  return ptr;
+}
+
+/* Map a segment that another process created, once it is set up */
+static void *attach_segment(int fd, uint64_t size, uint64_t layout,
+                            int n_blocks) {
+  const struct timespec pause = {0, 1000000};
+  struct stat st;
+  ShmSegment *seg;
+  void *ptr;
+  int i;
+  /* The creator may still be sizing it */
+  for (i = 0;; i++) {
+    if (fstat(fd, &st) != 0) return NULL;
+    if (st.st_size != 0 || i >= SHMSTATE_ATTACH_TRIES) break;
+    nanosleep(&pause, NULL);
+  }
+  if ((uint64_t)st.st_size != size) {
+    errno = st.st_size == 0 ? ETIMEDOUT : EINVAL;
+    return NULL;
+  }
+  ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (ptr == MAP_FAILED) return NULL;
+  seg = ptr;
+  /* Or setting up the blocks */
+  for (i = 0; __atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) == 0; i++) {
+    if (i >= SHMSTATE_ATTACH_TRIES) {
+      munmap(ptr, size);
+      errno = ETIMEDOUT;
+      return NULL;
+    }
+    nanosleep(&pause, NULL);
+  }
+  /* Laid out by a different *cm file: never wipe it under its users */
+  if (seg->magic != SHMSTATE_MAGIC || seg->layout != layout ||
+      seg->size != size || seg->n_blocks != (uint32_t)n_blocks) {
+    munmap(ptr, size);
+    errno = EINVAL;
+    return NULL;
+  }
+  return ptr;
+}
+
+void *shmstate_open(const char *name, uint64_t size, const char *description,
+                    const uint32_t *offsets, const uint32_t *counts,
+                    int n_blocks, int *created) {
+  uint64_t layout = shmstate_hash(description);
+  void *ptr;
+  int fd, err;
+
+  *created = 0;
+  if (size < sizeof(ShmSegment)) {
+    errno = EINVAL;
+    return NULL;
+  }
+  /* Exactly one process creates the segment, and the rest attach to it */
+  fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0666);
+  if (fd >= 0) {
+    ptr = init_segment(fd, size, layout, offsets, counts, n_blocks);
+    if (!ptr) {
+      err = errno;
+      shm_unlink(name);
+      errno = err;
+    }
+    *created = ptr != NULL;
+  } else if (errno == EEXIST) {
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) return NULL;
+    ptr = attach_segment(fd, size, layout, n_blocks);
+  } else {
+    return NULL;
+  }
+  err = errno;
+  close(fd);
+  errno = err;
+  return ptr;
+}
+
+int shmstate_close(void *segment, uint64_t size) {
+  return munmap(segment, size);
+}
+
+int shmstate_unlink(const char *name) {
+  return shm_unlink(name);
+}
+
+/* Returns 1 when it yielded */
+static inline int relax(int *spins) {
+  if (++*spins < SPINS_BEFORE_YIELD) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+    return 0;
+  }
+  *spins = 0;
+  sched_yield();
+  return 1;
+}
+
+static long elapsed_ms(const struct timespec *since) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - since->tv_sec) * 1000L +
+         (now.tv_nsec - since->tv_nsec) / 1000000L;
+}
+
+/* Clamp a byte range to the block data */
+static inline size_t clamp(const ShmBlock *block, size_t offset,
+                           size_t nbytes) {
+  size_t capacity = 8 * (size_t)block->n;
+  if (offset >= capacity) return 0;
+  return nbytes > capacity - offset ? capacity - offset : nbytes;
+}
+
+int64_t shmstate_read(const ShmBlock *block, void *dst, size_t offset,
+                      size_t nbytes) {
+  const uint8_t *data = (const uint8_t *)SHMSTATE_DATA(block) + offset;
+  struct timespec since;
+  uint32_t s0, s1, held = 0;
+  int spins = 0;
+  nbytes = clamp(block, offset, nbytes);
+  for (;;) {
+    s0 = __atomic_load_n(&block->seq, __ATOMIC_ACQUIRE);
+    if (s0 & 1) {
+      /* A writer that died mid-write leaves the same odd seq for good */
+      if (s0 != held) {
+        held = s0;
+        clock_gettime(CLOCK_MONOTONIC, &since);
+      } else if (relax(&spins) &&
+                 elapsed_ms(&since) >= SHMSTATE_READ_TIMEOUT_MS) {
+        return -1;
+      }
+      continue;
+    }
+    memcpy(dst, data, nbytes);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    s1 = __atomic_load_n(&block->seq, __ATOMIC_RELAXED);
+    if (s0 == s1) break;
+    relax(&spins);
+  }
+  /* Each write moves seq by two, as it does the generation */
+  return s0 >> 1;
+}
+
+void shmstate_begin(ShmBlock *block) {
+  uint32_t s = __atomic_load_n(&block->seq, __ATOMIC_RELAXED);
+  int spins = 0;
+  for (;;) {
+    if (!(s & 1) &&
+        __atomic_compare_exchange_n(&block->seq, &s, s + 1, 1,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      break;
+    }
+    relax(&spins);
+    s = __atomic_load_n(&block->seq, __ATOMIC_RELAXED);
+  }
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+#ifdef __linux__
+static long futex(uint32_t *addr, int op, uint32_t val,
+                  const struct timespec *timeout) {
+  return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+#endif
+
+/* Bump a generation, and wake its waiters if there are any */
+static uint32_t bump(uint32_t *generation, uint32_t *waiters) {
+  /* Paired with the waiter count, so either side sees the other */
+  uint32_t g = __atomic_add_fetch(generation, 1, __ATOMIC_SEQ_CST);
+#ifdef __linux__
+  if (__atomic_load_n(waiters, __ATOMIC_SEQ_CST)) {
+    futex(generation, FUTEX_WAKE, INT_MAX, NULL);
+  }
+#else
+  (void)waiters;
+#endif
+  return g;
+}
+
+uint32_t shmstate_end(ShmSegment *segment, ShmBlock *block) {
+  uint32_t generation;
+  /* Bumped before the release, so that a copy's generation matches it */
+  generation = __atomic_add_fetch(&block->generation, 1, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&block->seq, 1, __ATOMIC_SEQ_CST);
+#ifdef __linux__
+  if (__atomic_load_n(&block->waiters, __ATOMIC_SEQ_CST)) {
+    futex(&block->generation, FUTEX_WAKE, INT_MAX, NULL);
+  }
+#endif
+  if (segment) bump(&segment->generation, &segment->waiters);
+  return generation;
+}
+
+uint32_t shmstate_write(ShmSegment *segment, ShmBlock *block, const void *src,
+                        size_t offset, size_t nbytes) {
+  nbytes = clamp(block, offset, nbytes);
+  shmstate_begin(block);
+  memcpy((uint8_t *)SHMSTATE_DATA(block) + offset, src, nbytes);
+  return shmstate_end(segment, block);
+}
+
+uint32_t shmstate_generation(const ShmBlock *block) {
+  return __atomic_load_n(&block->generation, __ATOMIC_ACQUIRE);
+}
+
+uint32_t shmstate_segment_generation(const ShmSegment *segment) {
+  return __atomic_load_n(&segment->generation, __ATOMIC_ACQUIRE);
+}
+
+static int64_t wait_word(uint32_t *word, uint32_t *waiters,
+                         uint32_t generation, double timeout) {
+  struct timespec now, deadline, wait;
+  int64_t result = -1;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  if (timeout >= 0) {
+    long ns = deadline.tv_nsec + (long)((timeout - (long)timeout) * 1e9);
+    deadline.tv_sec += (long)timeout + ns / 1000000000L;
+    deadline.tv_nsec = ns % 1000000000L;
+  }
+  __atomic_add_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+  for (;;) {
+    uint32_t g = __atomic_load_n(word, __ATOMIC_SEQ_CST);
+    if (g != generation) {
+      result = g;
+      break;
+    }
+    if (timeout >= 0) {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      wait.tv_sec = deadline.tv_sec - now.tv_sec;
+      wait.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+      if (wait.tv_nsec < 0) {
+        wait.tv_sec--;
+        wait.tv_nsec += 1000000000L;
+      }
+      if (wait.tv_sec < 0) break;
+    }
+#ifdef __linux__
+    /* Returns at once if the generation already moved on */
+    futex(word, FUTEX_WAIT, generation, timeout >= 0 ? &wait : NULL);
+#else
+    wait.tv_sec = 0;
+    wait.tv_nsec = 1000000;
+    nanosleep(&wait, NULL);
+#endif
+  }
+  __atomic_sub_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+  return result;
+}
+
+int64_t shmstate_wait(ShmBlock *block, uint32_t generation, double timeout) {
+  return wait_word(&block->generation, &block->waiters, generation, timeout);
+}
+
+int64_t shmstate_wait_segment(ShmSegment *segment, uint32_t generation,
+                              double timeout) {
+  return wait_word(&segment->generation, &segment->waiters, generation,
+                   timeout);
+}
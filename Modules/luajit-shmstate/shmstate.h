@@ -0,0 +1,85 @@
+#pragma once
+/*
+Shared memory state blocks, for use via the LuaJIT FFI
+A segment is a fixed layout of blocks, each guarded by a seqlock so that
+multi-word values are never read torn, with a generation counter that
+readers may sleep on
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHMSTATE_MAGIC 0x53544D31
+/* Segment header and blocks each start on their own cache line */
+#define SHMSTATE_ALIGN 64
+
+typedef struct {
+  uint32_t magic;
+  uint32_t n_blocks;
+  /* Hash of the layout description, to catch a changed *cm file */
+  uint64_t layout;
+  uint64_t size;
+  /* Bumped after a write to any block, for waiting on the whole segment */
+  uint32_t generation;
+  uint32_t waiters;
+} ShmSegment;
+
+/* Followed by the data, as n doubles */
+typedef struct {
+  /* Odd while a write is in progress */
+  uint32_t seq;
+  /* Bumped after every write. This is the futex word */
+  uint32_t generation;
+  uint32_t waiters;
+  uint32_t n;
+} ShmBlock;
+
+#define SHMSTATE_DATA(block) ((double *)((ShmBlock *)(block) + 1))
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint64_t shmstate_hash(const char *description);
+
+/* Map the named segment, creating it with the blocks at offsets with counts
+ * if it does not exist. created is set when the caller should write the
+ * initial values. An existing segment of another size or layout is left
+ * alone, and is an error (EINVAL) until it is unlinked.
+ * Returns the mapping, or NULL with errno set on failure
+ */
+void *shmstate_open(const char *name, uint64_t size, const char *description,
+                    const uint32_t *offsets, const uint32_t *counts,
+                    int n_blocks, int *created);
+int shmstate_close(void *segment, uint64_t size);
+int shmstate_unlink(const char *name);
+
+/* Copy bytes out of a block, retrying while a write is in progress.
+ * Returns the generation of the copy, or -1 if one write held the block
+ * for too long, as when its writer died in the middle of it
+ */
+int64_t shmstate_read(const ShmBlock *block, void *dst, size_t offset,
+                      size_t nbytes);
+/* Copy bytes into a block of the segment and wake any waiters.
+ * Returns the new generation of the block
+ */
+uint32_t shmstate_write(ShmSegment *segment, ShmBlock *block, const void *src,
+                        size_t offset, size_t nbytes);
+/* Bracket writes made in place through SHMSTATE_DATA */
+void shmstate_begin(ShmBlock *block);
+uint32_t shmstate_end(ShmSegment *segment, ShmBlock *block);
+
+uint32_t shmstate_generation(const ShmBlock *block);
+/* Sleep until the generation differs from the one given, or the timeout
+ * in seconds passes. A negative timeout waits forever.
+ * Returns the new generation, or -1 on timeout
+ */
+int64_t shmstate_wait(ShmBlock *block, uint32_t generation, double timeout);
+/* Same, for a write to any block of the segment */
+uint32_t shmstate_segment_generation(const ShmSegment *segment);
+int64_t shmstate_wait_segment(ShmSegment *segment, uint32_t generation,
+                              double timeout);
+
+#ifdef __cplusplus
+}
+#endif
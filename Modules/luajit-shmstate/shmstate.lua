@@ -0,0 +1,301 @@
+-- Shared memory state blocks: fixed layout, seqlock reads and writes,
+-- and generation counters to wait on
+local lib = {}
+local ffi = require'ffi'
+local bit = require'bit'
+ffi.cdef[[
+typedef struct {
+  uint32_t magic;
+  uint32_t n_blocks;
+  uint64_t layout;
+  uint64_t size;
+  uint32_t generation;
+  uint32_t waiters;
+} ShmSegment;
+typedef struct {
+  uint32_t seq;
+  uint32_t generation;
+  uint32_t waiters;
+  uint32_t n;
+} ShmBlock;
+uint64_t shmstate_hash(const char *description);
+void *shmstate_open(const char *name, uint64_t size, const char *description,
+                    const uint32_t *offsets, const uint32_t *counts,
+                    int n_blocks, int *created);
+int shmstate_close(void *segment, uint64_t size);
+int shmstate_unlink(const char *name);
+char *strerror(int errnum);
+int64_t shmstate_read(const ShmBlock *block, void *dst, size_t offset,
+                      size_t nbytes);
+uint32_t shmstate_write(ShmSegment *segment, ShmBlock *block, const void *src,
+                        size_t offset, size_t nbytes);
+void shmstate_begin(ShmBlock *block);
+uint32_t shmstate_end(ShmSegment *segment, ShmBlock *block);
+uint32_t shmstate_generation(const ShmBlock *block);
+int64_t shmstate_wait(ShmBlock *block, uint32_t generation, double timeout);
+uint32_t shmstate_segment_generation(const ShmSegment *segment);
+int64_t shmstate_wait_segment(ShmSegment *segment, uint32_t generation,
+                              double timeout);
+]]
+local C = ffi.load'shmstate'
+lib.C = C
+
+local ALIGN = 64
+local BLOCK_HEADER = ffi.sizeof'ShmBlock'
+-- Room for strings to grow, in bytes
+local STRING_CAPACITY = 64
+-- errno of shmstate_open for a segment of another layout
+local EINVAL = 22
+local ceil, max, min = math.ceil, math.max, math.min
+
+local function align(n) return ALIGN * ceil(n / ALIGN) end
+
+-- Fixed layout of a *cm table: blocks in key order, so that every process
+-- loading the same file agrees on it
+function lib.layout(shared)
+  local keys = {}
+  for k in pairs(shared) do table.insert(keys, k) end
+  table.sort(keys)
+  local entries, description = {}, {}
+  local offset = align(ffi.sizeof'ShmSegment')
+  for i, k in ipairs(keys) do
+    local v = shared[k]
+    local kind = type(v)
+    local nbytes
+    if kind == 'table' then
+      nbytes = 8 * #v
+    elseif kind == 'number' then
+      -- Raw bytes, as shm:empty
+      nbytes = v
+    elseif kind == 'string' then
+      nbytes = max(#v + 1, STRING_CAPACITY)
+    else
+      error('Unsupported shm type: '..kind)
+    end
+    local n = ceil(nbytes / 8)
+    entries[k] = {index = i, kind = kind, n = n, offset = offset,
+                  nbytes = kind == 'table' and 8 * n or nbytes}
+    table.insert(description, string.format('%s:%s:%d;', k, kind, n))
+    offset = align(offset + BLOCK_HEADER + 8 * n)
+  end
+  return {
+    keys = keys,
+    entries = entries,
+    size = offset,
+    description = table.concat(description),
+  }
+end
+
+-- C header of a layout, for native code sharing the segment
+function lib.header(prefix, shared)
+  local layout = lib.layout(shared)
+  prefix = prefix:upper()
+  local lines = {
+    '#pragma once',
+    string.format('/* Layout of %s, generated by shmstate.header */', prefix),
+    string.format('#define %s_SIZE %d', prefix, layout.size),
+    string.format('#define %s_LAYOUT 0x%sULL', prefix,
+      bit.tohex(C.shmstate_hash(layout.description))),
+  }
+  for _, k in ipairs(layout.keys) do
+    local e = layout.entries[k]
+    local name = prefix..'_'..k:upper():gsub('[^%w]', '_')
+    table.insert(lines, string.format('#define %s_OFFSET %d', name, e.offset))
+    table.insert(lines, string.format('#define %s_COUNT %d', name, e.n))
+  end
+  return table.concat(lines, '\n')..'\n'
+end
+
+local function block_of(self, k)
+  local block = self.blocks[k]
+  if not block then error('No shm key: '..tostring(k), 3) end
+  return block, self.entries[k]
+end
+
+-- Seqlock copy, as a number for single values as shm:get,
+-- and the generation of the copy.
+-- Returns nil if a writer died in the middle of writing k
+local function get(self, k)
+  local block, e = block_of(self, k)
+  if e.kind == 'string' then
+    local gen = C.shmstate_read(block, self.scratch, 0, e.nbytes)
+    if gen < 0 then return end
+    return ffi.string(ffi.cast('const char*', self.scratch)), tonumber(gen)
+  elseif e.kind == 'number' then
+    return self.ptrs[k], C.shmstate_generation(block)
+  elseif e.n == 0 then
+    return nil, C.shmstate_generation(block)
+  end
+  local gen = C.shmstate_read(block, self.scratch, 0, 8 * e.n)
+  if gen < 0 then return end
+  gen = tonumber(gen)
+  if e.n == 1 then return self.scratch[0], gen end
+  local val = {}
+  for i=1,e.n do val[i] = self.scratch[i-1] end
+  return val, gen
+end
+
+-- val: number, table of numbers, string, or cdata with a byte count
+local function set(self, k, val, nbytes)
+  local block, e = block_of(self, k)
+  local kind = type(val)
+  if kind == 'number' then
+    self.scratch[0] = val
+    return C.shmstate_write(self.header, block, self.scratch, 0, 8)
+  elseif kind == 'table' then
+    local n = min(#val, e.n)
+    for i=1,n do self.scratch[i-1] = tonumber(val[i]) or 0 end
+    return C.shmstate_write(self.header, block, self.scratch, 0, 8 * n)
+  elseif kind == 'string' then
+    if e.kind == 'string' then
+      -- Keep the terminator
+      local n = min(#val, e.nbytes - 1)
+      ffi.copy(self.scratch, val, n)
+      ffi.cast('char*', self.scratch)[n] = 0
+      return C.shmstate_write(self.header, block, self.scratch, 0, n + 1)
+    end
+    return C.shmstate_write(self.header, block, val, 0, #val)
+  elseif kind == 'cdata' or kind == 'userdata' then
+    return C.shmstate_write(self.header, block, val, 0,
+                            tonumber(nbytes) or e.nbytes)
+  end
+  error('Unsupported shm value: '..kind, 2)
+end
+
+-- Direct access: pointer, type and number of elements, as shm:pointer
+local function pointer(self, k)
+  local e = self.entries[k]
+  if not e then return end
+  if e.kind == 'string' then return self.ptrs[k], 'char', e.nbytes end
+  return self.ptrs[k], 'double', e.n
+end
+
+local function size(self, k)
+  local e = self.entries[k]
+  return e and e.n or 0
+end
+
+-- Iterate the keys, as shm.next
+local function next_key(self, k)
+  local i = k and self.entries[k].index or 0
+  local key = self.keys[i + 1]
+  if key then return key, self.entries[key].n end
+end
+
+local function generation(self, k)
+  return C.shmstate_generation((block_of(self, k)))
+end
+
+-- Sleep until k is written after the given generation.
+-- Returns the new generation, or false on timeout
+local function wait(self, k, gen, timeout)
+  local block = block_of(self, k)
+  gen = gen or C.shmstate_generation(block)
+  local ret = C.shmstate_wait(block, gen, timeout or -1)
+  if ret < 0 then return false end
+  return tonumber(ret)
+end
+
+-- Same, for a write to any key
+local function segment_generation(self)
+  return C.shmstate_segment_generation(self.header)
+end
+local function wait_segment(self, gen, timeout)
+  gen = gen or C.shmstate_segment_generation(self.header)
+  local ret = C.shmstate_wait_segment(self.header, gen, timeout or -1)
+  if ret < 0 then return false end
+  return tonumber(ret)
+end
+
+-- Bracket writes made through the pointer, so readers see them whole
+local function begin_write(self, k)
+  C.shmstate_begin((block_of(self, k)))
+end
+local function end_write(self, k)
+  return C.shmstate_end(self.header, (block_of(self, k)))
+end
+
+-- Unmapped now, rather than when the mapping is collected
+local function close(self)
+  if self.segment == nil then return end
+  C.shmstate_close(ffi.gc(self.segment, nil), self.bytes)
+  self.segment = nil
+end
+
+-- Open the segment for a *cm shared table, e.g. shared.ball of vcm.
+-- On creation, the values of the table are the initial contents
+function lib.new(name, shared)
+  local layout = lib.layout(shared)
+  local n_blocks = #layout.keys
+  local offsets = ffi.new('uint32_t[?]', max(n_blocks, 1))
+  local counts = ffi.new('uint32_t[?]', max(n_blocks, 1))
+  for i, k in ipairs(layout.keys) do
+    offsets[i-1] = layout.entries[k].offset
+    counts[i-1] = layout.entries[k].n
+  end
+  local created = ffi.new'int[1]'
+  -- POSIX names begin with a slash, and stay clear of the boost segments
+  local segment = C.shmstate_open('/'..name..'_state', layout.size,
+    layout.description, offsets, counts, n_blocks, created)
+  if segment == nil then
+    local err = ffi.errno()
+    if err == EINVAL then
+      return false, name.." has another layout: unlink it to change it"
+    end
+    return false, "Could not open "..name..": "..ffi.string(ffi.C.strerror(err))
+  end
+  -- The table holds the mapping, so it is unmapped along with the table
+  local bytes = layout.size
+  segment = ffi.gc(segment, function(p) C.shmstate_close(p, bytes) end)
+  local base = ffi.cast('uint8_t*', segment)
+  local self = {
+    segment = segment,
+    header = ffi.cast('ShmSegment*', segment),
+    bytes = bytes,
+    keys = layout.keys,
+    entries = layout.entries,
+    blocks = {},
+    ptrs = {},
+    get = get,
+    set = set,
+    pointer = pointer,
+    size = size,
+    next = next_key,
+    generation = generation,
+    wait = wait,
+    segment_generation = segment_generation,
+    wait_segment = wait_segment,
+    begin_write = begin_write,
+    end_write = end_write,
+    close = close,
+  }
+  local largest = 1
+  for _, k in ipairs(layout.keys) do
+    local e = layout.entries[k]
+    local block = ffi.cast('ShmBlock*', base + e.offset)
+    self.blocks[k] = block
+    local data = base + e.offset + BLOCK_HEADER
+    if e.kind == 'string' then
+      self.ptrs[k] = ffi.cast('char*', data)
+    elseif e.kind == 'number' then
+      self.ptrs[k] = ffi.cast('void*', data)
+    else
+      self.ptrs[k] = ffi.cast('double*', data)
+    end
+    largest = max(largest, e.n)
+  end
+  self.scratch = ffi.new('double[?]', largest + 1)
+  if created[0] == 1 then
+    for _, k in ipairs(layout.keys) do
+      local v = shared[k]
+      if type(v) ~= 'number' then set(self, k, v) end
+    end
+  end
+  return self
+end
+
+function lib.unlink(name)
+  return C.shmstate_unlink('/'..name..'_state') == 0
+end
+
+return lib
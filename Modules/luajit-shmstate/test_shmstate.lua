@@ -0,0 +1,77 @@
+#!/usr/bin/env luajit
+
+local shmstate = require'shmstate'
+
+local shared = {
+  pose = {0, 0, 0},
+  t = {0},
+  state = 'idle',
+  raw = 20,
+}
+local name = 'testShmstate'..(os.getenv('USER') or '')
+shmstate.unlink(name)
+
+local seg = assert(shmstate.new(name, shared))
+-- Initial values from the table
+assert(seg:get'state' == 'idle')
+assert(seg:get't' == 0)
+assert(#seg:get'pose' == 3)
+
+-- Same layout on a second mapping
+local seg2 = assert(shmstate.new(name, shared))
+local g0 = seg2:generation'pose'
+seg:set('pose', {1, 2, 3})
+local pose = seg2:get'pose'
+assert(pose[1] == 1 and pose[2] == 2 and pose[3] == 3)
+assert(seg2:generation'pose' == g0 + 1)
+-- Already newer than g0, so no wait
+assert(seg2:wait('pose', g0, 1) == g0 + 1)
+-- Nothing new
+assert(seg2:wait('pose', g0 + 1, 0.01) == false)
+
+-- The copy carries its generation, and any write moves the segment
+local _, g1 = seg2:get'pose'
+assert(g1 == g0 + 1)
+local s0 = seg2:segment_generation()
+seg:set('t', 1.5)
+assert(seg2:wait_segment(s0, 1) == s0 + 1)
+assert(seg2:wait_segment(s0 + 1, 0.01) == false)
+
+-- Strings may grow up to the capacity
+seg:set('state', 'walking')
+assert(seg2:get'state' == 'walking')
+
+-- Direct access, with writes bracketed for readers
+local ptr, tp, n = seg2:pointer'pose'
+assert(tp == 'double' and n == 3)
+seg2:begin_write'pose'
+ptr[0], ptr[1], ptr[2] = 4, 5, 6
+seg2:end_write'pose'
+assert(seg:get'pose'[3] == 6)
+
+-- A write left unfinished, as by a writer that died, makes reads give up
+seg2:begin_write'pose'
+assert(seg:get'pose' == nil)
+seg2:end_write'pose'
+assert(seg:get'pose'[3] == 6)
+
+-- Keys as shm.next
+local keys = {}
+for k, nval in seg.next, seg do keys[k] = nval end
+assert(keys.pose == 3 and keys.t == 1 and keys.raw == 3)
+
+-- A changed table is refused while the old segment exists, and left as is
+shared.pose = {0, 0, 0, 0}
+assert(not shmstate.new(name, shared))
+assert(seg2:get'pose'[3] == 6)
+-- Then laid out again once unlinked
+shmstate.unlink(name)
+local seg3 = assert(shmstate.new(name, shared))
+assert(#seg3:get'pose' == 4 and seg3:get'state' == 'idle')
+
+io.write(shmstate.header('test', shared))
+seg:close()
+seg2:close()
+seg3:close()
+shmstate.unlink(name)
+print('OK')
@@ -288,15 +288,6 @@ int THOROP_kinematics_check_collision(const double *qLArm,const double *qRArm){
     .translateZ(elbowOffsetX)
     .rotateY(qLArm[3]);
   
-  Transform tLWrist = trcopy(tLElbow)
-    .translateZ(-elbowOffsetX)
-    .rotateX(qLArm[4]);         
-  
-  Transform tLHand = trcopy(tLWrist)
-    .translateX(lowerArmLengthL)          
-    .rotateZ(qLArm[5])
-    .rotateX(qLArm[6]);
-
   Transform tRShoulder = trcopy(tTorso)
     .translateY(-shoulderOffsetY)
     .translateZ(shoulderOffsetZ)        
@@ -309,15 +300,6 @@ int THOROP_kinematics_check_collision(const double *qLArm,const double *qRArm){
     .translateZ(elbowOffsetX)
     .rotateY(qRArm[3]);    
 
-  Transform tRWrist = trcopy(tRElbow)
-    .translateZ(-elbowOffsetX)
-    .rotateX(qRArm[4]);            
-
-  Transform tRHand = trcopy(tRWrist)
-    .translateX(lowerArmLengthR)          
-    .rotateZ(qRArm[5])
-    .rotateX(qRArm[6]);
-
   //Elbow should always be outside the shoulder
   if ((tLElbow(1,3)<tLShoulder(1,3))||(tRElbow(1,3)>tRShoulder(1,3))){
     printf("Elbow collision!\n");
@@ -339,7 +321,7 @@ int THOROP_kinematics_check_collision_single(const double *qArm,int is_left){
 
 
 
-  double upperArmLength, lowerArmLength;
+  double upperArmLength;
 
   //TODOTODOTODOTODO
 
@@ -349,7 +331,6 @@ int THOROP_kinematics_check_collision_single(const double *qArm,int is_left){
 
   if (is_left>0){
     upperArmLength = upperArmLengthL;
-    lowerArmLength = lowerArmLengthL;
     tShoulder = trcopy(tTorso)
       .translateY(shoulderOffsetY)
       .translateZ(shoulderOffsetZ)        
@@ -359,7 +340,6 @@ int THOROP_kinematics_check_collision_single(const double *qArm,int is_left){
   }
   else{
     upperArmLength = upperArmLengthR;
-    lowerArmLength = lowerArmLengthR;
     tShoulder = trcopy(tTorso)
       .translateY(-shoulderOffsetY)
       .translateZ(shoulderOffsetZ)        
@@ -373,11 +353,6 @@ int THOROP_kinematics_check_collision_single(const double *qArm,int is_left){
     .translateZ(elbowOffsetX)
     .rotateY(qArm[3]);
   
-  Transform tWrist = trcopy(tElbow)
-    .translateZ(-elbowOffsetX)
-    .translateX(lowerArmLength)          
-    .rotateX(qArm[4]);         
-
 /*  
   Transform tLHand = trcopy(tLWrist)
 
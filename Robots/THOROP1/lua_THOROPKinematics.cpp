@@ -75,7 +75,7 @@ static std::vector<double> lua_checkvector(lua_State *L, int narg) {
 	return v;
 }
 
-static void lua_pushtransform(lua_State *L, Transform t) {
+static void lua_pushtransform(lua_State *L, const Transform &t) {
 	lua_createtable(L, 4, 0);
 	for (int i = 0; i < 4; i++) {
 		lua_createtable(L, 4, 0);
@@ -605,13 +605,14 @@ static Transform luaT_checktransform(lua_State *L, int narg) {
 
   // Form into our Transform type
   Transform tr;
-  for (int i = 0; i < 4; i++)
+  // The bottom row is implied
+  for (int i = 0; i < 3; i++)
     for (int j = 0; j < 4; j++)
       tr(i,j) = THTensor_fastGet2d( _t, i, j );
 
   return tr;
 }
-static void luaT_pushtransform(lua_State *L, Transform t) {
+static void luaT_pushtransform(lua_State *L, const Transform &t) {
   // Make the Tensor
   THLongStorage *sz = THLongStorage_newWithSize(2);
   sz->data[0] = 4;
@@ -644,7 +645,8 @@ static Transform lua_checktransform(lua_State *L, int narg) {
   int i, j;
 
   // Loop through the transform
-  for (i = 1; i <= 4; i++) {
+  // The bottom row is implied
+  for (i = 1; i <= 3; i++) {
     // Grab the table entry
     lua_rawgeti(L, narg, i);
     // Get the top of the stack
@@ -0,0 +1,175 @@
+/*
+Differential IK for the 7 DOF arms
+Damped least squares on the geometric Jacobian, with a null space
+pull towards a preferred posture, joint limits and collision rejection
+*/
+
+#include "THOROPKinematics.h"
+
+// Default limits, from the THOROP0 servo configuration
+static const double qLArmMin[7] = {-90, 0, -90, -160, -180, -87, -180};
+static const double qLArmMax[7] = {160, 87, 90, 0, 180, 87, 180};
+static const double qRArmMin[7] = {-90, -87, -90, -160, -180, -87, -180};
+static const double qRArmMax[7] = {160, 0, 90, 0, 180, 87, 180};
+
+// Record the axis and origin of a revolute joint about the current z
+static inline void joint_axis(const Transform &t, double *z, double *o) {
+  for (int i = 0; i < 3; i++) {
+    z[i] = t(i,2);
+    o[i] = t(i,3);
+  }
+}
+
+Transform
+THOROP_kinematics_arm_jacobian_7(double *J, const double *q, int arm,
+  double bodyPitch, const double *qWaist,
+  double handOffsetXNew, double handOffsetYNew, double handOffsetZNew) {
+  // Same chain as THOROP_kinematics_forward_l/r_arm_7,
+  // with mDH split to expose each joint before its rotateZ
+  static const double alpha[7] = {-PI/2, PI/2, PI/2, PI/2, -PI/2, -PI/2, PI/2};
+  static const double theta0[7] = {0, PI/2, PI/2, 0, -PI/2, 0, 0};
+  double a[7] = {0, 0, 0, elbowOffsetX, -elbowOffsetX, 0, 0};
+  double d[7] = {0, 0, 0, 0, 0, 0, 0};
+  double z[7][3], o[7][3];
+  double sign = arm==ARM_LEFT ? 1 : -1;
+
+  d[2] = arm==ARM_LEFT ? upperArmLengthL : upperArmLengthR;
+  d[4] = arm==ARM_LEFT ? lowerArmLengthL : lowerArmLengthR;
+
+  Transform t;
+  t.rotateY(bodyPitch)
+    .translateZ(-originOffsetZ)
+    .rotateY(qWaist[1]).rotateZ(qWaist[0])
+    .translateZ(originOffsetZ)
+    .translateY(sign*shoulderOffsetY)
+    .translateZ(shoulderOffsetZ);
+  for (int i = 0; i < 7; i++) {
+    t.translateX(a[i]).rotateX(alpha[i]).translateZ(d[i]);
+    joint_axis(t, z[i], o[i]);
+    t.rotateZ(theta0[i]+q[i]);
+  }
+  t.mDH(-PI/2, 0, -PI/2, 0)
+    .translateX(handOffsetXNew)
+    .translateY(-sign*handOffsetYNew)
+    .translateZ(handOffsetZNew);
+
+  // Columns are {z x (p - o), z}
+  for (int j = 0; j < 7; j++) {
+    double r0 = t(0,3) - o[j][0];
+    double r1 = t(1,3) - o[j][1];
+    double r2 = t(2,3) - o[j][2];
+    J[0*7+j] = z[j][1]*r2 - z[j][2]*r1;
+    J[1*7+j] = z[j][2]*r0 - z[j][0]*r2;
+    J[2*7+j] = z[j][0]*r1 - z[j][1]*r0;
+    J[3*7+j] = z[j][0];
+    J[4*7+j] = z[j][1];
+    J[5*7+j] = z[j][2];
+  }
+  return t;
+}
+
+void THOROP_kinematics_arm_ik_init(THOROPArmIK *ik, int arm) {
+  ik->arm = arm;
+  ik->bodyPitch = 0;
+  ik->qWaist[0] = 0;
+  ik->qWaist[1] = 0;
+  ik->hand[0] = handOffsetX;
+  ik->hand[1] = handOffsetY;
+  ik->hand[2] = handOffsetZ;
+  for (int i = 0; i < 7; i++) {
+    ik->qMin[i] = (arm==ARM_LEFT ? qLArmMin[i] : qRArmMin[i]) * PI/180;
+    ik->qMax[i] = (arm==ARM_LEFT ? qLArmMax[i] : qRArmMax[i]) * PI/180;
+    ik->dqMax[i] = PI/2;
+  }
+  ik->damping = 0.02;
+  ik->gain = 20;
+  ik->null_gain = 1;
+  ik->check_collision = 1;
+}
+
+// Solve (L L') x = b in place, given the Cholesky factor in the lower triangle
+static void chol_solve6(const double L[6][6], double *b) {
+  for (int i = 0; i < 6; i++) {
+    for (int k = 0; k < i; k++) b[i] -= L[i][k]*b[k];
+    b[i] /= L[i][i];
+  }
+  for (int i = 5; i >= 0; i--) {
+    for (int k = i+1; k < 6; k++) b[i] -= L[k][i]*b[k];
+    b[i] /= L[i][i];
+  }
+}
+
+double THOROP_kinematics_arm_ik_step(THOROPArmIK *ik, double *q,
+  const Transform &trTarget, const double *qNull, double dt) {
+  const double *J = ik->J;
+  double L[6][6], y[6], dq[7], qNew[7];
+
+  Transform t = THOROP_kinematics_arm_jacobian_7(ik->J, q, ik->arm,
+    ik->bodyPitch, ik->qWaist, ik->hand[0], ik->hand[1], ik->hand[2]);
+  position6D(t, ik->pose);
+
+  // Position error, and rotation error as half the sum of column crosses
+  double *e = ik->err;
+  e[0] = trTarget(0,3) - t(0,3);
+  e[1] = trTarget(1,3) - t(1,3);
+  e[2] = trTarget(2,3) - t(2,3);
+  e[3] = e[4] = e[5] = 0;
+  for (int k = 0; k < 3; k++) {
+    e[3] += 0.5*(t(1,k)*trTarget(2,k) - t(2,k)*trTarget(1,k));
+    e[4] += 0.5*(t(2,k)*trTarget(0,k) - t(0,k)*trTarget(2,k));
+    e[5] += 0.5*(t(0,k)*trTarget(1,k) - t(1,k)*trTarget(0,k));
+  }
+  double err = 0;
+  for (int i = 0; i < 6; i++) err += e[i]*e[i];
+  err = sqrt(err);
+
+  // Cholesky factor of J J' + damping^2 I
+  double lambda2 = ik->damping*ik->damping;
+  for (int i = 0; i < 6; i++) {
+    for (int j = 0; j <= i; j++) {
+      double s = i==j ? lambda2 : 0;
+      for (int k = 0; k < 7; k++) s += J[i*7+k]*J[j*7+k];
+      for (int k = 0; k < j; k++) s -= L[i][k]*L[j][k];
+      L[i][j] = i==j ? sqrt(s) : s/L[j][j];
+    }
+  }
+
+  // Null space motion towards the preferred posture, or the middle of the range
+  for (int k = 0; k < 7; k++) {
+    double qRef = qNull ? qNull[k] : 0.5*(ik->qMin[k] + ik->qMax[k]);
+    dq[k] = ik->null_gain*(qRef - q[k]);
+  }
+  // Task velocity, less what the null space motion already does
+  for (int i = 0; i < 6; i++) {
+    y[i] = ik->gain*e[i];
+    for (int k = 0; k < 7; k++) y[i] -= J[i*7+k]*dq[k];
+  }
+  chol_solve6(L, y);
+  for (int k = 0; k < 7; k++)
+    for (int i = 0; i < 6; i++) dq[k] += J[i*7+k]*y[i];
+
+  // Keep the direction under the speed limits
+  double scale = 1;
+  for (int k = 0; k < 7; k++) {
+    double v = fabs(dq[k]);
+    if (v*scale > ik->dqMax[k]) scale = ik->dqMax[k]/v;
+  }
+
+  int collided = ik->check_collision &&
+    THOROP_kinematics_check_collision_single(q, ik->arm==ARM_LEFT);
+  // Back off a step that would hit, unless already in collision
+  for (int tries = 0; tries < 4; tries++) {
+    for (int k = 0; k < 7; k++) {
+      double qk = q[k] + scale*dq[k]*dt;
+      qNew[k] = qk < ik->qMin[k] ? ik->qMin[k] :
+        (qk > ik->qMax[k] ? ik->qMax[k] : qk);
+    }
+    if (collided || !ik->check_collision ||
+        !THOROP_kinematics_check_collision_single(qNew, ik->arm==ARM_LEFT)) {
+      for (int k = 0; k < 7; k++) q[k] = qNew[k];
+      break;
+    }
+    scale *= 0.5;
+  }
+  return err;
+}
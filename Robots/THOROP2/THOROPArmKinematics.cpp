@@ -98,7 +98,7 @@ Transform THOROP_kinematics_forward_r_wrist(const double *q, double bodyPitch, c
 
 
 
-std::vector<double> THOROP_kinematics_inverse_wrist(Transform trWrist, int arm, const double *qOrg, double shoulderYaw, double bodyPitch, const double *qWaist){
+std::vector<double> THOROP_kinematics_inverse_wrist(const Transform &trWrist, int arm, const double *qOrg, double shoulderYaw, double bodyPitch, const double *qWaist){
   //calculate shoulder and elbow angle given wrist POSITION
   // Shoulder yaw angle is given
 
@@ -227,8 +227,8 @@ std::vector<double> THOROP_kinematics_inverse_wrist(Transform trWrist, int arm,
 
 
 
-  std::vector<double>
-THOROP_kinematics_inverse_arm_7(Transform trArm, int arm, const double *qOrg, double shoulderYaw, 
+void
+THOROP_kinematics_inverse_arm_7(double *qArm, Transform trArm, int arm, const double *qOrg, double shoulderYaw, 
   double bodyPitch, const double *qWaist, double handOffsetXNew, double handOffsetYNew, double handOffsetZNew, int flip_shoulderroll) 
 {
   // Closed-form inverse kinematics for THOR-OP 7DOF arm
@@ -480,7 +480,6 @@ THOROP_kinematics_inverse_arm_7(Transform trArm, int arm, const double *qOrg, do
 	
   if (err_a*err_a<err_b*err_b)   select_a=true;
   
-  std::vector<double> qArm(7);
   qArm[0] = shoulderPitch;
   qArm[1] = shoulderRoll;
   qArm[2] = shoulderYaw;
@@ -495,6 +494,16 @@ THOROP_kinematics_inverse_arm_7(Transform trArm, int arm, const double *qOrg, do
     qArm[5] = wristRoll_b;
     qArm[6] = wristYaw2_b;
   }
+}
+
+
+std::vector<double>
+THOROP_kinematics_inverse_arm_7(const Transform &trArm, int arm, const double *qOrg, double shoulderYaw, 
+  double bodyPitch, const double *qWaist, double handOffsetXNew, double handOffsetYNew, double handOffsetZNew, int flip_shoulderroll) 
+{
+  std::vector<double> qArm(7);
+  THOROP_kinematics_inverse_arm_7(&qArm[0], trArm, arm, qOrg, shoulderYaw, bodyPitch, qWaist,
+    handOffsetXNew, handOffsetYNew, handOffsetZNew, flip_shoulderroll);
   return qArm;
 }
 
@@ -582,33 +591,33 @@ THOROP_kinematics_inverse_arm_given_wrist(Transform trArm, int arm, const double
 }
 
 std::vector<double>
-THOROP_kinematics_inverse_l_arm_7(Transform trArm, const double *qOrg, double shoulderYaw , double bodyPitch, const double *qWaist,
+THOROP_kinematics_inverse_l_arm_7(const Transform &trArm, const double *qOrg, double shoulderYaw , double bodyPitch, const double *qWaist,
     double handOffsetXNew, double handOffsetYNew, double handOffsetZNew, int flip_shoulderroll) {
   return THOROP_kinematics_inverse_arm_7(trArm, ARM_LEFT, qOrg, shoulderYaw, bodyPitch, qWaist, handOffsetXNew, handOffsetYNew, handOffsetZNew, flip_shoulderroll);
 }
 
 std::vector<double>
-THOROP_kinematics_inverse_r_arm_7(Transform trArm, const double *qOrg,double shoulderYaw, double bodyPitch, const double *qWaist,
+THOROP_kinematics_inverse_r_arm_7(const Transform &trArm, const double *qOrg,double shoulderYaw, double bodyPitch, const double *qWaist,
    double handOffsetXNew, double handOffsetYNew, double handOffsetZNew, int flip_shoulderroll){
   return THOROP_kinematics_inverse_arm_7(trArm, ARM_RIGHT, qOrg, shoulderYaw, bodyPitch, qWaist, handOffsetXNew, handOffsetYNew, handOffsetZNew, flip_shoulderroll);
 }
 
 std::vector<double>
-THOROP_kinematics_inverse_l_wrist(Transform trWrist, const double *qOrg, double shoulderYaw, double bodyPitch, const double *qWaist){
+THOROP_kinematics_inverse_l_wrist(const Transform &trWrist, const double *qOrg, double shoulderYaw, double bodyPitch, const double *qWaist){
   return THOROP_kinematics_inverse_wrist(trWrist, ARM_LEFT, qOrg, shoulderYaw, bodyPitch, qWaist);
 }
 
 std::vector<double>
-THOROP_kinematics_inverse_r_wrist(Transform trWrist,const double *qOrg, double shoulderYaw, double bodyPitch, const double *qWaist) {
+THOROP_kinematics_inverse_r_wrist(const Transform &trWrist,const double *qOrg, double shoulderYaw, double bodyPitch, const double *qWaist) {
   return THOROP_kinematics_inverse_wrist(trWrist, ARM_RIGHT, qOrg, shoulderYaw, bodyPitch, qWaist);
 }
 
 std::vector<double> 
-THOROP_kinematics_inverse_larm_given_wrist(Transform trArm, const double *qOrg, double bodyPitch, const double *qWaist){
+THOROP_kinematics_inverse_larm_given_wrist(const Transform &trArm, const double *qOrg, double bodyPitch, const double *qWaist){
   return THOROP_kinematics_inverse_arm_given_wrist(trArm, ARM_LEFT,qOrg, bodyPitch, qWaist);
 }
 
 std::vector<double> 
-THOROP_kinematics_inverse_rarm_given_wrist(Transform trArm, const double *qOrg, double bodyPitch, const double *qWaist){
+THOROP_kinematics_inverse_rarm_given_wrist(const Transform &trArm, const double *qOrg, double bodyPitch, const double *qWaist){
   return THOROP_kinematics_inverse_arm_given_wrist(trArm, ARM_RIGHT,qOrg, bodyPitch, qWaist);
 }
\ No newline at end of file
@@ -0,0 +1,367 @@
+/*
+Whole body rigid body dynamics
+Recursive Newton-Euler for the inverse dynamics, and composite rigid
+bodies for the mass matrix and COM Jacobian, all O(n) passes over one
+tree of the arm, leg and waist joints
+*/
+
+#include "THOROPKinematics.h"
+
+enum {AXIS_X = 0, AXIS_Y = 1, AXIS_Z = 2};
+
+static const int armAxis[7] = {AXIS_Y, AXIS_Z, AXIS_X, AXIS_Y, AXIS_X, AXIS_Z, AXIS_X};
+static const int legAxis[6] = {AXIS_Z, AXIS_X, AXIS_Y, AXIS_Y, AXIS_Y, AXIS_X};
+
+static inline void cross(const double *a, const double *b, double *c) {
+  c[0] = a[1]*b[2] - a[2]*b[1];
+  c[1] = a[2]*b[0] - a[0]*b[2];
+  c[2] = a[0]*b[1] - a[1]*b[0];
+}
+
+static inline double dot(const double *a, const double *b) {
+  return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+}
+
+// out = R v, for R the rotation about axis ax by (c, s)
+static inline void rot(int ax, double c, double s, const double *v, double *out) {
+  int j = (ax+1)%3, k = (ax+2)%3;
+  out[ax] = v[ax];
+  out[j] = c*v[j] - s*v[k];
+  out[k] = s*v[j] + c*v[k];
+}
+
+// out = R' v
+static inline void rotT(int ax, double c, double s, const double *v, double *out) {
+  int j = (ax+1)%3, k = (ax+2)%3;
+  out[ax] = v[ax];
+  out[j] = c*v[j] + s*v[k];
+  out[k] = -s*v[j] + c*v[k];
+}
+
+// out = I v, for I stored as xx, yy, zz, xy, xz, yz
+static inline void symmul(const double *I, const double *v, double *out) {
+  out[0] = I[0]*v[0] + I[3]*v[1] + I[4]*v[2];
+  out[1] = I[3]*v[0] + I[1]*v[1] + I[5]*v[2];
+  out[2] = I[4]*v[0] + I[5]*v[1] + I[2]*v[2];
+}
+
+static void set_joint(THOROPDynamics *d, int i, int parent, int axis,
+  const double *offset, const double *com, double mass, const double *inertia) {
+  d->parent[i] = parent;
+  d->axis[i] = axis;
+  d->index[i] = i;
+  d->mass[i] = mass;
+  for (int k = 0; k < 3; k++) {
+    d->offset[i][k] = offset ? offset[k] : 0;
+    d->com[i][k] = com ? com[k] : 0;
+  }
+  for (int k = 0; k < 6; k++) d->inertia[i][k] = inertia ? inertia[k] : 0;
+}
+
+void THOROP_dynamics_init(THOROPDynamics *d) {
+  // Waist pitch is the parent of waist yaw, as in calculate_com_positions,
+  // so the two swap places in the whole body vectors.
+  // The torso and pelvis have no inertia tables, and are point masses
+  set_joint(d, 0, -1, AXIS_Y, NULL, NULL, 0, NULL);
+  set_joint(d, 1, 0, AXIS_Z, NULL, bodyCom[0], MassBody[0], NULL);
+  d->index[0] = DYN_WAIST+1;
+  d->index[1] = DYN_WAIST;
+  for (int i = 0; i < 7; i++) {
+    set_joint(d, DYN_LARM+i, i==0 ? 1 : DYN_LARM+i-1, armAxis[i],
+      armLinkL[i], armComL[i], MassArmL[i], InertiaArm[i]);
+    set_joint(d, DYN_RARM+i, i==0 ? 1 : DYN_RARM+i-1, armAxis[i],
+      armLinkR[i], armComR[i], MassArmR[i], InertiaArm[i]);
+  }
+  for (int i = 0; i < 6; i++) {
+    set_joint(d, DYN_LLEG+i, i==0 ? -1 : DYN_LLEG+i-1, legAxis[i],
+      i==0 ? llegLink0 : legLink[i], legCom[i], MassLeg[i], InertiaLeg[i]);
+    set_joint(d, DYN_RLEG+i, i==0 ? -1 : DYN_RLEG+i-1, legAxis[i],
+      i==0 ? rlegLink0 : legLink[i], legCom[6+i], MassLeg[i], InertiaLeg[6+i]);
+  }
+  d->pelvis_mass = MassBody[1];
+  for (int k = 0; k < 3; k++) {
+    d->pelvis_com[k] = bodyCom[1][k];
+    d->sole[0][k] = legLink[6][k];
+    d->sole[1][k] = legLink[6][k];
+  }
+  d->foot[0] = DYN_LLEG+5;
+  d->foot[1] = DYN_RLEG+5;
+  d->gravity = g;
+  d->eps = 1e-9;
+  d->valid = 0;
+
+  double q[DYN_NJ] = {0};
+  THOROP_dynamics_update(d, q, NULL);
+}
+
+// Link frame, joint axis, and first moment and inertia about the base origin
+static void update_link(THOROPDynamics *d, int i, double qi) {
+  int ax = d->axis[i], j = (ax+1)%3, k = (ax+2)%3;
+  double c = cos(qi), s = sin(qi);
+  d->qc[i] = qi;
+  d->cq[i] = c;
+  d->sq[i] = s;
+
+  Transform &t = d->link[i];
+  t = d->parent[i] < 0 ? d->base : d->link[d->parent[i]];
+  t.translate(d->offset[i]);
+  for (int r = 0; r < 3; r++) {
+    double tj = t(r,j), tk = t(r,k);
+    t(r,j) = c*tj + s*tk;
+    t(r,k) = -s*tj + c*tk;
+    d->z[i][r] = t(r,ax);
+    d->o[i][r] = t(r,3);
+  }
+
+  // Rotate the COM and inertia into the base frame
+  double m = d->mass[i], cw[3], RI[3][3];
+  for (int r = 0; r < 3; r++) {
+    cw[r] = t(r,3) + t(r,0)*d->com[i][0] + t(r,1)*d->com[i][1] + t(r,2)*d->com[i][2];
+    double row[3] = {t(r,0), t(r,1), t(r,2)};
+    symmul(d->inertia[i], row, RI[r]);
+  }
+  double *I = d->Ilink[i];
+  double cc = dot(cw, cw);
+  I[0] = RI[0][0]*t(0,0) + RI[0][1]*t(0,1) + RI[0][2]*t(0,2) + m*(cc - cw[0]*cw[0]);
+  I[1] = RI[1][0]*t(1,0) + RI[1][1]*t(1,1) + RI[1][2]*t(1,2) + m*(cc - cw[1]*cw[1]);
+  I[2] = RI[2][0]*t(2,0) + RI[2][1]*t(2,1) + RI[2][2]*t(2,2) + m*(cc - cw[2]*cw[2]);
+  I[3] = RI[0][0]*t(1,0) + RI[0][1]*t(1,1) + RI[0][2]*t(1,2) - m*cw[0]*cw[1];
+  I[4] = RI[0][0]*t(2,0) + RI[0][1]*t(2,1) + RI[0][2]*t(2,2) - m*cw[0]*cw[2];
+  I[5] = RI[1][0]*t(2,0) + RI[1][1]*t(2,1) + RI[1][2]*t(2,2) - m*cw[1]*cw[2];
+  for (int r = 0; r < 3; r++) d->hlink[i][r] = m*cw[r];
+}
+
+int THOROP_dynamics_update(THOROPDynamics *d, const double *q, const double *rpy) {
+  double roll = rpy ? rpy[0] : 0, pitch = rpy ? rpy[1] : 0;
+  int moved_base = !d->valid ||
+    fabs(roll - d->rpyc[0]) > d->eps || fabs(pitch - d->rpyc[1]) > d->eps;
+  if (moved_base) {
+    d->base.clear();
+    d->base.rotateX(roll).rotateY(pitch);
+    d->rpyc[0] = roll;
+    d->rpyc[1] = pitch;
+  }
+
+  // Parents come first, so a moved link marks its whole subtree
+  int moved[DYN_NJ], n_moved = 0;
+  for (int i = 0; i < DYN_NJ; i++) {
+    int p = d->parent[i];
+    double qi = q[d->index[i]];
+    moved[i] = (p < 0 ? moved_base : moved[p]) || fabs(qi - d->qc[i]) > d->eps;
+    if (moved[i]) {
+      update_link(d, i, qi);
+      n_moved++;
+    }
+  }
+  d->valid = 1;
+
+  // Fold the subtrees into their parents, and the roots into the COM
+  for (int i = 0; i < DYN_NJ; i++) {
+    d->msub[i] = d->mass[i];
+    for (int r = 0; r < 3; r++) d->hsub[i][r] = d->hlink[i][r];
+    for (int r = 0; r < 6; r++) d->Isub[i][r] = d->Ilink[i][r];
+  }
+  double pc[3];
+  for (int r = 0; r < 3; r++)
+    pc[r] = d->base(r,0)*d->pelvis_com[0] + d->base(r,1)*d->pelvis_com[1] +
+      d->base(r,2)*d->pelvis_com[2];
+  double *com = d->com_total;
+  com[3] = d->pelvis_mass;
+  for (int r = 0; r < 3; r++) com[r] = d->pelvis_mass*pc[r];
+  for (int i = DYN_NJ-1; i >= 0; i--) {
+    int p = d->parent[i];
+    if (p < 0) {
+      for (int r = 0; r < 3; r++) com[r] += d->hsub[i][r];
+      com[3] += d->msub[i];
+      continue;
+    }
+    d->msub[p] += d->msub[i];
+    for (int r = 0; r < 3; r++) d->hsub[p][r] += d->hsub[i][r];
+    for (int r = 0; r < 6; r++) d->Isub[p][r] += d->Isub[i][r];
+  }
+  for (int r = 0; r < 3; r++) com[r] /= com[3];
+  return n_moved;
+}
+
+// Recursive Newton-Euler, with the pelvis accelerating at aBase in the
+// gravity aligned frame. The wrench {force, moment about the origin} that
+// the pelvis exerts on the rest of the body goes to wrench, if given
+static void rnea(const THOROPDynamics *d, const double *qd, const double *qdd,
+  const double *aBase, const double *fFeet, double *tau, double *wrench) {
+  // Velocities, accelerations and the wrenches on each link, in its own frame
+  double w[DYN_NJ][3], dw[DYN_NJ][3], a[DYN_NJ][3], f[DYN_NJ][3], n[DYN_NJ][3];
+  // Gravity enters as an upward acceleration of the pelvis
+  double ag[3] = {0, 0, d->gravity}, a0[3];
+  if (aBase)
+    for (int k = 0; k < 3; k++) ag[k] += aBase[k];
+  for (int k = 0; k < 3; k++)
+    a0[k] = d->base(0,k)*ag[0] + d->base(1,k)*ag[1] + d->base(2,k)*ag[2];
+  double tmp[3], tmp2[3], lin[3], f0[3] = {0, 0, 0}, n0[3] = {0, 0, 0};
+
+  for (int i = 0; i < DYN_NJ; i++) {
+    int p = d->parent[i], ax = d->axis[i];
+    double c = d->cq[i], s = d->sq[i];
+    double v = qd ? qd[d->index[i]] : 0;
+    double acc = qdd ? qdd[d->index[i]] : 0;
+
+    if (p < 0) {
+      rotT(ax, c, s, a0, a[i]);
+      w[i][0] = w[i][1] = w[i][2] = 0;
+      dw[i][0] = dw[i][1] = dw[i][2] = 0;
+    } else {
+      const double *r = d->offset[i];
+      cross(dw[p], r, lin);
+      cross(w[p], r, tmp);
+      cross(w[p], tmp, tmp2);
+      for (int k = 0; k < 3; k++) lin[k] += a[p][k] + tmp2[k];
+      rotT(ax, c, s, lin, a[i]);
+      rotT(ax, c, s, w[p], w[i]);
+      rotT(ax, c, s, dw[p], dw[i]);
+      // Parent rate cross the joint rate, before adding the joint rate in
+      tmp[0] = tmp[1] = tmp[2] = 0;
+      tmp[ax] = v;
+      cross(w[i], tmp, tmp2);
+      for (int k = 0; k < 3; k++) dw[i][k] += tmp2[k];
+    }
+    w[i][ax] += v;
+    dw[i][ax] += acc;
+
+    // Force at the COM, and moment about the joint origin
+    const double *cm = d->com[i];
+    double ac[3], Iw[3];
+    cross(dw[i], cm, ac);
+    cross(w[i], cm, tmp);
+    cross(w[i], tmp, tmp2);
+    for (int k = 0; k < 3; k++) f[i][k] = d->mass[i]*(a[i][k] + ac[k] + tmp2[k]);
+    symmul(d->inertia[i], w[i], Iw);
+    cross(w[i], Iw, tmp);
+    symmul(d->inertia[i], dw[i], n[i]);
+    cross(cm, f[i], tmp2);
+    for (int k = 0; k < 3; k++) n[i][k] += tmp[k] + tmp2[k];
+  }
+
+  // Ground reactions push on the soles
+  if (fFeet) {
+    for (int l = 0; l < 2; l++) {
+      int i = d->foot[l];
+      const Transform &t = d->link[i];
+      const double *F = fFeet + 3*l;
+      double Fl[3];
+      for (int k = 0; k < 3; k++)
+        Fl[k] = t(0,k)*F[0] + t(1,k)*F[1] + t(2,k)*F[2];
+      cross(d->sole[l], Fl, tmp);
+      for (int k = 0; k < 3; k++) {
+        f[i][k] -= Fl[k];
+        n[i][k] -= tmp[k];
+      }
+    }
+  }
+
+  for (int i = DYN_NJ-1; i >= 0; i--) {
+    int p = d->parent[i], ax = d->axis[i];
+    tau[d->index[i]] = n[i][ax];
+    double c = d->cq[i], s = d->sq[i], Rf[3], Rn[3];
+    rot(ax, c, s, f[i], Rf);
+    rot(ax, c, s, n[i], Rn);
+    cross(d->offset[i], Rf, tmp);
+    double *fp = p < 0 ? f0 : f[p], *np = p < 0 ? n0 : n[p];
+    for (int k = 0; k < 3; k++) {
+      fp[k] += Rf[k];
+      np[k] += Rn[k] + tmp[k];
+    }
+  }
+  if (!wrench) return;
+  // From the pelvis frame to the gravity aligned frame
+  for (int k = 0; k < 3; k++) {
+    wrench[k] = d->base(k,0)*f0[0] + d->base(k,1)*f0[1] + d->base(k,2)*f0[2];
+    wrench[3+k] = d->base(k,0)*n0[0] + d->base(k,1)*n0[1] + d->base(k,2)*n0[2];
+  }
+}
+
+void THOROP_dynamics_inverse(const THOROPDynamics *d,
+  const double *qd, const double *qdd, const double *fFeet, double *tau) {
+  rnea(d, qd, qdd, NULL, fFeet, tau, NULL);
+}
+
+void THOROP_dynamics_mass_matrix(const THOROPDynamics *d, double *H) {
+  for (int i = 0; i < DYN_NJ*DYN_NJ; i++) H[i] = 0;
+
+  // Spatial velocity of joint i is {z, o x z} about the base origin
+  double v[DYN_NJ][3];
+  for (int i = 0; i < DYN_NJ; i++) cross(d->o[i], d->z[i], v[i]);
+
+  for (int i = 0; i < DYN_NJ; i++) {
+    // Momentum of the subtree of i, moving with joint i alone
+    const double *z = d->z[i], *h = d->hsub[i];
+    double L[3], P[3], tmp[3];
+    symmul(d->Isub[i], z, L);
+    cross(h, v[i], tmp);
+    for (int k = 0; k < 3; k++) L[k] += tmp[k];
+    cross(z, h, P);
+    for (int k = 0; k < 3; k++) P[k] += d->msub[i]*v[i][k];
+
+    int ii = d->index[i];
+    for (int j = i; j >= 0; j = d->parent[j]) {
+      int jj = d->index[j];
+      double Hij = dot(d->z[j], L) + dot(v[j], P);
+      H[ii*DYN_NJ+jj] = Hij;
+      H[jj*DYN_NJ+ii] = Hij;
+    }
+  }
+}
+
+void THOROP_dynamics_com_jacobian(const THOROPDynamics *d, double *com, double *J) {
+  const double *c = d->com_total;
+  for (int k = 0; k < 4; k++) com[k] = c[k];
+  for (int i = 0; i < DYN_NJ; i++) {
+    double r[3], col[3];
+    for (int k = 0; k < 3; k++) r[k] = (d->hsub[i][k] - d->msub[i]*d->o[i][k])/c[3];
+    cross(d->z[i], r, col);
+    for (int k = 0; k < 3; k++) J[k*DYN_NJ+d->index[i]] = col[k];
+  }
+}
+
+void THOROP_dynamics_zmp(const THOROPDynamics *d, const double *qd,
+  const double *qdd, const double *aBase, const double *zGround, double *zmp) {
+  double tau[DYN_NJ], wr[6], pc[3], ag[3] = {0, 0, d->gravity};
+  rnea(d, qd, qdd, aBase, NULL, tau, wr);
+
+  // Add the pelvis itself, to get the wrench from the ground
+  if (aBase)
+    for (int k = 0; k < 3; k++) ag[k] += aBase[k];
+  for (int k = 0; k < 3; k++)
+    pc[k] = d->base(k,0)*d->pelvis_com[0] + d->base(k,1)*d->pelvis_com[1] +
+      d->base(k,2)*d->pelvis_com[2];
+  double fp[3], np[3];
+  for (int k = 0; k < 3; k++) fp[k] = d->pelvis_mass*ag[k];
+  cross(pc, fp, np);
+  for (int k = 0; k < 3; k++) {
+    wr[k] += fp[k];
+    wr[3+k] += np[k];
+  }
+
+  double h;
+  if (zGround) h = *zGround;
+  else {
+    // Height of the lower sole
+    h = 0;
+    for (int l = 0; l < 2; l++) {
+      const Transform &t = d->link[d->foot[l]];
+      const double *s = d->sole[l];
+      double zs = t(2,0)*s[0] + t(2,1)*s[1] + t(2,2)*s[2] + t(2,3);
+      if (l==0 || zs < h) h = zs;
+    }
+  }
+  // Where the horizontal moment of the ground wrench vanishes
+  zmp[0] = (h*wr[0] - wr[4])/wr[2];
+  zmp[1] = (h*wr[1] + wr[3])/wr[2];
+}
+
+int THOROP_dynamics_com_zmp(THOROPDynamics *d, const double *q, const double *rpy,
+  const double *qd, const double *qdd, const double *aBase, const double *zGround,
+  double *com, double *Jcom, double *zmp) {
+  int n_moved = THOROP_dynamics_update(d, q, rpy);
+  THOROP_dynamics_com_jacobian(d, com, Jcom);
+  THOROP_dynamics_zmp(d, qd, qdd, aBase, zGround, zmp);
+  return n_moved;
+}
@@ -252,16 +252,21 @@ Transform THOROP_kinematics_forward_head(const double *q);
 Transform THOROP_kinematics_forward_l_leg(const double *q);
 Transform THOROP_kinematics_forward_r_leg(const double *q);
 
-std::vector<double> THOROP_kinematics_inverse_leg(const Transform trLeg, int leg, double aShiftX, double aShiftY);
-std::vector<double> THOROP_kinematics_inverse_leg_toelift(const Transform trLeg, int leg,double aShiftX, double aShiftY,
+std::vector<double> THOROP_kinematics_inverse_leg(const Transform &trLeg, int leg, double aShiftX, double aShiftY);
+std::vector<double> THOROP_kinematics_inverse_leg_toelift(const Transform &trLeg, int leg,double aShiftX, double aShiftY,
 		int birdwalk, double anklePitchCurrent,  double toeliftMin);
-std::vector<double> THOROP_kinematics_inverse_leg_heellift(const Transform trLeg, int leg, double aShiftX, double aShiftY,
+std::vector<double> THOROP_kinematics_inverse_leg_heellift(const Transform &trLeg, int leg, double aShiftX, double aShiftY,
+		 int birdwalk, double anklePitchCurrent, double heelliftMin);
+// Write the 6 joint angles into qLeg, without allocating
+void THOROP_kinematics_inverse_leg_toelift(double *qLeg, Transform trLeg, int leg,double aShiftX, double aShiftY,
+		int birdwalk, double anklePitchCurrent,  double toeliftMin);
+void THOROP_kinematics_inverse_leg_heellift(double *qLeg, Transform trLeg, int leg, double aShiftX, double aShiftY,
 		 int birdwalk, double anklePitchCurrent, double heelliftMin);
 
-std::vector<double> THOROP_kinematics_inverse_r_leg(const Transform trLeg, double aShiftX, double aShiftY);
-std::vector<double> THOROP_kinematics_inverse_l_leg(const Transform trLeg, double aShiftX, double aShiftY);
+std::vector<double> THOROP_kinematics_inverse_r_leg(const Transform &trLeg, double aShiftX, double aShiftY);
+std::vector<double> THOROP_kinematics_inverse_l_leg(const Transform &trLeg, double aShiftX, double aShiftY);
 
-double THOROP_kinematics_inverse_leg_bodyheight_diff(const Transform trLeg, int leg, double aShiftX, double aShiftY);
+double THOROP_kinematics_inverse_leg_bodyheight_diff(const Transform &trLeg, int leg, double aShiftX, double aShiftY);
 
 
 ///////////////////////////////////////////////////////////////////////////////////////
@@ -276,13 +281,52 @@ Transform THOROP_kinematics_forward_r_arm_7(const double *q, double bodyPitch, c
 	double handOffsetXNew, double handOffsetYNew, double handOffsetZNew);
 
 std::vector<double> THOROP_kinematics_inverse_r_arm_7(
-	const Transform trArm, const double *qOrg, double shoulderYaw, double bodyPitch, const double *qWaist,
+	const Transform &trArm, const double *qOrg, double shoulderYaw, double bodyPitch, const double *qWaist,
 	double handOffsetXNew, double handOffsetYNew, double handOffsetZNew, int flip_shoulderroll);
 std::vector<double> THOROP_kinematics_inverse_l_arm_7(
-	const Transform trArm, const double *qOrg, double shoulderYaw, double bodyPitch, const double *qWaist,
+	const Transform &trArm, const double *qOrg, double shoulderYaw, double bodyPitch, const double *qWaist,
 	double handOffsetXNew, double handOffsetYNew, double handOffsetZNew, int flip_shoulderroll);
 
-std::vector<double> THOROP_kinematics_inverse_arm(Transform trArm, std::vector<double>& qOrg, double shoulderYaw, bool flip_shoulderroll);
+std::vector<double> THOROP_kinematics_inverse_arm(const Transform &trArm, std::vector<double>& qOrg, double shoulderYaw, bool flip_shoulderroll);
+
+// Write the 7 joint angles into qArm, without allocating
+void THOROP_kinematics_inverse_arm_7(double *qArm, Transform trArm, int arm, const double *qOrg, double shoulderYaw, 
+  double bodyPitch, const double *qWaist, double handOffsetXNew, double handOffsetYNew, double handOffsetZNew, int flip_shoulderroll);
+
+
+///////////////////////////////////////////////////////////////////////////////////////
+// Arm differential IK
+///////////////////////////////////////////////////////////////////////////////////////
+
+// Workspace of the damped least squares arm IK, kept across servo steps
+struct THOROPArmIK {
+  int arm;
+  // Body state and hand offset, as for the FK
+  double bodyPitch;
+  double qWaist[2];
+  double hand[3];
+  // Joint limits, and speed limits in rad/s
+  double qMin[7], qMax[7], dqMax[7];
+  // Damping, task space gain and null space gain (1/s)
+  double damping, gain, null_gain;
+  // Back off steps that fail THOROP_kinematics_check_collision_single
+  int check_collision;
+  // From the last step: hand pose {x,y,z,r,p,y}, pose error, 6x7 Jacobian
+  double pose[6];
+  double err[6];
+  double J[6*7];
+};
+
+// Hand pose and the 6x7 Jacobian (row major, linear rows first) from one FK pass
+Transform THOROP_kinematics_arm_jacobian_7(double *J, const double *q, int arm,
+  double bodyPitch, const double *qWaist,
+  double handOffsetXNew, double handOffsetYNew, double handOffsetZNew);
+
+void THOROP_kinematics_arm_ik_init(THOROPArmIK *ik, int arm);
+// Move q in place towards trTarget over dt seconds, with qNull (or NULL)
+// as the preferred posture. Returns the pose error before the step
+double THOROP_kinematics_arm_ik_step(THOROPArmIK *ik, double *q,
+  const Transform &trTarget, const double *qNull, double dt);
 
 
 ///////////////////////////////////////////////////////////////////////////////////////
@@ -291,16 +335,16 @@ std::vector<double> THOROP_kinematics_inverse_arm(Transform trArm, std::vector<d
 
 //std::vector<double> THOROP_kinematics_inverse_wrist(Transform trWrist, std::vector<double>& qOrg, double shoulderYaw);
 
-std::vector<double> THOROP_kinematics_inverse_wrist(Transform trWrist, int arm, const double *qOrg, double shoulderYaw, double bodyPitch, const double *qWaist); 
+std::vector<double> THOROP_kinematics_inverse_wrist(const Transform &trWrist, int arm, const double *qOrg, double shoulderYaw, double bodyPitch, const double *qWaist); 
 
 Transform THOROP_kinematics_forward_l_wrist(const double *q, double bodyPitch, const double *qWaist);
 Transform THOROP_kinematics_forward_r_wrist(const double *q, double bodyPitch, const double *qWaist);
 
-std::vector<double> THOROP_kinematics_inverse_r_wrist(const Transform trWrist, const double *qOrg, double shoulderYaw, double bodyPitch, const double *qWaist);
-std::vector<double> THOROP_kinematics_inverse_l_wrist(const Transform trWrist, const double *qOrg, double shoulderYaw, double bodyPitch, const double *qWaist); 
+std::vector<double> THOROP_kinematics_inverse_r_wrist(const Transform &trWrist, const double *qOrg, double shoulderYaw, double bodyPitch, const double *qWaist);
+std::vector<double> THOROP_kinematics_inverse_l_wrist(const Transform &trWrist, const double *qOrg, double shoulderYaw, double bodyPitch, const double *qWaist); 
 
-std::vector<double> THOROP_kinematics_inverse_larm_given_wrist(Transform trArm, const double *qOrg, double bodyPitch, const double *qWaist); 
-	std::vector<double> THOROP_kinematics_inverse_rarm_given_wrist(Transform trArm, const double *qOrg, double bodyPitch, const double *qWaist); 
+std::vector<double> THOROP_kinematics_inverse_larm_given_wrist(const Transform &trArm, const double *qOrg, double bodyPitch, const double *qWaist); 
+	std::vector<double> THOROP_kinematics_inverse_rarm_given_wrist(const Transform &trArm, const double *qOrg, double bodyPitch, const double *qWaist); 
 
 
 
@@ -314,6 +358,14 @@ std::vector<double> THOROP_kinematics_calculate_com_positions(
     double mLHand, double mRHand, double bodyPitch,
     int use_lleg, int use_rleg, int birdwalk
     );
+// Write the COM {x, y, z, mass} into r, without allocating
+void THOROP_kinematics_calculate_com_positions(
+    double *r,
+    const double *qWaist,  const double *qLArm,   const double *qRArm,
+    const double *qLLeg,   const double *qRLeg,   
+    double mLHand, double mRHand, double bodyPitch,
+    int use_lleg, int use_rleg, int birdwalk
+    );
 
 
 std::vector<double> THOROP_kinematics_calculate_zmp(const double *com0, const double *com1, 
@@ -323,6 +375,72 @@ int THOROP_kinematics_check_collision(const double *qLArm,const double *qRArm);
 int THOROP_kinematics_check_collision_single(const double *qArm,int is_left);
 
 
+///////////////////////////////////////////////////////////////////////////////////////
+// Whole body dynamics
+///////////////////////////////////////////////////////////////////////////////////////
+
+// Joint order of the whole body vectors
+#define DYN_NJ 28
+#define DYN_WAIST 0 // yaw, pitch as in qWaist
+#define DYN_LARM 2
+#define DYN_RARM 9
+#define DYN_LLEG 16
+#define DYN_RLEG 22
+
+// Rigid body tree built from the mass tables above, with the pelvis fixed
+// in a gravity aligned frame. Link frames are cached by THOROP_dynamics_update
+struct THOROPDynamics {
+  // Model, parents before children
+  int parent[DYN_NJ];         // -1 on the pelvis
+  int axis[DYN_NJ];           // 0, 1, 2 for rotation about x, y, z
+  int index[DYN_NJ];          // position in the whole body vectors
+  double offset[DYN_NJ][3];   // joint origin in the parent link frame
+  double com[DYN_NJ][3];      // COM in the link frame
+  double mass[DYN_NJ];
+  double inertia[DYN_NJ][6];  // about the COM: xx, yy, zz, xy, xz, yz
+  double pelvis_mass, pelvis_com[3];
+  int foot[2];                // ankle roll links, left then right
+  double sole[2][3];          // contact points in the ankle roll link frames
+  double gravity;
+  // Joints that moved less than eps keep their cached frames
+  double eps;
+
+  // State of the last update
+  int valid;
+  double qc[DYN_NJ], rpyc[2];
+  double cq[DYN_NJ], sq[DYN_NJ];
+  Transform base;
+  Transform link[DYN_NJ];
+  double z[DYN_NJ][3], o[DYN_NJ][3];  // joint axes and origins
+  // First moment and inertia about the origin of each link, then of each subtree
+  double hlink[DYN_NJ][3], Ilink[DYN_NJ][6];
+  double msub[DYN_NJ], hsub[DYN_NJ][3], Isub[DYN_NJ][6];
+  double com_total[4];
+};
+
+void THOROP_dynamics_init(THOROPDynamics *d);
+// Cache the link frames and subtree inertias at q, with the pelvis at
+// roll and pitch rpy[0], rpy[1] (or level if rpy is NULL).
+// Only the subtrees below moved joints are recomputed, and their number of
+// links is returned
+int THOROP_dynamics_update(THOROPDynamics *d, const double *q, const double *rpy);
+// Joint torques for qd, qdd (NULL for zero) at the cached q, with optional
+// ground reaction forces on the soles {lx, ly, lz, rx, ry, rz}
+void THOROP_dynamics_inverse(const THOROPDynamics *d,
+  const double *qd, const double *qdd, const double *fFeet, double *tau);
+// DYN_NJ x DYN_NJ joint space mass matrix, row major
+void THOROP_dynamics_mass_matrix(const THOROPDynamics *d, double *H);
+// COM {x, y, z, mass} and its 3 x DYN_NJ Jacobian, row major
+void THOROP_dynamics_com_jacobian(const THOROPDynamics *d, double *com, double *J);
+// Zero moment point {x, y} on the plane at height zGround (or the lower sole
+// if NULL), for qd, qdd and the pelvis acceleration aBase (NULL for zero)
+void THOROP_dynamics_zmp(const THOROPDynamics *d, const double *qd,
+  const double *qdd, const double *aBase, const double *zGround, double *zmp);
+// Update, then COM, COM Jacobian and ZMP in one call
+int THOROP_dynamics_com_zmp(THOROPDynamics *d, const double *q, const double *rpy,
+  const double *qd, const double *qdd, const double *aBase, const double *zGround,
+  double *com, double *Jcom, double *zmp);
+
 void THOROP_kinematics_calculate_arm_torque(
 	double* stall_torque,double* b_matrx,
 	const double *rpyangle,	const double *qArm, int is_left);
@@ -51,7 +51,7 @@ Transform THOROP_kinematics_forward_r_leg(const double *q){
 
 
 //This does not have toe or heel automatic tilt - we no longer use this 
-std::vector<double> THOROP_kinematics_inverse_leg(Transform trLeg, int leg, double aShiftX, double aShiftY){
+std::vector<double> THOROP_kinematics_inverse_leg(const Transform &trLeg, int leg, double aShiftX, double aShiftY){
   std::vector<double> qLeg(6);
   Transform trInvLeg = inv(trLeg);
 
@@ -112,11 +112,10 @@ std::vector<double> THOROP_kinematics_inverse_leg(Transform trLeg, int leg, doub
 
 
 
-std::vector<double> THOROP_kinematics_inverse_leg_heellift(Transform trLeg, int leg, double aShiftX, double aShiftY,
+void THOROP_kinematics_inverse_leg_heellift(double *qLeg, Transform trLeg, int leg, double aShiftX, double aShiftY,
                                                            int birdwalk, double anklePitchCurrent,
                                                            double heelliftMin){
 
-  std::vector<double> qLeg(6);
 
   trLeg.rotateX(aShiftX).rotateY(aShiftY);
 
@@ -379,6 +378,12 @@ std::vector<double> THOROP_kinematics_inverse_leg_heellift(Transform trLeg, int
   qLeg[5] = ankleRollNew;
 
 
+}
+
+std::vector<double> THOROP_kinematics_inverse_leg_heellift(const Transform &trLeg, int leg, double aShiftX, double aShiftY,
+        int birdwalk, double anklePitchCurrent, double heelliftMin){
+  std::vector<double> qLeg(6);
+  THOROP_kinematics_inverse_leg_heellift(&qLeg[0], trLeg, leg, aShiftX, aShiftY, birdwalk, anklePitchCurrent, heelliftMin);
   return qLeg;
 }
 
@@ -399,11 +404,10 @@ std::vector<double> THOROP_kinematics_inverse_leg_heellift(Transform trLeg, int
 
 
 
-std::vector<double> THOROP_kinematics_inverse_leg_toelift(Transform trLeg, int leg, double aShiftX, double aShiftY,
+void THOROP_kinematics_inverse_leg_toelift(double *qLeg, Transform trLeg, int leg, double aShiftX, double aShiftY,
         int birdwalk, double anklePitchCurrent, double toeliftMin){
 
   //TODOTODOTODOTODOTODO!!!!!!!!!!!!!!
-  std::vector<double> qLeg(6);
 
   trLeg.rotateX(aShiftX).rotateY(aShiftY);
 
@@ -684,12 +688,18 @@ std::vector<double> THOROP_kinematics_inverse_leg_toelift(Transform trLeg, int l
 
 
   
+}
+
+std::vector<double> THOROP_kinematics_inverse_leg_toelift(const Transform &trLeg, int leg, double aShiftX, double aShiftY,
+        int birdwalk, double anklePitchCurrent, double toeliftMin){
+  std::vector<double> qLeg(6);
+  THOROP_kinematics_inverse_leg_toelift(&qLeg[0], trLeg, leg, aShiftX, aShiftY, birdwalk, anklePitchCurrent, toeliftMin);
   return qLeg;
 }
 
 
 double THOROP_kinematics_inverse_leg_bodyheight_diff(
-  Transform trLeg, int leg, double aShiftX, double aShiftY){
+  const Transform &trLeg, int leg, double aShiftX, double aShiftY){
   
   std::vector<double> qLeg(6);
   Transform trInvLeg = inv(trLeg);
@@ -736,8 +746,8 @@ double THOROP_kinematics_inverse_leg_bodyheight_diff(
 
 
 
-std::vector<double>THOROP_kinematics_inverse_l_leg(Transform trLeg, double aShiftX, double aShiftY){
+std::vector<double>THOROP_kinematics_inverse_l_leg(const Transform &trLeg, double aShiftX, double aShiftY){
   return THOROP_kinematics_inverse_leg(trLeg, LEG_LEFT,aShiftX,  aShiftY);}
 
-std::vector<double>THOROP_kinematics_inverse_r_leg(Transform trLeg, double aShiftX, double aShiftY){
+std::vector<double>THOROP_kinematics_inverse_r_leg(const Transform &trLeg, double aShiftX, double aShiftY){
   return THOROP_kinematics_inverse_leg(trLeg, LEG_RIGHT, aShiftX,  aShiftY);}
\ No newline at end of file
@@ -1,7 +1,8 @@
 #include "THOROPKinematics.h"
 
-std::vector<double>
+void
 THOROP_kinematics_calculate_com_positions(
+    double *r,
     const double *qWaist,
     const double *qLArm,
     const double *qRArm,
@@ -27,7 +28,8 @@ THOROP_kinematics_calculate_com_positions(
     tLLeg0, tLLeg1, tLLeg2, tLLeg3, tLLeg4, tLLeg5,
     tRLeg0, tRLeg1, tRLeg2, tRLeg3, tRLeg4, tRLeg5,
     
-    tPelvisCOM, tTorsoCOM
+    tPelvisCOM, tTorsoCOM,
+    frame
     ;
     
   //COM is calculated based on PELVIS frame
@@ -42,135 +44,51 @@ THOROP_kinematics_calculate_com_positions(
   .rotateZ(qWaist[0]); //for mk2 body, fixed
  
 
-  tLArm0= trcopy(tTorso).translate(armLinkL[0])
-          .rotateY(qLArm[0]);
-
-  tLArm1= trcopy(tTorso).translate(armLinkL[0])
-          .rotateY(qLArm[0]).rotateZ(qLArm[1])
-          .translate(armComL[1]);
-
-  tLArm2= trcopy(tTorso).translate(armLinkL[0])
-          .rotateY(qLArm[0]).rotateZ(qLArm[1])
-          .translate(armLinkL[2]).rotateX(qLArm[2])
+  // Each link frame extends the previous one
+  frame = trcopy(tTorso).translate(armLinkL[0]).rotateY(qLArm[0]);
+  tLArm0 = frame;
+  tLArm1 = trcopy(frame.rotateZ(qLArm[1])).translate(armComL[1]);
+  tLArm2 = trcopy(frame.translate(armLinkL[2]).rotateX(qLArm[2]))
           .translate(armComL[2]);
-
-  tLArm3= trcopy(tTorso).translate(armLinkL[0])
-          .rotateY(qLArm[0]).rotateZ(qLArm[1])
-          .translate(armLinkL[2]).rotateX(qLArm[2])
-          .translate(armLinkL[3]).rotateY(qLArm[3])
+  tLArm3 = trcopy(frame.translate(armLinkL[3]).rotateY(qLArm[3]))
           .translate(armComL[3]);
-
-  tLArm4= trcopy(tTorso).translate(armLinkL[0])
-          .rotateY(qLArm[0]).rotateZ(qLArm[1])
-          .translate(armLinkL[2]).rotateX(qLArm[2])
-          .translate(armLinkL[3]).rotateY(qLArm[3])
-          .translate(armLinkL[4]).rotateX(qLArm[4])
+  tLArm4 = trcopy(frame.translate(armLinkL[4]).rotateX(qLArm[4]))
           .translate(armComL[4]);
+  tLArm5 = trcopy(frame.rotateZ(qLArm[5])).translate(armComL[5]);
+  tLArm6 = trcopy(frame.rotateX(qLArm[6])).translate(armComL[6]);
 
-  tLArm5= trcopy(tTorso).translate(armLinkL[0])
-          .rotateY(qLArm[0]).rotateZ(qLArm[1])
-          .translate(armLinkL[2]).rotateX(qLArm[2])
-          .translate(armLinkL[3]).rotateY(qLArm[3])
-          .translate(armLinkL[4]).rotateX(qLArm[4])
-          .rotateZ(qLArm[5]).translate(armComL[5]);
-
-  tLArm6= trcopy(tTorso).translate(armLinkL[0])
-          .rotateY(qLArm[0]).rotateZ(qLArm[1])
-          .translate(armLinkL[2]).rotateX(qLArm[2])
-          .translate(armLinkL[3]).rotateY(qLArm[3])
-          .translate(armLinkL[4]).rotateX(qLArm[4])
-          .rotateZ(qLArm[5]).rotateX(qLArm[6])
-          .translate(armComL[6]);
-
-
-  tRArm0= trcopy(tTorso).translate(armLinkR[0])
-          .rotateY(qRArm[0]);          
-
-  tRArm1= trcopy(tTorso).translate(armLinkR[0])
-          .rotateY(qRArm[0]).rotateZ(qRArm[1])
-          .translate(armComR[1]);
-
-  tRArm2= trcopy(tTorso).translate(armLinkR[0])
-          .rotateY(qRArm[0]).rotateZ(qRArm[1])
-          .translate(armLinkR[2]).rotateX(qRArm[2])
+  frame = trcopy(tTorso).translate(armLinkR[0]).rotateY(qRArm[0]);
+  tRArm0 = frame;
+  tRArm1 = trcopy(frame.rotateZ(qRArm[1])).translate(armComR[1]);
+  tRArm2 = trcopy(frame.translate(armLinkR[2]).rotateX(qRArm[2]))
           .translate(armComR[2]);
-
-  tRArm3= trcopy(tTorso).translate(armLinkR[0])
-          .rotateY(qRArm[0]).rotateZ(qRArm[1])
-          .translate(armLinkR[2]).rotateX(qRArm[2])
-          .translate(armLinkR[3]).rotateY(qRArm[3])
+  tRArm3 = trcopy(frame.translate(armLinkR[3]).rotateY(qRArm[3]))
           .translate(armComR[3]);
-
-  tRArm4= trcopy(tTorso).translate(armLinkR[0])
-          .rotateY(qRArm[0]).rotateZ(qRArm[1])
-          .translate(armLinkR[2]).rotateX(qRArm[2])
-          .translate(armLinkR[3]).rotateY(qRArm[3])
-          .translate(armLinkR[4]).rotateX(qRArm[4])
-          .translate(armComR[4]);          
-
-  tRArm5= trcopy(tTorso).translate(armLinkR[0])
-          .rotateY(qRArm[0]).rotateZ(qRArm[1])
-          .translate(armLinkR[2]).rotateX(qRArm[2])
-          .translate(armLinkR[3]).rotateY(qRArm[3])
-          .translate(armLinkR[4]).rotateX(qRArm[4])
-          .rotateZ(qRArm[5]).translate(armComR[5]);
-
-  tRArm6= trcopy(tTorso).translate(armLinkR[0])
-          .rotateY(qRArm[0]).rotateZ(qRArm[1])
-          .translate(armLinkR[2]).rotateX(qRArm[2])
-          .translate(armLinkR[3]).rotateY(qRArm[3])
-          .translate(armLinkR[4]).rotateX(qRArm[4])
-          .rotateZ(qRArm[5]).rotateX(qRArm[6])
-          .translate(armComR[6]);
-
-  tLLeg0 = trcopy(tPelvis).translate(llegLink0)
-          .rotateZ(qLLeg[0])
-          .translate(legCom[0]);
-  tLLeg1 = trcopy(tPelvis).translate(llegLink0)
-          .rotateZ(qLLeg[0]).rotateX(qLLeg[1])
-          .translate(legCom[1]);
-  tLLeg2 = trcopy(tPelvis).translate(llegLink0)
-          .rotateZ(qLLeg[0]).rotateX(qLLeg[1]).rotateY(qLLeg[2])
-          .translate(legCom[2]);
-  tLLeg3 = trcopy(tPelvis).translate(llegLink0)
-          .rotateZ(qLLeg[0]).rotateX(qLLeg[1]).rotateY(qLLeg[2])
-          .translate(legLink[3]).rotateY(qLLeg[3])
+  tRArm4 = trcopy(frame.translate(armLinkR[4]).rotateX(qRArm[4]))
+          .translate(armComR[4]);
+  tRArm5 = trcopy(frame.rotateZ(qRArm[5])).translate(armComR[5]);
+  tRArm6 = trcopy(frame.rotateX(qRArm[6])).translate(armComR[6]);
+
+  frame = trcopy(tPelvis).translate(llegLink0).rotateZ(qLLeg[0]);
+  tLLeg0 = trcopy(frame).translate(legCom[0]);
+  tLLeg1 = trcopy(frame.rotateX(qLLeg[1])).translate(legCom[1]);
+  tLLeg2 = trcopy(frame.rotateY(qLLeg[2])).translate(legCom[2]);
+  tLLeg3 = trcopy(frame.translate(legLink[3]).rotateY(qLLeg[3]))
           .translate(legCom[3]);
-  tLLeg4 = trcopy(tPelvis).translate(llegLink0)
-          .rotateZ(qLLeg[0]).rotateX(qLLeg[1]).rotateY(qLLeg[2])
-          .translate(legLink[3]).rotateY(qLLeg[3])
-          .translate(legLink[4]).rotateY(qLLeg[4])
+  tLLeg4 = trcopy(frame.translate(legLink[4]).rotateY(qLLeg[4]))
           .translate(legCom[4]);
-  tLLeg5 = trcopy(tPelvis).translate(llegLink0)
-          .rotateZ(qLLeg[0]).rotateX(qLLeg[1]).rotateY(qLLeg[2])
-          .translate(legLink[3]).rotateY(qLLeg[3])
-          .translate(legLink[4]).rotateY(qLLeg[4])
-          .translate(legLink[5]).rotateY(qLLeg[5])
+  tLLeg5 = trcopy(frame.translate(legLink[5]).rotateY(qLLeg[5]))
           .translate(legCom[5]);
 
-  tRLeg0 = trcopy(tPelvis).translate(rlegLink0)
-          .rotateZ(qRLeg[0])
-          .translate(legCom[6]);
-  tRLeg1 = trcopy(tPelvis).translate(rlegLink0)
-          .rotateZ(qRLeg[0]).rotateX(qRLeg[1])
-          .translate(legCom[7]);
-  tRLeg2 = trcopy(tPelvis).translate(rlegLink0)
-          .rotateZ(qRLeg[0]).rotateX(qRLeg[1]).rotateY(qRLeg[2])
-          .translate(legCom[8]);
-  tRLeg3 = trcopy(tPelvis).translate(rlegLink0)
-          .rotateZ(qRLeg[0]).rotateX(qRLeg[1]).rotateY(qRLeg[2])
-          .translate(legLink[3]).rotateY(qRLeg[3])
+  frame = trcopy(tPelvis).translate(rlegLink0).rotateZ(qRLeg[0]);
+  tRLeg0 = trcopy(frame).translate(legCom[6]);
+  tRLeg1 = trcopy(frame.rotateX(qRLeg[1])).translate(legCom[7]);
+  tRLeg2 = trcopy(frame.rotateY(qRLeg[2])).translate(legCom[8]);
+  tRLeg3 = trcopy(frame.translate(legLink[3]).rotateY(qRLeg[3]))
           .translate(legCom[9]);
-  tRLeg4 = trcopy(tPelvis).translate(rlegLink0)
-          .rotateZ(qRLeg[0]).rotateX(qRLeg[1]).rotateY(qRLeg[2])
-          .translate(legLink[3]).rotateY(qRLeg[3])
-          .translate(legLink[4]).rotateY(qRLeg[4])
+  tRLeg4 = trcopy(frame.translate(legLink[4]).rotateY(qRLeg[4]))
           .translate(legCom[10]);
-  tRLeg5 = trcopy(tPelvis).translate(rlegLink0)
-          .rotateZ(qRLeg[0]).rotateX(qRLeg[1]).rotateY(qRLeg[2])
-          .translate(legLink[3]).rotateY(qRLeg[3])
-          .translate(legLink[4]).rotateY(qRLeg[4])
-          .translate(legLink[5]).rotateY(qRLeg[5])
+  tRLeg5 = trcopy(frame.translate(legLink[5]).rotateY(qRLeg[5]))
           .translate(legCom[11]);
 
 
@@ -189,7 +107,6 @@ THOROP_kinematics_calculate_com_positions(
 
 
 //make a single compound COM position (from pelvis frame)
-  std::vector<double> r(4);
 
 
  r[0] = 
@@ -258,6 +175,18 @@ THOROP_kinematics_calculate_com_positions(
   for (i=0;i<7;i++) r[3]+=MassArmL[i]+MassArmR[i];
   for (i=0;i<6;i++) r[3]+=(use_lleg+use_rleg)*MassLeg[i];
 
+}
+
+std::vector<double>
+THOROP_kinematics_calculate_com_positions(
+    const double *qWaist,  const double *qLArm,   const double *qRArm,
+    const double *qLLeg,   const double *qRLeg,
+    double mLHand, double mRHand, double bodyPitch,
+    int use_lleg, int use_rleg, int birdwalk
+    ){
+  std::vector<double> r(4);
+  THOROP_kinematics_calculate_com_positions(&r[0], qWaist, qLArm, qRArm, qLLeg, qRLeg,
+    mLHand, mRHand, bodyPitch, use_lleg, use_rleg, birdwalk);
   return r;
 }
 
@@ -288,15 +217,6 @@ int THOROP_kinematics_check_collision(const double *qLArm,const double *qRArm){
     .translateZ(elbowOffsetX)
     .rotateY(qLArm[3]);
   
-  Transform tLWrist = trcopy(tLElbow)
-    .translateZ(-elbowOffsetX)
-    .rotateX(qLArm[4]);         
-  
-  Transform tLHand = trcopy(tLWrist)
-    .translateX(lowerArmLengthL)          
-    .rotateZ(qLArm[5])
-    .rotateX(qLArm[6]);
-
   Transform tRShoulder = trcopy(tTorso)
     .translateY(-shoulderOffsetY)
     .translateZ(shoulderOffsetZ)        
@@ -309,15 +229,6 @@ int THOROP_kinematics_check_collision(const double *qLArm,const double *qRArm){
     .translateZ(elbowOffsetX)
     .rotateY(qRArm[3]);    
 
-  Transform tRWrist = trcopy(tRElbow)
-    .translateZ(-elbowOffsetX)
-    .rotateX(qRArm[4]);            
-
-  Transform tRHand = trcopy(tRWrist)
-    .translateX(lowerArmLengthR)          
-    .rotateZ(qRArm[5])
-    .rotateX(qRArm[6]);
-
   //Elbow should always be outside the shoulder
   if ((tLElbow(1,3)<tLShoulder(1,3))||(tRElbow(1,3)>tRShoulder(1,3))){
     printf("Elbow collision!\n");
@@ -332,14 +243,13 @@ int THOROP_kinematics_check_collision_single(const double *qArm,int is_left){
 
 
   /* inverse kinematics to convert joint angles to servo positions */
-  std::vector<double> r(4);
 
   Transform tTorso;
   Transform tShoulder;
 
 
 
-  double upperArmLength, lowerArmLength;
+  double upperArmLength;
 
   //TODOTODOTODOTODO
 
@@ -349,7 +259,6 @@ int THOROP_kinematics_check_collision_single(const double *qArm,int is_left){
 
   if (is_left>0){
     upperArmLength = upperArmLengthL;
-    lowerArmLength = lowerArmLengthL;
     tShoulder = trcopy(tTorso)
       .translateY(shoulderOffsetY)
       .translateZ(shoulderOffsetZ)        
@@ -359,7 +268,6 @@ int THOROP_kinematics_check_collision_single(const double *qArm,int is_left){
   }
   else{
     upperArmLength = upperArmLengthR;
-    lowerArmLength = lowerArmLengthR;
     tShoulder = trcopy(tTorso)
       .translateY(-shoulderOffsetY)
       .translateZ(shoulderOffsetZ)        
@@ -373,11 +281,6 @@ int THOROP_kinematics_check_collision_single(const double *qArm,int is_left){
     .translateZ(elbowOffsetX)
     .rotateY(qArm[3]);
   
-  Transform tWrist = trcopy(tElbow)
-    .translateZ(-elbowOffsetX)
-    .translateX(lowerArmLength)          
-    .rotateX(qArm[4]);         
-
 /*  
   Transform tLHand = trcopy(tLWrist)
 
@@ -443,515 +346,87 @@ THOROP_kinematics_calculate_zmp(
 }
 
 
+// Whole body model with only one arm moving
+static int arm_dynamics(THOROPDynamics *d, const double *rpyangle,
+  const double *qArm, int is_left) {
+  double q[DYN_NJ] = {0};
+  int off = is_left==1 ? DYN_LARM : DYN_RARM;
+  for (int i = 0; i < 7; i++) q[off+i] = qArm[i];
+  THOROP_dynamics_init(d);
+  THOROP_dynamics_update(d, q, rpyangle);
+  return off;
+}
+
+// acc_torque is the inertial term H qdd, and acc_torque2 the velocity
+// product term C qd, both exact so dq is unused
 void THOROP_kinematics_calculate_arm_torque_adv(
   double* stall_torque,double* acc_torque,double* acc_torque2,const double *rpyangle,
   const double *qArm,const double *qArmVel,const double *qArmAcc,double dq, int is_left){
 
-  double dummy[7];
-  double qArmDq[7];
-  double b_matrix0[49];
-  double b_matrix[7][49];
-
-  int i,j,k;
-  for (i=0;i<7;i++) {
-    qArmDq[i]=qArm[i];
-    stall_torque[i]=0;
-    acc_torque[i]=0;
-    acc_torque2[i]=0;
-  }
-
-  THOROP_kinematics_calculate_arm_torque(stall_torque, b_matrix0, rpyangle,qArm , is_left);    
-
-/*
-  printf("B matrix:\n");
-  for(i=0;i<7;i++){ 
-    for (j=0;j<7;j++)
-      printf("%.6f ",b_matrix0[i*7+j]);
-    printf("\n");
-  }
-  printf("\n");
-*/
-
-  qArmDq[0]=qArm[0]+dq;  
-  THOROP_kinematics_calculate_arm_torque(dummy, b_matrix[0], rpyangle,qArmDq, is_left);
-  qArmDq[0]=qArm[0];  
-  qArmDq[1]=qArm[1]+dq;  
-  THOROP_kinematics_calculate_arm_torque(dummy, b_matrix[1], rpyangle,qArmDq, is_left);
-  qArmDq[1]=qArm[1];  
-  qArmDq[2]=qArm[2]+dq;  
-  THOROP_kinematics_calculate_arm_torque(dummy, b_matrix[2], rpyangle,qArmDq, is_left);
-  qArmDq[2]=qArm[2];  
-  qArmDq[3]=qArm[3]+dq;  
-  THOROP_kinematics_calculate_arm_torque(dummy, b_matrix[3], rpyangle,qArmDq, is_left);
-  qArmDq[3]=qArm[3];  
-  qArmDq[4]=qArm[4]+dq;  
-  THOROP_kinematics_calculate_arm_torque(dummy, b_matrix[4], rpyangle,qArmDq, is_left);
-  qArmDq[4]=qArm[4];  
-  qArmDq[5]=qArm[5]+dq;  
-  THOROP_kinematics_calculate_arm_torque(dummy, b_matrix[5], rpyangle,qArmDq, is_left);
-  qArmDq[5]=qArm[5];  
-  qArmDq[6]=qArm[6]+dq;  
-  THOROP_kinematics_calculate_arm_torque(dummy, b_matrix[6], rpyangle,qArmDq, is_left);
-  qArmDq[6]=qArm[6];  
-
-  for(i=0;i<7;i++) for (j=0;j<49;j++)
-    b_matrix[i][j]=(b_matrix[i][j]-b_matrix0[j])/dq;
-/*
-  printf("B2 matrix:\n");
-  for(i=0;i<7;i++){ 
-    for (j=0;j<7;j++)
-      printf("%.4f ",b_matrix[2][i*7+j]);
-    printf("\n");
+  THOROPDynamics d;
+  double qd[DYN_NJ] = {0}, qdd[DYN_NJ] = {0}, tau[DYN_NJ];
+  (void)dq;
+  int off = arm_dynamics(&d, rpyangle, qArm, is_left);
+  for (int i = 0; i < 7; i++) {
+    qd[off+i] = qArmVel[i];
+    qdd[off+i] = qArmAcc[i];
   }
-  printf("\n");
-*/
-
-
-  for(k=0;k<7;k++){
-    for(j=0;j<7;j++){
-      //linear term
-      acc_torque[k]+=b_matrix0[k*7+j]*qArmAcc[j];
 
-      //quadratic term
-      for(i=0;i<7;i++){
-        acc_torque2[k]+=(b_matrix[i][k*7+j]-0.5*b_matrix[k][i*7+j]) *qArmVel[i]*qArmVel[j];
-      }
-    }
-  }
-/*
-  printf("Acc torque:");
-  for(k=0;k<7;k++){printf("%.5f ",acc_torque[k]);}
-  printf("\n");
-  printf("Acc2 torque:");
-  for(k=0;k<7;k++){printf("%.5f ",acc_torque2[k]);}
-  printf("\n");
-*/
+  THOROP_dynamics_inverse(&d, NULL, NULL, NULL, tau);
+  for (int i = 0; i < 7; i++) stall_torque[i] = tau[off+i];
+  d.gravity = 0;
+  THOROP_dynamics_inverse(&d, NULL, qdd, NULL, tau);
+  for (int i = 0; i < 7; i++) acc_torque[i] = tau[off+i];
+  THOROP_dynamics_inverse(&d, qd, NULL, NULL, tau);
+  for (int i = 0; i < 7; i++) acc_torque2[i] = tau[off+i];
 }
 
-
-
-
 void THOROP_kinematics_calculate_arm_torque(
   double* stall_torque, double* b_matrix,
   const double *rpyangle,const double *qArm,
   int is_left
   ){
 
-  Transform 
-    COM0,COM1,COM2,COM3,COM4,COM5,COM6,
-
-    Jac00,
-    Jac10,Jac11,
-    Jac20,Jac21,Jac22,
-    Jac30,Jac31,Jac32,Jac33,
-    Jac40,Jac41,Jac42,Jac43,Jac44,
-    Jac50,Jac51,Jac52,Jac53,Jac54,Jac55,
-    Jac60,Jac61,Jac62,Jac63,Jac64,Jac65,Jac66;
-  int i;
-  for (i=0;i<7;i++) stall_torque[i]=0;
-  for (i=0;i<49;i++) b_matrix[i]=0;
-
-  const double* armLink[7];
-  const double* armCom[7];
-  double MassArm[7];
-  
-  for(i=0;i<7;i++){
-    if (is_left==1){
-      armLink[i]=armLinkL[i];
-      armCom[i]=armComL[i];
-      MassArm[i]=MassArmL[7];
-    }else{
-      armLink[i]=armLinkR[i];
-      armCom[i]=armComR[i];
-      MassArm[i]=MassArmR[7];
-    }
+  THOROPDynamics d;
+  double tau[DYN_NJ], H[DYN_NJ*DYN_NJ];
+  int off = arm_dynamics(&d, rpyangle, qArm, is_left);
+  THOROP_dynamics_inverse(&d, NULL, NULL, NULL, tau);
+  THOROP_dynamics_mass_matrix(&d, H);
+  for (int i = 0; i < 7; i++) {
+    stall_torque[i] = tau[off+i];
+    for (int j = 0; j < 7; j++) b_matrix[i*7+j] = H[(off+i)*DYN_NJ+off+j];
   }
-  
-  Transform torso;
-  torso.rotateX(rpyangle[0]).rotateY(rpyangle[1]);
-
-  //more compact calculation
-  COM0 = trcopy(torso).rotateY(qArm[0]).translate(armCom[0]);
-  Jac00= trcopy(torso).rotateDotY(qArm[0]);  //d (com0) / dq0
-
-  COM1= trcopy(torso).rotateY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armCom[1]);
-  Jac10= trcopy(torso).rotateDotY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armCom[1]);
-  Jac11= trcopy(torso).rotateY(qArm[0]).translate(armLink[1])
-        .rotateDotZ(qArm[1]).translate(armCom[1]);
-
-  COM2= trcopy(torso).rotateY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armCom[2]);
-  Jac20= trcopy(torso).rotateDotY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armCom[2]);
-  Jac21= trcopy(torso).rotateY(qArm[0]).translate(armLink[1])
-        .rotateDotZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armCom[2]);
-  Jac22= trcopy(torso).rotateY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateDotX(qArm[2]).translate(armCom[2]);
-
-  COM3= trcopy(torso).rotateY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armLink[3])
-        .rotateY(qArm[3]).translate(armCom[3]);
-  Jac30= trcopy(torso).rotateDotY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armLink[3])
-        .rotateY(qArm[3]).translate(armCom[3]);
-  Jac31= trcopy(torso).rotateY(qArm[0]).translate(armLink[1]) 
-        .rotateDotZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armLink[3])
-        .rotateY(qArm[3]).translate(armCom[3]);
-  Jac32= trcopy(torso).rotateY(qArm[0]).translate(armLink[1]) 
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateDotX(qArm[2]).translate(armLink[3])
-        .rotateY(qArm[3]).translate(armCom[3]);
-  Jac33= trcopy(torso).rotateY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armLink[3])
-        .rotateDotY(qArm[3]).translate(armCom[3]);
-
-  COM4= trcopy(torso).rotateY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armLink[3])
-        .rotateY(qArm[3]).translate(armLink[4])
-        .rotateX(qArm[4]).translate(armCom[4]);
-  Jac40= trcopy(torso).rotateDotY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armLink[3])
-        .rotateY(qArm[3]).translate(armLink[4])
-        .rotateX(qArm[4]).translate(armCom[4]);
-  Jac41= trcopy(torso).rotateY(qArm[0]).translate(armLink[1]) 
-        .rotateDotZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armLink[3])
-        .rotateY(qArm[3]).translate(armLink[4])
-        .rotateX(qArm[4]).translate(armCom[4]);
-  Jac42= trcopy(torso).rotateY(qArm[0]).translate(armLink[1]) 
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateDotX(qArm[2]).translate(armLink[3])
-        .rotateY(qArm[3]).translate(armLink[4])
-        .rotateX(qArm[4]).translate(armCom[4]);
-  Jac43= trcopy(torso).rotateY(qArm[0]).translate(armLink[1]) 
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armLink[3])
-        .rotateDotY(qArm[3]).translate(armLink[4])
-        .rotateX(qArm[4]).translate(armCom[4]);
-  Jac44= trcopy(torso).rotateY(qArm[0]).translate(armLink[1]) 
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armLink[3])
-        .rotateY(qArm[3]).translate(armLink[4])
-        .rotateDotX(qArm[4]).translate(armCom[4]);
-
-  COM5= trcopy(torso).rotateY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armLink[3])
-        .rotateY(qArm[3]).translate(armLink[4])
-        .rotateX(qArm[4]).translate(armLink[5])
-        .rotateZ(qArm[5]).translate(armCom[5]);
-  Jac50= trcopy(torso).rotateDotY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armLink[3])
-        .rotateY(qArm[3]).translate(armLink[4])
-        .rotateX(qArm[4]).translate(armLink[5])
-        .rotateZ(qArm[5]).translate(armCom[5]);
-  Jac51= trcopy(torso).rotateY(qArm[0]).translate(armLink[1])
-        .rotateDotZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armLink[3])
-        .rotateY(qArm[3]).translate(armLink[4])
-        .rotateX(qArm[4]).translate(armLink[5])
-        .rotateZ(qArm[5]).translate(armCom[5]);
-  Jac52= trcopy(torso).rotateY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateDotX(qArm[2]).translate(armLink[3])
-        .rotateY(qArm[3]).translate(armLink[4])
-        .rotateX(qArm[4]).translate(armLink[5])
-        .rotateZ(qArm[5]).translate(armCom[5]);
-  Jac53= trcopy(torso).rotateY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armLink[3])
-        .rotateDotY(qArm[3]).translate(armLink[4])
-        .rotateX(qArm[4]).translate(armLink[5])
-        .rotateZ(qArm[5]).translate(armCom[5]);
-  Jac54= trcopy(torso).rotateY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armLink[3])
-        .rotateY(qArm[3]).translate(armLink[4])
-        .rotateDotX(qArm[4]).translate(armLink[5])
-        .rotateZ(qArm[5]).translate(armCom[5]);
-  Jac55= trcopy(torso).rotateY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armLink[3])
-        .rotateY(qArm[3]).translate(armLink[4])
-        .rotateX(qArm[4]).translate(armLink[5])
-        .rotateDotZ(qArm[5]).translate(armCom[5]);
-
-  COM6= trcopy(torso).rotateY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armLink[3])
-        .rotateY(qArm[3]).translate(armLink[4])
-        .rotateX(qArm[4]).translate(armLink[5])
-        .rotateZ(qArm[5]).translate(armLink[6])
-        .rotateX(qArm[6]).translate(armCom[6]);
-  Jac60= trcopy(torso).rotateDotY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armLink[3])
-        .rotateY(qArm[3]).translate(armLink[4])
-        .rotateX(qArm[4]).translate(armLink[5])
-        .rotateZ(qArm[5]).translate(armLink[6])
-        .rotateX(qArm[6]).translate(armCom[6]);
-  Jac61= trcopy(torso).rotateY(qArm[0]).translate(armLink[1])
-        .rotateDotZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armLink[3])
-        .rotateY(qArm[3]).translate(armLink[4])
-        .rotateX(qArm[4]).translate(armLink[5])
-        .rotateZ(qArm[5]).translate(armLink[6])
-        .rotateX(qArm[6]).translate(armCom[6]);
-  Jac62= trcopy(torso).rotateY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateDotX(qArm[2]).translate(armLink[3])
-        .rotateY(qArm[3]).translate(armLink[4])
-        .rotateX(qArm[4]).translate(armLink[5])
-        .rotateZ(qArm[5]).translate(armLink[6])
-        .rotateX(qArm[6]).translate(armCom[6]);
-  Jac63= trcopy(torso).rotateY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armLink[3])
-        .rotateDotY(qArm[3]).translate(armLink[4])
-        .rotateX(qArm[4]).translate(armLink[5])
-        .rotateZ(qArm[5]).translate(armLink[6])
-        .rotateX(qArm[6]).translate(armCom[6]);
-  Jac64= trcopy(torso).rotateY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armLink[3])
-        .rotateY(qArm[3]).translate(armLink[4])
-        .rotateDotX(qArm[4]).translate(armLink[5])
-        .rotateZ(qArm[5]).translate(armLink[6])
-        .rotateX(qArm[6]).translate(armCom[6]);
-  Jac65= trcopy(torso).rotateY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armLink[3])
-        .rotateY(qArm[3]).translate(armLink[4])
-        .rotateX(qArm[4]).translate(armLink[5])
-        .rotateDotZ(qArm[5]).translate(armLink[6])
-        .rotateX(qArm[6]).translate(armCom[6]);
-  Jac66= trcopy(torso).rotateY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armLink[3])
-        .rotateY(qArm[3]).translate(armLink[4])
-        .rotateX(qArm[4]).translate(armLink[5])
-        .rotateZ(qArm[5]).translate(armLink[6])
-        .rotateDotX(qArm[6]).translate(armCom[6]);
-
-  Transform JacZZ;
-  Jacobian J0,J1,J2,J3,J4,J5,J6;
-  J0.calculate7(COM0,Jac00,JacZZ,JacZZ,JacZZ,JacZZ,JacZZ,JacZZ, MassArm[0],InertiaArm[0]);  
-  J1.calculate7(COM1,Jac10,Jac11,JacZZ,JacZZ,JacZZ,JacZZ,JacZZ, MassArm[1],InertiaArm[1]);
-  J2.calculate7(COM2,Jac20,Jac21,Jac22,JacZZ,JacZZ,JacZZ,JacZZ, MassArm[2],InertiaArm[2]);  
-  J3.calculate7(COM3,Jac30,Jac31,Jac32,Jac33,JacZZ,JacZZ,JacZZ, MassArm[3],InertiaArm[3]);
-  J4.calculate7(COM4,Jac40,Jac41,Jac42,Jac43,Jac44,JacZZ,JacZZ, MassArm[4],InertiaArm[4]);  
-  J5.calculate7(COM5,Jac50,Jac51,Jac52,Jac53,Jac54,Jac55,JacZZ, MassArm[5],InertiaArm[5]);
-  J6.calculate7(COM6,Jac60,Jac61,Jac62,Jac63,Jac64,Jac65,Jac66, MassArm[6],InertiaArm[6]);
-  
-  J0.accumulate_stall_torque(stall_torque, 0.0,0.0,MassArm[0]*g);
-  J1.accumulate_stall_torque(stall_torque, 0.0,0.0,MassArm[1]*g);
-  J2.accumulate_stall_torque(stall_torque, 0.0,0.0,MassArm[2]*g);
-  J3.accumulate_stall_torque(stall_torque, 0.0,0.0,MassArm[3]*g);
-  J4.accumulate_stall_torque(stall_torque, 0.0,0.0,MassArm[4]*g);
-  J5.accumulate_stall_torque(stall_torque, 0.0,0.0,MassArm[5]*g);
-  J6.accumulate_stall_torque(stall_torque, 0.0,0.0,MassArm[6]*g);  
-
-  J0.dump_b_matrix(b_matrix);
-  J1.dump_b_matrix(b_matrix);
-  J2.dump_b_matrix(b_matrix);
-  J3.dump_b_matrix(b_matrix);
-  J4.dump_b_matrix(b_matrix);
-  J5.dump_b_matrix(b_matrix);
-  J6.dump_b_matrix(b_matrix);
 }
 
 
 
+
+// Leg joint torques with the vertical ground reaction grf
+// at the support point {x, y} on the sole.
+// This was a stub that left both outputs unset, so callers such as
+// SJ_OLD/armPose1.lua read garbage from it before
 void THOROP_kinematics_calculate_leg_torque(
   double* stall_torque,double* b_matrx,
   const double *rpyangle,const double *qLeg,
   int isLeft, double grf, const double *support){
 
-/*
-  int index = 6;
-  if (isLeft>0) index = 0;
-
-  Transform 
-    COM0,COM1,COM2,COM3,COM4,COM5,COMS,
-    Jac00,
-    Jac10,Jac11,
-    Jac20,Jac21,Jac22,
-    Jac30,Jac31,Jac32,Jac33,
-    Jac40,Jac41,Jac42,Jac43,Jac44,
-    Jac50,Jac51,Jac52,Jac53,Jac54,Jac55,
-    JacS0,JacS1,JacS2,JacS3,JacS4,JacS5;
-
-  for (int i=0;i<6;i++) {stall_torque[i]=0;acc_torque[i]=0;}
-    
-  Transform torso;
-  torso.rotateX(rpyangle[0]).rotateY(rpyangle[1]);
-
-  COM0= trcopy(torso).rotateZ(qLeg[0]).translate(legCom[index]);
-  Jac00=trcopy(torso).rotateDotZ(qLeg[0]).translate(legCom[index]);
-
-  COM1= trcopy(torso).rotateZ(qLeg[0]).translate(legLink[1])
-       .rotateX(qLeg[1]).translate(legCom[index+1]);
-  Jac10=trcopy(torso).rotateDotZ(qLeg[0]).translate(legLink[1])
-       .rotateX(qLeg[1]).translate(legCom[index+1]);
-  Jac11=trcopy(torso).rotateZ(qLeg[0]).translate(legLink[1])
-       .rotateDotX(qLeg[1]).translate(legCom[index+1]);       
-
-  COM2= trcopy(torso).rotateZ(qLeg[0]).translate(legLink[1])
-       .rotateX(qLeg[1]).translate(legLink[2])
-       .rotateY(qLeg[2]).translate(legCom[index+2]);
-  Jac20=trcopy(torso).rotateDotZ(qLeg[0]).translate(legLink[1])
-       .rotateX(qLeg[1]).translate(legLink[2])
-       .rotateY(qLeg[2]).translate(legCom[index+2]);
-  Jac21=trcopy(torso).rotateZ(qLeg[0]).translate(legLink[1])
-       .rotateDotX(qLeg[1]).translate(legLink[2])
-       .rotateY(qLeg[2]).translate(legCom[index+2]);
-  Jac22=trcopy(torso).rotateZ(qLeg[0]).translate(legLink[1])
-       .rotateX(qLeg[1]).translate(legLink[2])
-       .rotateDotY(qLeg[2]).translate(legCom[index+2]);
-
-  COM3= trcopy(torso).rotateZ(qLeg[0]).translate(legLink[1])
-       .rotateX(qLeg[1]).translate(legLink[2])
-       .rotateY(qLeg[2]).translate(legLink[3])
-       .rotateY(qLeg[3]).translate(legCom[index+3]);
-  Jac30=trcopy(torso).rotateDotZ(qLeg[0]).translate(legLink[1])
-       .rotateX(qLeg[1]).translate(legLink[2])
-       .rotateY(qLeg[2]).translate(legLink[3])
-       .rotateY(qLeg[3]).translate(legCom[index+3]);
-  Jac31=trcopy(torso).rotateZ(qLeg[0]).translate(legLink[1])
-       .rotateDotX(qLeg[1]).translate(legLink[2])
-       .rotateY(qLeg[2]).translate(legLink[3])
-       .rotateY(qLeg[3]).translate(legCom[index+3]);
-  Jac32=trcopy(torso).rotateZ(qLeg[0]).translate(legLink[1])
-       .rotateX(qLeg[1]).translate(legLink[2])
-       .rotateDotY(qLeg[2]).translate(legLink[3])
-       .rotateY(qLeg[3]).translate(legCom[index+3]);
-  Jac33=trcopy(torso).rotateZ(qLeg[0]).translate(legLink[1])
-       .rotateX(qLeg[1]).translate(legLink[2])
-       .rotateY(qLeg[2]).translate(legLink[3])
-       .rotateDotY(qLeg[3]).translate(legCom[index+3]);
-
-  COM4=trcopy(torso).rotateZ(qLeg[0]).translate(legLink[1])
-       .rotateX(qLeg[1]).translate(legLink[2])
-       .rotateY(qLeg[2]).translate(legLink[3])
-       .rotateY(qLeg[3]).translate(legLink[4])
-       .rotateY(qLeg[4]).translate(legCom[index+4]);
-  Jac40=trcopy(torso).rotateDotZ(qLeg[0]).translate(legLink[1])
-       .rotateX(qLeg[1]).translate(legLink[2])
-       .rotateY(qLeg[2]).translate(legLink[3])
-       .rotateY(qLeg[3]).translate(legLink[4])
-       .rotateY(qLeg[4]).translate(legCom[index+4]);
-  Jac41=trcopy(torso).rotateZ(qLeg[0]).translate(legLink[1])
-       .rotateDotX(qLeg[1]).translate(legLink[2])
-       .rotateY(qLeg[2]).translate(legLink[3])
-       .rotateY(qLeg[3]).translate(legLink[4])
-       .rotateY(qLeg[4]).translate(legCom[index+4]);
-  Jac42=trcopy(torso).rotateZ(qLeg[0]).translate(legLink[1])
-       .rotateX(qLeg[1]).translate(legLink[2])
-       .rotateDotY(qLeg[2]).translate(legLink[3])
-       .rotateY(qLeg[3]).translate(legLink[4])
-       .rotateY(qLeg[4]).translate(legCom[index+4]);
-  Jac43=trcopy(torso).rotateZ(qLeg[0]).translate(legLink[1])
-       .rotateX(qLeg[1]).translate(legLink[2])
-       .rotateY(qLeg[2]).translate(legLink[3])
-       .rotateDotY(qLeg[3]).translate(legLink[4])
-       .rotateY(qLeg[4]).translate(legCom[index+4]);
-  Jac44=trcopy(torso).rotateZ(qLeg[0]).translate(legLink[1])
-       .rotateX(qLeg[1]).translate(legLink[2])
-       .rotateY(qLeg[2]).translate(legLink[3])
-       .rotateY(qLeg[3]).translate(legLink[4])
-       .rotateDotY(qLeg[4]).translate(legCom[index+4]);
-
-  COM5=trcopy(torso).rotateZ(qLeg[0]).translate(legLink[1])
-       .rotateX(qLeg[1]).translate(legLink[2])
-       .rotateY(qLeg[2]).translate(legLink[3])
-       .rotateY(qLeg[3]).translate(legLink[4])
-       .rotateY(qLeg[4]).translate(legLink[5])
-       .rotateX(qLeg[5]);
-  Jac50=trcopy(torso).rotateDotZ(qLeg[0]).translate(legLink[1])
-       .rotateX(qLeg[1]).translate(legLink[2])
-       .rotateY(qLeg[2]).translate(legLink[3])
-       .rotateY(qLeg[3]).translate(legLink[4])
-       .rotateY(qLeg[4]).translate(legLink[5])
-       .rotateX(qLeg[5]);  
-  Jac51=trcopy(torso).rotateZ(qLeg[0]).translate(legLink[1])
-       .rotateDotX(qLeg[1]).translate(legLink[2])
-       .rotateY(qLeg[2]).translate(legLink[3])
-       .rotateY(qLeg[3]).translate(legLink[4])
-       .rotateY(qLeg[4]).translate(legLink[5])
-       .rotateX(qLeg[5]);
-  Jac52=trcopy(torso).rotateZ(qLeg[0]).translate(legLink[1])
-       .rotateX(qLeg[1]).translate(legLink[2])
-       .rotateDotY(qLeg[2]).translate(legLink[3])
-       .rotateY(qLeg[3]).translate(legLink[4])
-       .rotateY(qLeg[4]).translate(legLink[5])
-       .rotateX(qLeg[5]);
-  Jac53=trcopy(torso).rotateZ(qLeg[0]).translate(legLink[1])
-       .rotateX(qLeg[1]).translate(legLink[2])
-       .rotateY(qLeg[2]).translate(legLink[3])
-       .rotateDotY(qLeg[3]).translate(legLink[4])
-       .rotateY(qLeg[4]).translate(legLink[5])
-       .rotateX(qLeg[5]);
-  Jac54=trcopy(torso).rotateZ(qLeg[0]).translate(legLink[1])
-       .rotateX(qLeg[1]).translate(legLink[2])
-       .rotateY(qLeg[2]).translate(legLink[3])
-       .rotateY(qLeg[3]).translate(legLink[4])
-       .rotateDotY(qLeg[4]).translate(legLink[5])
-       .rotateX(qLeg[5]);
-  Jac55=trcopy(torso).rotateZ(qLeg[0]).translate(legLink[1])
-       .rotateX(qLeg[1]).translate(legLink[2])
-       .rotateY(qLeg[2]).translate(legLink[3])
-       .rotateY(qLeg[3]).translate(legLink[4])
-       .rotateY(qLeg[4]).translate(legLink[5])
-       .rotateDotX(qLeg[5]);
-
-  COMS = trcopy(COM5).translate(support[0],support[1],0).translate(legLink[6]);
-  JacS0 = trcopy(Jac50).translate(support[0],support[1],0).translate(legLink[6]);
-  JacS1 = trcopy(Jac51).translate(support[0],support[1],0).translate(legLink[6]);
-  JacS2 = trcopy(Jac52).translate(support[0],support[1],0).translate(legLink[6]);
-  JacS3 = trcopy(Jac53).translate(support[0],support[1],0).translate(legLink[6]);
-  JacS4 = trcopy(Jac54).translate(support[0],support[1],0).translate(legLink[6]);
-  JacS5 = trcopy(Jac55).translate(support[0],support[1],0).translate(legLink[6]);
-
-  COM5.translate(legCom[index+5]);
-  Jac50.translate(legCom[index+5]);
-  Jac51.translate(legCom[index+5]);
-  Jac52.translate(legCom[index+5]);
-  Jac53.translate(legCom[index+5]);
-  Jac54.translate(legCom[index+5]);
-  Jac55.translate(legCom[index+5]);
-
-  Transform JacZZ;
-  Jacobian J0,J1,J2,J3,J4,J5,JS;
-
-  J0.calculate6(COM0,Jac00,JacZZ,JacZZ,JacZZ,JacZZ,JacZZ,MassLeg[0],InertiaLeg[index+0]);  
-  J1.calculate6(COM1,Jac10,Jac11,JacZZ,JacZZ,JacZZ,JacZZ,MassLeg[1],InertiaLeg[index+1]);
-  J2.calculate6(COM2,Jac20,Jac21,Jac22,JacZZ,JacZZ,JacZZ,MassLeg[2],InertiaLeg[index+2]);  
-  J3.calculate6(COM3,Jac30,Jac31,Jac32,Jac33,JacZZ,JacZZ,MassLeg[3],InertiaLeg[index+3]);
-  J4.calculate6(COM4,Jac40,Jac41,Jac42,Jac43,Jac44,JacZZ,MassLeg[4],InertiaLeg[index+4]);  
-  J5.calculate6(COM5,Jac50,Jac51,Jac52,Jac53,Jac54,Jac55,MassLeg[5],InertiaLeg[index+5]);
-  J6.calculate6(COM5,Jac50,Jac51,Jac52,Jac53,Jac54,Jac55,0,InertiaLeg[index+0]);
-  
-  J0.accumulate_stall_torque(stall_torque, 0.0,0.0,MassLeg[0]*g);
-  J1.accumulate_stall_torque(stall_torque, 0.0,0.0,MassLeg[1]*g);
-  J2.accumulate_stall_torque(stall_torque, 0.0,0.0,MassLeg[2]*g);
-  J3.accumulate_stall_torque(stall_torque, 0.0,0.0,MassLeg[3]*g);
-  J4.accumulate_stall_torque(stall_torque, 0.0,0.0,MassLeg[4]*g);
-  JS.accumulate_stall_torque(stall_torque, 0.0,0.0,-grf);
-   
-*/ 
+  THOROPDynamics d;
+  double q[DYN_NJ] = {0}, fFeet[6] = {0}, tau[DYN_NJ], H[DYN_NJ*DYN_NJ];
+  int foot = isLeft>0 ? 0 : 1;
+  int off = isLeft>0 ? DYN_LLEG : DYN_RLEG;
+  for (int i = 0; i < 6; i++) q[off+i] = qLeg[i];
+  THOROP_dynamics_init(&d);
+  d.sole[foot][0] += support[0];
+  d.sole[foot][1] += support[1];
+  THOROP_dynamics_update(&d, q, rpyangle);
+
+  fFeet[3*foot+2] = grf;
+  THOROP_dynamics_inverse(&d, NULL, NULL, fFeet, tau);
+  THOROP_dynamics_mass_matrix(&d, H);
+  for (int i = 0; i < 6; i++) {
+    stall_torque[i] = tau[off+i];
+    for (int j = 0; j < 6; j++) b_matrx[i*6+j] = H[(off+i)*DYN_NJ+off+j];
+  }
 }
 
 
@@ -1185,70 +660,39 @@ void THOROP_kinematics_calculate_arm_jacobian(
       .rotateZ(qWaist[0]).rotateY(qWaist[1]);
     
 
-  COM= trcopy(torso).rotateY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armLink[3])
-        .rotateY(qArm[3]).translate(armLink[4])
-        .rotateX(qArm[4]).translate(armLink[5])
-        .rotateZ(qArm[5]).translate(armLink[6])
-        .rotateX(qArm[6]).translate(handx,handy,handz);
-
-  Jac0= trcopy(torso).rotateDotY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armLink[3])
-        .rotateY(qArm[3]).translate(armLink[4])
-        .rotateX(qArm[4]).translate(armLink[5])
-        .rotateZ(qArm[5]).translate(armLink[6])
-        .rotateX(qArm[6]).translate(handx,handy,handz);
-
-  Jac1= trcopy(torso).rotateY(qArm[0]).translate(armLink[1])
-        .rotateDotZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armLink[3])
-        .rotateY(qArm[3]).translate(armLink[4])
-        .rotateX(qArm[4]).translate(armLink[5])
-        .rotateZ(qArm[5]).translate(armLink[6])
-        .rotateX(qArm[6]).translate(handx,handy,handz);
-
-  Jac2= trcopy(torso).rotateY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateDotX(qArm[2]).translate(armLink[3])
-        .rotateY(qArm[3]).translate(armLink[4])
-        .rotateX(qArm[4]).translate(armLink[5])
-        .rotateZ(qArm[5]).translate(armLink[6])
-        .rotateX(qArm[6]).translate(handx,handy,handz);
-
-  Jac3= trcopy(torso).rotateY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armLink[3])
-        .rotateDotY(qArm[3]).translate(armLink[4])
-        .rotateX(qArm[4]).translate(armLink[5])
-        .rotateZ(qArm[5]).translate(armLink[6])
-        .rotateX(qArm[6]).translate(handx,handy,handz);
-
-
-  Jac4= trcopy(torso).rotateY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armLink[3])
-        .rotateY(qArm[3]).translate(armLink[4])
-        .rotateDotX(qArm[4]).translate(armLink[5])
-        .rotateZ(qArm[5]).translate(armLink[6])
-        .rotateX(qArm[6]).translate(handx,handy,handz);
-
-  Jac5= trcopy(torso).rotateY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armLink[3])
-        .rotateY(qArm[3]).translate(armLink[4])
-        .rotateX(qArm[4]).translate(armLink[5])
-        .rotateDotZ(qArm[5]).translate(armLink[6])
-        .rotateX(qArm[6]).translate(handx,handy,handz);
-
-  Jac6= trcopy(torso).rotateY(qArm[0]).translate(armLink[1])
-        .rotateZ(qArm[1]).translate(armLink[2])
-        .rotateX(qArm[2]).translate(armLink[3])
-        .rotateY(qArm[3]).translate(armLink[4])
-        .rotateX(qArm[4]).translate(armLink[5])
-        .rotateZ(qArm[5]).translate(armLink[6])
-        .rotateDotX(qArm[6]).translate(handx,handy,handz);
+  // Frames up to each joint, differentiated there
+  Transform frame = trcopy(torso);
+  Jac0 = trcopy(frame).rotateDotY(qArm[0]);
+  frame.rotateY(qArm[0]).translate(armLink[1]);
+  Jac1 = trcopy(frame).rotateDotZ(qArm[1]);
+  frame.rotateZ(qArm[1]).translate(armLink[2]);
+  Jac2 = trcopy(frame).rotateDotX(qArm[2]);
+  frame.rotateX(qArm[2]).translate(armLink[3]);
+  Jac3 = trcopy(frame).rotateDotY(qArm[3]);
+  frame.rotateY(qArm[3]).translate(armLink[4]);
+  Jac4 = trcopy(frame).rotateDotX(qArm[4]);
+  frame.rotateX(qArm[4]).translate(armLink[5]);
+  Jac5 = trcopy(frame).rotateDotZ(qArm[5]);
+  frame.rotateZ(qArm[5]).translate(armLink[6]);
+  Jac6 = trcopy(frame).rotateDotX(qArm[6]);
+  COM = frame.rotateX(qArm[6]).translate(handx,handy,handz);
+
+  // Then the rest of the chain to the hand, built from the hand back
+  Transform rest;
+  rest.translate(handx,handy,handz);
+  Jac6 *= rest;
+  rest = Transform().translate(armLink[6]).rotateX(qArm[6]) * rest;
+  Jac5 *= rest;
+  rest = Transform().translate(armLink[5]).rotateZ(qArm[5]) * rest;
+  Jac4 *= rest;
+  rest = Transform().translate(armLink[4]).rotateX(qArm[4]) * rest;
+  Jac3 *= rest;
+  rest = Transform().translate(armLink[3]).rotateY(qArm[3]) * rest;
+  Jac2 *= rest;
+  rest = Transform().translate(armLink[2]).rotateX(qArm[2]) * rest;
+  Jac1 *= rest;
+  rest = Transform().translate(armLink[1]).rotateZ(qArm[1]) * rest;
+  Jac0 *= rest;
 
   Jacobian J;
   J.calculateVel7(COM,Jac0,Jac1,Jac2,Jac3,Jac4,Jac5,Jac6);    
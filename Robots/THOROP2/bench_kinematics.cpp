@@ -0,0 +1,185 @@
+/*
+Micro-benchmark of FK, IK, COM, arm Jacobians, differential IK steps
+and whole body dynamics, incremental COM/ZMP
+per second, comparing the per-call std::vector API to the buffer API
+*/
+
+#include <stdlib.h>
+#include <sys/time.h>
+#include "THOROPKinematics.h"
+
+static double get_time() {
+  struct timeval t;
+  gettimeofday(&t, NULL);
+  return t.tv_sec + 1E-6 * t.tv_usec;
+}
+
+static void report(const char *name, int n, double dt) {
+  printf("%-24s %10.0f per second\n", name, n / dt);
+}
+
+int main(int argc, char **argv) {
+  int n = argc > 1 ? atoi(argv[1]) : 100000;
+  double *qArm = new double[7 * n];
+  double *qWaist = new double[2 * n];
+  double *qLeg = new double[6 * n];
+  double *pArm = new double[6 * n];
+  double *qOut = new double[7 * n];
+  double *com = new double[4 * n];
+  double jac[42];
+  double rpy[3] = {0, 0, 0};
+  double sink = 0;
+
+  srand(123);
+  for (int i = 0; i < 7 * n; i++) qArm[i] = (rand() / (double)RAND_MAX - 0.5) * PI / 2;
+  for (int i = 0; i < 2 * n; i++) qWaist[i] = 0;
+  for (int i = 0; i < 6 * n; i++) qLeg[i] = (rand() / (double)RAND_MAX - 0.5) * PI / 8;
+
+  double t0 = get_time();
+  for (int i = 0; i < n; i++) {
+    std::vector<double> p = position6D(THOROP_kinematics_forward_l_arm_7(
+      qArm + 7 * i, 0, qWaist + 2 * i, handOffsetX, handOffsetY, handOffsetZ));
+    sink += p[0];
+  }
+  report("FK vector", n, get_time() - t0);
+
+  t0 = get_time();
+  for (int i = 0; i < n; i++) {
+    position6D(THOROP_kinematics_forward_l_arm_7(
+      qArm + 7 * i, 0, qWaist + 2 * i, handOffsetX, handOffsetY, handOffsetZ),
+      pArm + 6 * i);
+  }
+  report("FK buffer", n, get_time() - t0);
+
+  t0 = get_time();
+  for (int i = 0; i < n; i++) {
+    std::vector<double> q = THOROP_kinematics_inverse_l_arm_7(
+      transform6D(pArm + 6 * i), qArm + 7 * i, qArm[7 * i + 2], 0, qWaist + 2 * i,
+      handOffsetX, handOffsetY, handOffsetZ, 0);
+    sink += q[0];
+  }
+  report("IK vector", n, get_time() - t0);
+
+  t0 = get_time();
+  for (int i = 0; i < n; i++) {
+    THOROP_kinematics_inverse_arm_7(qOut + 7 * i,
+      transform6D(pArm + 6 * i), ARM_LEFT, qArm + 7 * i, qArm[7 * i + 2], 0,
+      qWaist + 2 * i, handOffsetX, handOffsetY, handOffsetZ, 0);
+  }
+  report("IK buffer", n, get_time() - t0);
+
+  t0 = get_time();
+  for (int i = 0; i < n; i++) {
+    std::vector<double> r = THOROP_kinematics_calculate_com_positions(
+      qWaist + 2 * i, qArm + 7 * i, qArm + 7 * i, qLeg + 6 * i, qLeg + 6 * i,
+      0, 0, 0, 1, 1, 0);
+    sink += r[0];
+  }
+  report("COM vector", n, get_time() - t0);
+
+  t0 = get_time();
+  for (int i = 0; i < n; i++) {
+    THOROP_kinematics_calculate_com_positions(com + 4 * i,
+      qWaist + 2 * i, qArm + 7 * i, qArm + 7 * i, qLeg + 6 * i, qLeg + 6 * i,
+      0, 0, 0, 1, 1, 0);
+  }
+  report("COM buffer", n, get_time() - t0);
+
+  t0 = get_time();
+  for (int i = 0; i < n; i++) {
+    THOROP_kinematics_calculate_arm_jacobian(jac, qArm + 7 * i, qWaist + 2 * i,
+      rpy, handOffsetX, handOffsetY, handOffsetZ, 1);
+    sink += jac[41];
+  }
+  report("Jacobian", n, get_time() - t0);
+
+  // Servo towards each FK pose from the previous configuration
+  THOROPArmIK ik;
+  THOROP_kinematics_arm_ik_init(&ik, ARM_LEFT);
+  double q[7];
+  for (int j = 0; j < 7; j++) q[j] = qArm[j];
+  t0 = get_time();
+  for (int i = 0; i < n; i++) {
+    sink += THOROP_kinematics_arm_ik_step(&ik, q, transform6D(pArm + 6 * i),
+      qArm + 7 * i, 0.001);
+  }
+  report("Diff IK step", n, get_time() - t0);
+
+  // One DCM cycle: FK cache, inverse dynamics, mass matrix and COM Jacobian
+  THOROPDynamics *dyn = new THOROPDynamics;
+  THOROP_dynamics_init(dyn);
+  double qBody[DYN_NJ] = {0}, qdBody[DYN_NJ] = {0}, tau[DYN_NJ];
+  double H[DYN_NJ * DYN_NJ], comBody[4], Jcom[3 * DYN_NJ];
+  t0 = get_time();
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < 7; j++) {
+      qBody[DYN_LARM + j] = qArm[7 * i + j];
+      qdBody[DYN_RARM + j] = qArm[7 * i + j];
+    }
+    THOROP_dynamics_update(dyn, qBody, rpy);
+    THOROP_dynamics_inverse(dyn, qdBody, NULL, NULL, tau);
+    sink += tau[DYN_LARM + 3];
+  }
+  report("Inverse dynamics", n, get_time() - t0);
+
+  t0 = get_time();
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < 7; j++) qBody[DYN_LARM + j] = qArm[7 * i + j];
+    THOROP_dynamics_update(dyn, qBody, rpy);
+    THOROP_dynamics_inverse(dyn, qdBody, NULL, NULL, tau);
+    THOROP_dynamics_mass_matrix(dyn, H);
+    THOROP_dynamics_com_jacobian(dyn, comBody, Jcom);
+    sink += tau[DYN_LARM + 3] + H[DYN_LARM] + Jcom[DYN_LARM];
+  }
+  report("Whole body dynamics", n, get_time() - t0);
+
+  t0 = get_time();
+  for (int i = 0; i < n; i++) {
+    double stall[7], acc[7], acc2[7];
+    THOROP_kinematics_calculate_arm_torque_adv(stall, acc, acc2, rpy,
+      qArm + 7 * i, qArm + 7 * i, qArm + 7 * i, 0, 1);
+    sink += acc2[3];
+  }
+  report("Arm torque adv", n, get_time() - t0);
+
+  // The COM above, from the cached tree, with every joint or only the legs moving
+  double zmp[2];
+  t0 = get_time();
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < 7; j++) qBody[DYN_LARM + j] = qBody[DYN_RARM + j] = qArm[7 * i + j];
+    for (int j = 0; j < 6; j++) qBody[DYN_LLEG + j] = qBody[DYN_RLEG + j] = qLeg[6 * i + j];
+    THOROP_dynamics_update(dyn, qBody, NULL);
+    sink += dyn->com_total[0];
+  }
+  report("COM cache, all moving", n, get_time() - t0);
+
+  t0 = get_time();
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < 6; j++) qBody[DYN_LLEG + j] = qBody[DYN_RLEG + j] = qLeg[6 * i + j];
+    THOROP_dynamics_update(dyn, qBody, NULL);
+    sink += dyn->com_total[0];
+  }
+  report("COM cache, legs moving", n, get_time() - t0);
+
+  t0 = get_time();
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < 6; j++) qBody[DYN_LLEG + j] = qBody[DYN_RLEG + j] = qLeg[6 * i + j];
+    THOROP_dynamics_com_zmp(dyn, qBody, NULL, qdBody, NULL, NULL, NULL,
+      comBody, Jcom, zmp);
+    sink += zmp[0];
+  }
+  report("COM/ZMP, legs moving", n, get_time() - t0);
+  delete dyn;
+
+  // Keep the results alive
+  for (int i = 0; i < n; i++) sink += qOut[7 * i] + com[4 * i];
+  printf("Checksum %g\n", sink);
+
+  delete[] qArm;
+  delete[] qWaist;
+  delete[] qLeg;
+  delete[] pArm;
+  delete[] qOut;
+  delete[] com;
+  return 0;
+}
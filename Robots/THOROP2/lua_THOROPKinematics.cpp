@@ -4,6 +4,7 @@
 */
 
 #include <lua.hpp>
+#include <stdint.h>
 
 // For pushing/pulling torch objects
 #ifdef TORCH
@@ -75,7 +76,7 @@ static std::vector<double> lua_checkvector(lua_State *L, int narg) {
 	return v;
 }
 
-static void lua_pushtransform(lua_State *L, Transform t) {
+static void lua_pushtransform(lua_State *L, const Transform &t) {
 	lua_createtable(L, 4, 0);
 	for (int i = 0; i < 4; i++) {
 		lua_createtable(L, 4, 0);
@@ -87,6 +88,19 @@ static void lua_pushtransform(lua_State *L, Transform t) {
 	}
 }
 
+/* Batched arrays come from the FFI as lightuserdata or integer addresses */
+static double *lua_checkdarray(lua_State *L, int narg) {
+	switch (lua_type(L, narg)) {
+	case LUA_TLIGHTUSERDATA:
+		return (double *)lua_touserdata(L, narg);
+	case LUA_TNUMBER:
+		return (double *)(intptr_t)lua_tointeger(L, narg);
+	default:
+		luaL_argerror(L, narg, "pointer");
+	}
+	return NULL;
+}
+
 static int forward_head(lua_State *L) {
 	std::vector<double> q = lua_checkvector(L, 1);
 	Transform t = THOROP_kinematics_forward_head(&q[0]);
@@ -513,8 +527,35 @@ static int inverse_r_leg(lua_State *L) {
 	return 1;
 }
 
+/* Choose toe or heel lift for each leg, writing 12 joint angles */
+static void inverse_legs_tilt(double *qLegs,
+		const Transform &trTorso_LLeg, const Transform &trTorso_RLeg,
+		const double *aShiftX, const double *aShiftY, int birdwalk,
+		double anklePitchL, double anklePitchR,
+		int leftTiltType, int rightTiltType, double leftTiltMin, double rightTiltMin) {
+	bool toeliftL, toeliftR;
+	if ((leftTiltType==0) && (rightTiltType==0)){ //automatic
+		//Left front lifts the left toe
+		toeliftL = trTorso_LLeg(0,3)>trTorso_RLeg(0,3);
+		toeliftR = !toeliftL;
+	}else{
+		toeliftL = leftTiltType==1;
+		toeliftR = rightTiltType==1;
+	}
+	if (toeliftL) {
+		THOROP_kinematics_inverse_leg_toelift(qLegs,trTorso_LLeg,LEG_LEFT,aShiftX[0],aShiftY[0],birdwalk,anklePitchL,leftTiltMin);
+	}else{
+		THOROP_kinematics_inverse_leg_heellift(qLegs,trTorso_LLeg,LEG_LEFT,aShiftX[0],aShiftY[0],birdwalk,anklePitchL,leftTiltMin);
+	}
+	if (toeliftR) {
+		THOROP_kinematics_inverse_leg_toelift(qLegs+6,trTorso_RLeg,LEG_RIGHT,aShiftX[1],aShiftY[1],birdwalk,anklePitchR,rightTiltMin);
+	}else{
+		THOROP_kinematics_inverse_leg_heellift(qLegs+6,trTorso_RLeg,LEG_RIGHT,aShiftX[1],aShiftY[1],birdwalk,anklePitchR,rightTiltMin);
+	}
+}
+
 static int inverse_legs(lua_State *L) {
-	std::vector<double> qLLeg(12), qRLeg;
+	std::vector<double> qLegs(12);
 	std::vector<double> pLLeg = lua_checkvector(L, 1);
 	std::vector<double> pRLeg = lua_checkvector(L, 2);
 	std::vector<double> pTorso = lua_checkvector(L, 3);
@@ -538,29 +579,10 @@ static int inverse_legs(lua_State *L) {
 	Transform trTorso_LLeg = inv(trTorso)*trLLeg;
 	Transform trTorso_RLeg = inv(trTorso)*trRLeg;
 
-
-	if ((leftTiltType==0) && (rightTiltType==0)){ //automatic
-		if(trTorso_LLeg(0,3)>trTorso_RLeg(0,3)){ //Left front
-			qLLeg = THOROP_kinematics_inverse_leg_toelift(trTorso_LLeg,LEG_LEFT,aShiftX[0],aShiftY[0],birdwalk,qL[4],leftTiltMin);
-			qRLeg = THOROP_kinematics_inverse_leg_heellift(trTorso_RLeg,LEG_RIGHT,aShiftX[1],aShiftY[1],birdwalk, qR[4],rightTiltMin);
-		}else{
-			qLLeg = THOROP_kinematics_inverse_leg_heellift(trTorso_LLeg,LEG_LEFT,aShiftX[0],aShiftY[0],birdwalk,  qL[4],leftTiltMin) ;
-			qRLeg = THOROP_kinematics_inverse_leg_toelift(trTorso_RLeg,LEG_RIGHT,aShiftX[1],aShiftY[1],birdwalk, qR[4],rightTiltMin);
-		}
-	}else{
-		if (leftTiltType==1) {
-			qLLeg = THOROP_kinematics_inverse_leg_toelift(trTorso_LLeg,LEG_LEFT,aShiftX[0],aShiftY[0],birdwalk,qL[4],leftTiltMin);
-		}else{
-			qLLeg = THOROP_kinematics_inverse_leg_heellift(trTorso_LLeg,LEG_LEFT,aShiftX[0],aShiftY[0],birdwalk,qL[4],leftTiltMin);
-		}
-		if (rightTiltType==1) {
-			qRLeg = THOROP_kinematics_inverse_leg_toelift(trTorso_RLeg,LEG_RIGHT,aShiftX[1],aShiftY[1],birdwalk, qR[4],rightTiltMin);
-		}else{
-			qRLeg = THOROP_kinematics_inverse_leg_heellift(trTorso_RLeg,LEG_RIGHT,aShiftX[1],aShiftY[1],birdwalk, qR[4],rightTiltMin);
-		}
-	}
-	qLLeg.insert(qLLeg.end(), qRLeg.begin(), qRLeg.end());
-	lua_pushvector(L, qLLeg);
+	inverse_legs_tilt(&qLegs[0], trTorso_LLeg, trTorso_RLeg,
+		&aShiftX[0], &aShiftY[0], birdwalk, qL[4], qR[4],
+		leftTiltType, rightTiltType, leftTiltMin, rightTiltMin);
+	lua_pushvector(L, qLegs);
 	return 1;
 }
 
@@ -593,6 +615,355 @@ static int get_body_dh(lua_State *L) {
 
 
 
+/* Batched, allocation-free versions
+ * Each array holds n rows, one per configuration, and results are written
+ * into the caller's out array
+ */
+
+// (n, qArm[n*7], qWaist[n*2], out[n*6], [bodyPitch, handOffsetX, Y, Z])
+static int arm_torso_7_batch(lua_State *L, int arm) {
+	int n = luaL_checkinteger(L, 1);
+	const double *qArm = lua_checkdarray(L, 2);
+	const double *qWaist = lua_checkdarray(L, 3);
+	double *out = lua_checkdarray(L, 4);
+	double bodyPitch = luaL_optnumber(L, 5, 0.0);
+	double handOffsetXNew = luaL_optnumber(L, 6, handOffsetX);
+	double handOffsetYNew = luaL_optnumber(L, 7, handOffsetY);
+	double handOffsetZNew = luaL_optnumber(L, 8, handOffsetZ);
+	for (int i = 0; i < n; i++) {
+		Transform t = arm==ARM_LEFT ?
+			THOROP_kinematics_forward_l_arm_7(qArm+7*i, bodyPitch, qWaist+2*i,
+				handOffsetXNew, handOffsetYNew, handOffsetZNew) :
+			THOROP_kinematics_forward_r_arm_7(qArm+7*i, bodyPitch, qWaist+2*i,
+				handOffsetXNew, handOffsetYNew, handOffsetZNew);
+		position6D(t, out+6*i);
+	}
+	return 0;
+}
+
+static int l_arm_torso_7_batch(lua_State *L) {
+	return arm_torso_7_batch(L, ARM_LEFT);
+}
+
+static int r_arm_torso_7_batch(lua_State *L) {
+	return arm_torso_7_batch(L, ARM_RIGHT);
+}
+
+// (n, pArm[n*6], qArmOrg[n*7], qWaist[n*2], out[n*7],
+//  [shoulderYaw, bodyPitch, handOffsetX, Y, Z, flip_shoulderroll])
+// Without shoulderYaw, each keeps the shoulder yaw of its qArmOrg
+static int inverse_arm_7_batch(lua_State *L, int arm) {
+	int n = luaL_checkinteger(L, 1);
+	const double *pArm = lua_checkdarray(L, 2);
+	const double *qArmOrg = lua_checkdarray(L, 3);
+	const double *qWaist = lua_checkdarray(L, 4);
+	double *out = lua_checkdarray(L, 5);
+	bool keepYaw = lua_isnoneornil(L, 6);
+	double shoulderYaw = luaL_optnumber(L, 6, 0.0);
+	double bodyPitch = luaL_optnumber(L, 7, 0.0);
+	double handOffsetXNew = luaL_optnumber(L, 8, handOffsetX);
+	double handOffsetYNew = luaL_optnumber(L, 9, handOffsetY);
+	double handOffsetZNew = luaL_optnumber(L, 10, handOffsetZ);
+	int flip_shoulderroll = luaL_optnumber(L, 11, 0);
+	for (int i = 0; i < n; i++) {
+		THOROP_kinematics_inverse_arm_7(out+7*i, transform6D(pArm+6*i), arm,
+			qArmOrg+7*i, keepYaw ? qArmOrg[7*i+2] : shoulderYaw,
+			bodyPitch, qWaist+2*i,
+			handOffsetXNew, handOffsetYNew, handOffsetZNew, flip_shoulderroll);
+	}
+	return 0;
+}
+
+static int inverse_l_arm_7_batch(lua_State *L) {
+	return inverse_arm_7_batch(L, ARM_LEFT);
+}
+
+static int inverse_r_arm_7_batch(lua_State *L) {
+	return inverse_arm_7_batch(L, ARM_RIGHT);
+}
+
+// (n, pLLeg[n*6], pRLeg[n*6], pTorso[n*6], qLegs[n*12], out[n*12],
+//  [aShiftX, aShiftY, birdwalk,
+//   leftTiltType, rightTiltType, leftTiltMin, rightTiltMin])
+// qLegs are the current angles, for the ankle pitch
+// aShiftX and aShiftY are {left, right} tables for all
+// The tilt arguments are as inverse_legs takes them, for all
+static int inverse_legs_batch(lua_State *L) {
+	int n = luaL_checkinteger(L, 1);
+	const double *pLLeg = lua_checkdarray(L, 2);
+	const double *pRLeg = lua_checkdarray(L, 3);
+	const double *pTorso = lua_checkdarray(L, 4);
+	const double *qLegs = lua_checkdarray(L, 5);
+	double *out = lua_checkdarray(L, 6);
+	double aShiftX[2] = {0, 0}, aShiftY[2] = {0, 0};
+	for (int i = 0; i < 2; i++) {
+		if (lua_istable(L, 7)) {
+			lua_rawgeti(L, 7, i+1);
+			aShiftX[i] = lua_tonumber(L, -1);
+			lua_pop(L, 1);
+		}
+		if (lua_istable(L, 8)) {
+			lua_rawgeti(L, 8, i+1);
+			aShiftY[i] = lua_tonumber(L, -1);
+			lua_pop(L, 1);
+		}
+	}
+	int birdwalk = luaL_optnumber(L, 9, 0);
+	int leftTiltType = luaL_optnumber(L, 10, 0);
+	int rightTiltType = luaL_optnumber(L, 11, 0);
+	double leftTiltMin = luaL_optnumber(L, 12, 0.0);
+	double rightTiltMin = luaL_optnumber(L, 13, 0.0);
+	for (int i = 0; i < n; i++) {
+		Transform trInvTorso = inv(transform6D(pTorso+6*i));
+		inverse_legs_tilt(out+12*i,
+			trInvTorso*transform6D(pLLeg+6*i), trInvTorso*transform6D(pRLeg+6*i),
+			aShiftX, aShiftY, birdwalk, qLegs[12*i+4], qLegs[12*i+10],
+			leftTiltType, rightTiltType, leftTiltMin, rightTiltMin);
+	}
+	return 0;
+}
+
+// (n, qWaist[n*2], qLArm[n*7], qRArm[n*7], qLLeg[n*6], qRLeg[n*6], out[n*4],
+//  [mLHand, mRHand, bodyPitch, birdwalk, use_lleg, use_rleg])
+static int calculate_com_pos_batch(lua_State *L) {
+	int n = luaL_checkinteger(L, 1);
+	const double *qWaist = lua_checkdarray(L, 2);
+	const double *qLArm = lua_checkdarray(L, 3);
+	const double *qRArm = lua_checkdarray(L, 4);
+	const double *qLLeg = lua_checkdarray(L, 5);
+	const double *qRLeg = lua_checkdarray(L, 6);
+	double *out = lua_checkdarray(L, 7);
+	double mLHand = luaL_optnumber(L, 8, 0.0);
+	double mRHand = luaL_optnumber(L, 9, 0.0);
+	double bodyPitch = luaL_optnumber(L, 10, 0.0);
+	int birdwalk = luaL_optnumber(L, 11, 0);
+	int use_lleg = luaL_optnumber(L, 12, 1);
+	int use_rleg = luaL_optnumber(L, 13, 1);
+	for (int i = 0; i < n; i++) {
+		THOROP_kinematics_calculate_com_positions(out+4*i,
+			qWaist+2*i, qLArm+7*i, qRArm+7*i, qLLeg+6*i, qRLeg+6*i,
+			mLHand, mRHand, bodyPitch, use_lleg, use_rleg, birdwalk);
+	}
+	return 0;
+}
+
+/* Differential arm IK, with its workspace in a userdata */
+#define MT_ARM_IK "THOROP_ArmIK"
+
+static THOROPArmIK *lua_checkarmik(lua_State *L, int narg) {
+	return (THOROPArmIK *)luaL_checkudata(L, narg, MT_ARM_IK);
+}
+
+// Read n numbers of a table into v, without allocating
+static void lua_checkdtable(lua_State *L, int narg, double *v, int n) {
+	luaL_checktype(L, narg, LUA_TTABLE);
+	for (int i = 0; i < n; i++) {
+		lua_rawgeti(L, narg, i+1);
+		v[i] = luaL_checknumber(L, -1);
+		lua_pop(L, 1);
+	}
+}
+
+// ([is_left])
+static int new_arm_ik(lua_State *L) {
+	int is_left = luaL_optnumber(L, 1, 0);
+	THOROPArmIK *ik = (THOROPArmIK *)lua_newuserdata(L, sizeof(THOROPArmIK));
+	THOROP_kinematics_arm_ik_init(ik, is_left ? ARM_LEFT : ARM_RIGHT);
+	luaL_getmetatable(L, MT_ARM_IK);
+	lua_setmetatable(L, -2);
+	return 1;
+}
+
+// (ik, bodyPitch, qWaist, [handOffsetX, handOffsetY, handOffsetZ])
+static int arm_ik_set_body(lua_State *L) {
+	THOROPArmIK *ik = lua_checkarmik(L, 1);
+	ik->bodyPitch = luaL_checknumber(L, 2);
+	lua_checkdtable(L, 3, ik->qWaist, 2);
+	ik->hand[0] = luaL_optnumber(L, 4, ik->hand[0]);
+	ik->hand[1] = luaL_optnumber(L, 5, ik->hand[1]);
+	ik->hand[2] = luaL_optnumber(L, 6, ik->hand[2]);
+	return 0;
+}
+
+// (ik, qMin, qMax, [dqMax])
+static int arm_ik_set_limits(lua_State *L) {
+	THOROPArmIK *ik = lua_checkarmik(L, 1);
+	lua_checkdtable(L, 2, ik->qMin, 7);
+	lua_checkdtable(L, 3, ik->qMax, 7);
+	if (!lua_isnoneornil(L, 4)) lua_checkdtable(L, 4, ik->dqMax, 7);
+	return 0;
+}
+
+// (ik, [damping, gain, null_gain, check_collision]), nil keeps the current value
+static int arm_ik_set_gains(lua_State *L) {
+	THOROPArmIK *ik = lua_checkarmik(L, 1);
+	ik->damping = luaL_optnumber(L, 2, ik->damping);
+	ik->gain = luaL_optnumber(L, 3, ik->gain);
+	ik->null_gain = luaL_optnumber(L, 4, ik->null_gain);
+	if (!lua_isnoneornil(L, 5)) ik->check_collision = lua_toboolean(L, 5);
+	return 0;
+}
+
+// (ik, qArm, pTarget, dt, [qNull])
+// Updates the qArm table in place, and returns the pose error before the step
+static int arm_ik_step(lua_State *L) {
+	THOROPArmIK *ik = lua_checkarmik(L, 1);
+	double qArm[7], pTarget[6], qNull[7];
+	lua_checkdtable(L, 2, qArm, 7);
+	lua_checkdtable(L, 3, pTarget, 6);
+	double dt = luaL_checknumber(L, 4);
+	int use_null = !lua_isnoneornil(L, 5);
+	if (use_null) lua_checkdtable(L, 5, qNull, 7);
+
+	double err = THOROP_kinematics_arm_ik_step(ik, qArm, transform6D(pTarget),
+		use_null ? qNull : NULL, dt);
+	for (int i = 0; i < 7; i++) {
+		lua_pushnumber(L, qArm[i]);
+		lua_rawseti(L, 2, i+1);
+	}
+	lua_pushnumber(L, err);
+	return 1;
+}
+
+// (ik, qArm): hand pose and the 6x7 Jacobian, row major
+static int arm_ik_jacobian(lua_State *L) {
+	THOROPArmIK *ik = lua_checkarmik(L, 1);
+	double qArm[7];
+	lua_checkdtable(L, 2, qArm, 7);
+	Transform t = THOROP_kinematics_arm_jacobian_7(ik->J, qArm, ik->arm,
+		ik->bodyPitch, ik->qWaist, ik->hand[0], ik->hand[1], ik->hand[2]);
+	position6D(t, ik->pose);
+	lua_pushdarray(L, ik->pose, 6);
+	lua_pushdarray(L, ik->J, 42);
+	return 2;
+}
+
+static const struct luaL_Reg arm_ik_methods[] = {
+	{"set_body", arm_ik_set_body},
+	{"set_limits", arm_ik_set_limits},
+	{"set_gains", arm_ik_set_gains},
+	{"step", arm_ik_step},
+	{"jacobian", arm_ik_jacobian},
+	{NULL, NULL}
+};
+
+/* Whole body dynamics. The workspace holds Transforms, which need more
+   alignment than a userdata has, so the userdata keeps a pointer */
+#define MT_DYNAMICS "THOROP_Dynamics"
+
+static THOROPDynamics *lua_checkdynamics(lua_State *L, int narg) {
+	THOROPDynamics **ud = (THOROPDynamics **)luaL_checkudata(L, narg, MT_DYNAMICS);
+	if (*ud == NULL) luaL_error(L, "Dynamics already freed");
+	return *ud;
+}
+
+static int new_dynamics(lua_State *L) {
+	THOROPDynamics **ud =
+		(THOROPDynamics **)lua_newuserdata(L, sizeof(THOROPDynamics *));
+	*ud = new THOROPDynamics;
+	THOROP_dynamics_init(*ud);
+	luaL_getmetatable(L, MT_DYNAMICS);
+	lua_setmetatable(L, -2);
+	return 1;
+}
+
+static int dynamics_gc(lua_State *L) {
+	THOROPDynamics **ud = (THOROPDynamics **)luaL_checkudata(L, 1, MT_DYNAMICS);
+	delete *ud;
+	*ud = NULL;
+	return 0;
+}
+
+// Read qWaist, qLArm, qRArm, qLLeg, qRLeg from narg on into the whole body q
+static void lua_checkbody(lua_State *L, int narg, double *q) {
+	lua_checkdtable(L, narg, q+DYN_WAIST, 2);
+	lua_checkdtable(L, narg+1, q+DYN_LARM, 7);
+	lua_checkdtable(L, narg+2, q+DYN_RARM, 7);
+	lua_checkdtable(L, narg+3, q+DYN_LLEG, 6);
+	lua_checkdtable(L, narg+4, q+DYN_RLEG, 6);
+}
+
+// Optional table of n numbers, or NULL
+static double *lua_optdtable(lua_State *L, int narg, double *v, int n) {
+	if (lua_isnoneornil(L, narg)) return NULL;
+	lua_checkdtable(L, narg, v, n);
+	return v;
+}
+
+// (dyn, qWaist, qLArm, qRArm, qLLeg, qRLeg, [rpy])
+// Returns the number of links that moved
+static int dynamics_update(lua_State *L) {
+	THOROPDynamics *d = lua_checkdynamics(L, 1);
+	double q[DYN_NJ], rpy[2];
+	lua_checkbody(L, 2, q);
+	lua_pushinteger(L, THOROP_dynamics_update(d, q, lua_optdtable(L, 7, rpy, 2)));
+	return 1;
+}
+
+// (dyn, [qd], [qdd], [fFeet]): whole body joint torques at the last update
+static int dynamics_inverse(lua_State *L) {
+	THOROPDynamics *d = lua_checkdynamics(L, 1);
+	double qd[DYN_NJ], qdd[DYN_NJ], fFeet[6], tau[DYN_NJ];
+	THOROP_dynamics_inverse(d, lua_optdtable(L, 2, qd, DYN_NJ),
+		lua_optdtable(L, 3, qdd, DYN_NJ), lua_optdtable(L, 4, fFeet, 6), tau);
+	lua_pushdarray(L, tau, DYN_NJ);
+	return 1;
+}
+
+// (dyn): row major mass matrix at the last update
+static int dynamics_mass_matrix(lua_State *L) {
+	THOROPDynamics *d = lua_checkdynamics(L, 1);
+	double H[DYN_NJ*DYN_NJ];
+	THOROP_dynamics_mass_matrix(d, H);
+	lua_pushdarray(L, H, DYN_NJ*DYN_NJ);
+	return 1;
+}
+
+// (dyn): COM {x, y, z, mass} and the row major 3 x 28 COM Jacobian
+static int dynamics_com_jacobian(lua_State *L) {
+	THOROPDynamics *d = lua_checkdynamics(L, 1);
+	double com[4], J[3*DYN_NJ];
+	THOROP_dynamics_com_jacobian(d, com, J);
+	lua_pushdarray(L, com, 4);
+	lua_pushdarray(L, J, 3*DYN_NJ);
+	return 2;
+}
+
+// (dyn, qWaist, qLArm, qRArm, qLLeg, qRLeg, [rpy, qd, qdd, aBase, zGround])
+// Returns the COM {x, y, z, mass}, COM Jacobian, ZMP {x, y}
+// and the number of links that moved
+static int dynamics_com_zmp(lua_State *L) {
+	THOROPDynamics *d = lua_checkdynamics(L, 1);
+	double q[DYN_NJ], rpy[2], qd[DYN_NJ], qdd[DYN_NJ], aBase[3], zGround;
+	double com[4], J[3*DYN_NJ], zmp[2];
+	lua_checkbody(L, 2, q);
+	double *pRpy = lua_optdtable(L, 7, rpy, 2);
+	double *pQd = lua_optdtable(L, 8, qd, DYN_NJ);
+	double *pQdd = lua_optdtable(L, 9, qdd, DYN_NJ);
+	double *pBase = lua_optdtable(L, 10, aBase, 3);
+	int use_ground = !lua_isnoneornil(L, 11);
+	if (use_ground) zGround = luaL_checknumber(L, 11);
+	int n_moved = THOROP_dynamics_com_zmp(d, q, pRpy, pQd, pQdd, pBase,
+		use_ground ? &zGround : NULL, com, J, zmp);
+	lua_pushdarray(L, com, 4);
+	lua_pushdarray(L, J, 3*DYN_NJ);
+	lua_pushdarray(L, zmp, 2);
+	lua_pushinteger(L, n_moved);
+	return 4;
+}
+
+static const struct luaL_Reg dynamics_methods[] = {
+	{"update", dynamics_update},
+	{"inverse_dynamics", dynamics_inverse},
+	{"mass_matrix", dynamics_mass_matrix},
+	{"com_jacobian", dynamics_com_jacobian},
+	{"com_zmp", dynamics_com_zmp},
+	{"__gc", dynamics_gc},
+	{NULL, NULL}
+};
+
+
+
 /* Extra definitions */
 
 #ifdef TORCH
@@ -605,13 +976,14 @@ static Transform luaT_checktransform(lua_State *L, int narg) {
 
   // Form into our Transform type
   Transform tr;
-  for (int i = 0; i < 4; i++)
+  // The bottom row is implied
+  for (int i = 0; i < 3; i++)
     for (int j = 0; j < 4; j++)
       tr(i,j) = THTensor_fastGet2d( _t, i, j );
 
   return tr;
 }
-static void luaT_pushtransform(lua_State *L, Transform t) {
+static void luaT_pushtransform(lua_State *L, const Transform &t) {
   // Make the Tensor
   THLongStorage *sz = THLongStorage_newWithSize(2);
   sz->data[0] = 4;
@@ -644,7 +1016,8 @@ static Transform lua_checktransform(lua_State *L, int narg) {
   int i, j;
 
   // Loop through the transform
-  for (i = 1; i <= 4; i++) {
+  // The bottom row is implied
+  for (i = 1; i <= 3; i++) {
     // Grab the table entry
     lua_rawgeti(L, narg, i);
     // Get the top of the stack
@@ -725,6 +1098,20 @@ static const struct luaL_Reg kinematics_lib [] = {
   {"calculate_leg_torque", calculate_leg_torque},
   {"calculate_support_leg_torque", calculate_support_leg_torque},
 
+  /* Batched, over FFI arrays */
+	{"l_arm_torso_7_batch", l_arm_torso_7_batch},
+	{"r_arm_torso_7_batch", r_arm_torso_7_batch},
+	{"inverse_l_arm_7_batch", inverse_l_arm_7_batch},
+	{"inverse_r_arm_7_batch", inverse_r_arm_7_batch},
+	{"inverse_legs_batch", inverse_legs_batch},
+	{"calculate_com_pos_batch", calculate_com_pos_batch},
+
+	/* Differential IK */
+	{"new_arm_ik", new_arm_ik},
+
+	/* Whole body dynamics */
+	{"new_dynamics", new_dynamics},
+
 	{NULL, NULL}
 };
 
@@ -747,6 +1134,26 @@ static const def_info kinematics_constants[] = {
 
 extern "C"
 int luaopen_THOROPKinematics (lua_State *L) {
+	luaL_newmetatable(L, MT_ARM_IK);
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+#if LUA_VERSION_NUM == 502
+	luaL_setfuncs(L, arm_ik_methods, 0);
+#else
+	luaL_register(L, NULL, arm_ik_methods);
+#endif
+	lua_pop(L, 1);
+
+	luaL_newmetatable(L, MT_DYNAMICS);
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+#if LUA_VERSION_NUM == 502
+	luaL_setfuncs(L, dynamics_methods, 0);
+#else
+	luaL_register(L, NULL, dynamics_methods);
+#endif
+	lua_pop(L, 1);
+
 #if LUA_VERSION_NUM == 502
 	luaL_newlib(L, kinematics_lib);
 #else
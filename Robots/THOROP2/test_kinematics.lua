@@ -199,3 +199,165 @@ for i,q in ipairs(qs) do
 	assert( d < 1e-10, string.format('BAD %d: %f',i,d))
 end
 print('Jacobian OK!')
+
+print()
+print('TESTING BATCH')
+print()
+
+if ok then
+	local n = #qs
+	local function ptr(arr) return tonumber(ffi.cast('intptr_t', ffi.cast('void *', arr))) end
+	local qArms = ffi.new('double[?]', 7 * n)
+	local qWaists = ffi.new('double[?]', 2 * n)
+	local fks = ffi.new('double[?]', 6 * n)
+	local iks = ffi.new('double[?]', 7 * n)
+	for i, q in ipairs(qs) do
+		for j=1,7 do qArms[7*(i-1)+j-1] = q[j] end
+	end
+
+	-- FK
+	local t0 = unix.time()
+	for i, q in ipairs(qs) do K.l_arm_torso_7(q, 0, {0, 0}, 0.125, 0, 0) end
+	local t1 = unix.time()
+	K.l_arm_torso_7_batch(n, ptr(qArms), ptr(qWaists), ptr(fks), 0, 0.125, 0, 0)
+	local t2 = unix.time()
+	for i, q in ipairs(qs) do
+		local fL = K.l_arm_torso_7(q, 0, {0, 0}, 0.125, 0, 0)
+		for j=1,6 do assert(math.abs(fL[j] - fks[6*(i-1)+j-1]) < 1e-10, 'Bad batch FK') end
+	end
+	print(string.format('FK per second: %.0f table, %.0f batch', n/(t1-t0), n/(t2-t1)))
+
+	-- IK, keeping the shoulder yaw of each configuration
+	local fk6s = {}
+	for i=1,n do
+		local fk6 = {}
+		for j=1,6 do fk6[j] = fks[6*(i-1)+j-1] end
+		fk6s[i] = fk6
+	end
+	t0 = unix.time()
+	for i, q in ipairs(qs) do
+		K.inverse_l_arm_7(fk6s[i], q, q[3], 0, {0, 0}, 0.125, 0, 0, 0)
+	end
+	t1 = unix.time()
+	K.inverse_l_arm_7_batch(n, ptr(fks), ptr(qArms), ptr(qWaists), ptr(iks),
+		nil, 0, 0.125, 0, 0, 0)
+	t2 = unix.time()
+	for i, q in ipairs(qs) do
+		local iq = K.inverse_l_arm_7(fk6s[i], q, q[3], 0, {0, 0}, 0.125, 0, 0, 0)
+		for j=1,7 do assert(math.abs(iq[j] - iks[7*(i-1)+j-1]) < 1e-10, 'Bad batch IK') end
+	end
+	print(string.format('IK per second: %.0f table, %.0f batch', n/(t1-t0), n/(t2-t1)))
+
+	-- COM
+	local qLegs = ffi.new('double[?]', 6 * n)
+	local coms = ffi.new('double[?]', 4 * n)
+	local qLeg0 = {0, 0, 0, 0, 0, 0}
+	t0 = unix.time()
+	for i, q in ipairs(qs) do K.calculate_com_pos({0, 0}, q, q, qLeg0, qLeg0, 0, 0, 0) end
+	t1 = unix.time()
+	K.calculate_com_pos_batch(n, ptr(qWaists), ptr(qArms), ptr(qArms), ptr(qLegs), ptr(qLegs), ptr(coms))
+	t2 = unix.time()
+	for i, q in ipairs(qs) do
+		local com = K.calculate_com_pos({0, 0}, q, q, qLeg0, qLeg0, 0, 0, 0)
+		for j=1,4 do assert(math.abs(com[j] - coms[4*(i-1)+j-1]) < 1e-10, 'Bad batch COM') end
+	end
+	print(string.format('COM per second: %.0f table, %.0f batch', n/(t1-t0), n/(t2-t1)))
+
+	-- Legs, with a toe lift on the left and a heel lift on the right
+	local pLLegs = ffi.new('double[?]', 6 * n)
+	local pRLegs = ffi.new('double[?]', 6 * n)
+	local pTorsos = ffi.new('double[?]', 6 * n)
+	local qLegs12 = ffi.new('double[?]', 12 * n)
+	local iqLegs = ffi.new('double[?]', 12 * n)
+	local aShiftX, aShiftY = {0.01, -0.01}, {0.02, 0}
+	local legs = {}
+	for i=1,n do
+		local dx = 0.1 * (math.random() - 0.5)
+		local pL = {dx, 0.1, -0.7, 0, 0.1 * (math.random() - 0.5), 0}
+		local pR = {-dx, -0.1, -0.7, 0, 0.1 * (math.random() - 0.5), 0}
+		local pT = {0, 0, 0.05 * math.random(), 0, 0, 0}
+		local qL = {0, 0, 0, 0, 0.2 * (math.random() - 0.5), 0}
+		local qR = {0, 0, 0, 0, 0.2 * (math.random() - 0.5), 0}
+		for j=1,6 do
+			pLLegs[6*(i-1)+j-1], pRLegs[6*(i-1)+j-1] = pL[j], pR[j]
+			pTorsos[6*(i-1)+j-1] = pT[j]
+			qLegs12[12*(i-1)+j-1], qLegs12[12*(i-1)+j+5] = qL[j], qR[j]
+		end
+		legs[i] = {pL, pR, pT, qL, qR}
+	end
+	K.inverse_legs_batch(n, ptr(pLLegs), ptr(pRLegs), ptr(pTorsos), ptr(qLegs12), ptr(iqLegs),
+		aShiftX, aShiftY, 0, 1, 2, 0.05, 0.05)
+	for i, l in ipairs(legs) do
+		local iq = K.inverse_legs(l[1], l[2], l[3], aShiftX, aShiftY, 0, l[4], l[5], 1, 2, 0.05, 0.05)
+		for j=1,12 do assert(math.abs(iq[j] - iqLegs[12*(i-1)+j-1]) < 1e-10, 'Bad batch legs') end
+	end
+	print('Batch OK!')
+end
+
+print()
+print('TESTING DIFFERENTIAL IK')
+local ik = K.new_arm_ik(1)
+ik:set_body(0, {0, 0}, 0.125, 0, 0)
+local q0 = vector.new({90, 10, 0, -45, 0, 0, 0})*DEG_TO_RAD
+local n_ok, n_steps, dt_ik = 0, 0, 0
+for i=1,20 do
+	-- Reach a nearby FK pose at 1kHz, pulled towards q0 in the null space
+	local qGoal = q0 + vector.new({math.random(), math.random(), math.random(),
+		-math.random(), math.random(), math.random(), math.random()})*(20*DEG_TO_RAD)
+	local pGoal = K.l_arm_torso_7(qGoal, 0, {0, 0}, 0.125, 0, 0)
+	local q = {unpack(q0)}
+	local err
+	local t0 = unix.time()
+	for s=1,3000 do
+		err = ik:step(q, pGoal, 0.001, q0)
+		if err < 1e-4 then break end
+		n_steps = n_steps + 1
+	end
+	dt_ik = dt_ik + unix.time() - t0
+	if err < 1e-3 then n_ok = n_ok + 1 end
+	-- The goal is reachable, so the pose residual must vanish
+	assert(err < 1e-3, string.format('IK residual %d: %g', i, err))
+end
+print(string.format('Converged %d/20, %.1f us per step', n_ok, 1e6*dt_ik/n_steps))
+local pose, J = ik:jacobian(q0)
+print('Pose', unpack(pose))
+
+print()
+print('TESTING WHOLE BODY DYNAMICS')
+local dyn = K.new_dynamics()
+local qWaist, qLArm, qRArm = {0, 0}, {0.5, 0.2, 0, -1, 0, 0, 0}, {0.5, -0.2, 0, -1, 0, 0, 0}
+local qLLeg, qRLeg = {0, 0, -0.3, 0.6, -0.3, 0}, {0, 0, -0.3, 0.6, -0.3, 0}
+local n_dyn = 1000
+local t0 = unix.time()
+local tau
+for i=1,n_dyn do
+	dyn:update(qWaist, qLArm, qRArm, qLLeg, qRLeg, {0, 0})
+	tau = dyn:inverse_dynamics()
+end
+print(string.format('%.1f us per update and inverse dynamics', 1e6*(unix.time()-t0)/n_dyn))
+local com, Jcom = dyn:com_jacobian()
+local com_pos = K.calculate_com_pos(qWaist, qLArm, qRArm, qLLeg, qRLeg, 0, 0, 0)
+print('COM', unpack(com))
+print('COM (calculate_com_pos)', com_pos[1]/com_pos[4], com_pos[2]/com_pos[4], com_pos[3]/com_pos[4], com_pos[4])
+-- Holding still, the torques are the weight through the COM Jacobian
+local max_err = 0
+for i=1,28 do
+	max_err = math.max(max_err, math.abs(tau[i] - 9.81*com[4]*Jcom[56+i]))
+end
+print('Gravity torque error', max_err)
+local H = dyn:mass_matrix()
+print('Left knee inertia', H[(16+3)*28 + 16+4])
+
+print()
+print('TESTING INCREMENTAL COM/ZMP')
+local n_moved
+-- Only the legs move, so the waist and arms stay cached
+t0 = unix.time()
+for i=1,n_dyn do
+	qLLeg[4] = 0.6 + 0.1*math.sin(i/100)
+	qRLeg[4] = qLLeg[4]
+	com, Jcom, zmp, n_moved = dyn:com_zmp(qWaist, qLArm, qRArm, qLLeg, qRLeg)
+end
+print(string.format('%.1f us per COM/ZMP, %d links moved', 1e6*(unix.time()-t0)/n_dyn, n_moved))
+print('COM', unpack(com))
+print('ZMP', unpack(zmp))
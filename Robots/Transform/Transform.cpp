@@ -1,190 +1,5 @@
 #include "Transform.h"
 
-Transform::Transform() {
-  clear();
-}
-
-void Transform::clear() {
-  // Initialize to identity matrix:
-  for (int i = 0; i < 4; i++)
-    for (int j = 0; j < 4; j++)
-      t[i][j] = 0;
-
-  t[0][0] = 1;
-  t[1][1] = 1;
-  t[2][2] = 1;
-  t[3][3] = 1;
-}
-
-Transform& Transform::translate(double x, double y, double z) {
-  t[0][3] += t[0][0]*x + t[0][1]*y + t[0][2]*z;
-  t[1][3] += t[1][0]*x + t[1][1]*y + t[1][2]*z;
-  t[2][3] += t[2][0]*x + t[2][1]*y + t[2][2]*z;
-  return *this;
-}
-
-Transform& Transform::translate(const double* p) {
-  t[0][3] += t[0][0]*p[0] + t[0][1]*p[1] + t[0][2]*p[2];
-  t[1][3] += t[1][0]*p[0] + t[1][1]*p[1] + t[1][2]*p[2];
-  t[2][3] += t[2][0]*p[0] + t[2][1]*p[1] + t[2][2]*p[2];
-  return *this;
-}
-
-Transform& Transform::translateNeg(const double* p) {
-  t[0][3] -= t[0][0]*p[0] + t[0][1]*p[1] + t[0][2]*p[2];
-  t[1][3] -= t[1][0]*p[0] + t[1][1]*p[1] + t[1][2]*p[2];
-  t[2][3] -= t[2][0]*p[0] + t[2][1]*p[1] + t[2][2]*p[2];
-  return *this;
-}
-
-Transform& Transform::translateX(double x) {
-  t[0][3] += t[0][0]*x;
-  t[1][3] += t[1][0]*x;
-  t[2][3] += t[2][0]*x;
-  return *this;
-}
-
-Transform& Transform::translateY(double y) {
-  t[0][3] += t[0][1]*y;
-  t[1][3] += t[1][1]*y;
-  t[2][3] += t[2][1]*y;
-  return *this;
-}
-
-Transform& Transform::translateZ(double z) {
-  t[0][3] += t[0][2]*z;
-  t[1][3] += t[1][2]*z;
-  t[2][3] += t[2][2]*z;
-  return *this;
-}
-
-Transform& Transform::rotateX(double a) {
-  double ca = cos(a);
-  double sa = sin(a);
-  for (int i = 0; i < 3; i++) {
-    double ty = t[i][1];
-    double tz = t[i][2];
-    t[i][1] = ca*ty + sa*tz;
-    t[i][2] = -sa*ty + ca*tz;
-  }
-  return *this;
-}
-
-Transform& Transform::rotateY(double a) {
-  double ca = cos(a);
-  double sa = sin(a);
-  for (int i = 0; i < 3; i++) {
-    double tx = t[i][0];
-    double tz = t[i][2];
-    t[i][0] = ca*tx - sa*tz;
-    t[i][2] = sa*tx + ca*tz;
-  }
-  return *this;
-}
-
-Transform& Transform::rotateZ(double a) {
-  double ca = cos(a);
-  double sa = sin(a);
-  for (int i = 0; i < 3; i++) {
-    double tx = t[i][0];
-    double ty = t[i][1];
-    t[i][0] = ca*tx + sa*ty;
-    t[i][1] = -sa*tx + ca*ty;
-  }
-  return *this;
-}
-
-Transform& Transform::rotateDotX(double a) {
-  double ca = cos(a);
-  double sa = sin(a);
-  for (int i = 0; i < 3; i++) {
-    double ty = t[i][1];
-    double tz = t[i][2];
-    t[i][0] = 0;
-    t[i][1] = -sa*ty + ca*tz;
-    t[i][2] = -ca*ty -sa*tz;
-    t[i][3] = 0;
-  }
-  return *this;
-}
-
-Transform& Transform::rotateDotY(double a) {
-  double ca = cos(a);
-  double sa = sin(a);
-  for (int i = 0; i < 3; i++) {
-    double tx = t[i][0];
-    double tz = t[i][2];
-    t[i][0] = -sa*tx - ca*tz;
-    t[i][1] = 0;
-    t[i][2] = ca*tx - sa*tz;
-    t[i][3] = 0;
-  }
-  return *this;
-}
-
-Transform& Transform::rotateDotZ(double a) {
-  double ca = cos(a);
-  double sa = sin(a);
-  for (int i = 0; i < 3; i++) {
-    double tx = t[i][0];
-    double ty = t[i][1];
-    t[i][0] = -sa*tx + ca*ty;
-    t[i][1] = -ca*tx - sa*ty;
-    t[i][2] = 0;
-    t[i][3] = 0;
-  }
-  return *this;
-}
-
-
-//d(rotateX(-q))/dt =  - d/dt(rotateX(-q))
-Transform& Transform::rotateDotXNeg(double a) {
-  double ca = cos(a);
-  double sa = sin(a);
-  for (int i = 0; i < 3; i++) {
-    double ty = t[i][1];
-    double tz = t[i][2];
-    t[i][0] = 0;
-    t[i][1] = -(-sa*ty + ca*tz);
-    t[i][2] = -(-ca*ty -sa*tz);
-    t[i][3] = 0;
-  }
-  return *this;
-}
-
-Transform& Transform::rotateDotYNeg(double a) {
-  double ca = cos(a);
-  double sa = sin(a);
-  for (int i = 0; i < 3; i++) {
-    double tx = t[i][0];
-    double tz = t[i][2];
-    t[i][0] = -(-sa*tx - ca*tz);
-    t[i][1] = 0;
-    t[i][2] = -(ca*tx - sa*tz);
-    t[i][3] = 0;
-  }
-  return *this;
-}
-
-Transform& Transform::rotateDotZNeg(double a) {
-  double ca = cos(a);
-  double sa = sin(a);
-  for (int i = 0; i < 3; i++) {
-    double tx = t[i][0];
-    double ty = t[i][1];
-    t[i][0] = -(-sa*tx + ca*ty);
-    t[i][1] = -(-ca*tx - sa*ty);
-    t[i][2] = 0;
-    t[i][3] = 0;
-  }
-  return *this;
-}
-
-
-
-
-
-
 Transform& Transform::mDH(double alpha, double a, double theta, double d) {
   /*
   Transform t1;
@@ -219,58 +34,6 @@ void Transform::apply0(double* x) {
 }
 
 
-double Transform::getZ() {return t[2][3];}
-double const Transform::getZ() const{return t[2][3];}
-
-void const Transform::getXYZ(double* ret) const{
-  ret[0]=t[0][3];
-  ret[1]=t[1][3];
-  ret[2]=t[2][3];
-}
-
-double const Transform::operator() (int i, int j) const {
-  return t[i][j];
-}
-
-double& Transform::operator() (int i, int j) {
-  return t[i][j];
-}
-
-Transform operator* (const Transform &t1, const Transform &t2) {
-  Transform t;
-  for (int i = 0; i < 3; i++) {
-    for (int j = 0; j < 4; j++) {
-      t(i,j) = t1(i,0)*t2(0,j) + t1(i,1)*t2(1,j) +
-	t1(i,2)*t2(2,j) + t1(i,3)*t2(3,j);
-    }
-  }
-  return t;
-}
-
-Transform inv (const Transform &t1) {
-  Transform t;
-  for (int i = 0; i < 3; i++) {
-    for (int j = 0; j < 3; j++) {
-      // Transpose rotation:
-      t(i,j) = t1(j,i);
-      // Compute inv translation:
-      t(i,3) -= t1(j,i)*t1(j,3);
-    }
-  }
-  return t;
-}
-
-Transform trcopy (const Transform &t1) {
-  Transform t;
-  for (int i = 0; i < 4; i++) {
-    for (int j = 0; j < 4; j++) {      
-      t(i,j) = t1(i,j);      
-    }
-  }
-  return t;
-}
-
-
 Transform transform6D(const double p[6]) {
   Transform t;
   //  t = t.translate(p[0],p[1],p[2]).rotateZ(p[5]).rotateY(p[4]).rotateX(p[3]);
@@ -298,34 +61,29 @@ Transform transform6D(const double p[6]) {
 
 std::vector<double> position6D(const Transform &t1) {
   std::vector<double> p(6);
+  position6D(t1, &p[0]);
+  return p;
+}
+
+void position6D(const Transform &t1, double *p) {
   p[0] = t1(0,3);
   p[1] = t1(1,3);
   p[2] = t1(2,3);
   p[3] = atan2(t1(2,1), t1(2,2));
   p[4] = -asin(t1(2,0));
   p[5] = atan2(t1(1,0), t1(0,0));
-  return p;
 }
 
 void getAngularVelocityTensor(const Transform &adot, const Transform &ainv, double* av){
-  Transform w = adot*ainv;  
-
-/*
-  printf("W matrix:\n");
-  printf("%.2f %.2f %.2f\n",w(0,0),w(1,0),w(2,0));
-  printf("%.2f %.2f %.2f\n",w(0,1),w(1,1),w(2,1));
-  printf("%.2f %.2f %.2f\n",w(0,2),w(1,2),w(2,2));
-*/
-
-//pointer error here
-  av[0]=w(1,2);
-  av[1]=w(2,0);
-  av[2]=w(0,1);
+  // Only three entries of w = adot*ainv are needed
+  av[0] = adot(1,0)*ainv(0,2) + adot(1,1)*ainv(1,2) + adot(1,2)*ainv(2,2);
+  av[1] = adot(2,0)*ainv(0,0) + adot(2,1)*ainv(1,0) + adot(2,2)*ainv(2,0);
+  av[2] = adot(0,0)*ainv(0,1) + adot(0,1)*ainv(1,1) + adot(0,2)*ainv(2,1);
 }
 
 
 
-void printTransform(Transform tr) {
+void printTransform(const Transform &tr) {
   for (int i = 0; i < 4; i++) {
     for (int j = 0; j < 4; j++) {
       printf("%.4g ", tr(i,j));
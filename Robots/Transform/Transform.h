@@ -1,64 +1,291 @@
 #ifndef Transform_h_DEFINED
 #define Transform_h_DEFINED
 
+#include <assert.h>
 #include <math.h>
 #include <stdio.h>
 #include <vector>
 
+/*
+Rigid transform stored as the top 3x4 of the homogeneous matrix.
+The bottom row is always {0, 0, 0, 1}: the const accessor returns it,
+and only rows 0..2 may be written. Rows are 4 doubles (one AVX or two SSE2
+registers) so composing runs row-wise.
+The chain operations are inline so that FK chains unroll at the call site.
+*/
 class Transform {
 public:
-  Transform();
-  virtual ~Transform() {}
+  Transform() { clear(); }
 
-  void clear();
-  Transform &translate(double x, double y, double z);
-  Transform &translate(const double *p);
+  inline void clear();
+  inline Transform &translate(double x, double y, double z);
+  inline Transform &translate(const double *p);
 
-  Transform &translateX(double x = 0);
-  Transform &translateY(double y = 0);
-  Transform &translateZ(double z = 0);
-  Transform &rotateX(double a = 0);
-  Transform &rotateY(double a = 0);
-  Transform &rotateZ(double a = 0);
-  Transform &rotateDotX(double a = 0);
-  Transform &rotateDotY(double a = 0);
-  Transform &rotateDotZ(double a = 0);
+  inline Transform &translateX(double x = 0);
+  inline Transform &translateY(double y = 0);
+  inline Transform &translateZ(double z = 0);
+  inline Transform &rotateX(double a = 0);
+  inline Transform &rotateY(double a = 0);
+  inline Transform &rotateZ(double a = 0);
+  inline Transform &rotateDotX(double a = 0);
+  inline Transform &rotateDotY(double a = 0);
+  inline Transform &rotateDotZ(double a = 0);
 
-  Transform &translateNeg(const double *p);
-  Transform &rotateDotXNeg(double a = 0);
-  Transform &rotateDotYNeg(double a = 0);
-  Transform &rotateDotZNeg(double a = 0);
+  inline Transform &translateNeg(const double *p);
+  inline Transform &rotateDotXNeg(double a = 0);
+  inline Transform &rotateDotYNeg(double a = 0);
+  inline Transform &rotateDotZNeg(double a = 0);
 
+  // In place: this = this * t1
+  inline Transform &operator*= (const Transform &t1);
+  // In place inverse
+  inline Transform &invert();
 
   Transform &mDH(double alpha, double a, double theta, double d);
   void apply(double x[3]);
   void apply0(double* x);
 
   
-  double getZ();
-  const void getXYZ(double* ret) const;
-  const double getZ() const;
+  double getZ() { return t[2][3]; }
+  void getXYZ(double* ret) const {
+    ret[0] = t[0][3];
+    ret[1] = t[1][3];
+    ret[2] = t[2][3];
+  }
+  double getZ() const { return t[2][3]; }
   
   
-  double& operator() (int i, int j);
-  const double operator() (int i, int j) const;
+  // Only the stored rows can be written; read row 3 through a const ref
+  double& operator() (int i, int j) {
+    assert(i >= 0 && i < 3);
+    return t[i][j];
+  }
+  double operator() (int i, int j) const {
+    return i < 3 ? t[i][j] : (j == 3 ? 1 : 0);
+  }
 
  private:
-  double t[4][4];
+  alignas(16) double t[3][4];
 };
 
-Transform operator* (const Transform &t1, const Transform &t2);
-Transform inv (const Transform &t1);
-Transform trcopy (const Transform &t1);
+inline Transform operator* (const Transform &t1, const Transform &t2);
+inline Transform inv (const Transform &t1);
+inline Transform trcopy (const Transform &t1) { return t1; }
 Transform transform6D(const double p[6]);
 std::vector<double> position6D(const Transform &t1);
+void position6D(const Transform &t1, double *p);
 
 void getAngularVelocityTensor(const Transform &adot, const Transform &ainv, double *av);
 
 
-void printTransform(Transform tr);
+void printTransform(const Transform &tr);
 void printVector(std::vector<double> v);
 
+inline void Transform::clear() {
+  // Initialize to identity matrix:
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 4; j++)
+      t[i][j] = i == j ? 1 : 0;
+}
+
+inline Transform& Transform::translate(double x, double y, double z) {
+  t[0][3] += t[0][0]*x + t[0][1]*y + t[0][2]*z;
+  t[1][3] += t[1][0]*x + t[1][1]*y + t[1][2]*z;
+  t[2][3] += t[2][0]*x + t[2][1]*y + t[2][2]*z;
+  return *this;
+}
+
+inline Transform& Transform::translate(const double* p) {
+  return translate(p[0], p[1], p[2]);
+}
+
+inline Transform& Transform::translateNeg(const double* p) {
+  t[0][3] -= t[0][0]*p[0] + t[0][1]*p[1] + t[0][2]*p[2];
+  t[1][3] -= t[1][0]*p[0] + t[1][1]*p[1] + t[1][2]*p[2];
+  t[2][3] -= t[2][0]*p[0] + t[2][1]*p[1] + t[2][2]*p[2];
+  return *this;
+}
+
+inline Transform& Transform::translateX(double x) {
+  t[0][3] += t[0][0]*x;
+  t[1][3] += t[1][0]*x;
+  t[2][3] += t[2][0]*x;
+  return *this;
+}
+
+inline Transform& Transform::translateY(double y) {
+  t[0][3] += t[0][1]*y;
+  t[1][3] += t[1][1]*y;
+  t[2][3] += t[2][1]*y;
+  return *this;
+}
+
+inline Transform& Transform::translateZ(double z) {
+  t[0][3] += t[0][2]*z;
+  t[1][3] += t[1][2]*z;
+  t[2][3] += t[2][2]*z;
+  return *this;
+}
+
+inline Transform& Transform::rotateX(double a) {
+  double ca = cos(a);
+  double sa = sin(a);
+  for (int i = 0; i < 3; i++) {
+    double ty = t[i][1];
+    double tz = t[i][2];
+    t[i][1] = ca*ty + sa*tz;
+    t[i][2] = -sa*ty + ca*tz;
+  }
+  return *this;
+}
+
+inline Transform& Transform::rotateY(double a) {
+  double ca = cos(a);
+  double sa = sin(a);
+  for (int i = 0; i < 3; i++) {
+    double tx = t[i][0];
+    double tz = t[i][2];
+    t[i][0] = ca*tx - sa*tz;
+    t[i][2] = sa*tx + ca*tz;
+  }
+  return *this;
+}
+
+inline Transform& Transform::rotateZ(double a) {
+  double ca = cos(a);
+  double sa = sin(a);
+  for (int i = 0; i < 3; i++) {
+    double tx = t[i][0];
+    double ty = t[i][1];
+    t[i][0] = ca*tx + sa*ty;
+    t[i][1] = -sa*tx + ca*ty;
+  }
+  return *this;
+}
+
+inline Transform& Transform::rotateDotX(double a) {
+  double ca = cos(a);
+  double sa = sin(a);
+  for (int i = 0; i < 3; i++) {
+    double ty = t[i][1];
+    double tz = t[i][2];
+    t[i][0] = 0;
+    t[i][1] = -sa*ty + ca*tz;
+    t[i][2] = -ca*ty -sa*tz;
+    t[i][3] = 0;
+  }
+  return *this;
+}
+
+inline Transform& Transform::rotateDotY(double a) {
+  double ca = cos(a);
+  double sa = sin(a);
+  for (int i = 0; i < 3; i++) {
+    double tx = t[i][0];
+    double tz = t[i][2];
+    t[i][0] = -sa*tx - ca*tz;
+    t[i][1] = 0;
+    t[i][2] = ca*tx - sa*tz;
+    t[i][3] = 0;
+  }
+  return *this;
+}
+
+inline Transform& Transform::rotateDotZ(double a) {
+  double ca = cos(a);
+  double sa = sin(a);
+  for (int i = 0; i < 3; i++) {
+    double tx = t[i][0];
+    double ty = t[i][1];
+    t[i][0] = -sa*tx + ca*ty;
+    t[i][1] = -ca*tx - sa*ty;
+    t[i][2] = 0;
+    t[i][3] = 0;
+  }
+  return *this;
+}
+
+//d(rotateX(-q))/dt =  - d/dt(rotateX(-q))
+inline Transform& Transform::rotateDotXNeg(double a) {
+  double ca = cos(a);
+  double sa = sin(a);
+  for (int i = 0; i < 3; i++) {
+    double ty = t[i][1];
+    double tz = t[i][2];
+    t[i][0] = 0;
+    t[i][1] = -(-sa*ty + ca*tz);
+    t[i][2] = -(-ca*ty -sa*tz);
+    t[i][3] = 0;
+  }
+  return *this;
+}
+
+inline Transform& Transform::rotateDotYNeg(double a) {
+  double ca = cos(a);
+  double sa = sin(a);
+  for (int i = 0; i < 3; i++) {
+    double tx = t[i][0];
+    double tz = t[i][2];
+    t[i][0] = -(-sa*tx - ca*tz);
+    t[i][1] = 0;
+    t[i][2] = -(ca*tx - sa*tz);
+    t[i][3] = 0;
+  }
+  return *this;
+}
+
+inline Transform& Transform::rotateDotZNeg(double a) {
+  double ca = cos(a);
+  double sa = sin(a);
+  for (int i = 0; i < 3; i++) {
+    double tx = t[i][0];
+    double ty = t[i][1];
+    t[i][0] = -(-sa*tx + ca*ty);
+    t[i][1] = -(-ca*tx - sa*ty);
+    t[i][2] = 0;
+    t[i][3] = 0;
+  }
+  return *this;
+}
+
+inline Transform& Transform::operator*= (const Transform &t1) {
+  if (&t1 == this) {
+    Transform t2 = t1;
+    return *this *= t2;
+  }
+  // Each output row is a combination of the rows of t1
+  for (int i = 0; i < 3; i++) {
+    double a0 = t[i][0], a1 = t[i][1], a2 = t[i][2];
+    for (int j = 0; j < 4; j++)
+      t[i][j] = (j == 3 ? t[i][3] : 0) +
+        a0*t1.t[0][j] + a1*t1.t[1][j] + a2*t1.t[2][j];
+  }
+  return *this;
+}
+
+inline Transform& Transform::invert() {
+  double p[3] = {t[0][3], t[1][3], t[2][3]};
+  // Transpose rotation:
+  double tmp;
+  tmp = t[0][1]; t[0][1] = t[1][0]; t[1][0] = tmp;
+  tmp = t[0][2]; t[0][2] = t[2][0]; t[2][0] = tmp;
+  tmp = t[1][2]; t[1][2] = t[2][1]; t[2][1] = tmp;
+  // Compute inv translation:
+  for (int i = 0; i < 3; i++)
+    t[i][3] = -(t[i][0]*p[0] + t[i][1]*p[1] + t[i][2]*p[2]);
+  return *this;
+}
+
+inline Transform operator* (const Transform &t1, const Transform &t2) {
+  Transform t = t1;
+  return t *= t2;
+}
+
+inline Transform inv (const Transform &t1) {
+  Transform t = t1;
+  return t.invert();
+}
+
 class Jacobian {
 public:
   Jacobian();
@@ -163,7 +163,7 @@ std::vector<double> get_xz_angles(double xy_dist, double z, double p ){
 
 // Inverse given a transform
 // Default uses the safe yaw
-std::vector<double> YouBot_kinematics_inverse_arm(Transform tr, std::vector<double>& q, char& is_reach_back, bool use_safe_yaw=true) {
+std::vector<double> YouBot_kinematics_inverse_arm(const Transform &tr, std::vector<double>& q, char& is_reach_back, bool use_safe_yaw=true) {
   double dx, dy, dz, base_yaw, pseudo_yaw, pitch, hand_yaw, tmp1, xy_coord;
 	char unique_pitch, yaw_issue;
 
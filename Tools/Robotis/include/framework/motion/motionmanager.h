@@ -8,10 +8,10 @@
 #ifndef MOTIONMANAGER_H_
 #define MOTIONMANAGER_H_
 
-#include <list>
 #include <vector>
 #include <time.h>
 #include <pthread.h>
+#include <semaphore.h>
 #include <fstream>
 #include <iostream>
 #include "framework/motion/motionmodule.h"
@@ -23,6 +23,7 @@
 #include "framework/motion/MX28.h"
 #include "framework/minIni.h"
 #include "framework/sensor/forcetorquesensor/forcetorquesensor.h"
+#include "framework/spscqueue.h"
 #include <unistd.h>
 #define OFFSET_SECTION "Offset"
 #define INVALID_VALUE   0X40000000
@@ -30,11 +31,49 @@
 namespace Thor
 {
 
+// Per cycle timing of the motion timer, in msec
+struct MotionTiming
+{
+	static const int NUMBER_OF_CHAINS = 4;
+
+	unsigned long long cycles;
+	unsigned long long overruns;		// periods missed by a late cycle
+	unsigned long long dropped;			// snapshots the queue had no room for
+	unsigned long long bulkread_errors[NUMBER_OF_CHAINS];
+	double latency_last, latency_mean, latency_max;	// wakeup after the period start
+	double cycle_last, cycle_mean, cycle_max;		// Process() duration
+	double chain_last[NUMBER_OF_CHAINS], chain_max[NUMBER_OF_CHAINS];
+};
+
+// State of one cycle, handed from the timer thread to the log thread
+struct MotionSnapshot
+{
+	struct timespec time;
+	int number_of_joints;
+	int id[MotionStatus::MAXIMUM_NUMBER_OF_JOINTS];
+	int goal_value[MotionStatus::MAXIMUM_NUMBER_OF_JOINTS];
+	int present_value[MotionStatus::MAXIMUM_NUMBER_OF_JOINTS];
+	double angle[MotionStatus::MAXIMUM_NUMBER_OF_JOINTS];
+	double fb_gyro, rl_gyro, fb_accel, rl_accel;
+	double r_leg_fsr[4], l_leg_fsr[4];
+	MotionTiming timing;
+};
+
 class MotionManager
 {
+public:
+	static const int MAXIMUM_NUMBER_OF_MODULES = 16;
+	static const int NUMBER_OF_CHAINS = MotionTiming::NUMBER_OF_CHAINS;
+
 private:
 	static MotionManager* UniqueInstance;
-	std::list< MotionModule* > m_Modules;
+
+	// Two module tables: the timer reads the active one while
+	// AddModule/RemoveModule edit the other, then swap them
+	MotionModule* m_Modules[2][MAXIMUM_NUMBER_OF_MODULES];
+	int m_NumberOfModules[2];
+	int m_ActiveModules;
+	pthread_mutex_t m_ModuleMutex;
 
 	bool m_ProcessEnable;
 	bool m_Enabled;
@@ -47,6 +86,23 @@ private:
 	bool m_IsLogging;
 
 	std::ofstream m_LogFileStream;
+	pthread_mutex_t m_LogMutex;
+
+	// Snapshots leave the timer thread through the queue only;
+	// the log thread keeps the latest for GetSnapshot()
+	static const int SNAPSHOT_QUEUE_SIZE = 128;
+	SPSCQueue<MotionSnapshot, SNAPSHOT_QUEUE_SIZE> m_SnapshotQueue;
+	MotionSnapshot m_CycleSnapshot;
+	MotionSnapshot m_LatestSnapshot;
+	bool m_HasSnapshot;
+	pthread_mutex_t m_SnapshotMutex;
+
+	MotionTiming m_Timing;
+	bool m_ResetTiming;
+	unsigned long long m_CycleCount;
+
+	int m_PresentValue[MotionStatus::MAXIMUM_NUMBER_OF_JOINTS];
+	bool m_IsBulkReading;
 
 	MotionManager();
 
@@ -89,6 +145,7 @@ public:
 	EnableList* GetEnable()	{ return m_EnableList; }
 	void AddModule(MotionModule *module);
 	void RemoveModule(MotionModule *module);
+	int GetNumberOfModules();
 
 
 	void ResetGyroCalibration() { m_CalibrationStatus = 0; m_FBGyroCenter = 512; m_RLGyroCenter = 512; }
@@ -98,6 +155,13 @@ public:
 	void TempStartLogging();
 	void TempStopLogging();
 
+	// Latest cycle as seen by the log thread, false before the first one
+	bool GetSnapshot(MotionSnapshot *snapshot);
+	MotionTiming GetTiming();
+	void ResetTiming() { __atomic_store_n(&m_ResetTiming, true, __ATOMIC_RELEASE); }
+	// Bulk read the present positions on each chain every cycle
+	void SetBulkRead(bool enable) { m_IsBulkReading = enable; }
+
     void LoadINISettings(minIni* ini);
     void LoadINISettings(minIni* ini, const std::string &section);
     void SaveINISettings(minIni* ini);
@@ -119,10 +183,35 @@ private:
 	pthread_t Thread_ID;
 	bool m_IsTimerRunning;
 	bool m_IsTimerStop;
-	pthread_t m_DXLCommThred0;
-	pthread_t m_DXLCommThred1;
-	pthread_t m_DXLCommThred2;
-	pthread_t m_DXLCommThred3;
+
+	// One thread per chain, woken by the timer every cycle
+	struct ChainWorker
+	{
+		MotionManager* manager;
+		int index;
+		pthread_t thread;
+		sem_t start;
+		void* (*proc)(void *param);
+		DXLComm* comm;
+		BulkRead* bulkread;
+		bool* paused;
+		double time;
+	};
+	ChainWorker m_Chains[NUMBER_OF_CHAINS];
+	sem_t m_ChainDone;
+	bool m_IsChainRunning;
+	bool m_IsChainStop;
+
+	pthread_t m_LogThread;
+	bool m_IsLogThreadRunning;
+	bool m_IsLogThreadStop;
+
+	void RunChain(ChainWorker *chain);
+	void RunChains();
+	void UpdateTiming(double latency, double cycle, int missed);
+	void PushSnapshot();
+	void WriteLog(const MotionSnapshot &snapshot);
+	void WaitForCycle();
 
 public:
 	void StartTimer();
@@ -135,6 +224,8 @@ protected:
 	static void *DXLCommProc1(void *param);
 	static void *DXLCommProc2(void *param);
 	static void *DXLCommProc3(void *param);
+	static void *ChainProc(void *param);
+	static void *LogProc(void *param);
 };
 
 } /* namespace Thor */
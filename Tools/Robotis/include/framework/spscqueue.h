@@ -0,0 +1,67 @@
+/*
+ * spscqueue.h
+ *
+ *  Fixed capacity queue between exactly one producer thread and one
+ *  consumer thread. Neither side locks or allocates, so the producer may
+ *  be a real-time thread.
+ */
+
+#ifndef SPSCQUEUE_H_
+#define SPSCQUEUE_H_
+
+namespace Thor
+{
+
+template <typename T, int CAPACITY>
+class SPSCQueue
+{
+private:
+	// Each index is written by one side only, and kept on its own cache line
+	volatile unsigned int m_Head;
+	char m_HeadPad[64 - sizeof(unsigned int)];
+	volatile unsigned int m_Tail;
+	char m_TailPad[64 - sizeof(unsigned int)];
+	volatile unsigned int m_Dropped;
+	T m_Items[CAPACITY];
+
+public:
+	SPSCQueue() : m_Head(0), m_Tail(0), m_Dropped(0) { }
+
+	// Producer: copy an item in, or count it as dropped when full
+	bool Push(const T &item)
+	{
+		unsigned int tail = m_Tail;
+		unsigned int head = __atomic_load_n(&m_Head, __ATOMIC_ACQUIRE);
+		if(tail - head >= (unsigned int)CAPACITY)
+		{
+			__atomic_add_fetch(&m_Dropped, 1, __ATOMIC_RELAXED);
+			return false;
+		}
+		m_Items[tail % CAPACITY] = item;
+		__atomic_store_n(&m_Tail, tail + 1, __ATOMIC_RELEASE);
+		return true;
+	}
+
+	// Consumer: copy the oldest item out
+	bool Pop(T *item)
+	{
+		unsigned int head = m_Head;
+		unsigned int tail = __atomic_load_n(&m_Tail, __ATOMIC_ACQUIRE);
+		if(head == tail)
+			return false;
+		*item = m_Items[head % CAPACITY];
+		__atomic_store_n(&m_Head, head + 1, __ATOMIC_RELEASE);
+		return true;
+	}
+
+	int Size()
+	{
+		return (int)(__atomic_load_n(&m_Tail, __ATOMIC_ACQUIRE) -
+				__atomic_load_n(&m_Head, __ATOMIC_ACQUIRE));
+	}
+
+	unsigned int Dropped() { return __atomic_load_n(&m_Dropped, __ATOMIC_RELAXED); }
+};
+
+} /* namespace Thor */
+#endif /* SPSCQUEUE_H_ */
@@ -9,6 +9,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <errno.h>
 #include "motion/motionmanager.h"
 #include <unistd.h>
 using namespace Thor;
@@ -39,8 +40,20 @@ MotionManager::MotionManager()
 	m_Enabled = false;
 	m_IsRunning = false;
 	m_IsThreadRunning = false;
+	m_IsLogging = false;
 	DEBUG_PRINT = false;
 
+	m_NumberOfModules[0] = m_NumberOfModules[1] = 0;
+	m_ActiveModules = 0;
+	pthread_mutex_init(&m_ModuleMutex, 0);
+	pthread_mutex_init(&m_LogMutex, 0);
+	pthread_mutex_init(&m_SnapshotMutex, 0);
+	m_HasSnapshot = false;
+	memset(&m_Timing, 0, sizeof(m_Timing));
+	m_ResetTiming = false;
+	m_CycleCount = 0;
+	m_IsBulkReading = false;
+
 	m_DXLComm0 = new DXLComm("/dev/ttyUSB0");
 	m_DXLComm1 = new DXLComm("/dev/ttyUSB1");
 	m_DXLComm2 = new DXLComm("/dev/ttyUSB2");
@@ -62,7 +75,10 @@ MotionManager::MotionManager()
 	m_tempMX28 = new MX28();
 
 	for(int index =0; index < MotionStatus::MAXIMUM_NUMBER_OF_JOINTS; index++)
+	{
 		m_Offset[index] = 0;
+		m_PresentValue[index] = 0;
+	}
 
 	for(int idx = 0; idx < 28 ; idx++)
 		wCurrentMeanValueArray[idx] = dwWattMeanValueArray[idx] = 0;
@@ -76,6 +92,27 @@ MotionManager::MotionManager()
 	comm1 = false;
 	comm2 = false;
 	comm3 = false;
+
+	DXLComm* comms[NUMBER_OF_CHAINS] = { m_DXLComm0, m_DXLComm1, m_DXLComm2, m_DXLComm3 };
+	BulkRead* bulkreads[NUMBER_OF_CHAINS] = { m_BulkRead0, m_BulkRead1, m_BulkRead2, m_BulkRead3 };
+	bool* paused[NUMBER_OF_CHAINS] = { &comm0, &comm1, &comm2, &comm3 };
+	void* (*procs[NUMBER_OF_CHAINS])(void*) = { DXLCommProc0, DXLCommProc1, DXLCommProc2, DXLCommProc3 };
+	for(int i = 0; i < NUMBER_OF_CHAINS; i++)
+	{
+		m_Chains[i].manager = this;
+		m_Chains[i].index = i;
+		m_Chains[i].thread = 0;
+		m_Chains[i].proc = procs[i];
+		m_Chains[i].comm = comms[i];
+		m_Chains[i].bulkread = bulkreads[i];
+		m_Chains[i].paused = paused[i];
+		m_Chains[i].time = 0;
+	}
+	m_IsChainRunning = false;
+	m_IsChainStop = false;
+	m_LogThread = 0;
+	m_IsLogThreadRunning = false;
+	m_IsLogThreadStop = false;
 }
 
 
@@ -333,6 +370,10 @@ bool MotionManager::Initialize()
 	for(unsigned int index = 0; index < MotionStatus::m_CurrentJoints.size(); index++)
 	{
 		int id = MotionStatus::m_CurrentJoints[index].m_ID;
+		// Present position of every joint, sent only while SetBulkRead(true)
+		MotionStatus::m_CurrentJoints[index].m_BulkRead->AddBulkReadData(id,
+				MotionStatus::m_CurrentJoints[index].m_DXLInfo->PRESENT_POSITION_ADDR,
+				MotionStatus::m_CurrentJoints[index].m_DXLInfo->POSITION_LENGTH);
 
 //		if( 0 < id && id < 29 )
 //		{
@@ -595,15 +636,57 @@ bool MotionManager::InitforTest()
 	return true;
 }
 
+// Wait until a cycle that may have started on the old module table ends
+void MotionManager::WaitForCycle()
+{
+	unsigned long long cycle = __atomic_load_n(&m_CycleCount, __ATOMIC_ACQUIRE);
+	while(m_IsTimerRunning == true && __atomic_load_n(&m_CycleCount, __ATOMIC_ACQUIRE) == cycle)
+		usleep(1000);
+}
+
 void MotionManager::AddModule(MotionModule *module)
 {
 	module->Initialize();
-	m_Modules.push_back(module);
+
+	pthread_mutex_lock(&m_ModuleMutex);
+	int active = m_ActiveModules;
+	int next = 1 - active;
+	int count = m_NumberOfModules[active];
+	if(count >= MAXIMUM_NUMBER_OF_MODULES)
+	{
+		pthread_mutex_unlock(&m_ModuleMutex);
+		fprintf(stderr, "[MotionManager] Module table is full\n");
+		return;
+	}
+	for(int i = 0; i < count; i++)
+		m_Modules[next][i] = m_Modules[active][i];
+	m_Modules[next][count] = module;
+	m_NumberOfModules[next] = count + 1;
+	__atomic_store_n(&m_ActiveModules, next, __ATOMIC_RELEASE);
+	WaitForCycle();
+	pthread_mutex_unlock(&m_ModuleMutex);
 }
 
 void MotionManager::RemoveModule(MotionModule *module)
 {
-	m_Modules.remove(module);
+	pthread_mutex_lock(&m_ModuleMutex);
+	int active = m_ActiveModules;
+	int next = 1 - active;
+	int count = 0;
+	for(int i = 0; i < m_NumberOfModules[active]; i++)
+	{
+		if(m_Modules[active][i] != module)
+			m_Modules[next][count++] = m_Modules[active][i];
+	}
+	m_NumberOfModules[next] = count;
+	__atomic_store_n(&m_ActiveModules, next, __ATOMIC_RELEASE);
+	WaitForCycle();
+	pthread_mutex_unlock(&m_ModuleMutex);
+}
+
+int MotionManager::GetNumberOfModules()
+{
+	return m_NumberOfModules[__atomic_load_n(&m_ActiveModules, __ATOMIC_ACQUIRE)];
 }
 
 void MotionManager::StartLogging()
@@ -620,12 +703,15 @@ void MotionManager::StartLogging()
 		if(count > 256) return;
     }
 
+    // Rows are written by the log thread, away from the timer
+    pthread_mutex_lock(&m_LogMutex);
     m_LogFileStream.open(szFile, std::ios::out);
-    for(int i = 0; i < MotionStatus::m_CurrentJoints.size(); i++)
+    for(unsigned int i = 0; i < MotionStatus::m_CurrentJoints.size(); i++)
         m_LogFileStream << "ID_" << MotionStatus::m_CurrentJoints[i].m_ID << "_GP,ID_" << MotionStatus::m_CurrentJoints[i].m_ID << "_PP,";
-    m_LogFileStream << "GyroFB,GyroRL,AccelFB,AccelRL,L_FSR_X,L_FSR_Y,R_FSR_X,R_FSR_Y" << std::endl;
+    m_LogFileStream << "GyroFB,GyroRL,AccelFB,AccelRL,L_FSR1,L_FSR2,L_FSR3,L_FSR4,R_FSR1,R_FSR2,R_FSR3,R_FSR4,Latency,CycleTime" << std::endl;
 
     m_IsLogging = true;
+    pthread_mutex_unlock(&m_LogMutex);
 }
 
 bool IsLogging = false;
@@ -643,8 +729,82 @@ void MotionManager::TempStopLogging()
 
 void MotionManager::StopLogging()
 {
+    pthread_mutex_lock(&m_LogMutex);
     m_IsLogging = false;
     m_LogFileStream.close();
+    pthread_mutex_unlock(&m_LogMutex);
+}
+
+void MotionManager::WriteLog(const MotionSnapshot &snapshot)
+{
+    for(int i = 0; i < snapshot.number_of_joints; i++)
+        m_LogFileStream << snapshot.goal_value[i] << "," << snapshot.present_value[i] << ",";
+    m_LogFileStream << snapshot.fb_gyro << "," << snapshot.rl_gyro << ","
+            << snapshot.fb_accel << "," << snapshot.rl_accel;
+    for(int i = 0; i < 4; i++)
+        m_LogFileStream << "," << snapshot.l_leg_fsr[i];
+    for(int i = 0; i < 4; i++)
+        m_LogFileStream << "," << snapshot.r_leg_fsr[i];
+    m_LogFileStream << "," << snapshot.timing.latency_last << "," << snapshot.timing.cycle_last << "\n";
+}
+
+bool MotionManager::GetSnapshot(MotionSnapshot *snapshot)
+{
+    pthread_mutex_lock(&m_SnapshotMutex);
+    bool has_snapshot = m_HasSnapshot;
+    if(has_snapshot)
+        *snapshot = m_LatestSnapshot;
+    pthread_mutex_unlock(&m_SnapshotMutex);
+    return has_snapshot;
+}
+
+MotionTiming MotionManager::GetTiming()
+{
+    MotionTiming timing;
+    pthread_mutex_lock(&m_SnapshotMutex);
+    if(m_HasSnapshot)
+        timing = m_LatestSnapshot.timing;
+    else
+        memset(&timing, 0, sizeof(timing));
+    pthread_mutex_unlock(&m_SnapshotMutex);
+    return timing;
+}
+
+void* MotionManager::LogProc(void *param)
+{
+    MotionManager* manager = (MotionManager*)param;
+    MotionSnapshot* snapshot = new MotionSnapshot;
+
+    while(!manager->m_IsLogThreadStop || manager->m_SnapshotQueue.Size() > 0)
+    {
+        bool popped = false;
+        while(manager->m_SnapshotQueue.Pop(snapshot))
+        {
+            popped = true;
+            pthread_mutex_lock(&manager->m_LogMutex);
+            if(manager->m_IsLogging)
+                manager->WriteLog(*snapshot);
+            pthread_mutex_unlock(&manager->m_LogMutex);
+        }
+
+        if(popped)
+        {
+            pthread_mutex_lock(&manager->m_SnapshotMutex);
+            manager->m_LatestSnapshot = *snapshot;
+            manager->m_HasSnapshot = true;
+            pthread_mutex_unlock(&manager->m_SnapshotMutex);
+        }
+        else
+            usleep(MotionManager::TIME_UNIT * 1000 / 2);
+    }
+
+    pthread_mutex_lock(&manager->m_LogMutex);
+    if(manager->m_IsLogging)
+        manager->m_LogFileStream.flush();
+    pthread_mutex_unlock(&manager->m_LogMutex);
+
+    delete snapshot;
+    return 0;
 }
 
 void MotionManager::LoadINISettings(minIni* ini)
@@ -799,22 +959,28 @@ void MotionManager::Process()
     // calibrate gyro sensor
 
 
-    if(m_Modules.size() != 0)
+    // The table is not edited while in use, see AddModule
+    int table = __atomic_load_n(&m_ActiveModules, __ATOMIC_ACQUIRE);
+    MotionModule** modules = m_Modules[table];
+    int number_of_modules = m_NumberOfModules[table];
+
+    if(number_of_modules != 0)
     {
     	int id = -1;
-    	for(std::list<MotionModule*>::iterator i = m_Modules.begin(); i != m_Modules.end(); i++)
+    	for(int m = 0; m < number_of_modules; m++)
     	{
-    		(*i)->Process();
+    		MotionModule* module = modules[m];
+    		module->Process();
     		for(unsigned int jointIndex=0; jointIndex<MotionStatus::m_CurrentJoints.size(); jointIndex++)
     		{
     			id = MotionStatus::m_CurrentJoints[jointIndex].m_ID;
-    			if( MotionStatus::m_EnableList[id-1].IsEqual((*i)->uID) )
+    			if( MotionStatus::m_EnableList[id-1].IsEqual(module->uID) )
     			{
-    				MotionStatus::m_CurrentJoints[jointIndex].m_Value = (*i)->m_RobotInfo[jointIndex].m_Value + m_Offset[id-1];
-    				MotionStatus::m_CurrentJoints[jointIndex].m_Angle = (*i)->m_RobotInfo[jointIndex].m_Angle;
-    				MotionStatus::m_CurrentJoints[jointIndex].m_Pgain = (*i)->m_RobotInfo[jointIndex].m_Pgain;
-    				MotionStatus::m_CurrentJoints[jointIndex].m_Igain = (*i)->m_RobotInfo[jointIndex].m_Igain;
-    				MotionStatus::m_CurrentJoints[jointIndex].m_Dgain = (*i)->m_RobotInfo[jointIndex].m_Dgain;
+    				MotionStatus::m_CurrentJoints[jointIndex].m_Value = module->m_RobotInfo[jointIndex].m_Value + m_Offset[id-1];
+    				MotionStatus::m_CurrentJoints[jointIndex].m_Angle = module->m_RobotInfo[jointIndex].m_Angle;
+    				MotionStatus::m_CurrentJoints[jointIndex].m_Pgain = module->m_RobotInfo[jointIndex].m_Pgain;
+    				MotionStatus::m_CurrentJoints[jointIndex].m_Igain = module->m_RobotInfo[jointIndex].m_Igain;
+    				MotionStatus::m_CurrentJoints[jointIndex].m_Dgain = module->m_RobotInfo[jointIndex].m_Dgain;
     			}
     		}
     	}
@@ -867,23 +1033,7 @@ void MotionManager::Process()
 //    	clock_gettime(CLOCK_REALTIME , &StartTime);
 //
 
-    	if(pthread_create(&this->m_DXLCommThred0, 0, this->DXLCommProc0, this) != 0)
-    		exit(-1);
-
-    	if(pthread_create(&this->m_DXLCommThred1, 0, this->DXLCommProc1, this) != 0)
-    		exit(-1);
-
-    	if(pthread_create(&this->m_DXLCommThred2, 0, this->DXLCommProc2, this) != 0)
-    		exit(-1);
-
-    	if(pthread_create(&this->m_DXLCommThred3, 0, this->DXLCommProc3, this) != 0)
-    		exit(-1);
-
-
-    	pthread_join(m_DXLCommThred0, 0);
-    	pthread_join(m_DXLCommThred1, 0);
-    	pthread_join(m_DXLCommThred2, 0);
-    	pthread_join(m_DXLCommThred3, 0);
+    	RunChains();
 
     	if(IsLogging)
     	{
@@ -1074,7 +1224,7 @@ void* MotionManager::DXLCommProc0(void *param)
 //	printf("%d", val);
 //	manager->m_BulkRead0->GetDwordValue(22, 611, (long*)&val);
 //	printf("  %d\n", val);
-
+	return 0;
 }
 
 
@@ -1158,6 +1308,7 @@ void* MotionManager::DXLCommProc1(void *param)
 //											  &(MotionStatus::R_ARM_TX),
 //											  &(MotionStatus::R_ARM_TY),
 //											  &(MotionStatus::R_ARM_TZ));
+	return 0;
 }
 
 //static int debug_num2 = 0;
@@ -1245,6 +1396,7 @@ void* MotionManager::DXLCommProc2(void *param)
 //											  &(MotionStatus::R_LEG_TX),
 //											  &(MotionStatus::R_LEG_TY),
 //											  &(MotionStatus::R_LEG_TZ));
+	return 0;
 }
 
 unsigned char param3[9];
@@ -1329,6 +1481,145 @@ void* MotionManager::DXLCommProc3(void *param)
 //	time_dif = time_dif/ 1000000000;
 //   	fprintf(fp, "%f\n", time_dif);
 //	printf(" %f\n",time_dif);
+	return 0;
+}
+
+// Run each chain's work for this cycle, on its thread once the timer started
+void MotionManager::RunChain(ChainWorker *chain)
+{
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if(*chain->paused == false)
+	{
+		chain->proc(this);
+
+		if(m_IsBulkReading == true)
+		{
+			if(chain->bulkread->SendTxPacket() == COMM_RXSUCCESS)
+			{
+				// Each chain only touches its own joints
+				for(unsigned int index = 0; index < MotionStatus::m_CurrentJoints.size(); index++)
+				{
+					JointData &joint = MotionStatus::m_CurrentJoints[index];
+					if(joint.m_BulkRead != chain->bulkread)
+						continue;
+					long value = 0;
+					int word = 0;
+					if(joint.m_DXLInfo->POSITION_LENGTH == 4 &&
+							chain->bulkread->GetDwordValue(joint.m_ID, joint.m_DXLInfo->PRESENT_POSITION_ADDR, &value))
+						m_PresentValue[index] = (int)value;
+					else if(joint.m_DXLInfo->POSITION_LENGTH == 2 &&
+							chain->bulkread->GetWordValue(joint.m_ID, joint.m_DXLInfo->PRESENT_POSITION_ADDR, &word))
+						m_PresentValue[index] = word;
+				}
+			}
+			else
+				m_Timing.bulkread_errors[chain->index]++;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	chain->time = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) * 0.000001;
+}
+
+void MotionManager::RunChains()
+{
+	if(m_IsChainRunning == false)
+	{
+		for(int i = 0; i < NUMBER_OF_CHAINS; i++)
+			RunChain(&m_Chains[i]);
+		return;
+	}
+
+	for(int i = 0; i < NUMBER_OF_CHAINS; i++)
+		sem_post(&m_Chains[i].start);
+	for(int i = 0; i < NUMBER_OF_CHAINS; i++)
+	{
+		while(sem_wait(&m_ChainDone) != 0 && errno == EINTR)
+			;
+	}
+}
+
+void* MotionManager::ChainProc(void *param)
+{
+	ChainWorker* chain = (ChainWorker*)param;
+	MotionManager* manager = chain->manager;
+
+	while(1)
+	{
+		while(sem_wait(&chain->start) != 0 && errno == EINTR)
+			;
+		if(manager->m_IsChainStop)
+			break;
+		manager->RunChain(chain);
+		sem_post(&manager->m_ChainDone);
+	}
+
+	return 0;
+}
+
+void MotionManager::UpdateTiming(double latency, double cycle, int missed)
+{
+	if(__atomic_exchange_n(&m_ResetTiming, false, __ATOMIC_ACQ_REL))
+		memset(&m_Timing, 0, sizeof(m_Timing));
+
+	MotionTiming &t = m_Timing;
+	t.cycles++;
+	t.overruns += missed;
+	t.dropped = m_SnapshotQueue.Dropped();
+
+	t.latency_last = latency;
+	t.latency_mean += (latency - t.latency_mean) / t.cycles;
+	if(latency > t.latency_max)
+		t.latency_max = latency;
+
+	t.cycle_last = cycle;
+	t.cycle_mean += (cycle - t.cycle_mean) / t.cycles;
+	if(cycle > t.cycle_max)
+		t.cycle_max = cycle;
+
+	for(int i = 0; i < NUMBER_OF_CHAINS; i++)
+	{
+		t.chain_last[i] = m_Chains[i].time;
+		if(m_Chains[i].time > t.chain_max[i])
+			t.chain_max[i] = m_Chains[i].time;
+	}
+}
+
+// Hand this cycle to the log thread; never blocks, drops when it falls behind
+void MotionManager::PushSnapshot()
+{
+	MotionSnapshot &s = m_CycleSnapshot;
+	clock_gettime(CLOCK_REALTIME, &s.time);
+
+	int n = MotionStatus::m_CurrentJoints.size();
+	if(n > MotionStatus::MAXIMUM_NUMBER_OF_JOINTS)
+		n = MotionStatus::MAXIMUM_NUMBER_OF_JOINTS;
+	s.number_of_joints = n;
+	for(int i = 0; i < n; i++)
+	{
+		s.id[i] = MotionStatus::m_CurrentJoints[i].m_ID;
+		s.goal_value[i] = MotionStatus::m_CurrentJoints[i].m_Value;
+		s.present_value[i] = m_PresentValue[i];
+		s.angle[i] = MotionStatus::m_CurrentJoints[i].m_Angle;
+	}
+
+	s.fb_gyro = MotionStatus::FB_GYRO;
+	s.rl_gyro = MotionStatus::RL_GYRO;
+	s.fb_accel = MotionStatus::FB_ACCEL;
+	s.rl_accel = MotionStatus::RL_ACCEL;
+	s.r_leg_fsr[0] = MotionStatus::R_LEG_FSR1;
+	s.r_leg_fsr[1] = MotionStatus::R_LEG_FSR2;
+	s.r_leg_fsr[2] = MotionStatus::R_LEG_FSR3;
+	s.r_leg_fsr[3] = MotionStatus::R_LEG_FSR4;
+	s.l_leg_fsr[0] = MotionStatus::L_LEG_FSR1;
+	s.l_leg_fsr[1] = MotionStatus::L_LEG_FSR2;
+	s.l_leg_fsr[2] = MotionStatus::L_LEG_FSR3;
+	s.l_leg_fsr[3] = MotionStatus::L_LEG_FSR4;
+	s.timing = m_Timing;
+
+	m_SnapshotQueue.Push(s);
 }
 
 void MotionManager::StartTimer()
@@ -1357,8 +1648,26 @@ void MotionManager::StartTimer()
 	if(error != 0)
 		fprintf(stderr, "[MotionTimer] pthread_attr_setschedparam Error = %d \n", error);
 
+	// Logging and snapshots stay at normal priority
+	m_IsLogThreadStop = false;
+	if(pthread_create(&this->m_LogThread, 0, this->LogProc, this) != 0)
+		exit(-1);
+	m_IsLogThreadRunning = true;
+
+	// Chain threads share the timer's priority, and live as long as it does
+	m_IsChainStop = false;
+	sem_init(&m_ChainDone, 0, 0);
+	m_IsChainRunning = true;
+	for(int i = 0; i < NUMBER_OF_CHAINS; i++)
+	{
+		sem_init(&m_Chains[i].start, 0, 0);
+		if(pthread_create(&m_Chains[i].thread, &attr, this->ChainProc, &m_Chains[i]) != 0)
+			exit(-1);
+	}
+
 	if(pthread_create(&this->Thread_ID, &attr, this->TimerProc, this) != 0)
 		exit(-1);
+	pthread_attr_destroy(&attr);
 
 	this->m_IsTimerRunning = true;
 }
@@ -1373,28 +1682,62 @@ void MotionManager::StopTimer()
 			exit(-1);
 		this->m_IsTimerStop = false;
 		this->m_IsTimerRunning = false;
+
+		m_IsChainStop = true;
+		for(int i = 0; i < NUMBER_OF_CHAINS; i++)
+			sem_post(&m_Chains[i].start);
+		for(int i = 0; i < NUMBER_OF_CHAINS; i++)
+		{
+			pthread_join(m_Chains[i].thread, 0);
+			sem_destroy(&m_Chains[i].start);
+		}
+		sem_destroy(&m_ChainDone);
+		m_IsChainRunning = false;
+	}
+
+	if(m_IsLogThreadRunning == true)
+	{
+		m_IsLogThreadStop = true;
+		pthread_join(m_LogThread, 0);
+		m_IsLogThreadRunning = false;
 	}
 }
 
 void* MotionManager::TimerProc(void *param)
 {
 	MotionManager* manager = (MotionManager*)param;
-	static struct timespec next_time;
+	const long period = MotionManager::TIME_UNIT * 1000000;
+	struct timespec next_time, start_time, end_time;
 	clock_gettime(CLOCK_MONOTONIC, &next_time);
 
 	while(!manager->m_IsTimerStop)
 	{
-        next_time.tv_sec += (next_time.tv_nsec + MotionManager::TIME_UNIT * 1000000) / 1000000000;
-        next_time.tv_nsec = (next_time.tv_nsec + MotionManager::TIME_UNIT * 1000000) % 1000000000;
+		// next_time is when this cycle should have started
+		clock_gettime(CLOCK_MONOTONIC, &start_time);
+		manager->Process();
+		clock_gettime(CLOCK_MONOTONIC, &end_time);
 
-        if(manager != NULL)
-        {
-        	manager->Process();
-        }
-        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_time, NULL);
+		double latency = (start_time.tv_sec - next_time.tv_sec) * 1000.0 + (start_time.tv_nsec - next_time.tv_nsec) * 0.000001;
+		double cycle = (end_time.tv_sec - start_time.tv_sec) * 1000.0 + (end_time.tv_nsec - start_time.tv_nsec) * 0.000001;
+
+		// Skip the periods a late cycle ran through, rather than bursting to catch up
+		int missed = -1;
+		do
+		{
+			next_time.tv_sec += (next_time.tv_nsec + period) / 1000000000;
+			next_time.tv_nsec = (next_time.tv_nsec + period) % 1000000000;
+			missed++;
+		}
+		while(next_time.tv_sec < end_time.tv_sec ||
+				(next_time.tv_sec == end_time.tv_sec && next_time.tv_nsec <= end_time.tv_nsec));
+
+		manager->UpdateTiming(latency, cycle, missed);
+		manager->PushSnapshot();
+		__atomic_add_fetch(&manager->m_CycleCount, 1, __ATOMIC_RELEASE);
+
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_time, NULL);
 	}
 
 	pthread_exit(NULL);
 	return 0;
 }
-
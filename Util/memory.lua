@@ -1,4 +1,6 @@
-local shm    = require'shm'
+-- The boost segments, which the MATLAB and Python readers share, unless
+-- Config.use_shmstate opts in to the seqlock state blocks
+local shm, shmstate
 local vector = require'vector'
 local ffi_ok, ffi = pcall(require, 'ffi')
 local memory = {}
@@ -27,6 +29,14 @@ function memory.init_shm_segment(name, shared, shsize, tid, pid)
   local tid = tid or 0
   local pid = pid or 1
 
+  -- Every process reads the same Config, so all agree on the backend
+  local use_shmstate = Config and Config.use_shmstate == true
+  if use_shmstate then
+    shmstate = shmstate or require'shmstate'
+  else
+    shm = shm or require'shm'
+  end
+
   local fenv = _G[name]
   if fenv == nil then
     _G[name] = {}
@@ -43,11 +53,16 @@ function memory.init_shm_segment(name, shared, shsize, tid, pid)
     -- ex. vcmBall01brindza is the segment for shared.ball table in vcm.lua
     -- NOTE: the first letter of the shared_table_name is capitalized
     local shmName = name..string.upper(string.sub(shtable, 1, 1))..string.sub(shtable, 2)..tid..pid..(os.getenv('USER') or '')
-    fenv[shmHandleName] = shm.new(shmName, shsize[shtable])
+    if use_shmstate then
+      -- Fixed layout from the table, with its values as the initial contents
+      fenv[shmHandleName] = assert(shmstate.new(shmName, shared[shtable]))
+    else
+      fenv[shmHandleName] = shm.new(shmName, shsize[shtable])
+    end
     local shmHandle = fenv[shmHandleName]
 		
     -- intialize shared memory
-    init_shm_keys(shmHandle, shared[shtable])
+    if not use_shmstate then init_shm_keys(shmHandle, shared[shtable]) end
 		
 		-- Add more direct memory access
     local shmPointerName, shmPointer
@@ -68,7 +83,13 @@ function memory.init_shm_segment(name, shared, shsize, tid, pid)
 			if shmPointer then shmPointer[k] = ffi.cast(tp..'*', ptr) end
       shmKeys[k] = n
       local kind = type(v)
-      if kind=='string' then
+      if kind=='string' and use_shmstate then
+        -- Stored as bytes
+        fenv['get_'..shtable..'_'..k] = function() return shmHandle:get(k) end
+        fenv['set_'..shtable..'_'..k] = function(val)
+          return shmHandle:set(k, val)
+        end
+      elseif kind=='string' then
         -- Get String
         fenv['get_'..shtable..'_'..k] = function()
             local bytes = shmHandle:get(k)
@@ -103,8 +124,38 @@ function memory.init_shm_segment(name, shared, shsize, tid, pid)
         error('Unsupported shm type: '..kind);
       end
 			-- end of determining the type for memory (if/then)
+      if use_shmstate and kind~='number' then
+        -- Change notification, only with Config.use_shmstate, as the boost
+        -- segments have no write counts: version_ counts the writes, and
+        -- wait_ sleeps until a write newer than the value it last returned
+        -- ex. local uOdometry = mcm.wait_status_odometry(0.1)
+        local seen
+        fenv['version_'..shtable..'_'..k] = function()
+          return shmHandle:generation(k)
+        end
+        fenv['wait_'..shtable..'_'..k] = function(timeout)
+          if not shmHandle:wait(k, seen, timeout) then return end
+          local val
+          val, seen = shmHandle:get(k)
+          if type(val) == 'table' then val = vector.new(val) end
+          return val
+        end
+      end
     end
 		-- End of for k,v
+    if use_shmstate then
+      -- Sleep until any key of the table is written, ex. mcm.wait_status(0.1)
+      -- Callers check for these, ex. if mcm.wait_status then ... end
+      local seen
+      fenv['version_'..shtable] = function()
+        return shmHandle:segment_generation()
+      end
+      fenv['wait_'..shtable] = function(timeout)
+        local gen = shmHandle:wait_segment(seen, timeout)
+        if gen then seen = gen end
+        return gen ~= false
+      end
+    end
   end
 	-- End of for shtable, shval
 end